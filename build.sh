@@ -5,8 +5,8 @@ set -e
 CC=x86_64-elf-gcc
 LD=x86_64-elf-ld
 
-# Compile Bootloader
-nasm src/boot/boot.asm -f bin -o build/boot.bin
+# Extra flags can be passed in, e.g. EXTRA_CFLAGS=-DGEMOS_FAST_BOOT ./build.sh
+CFLAGS="-m32 -ffreestanding $EXTRA_CFLAGS"
 
 # Compile Kernel Entry
 nasm src/kernel/kernel_entry.asm -f elf -o build/kernel_entry.o
@@ -14,28 +14,87 @@ nasm src/kernel/kernel_entry.asm -f elf -o build/kernel_entry.o
 # Compile Interrupts ASM
 nasm src/kernel/interrupts.asm -f elf -o build/interrupts.o
 
+# Compile the AP startup code (copied below 1MB at runtime)
+nasm src/kernel/ap_trampoline.asm -f elf -o build/ap_trampoline.o
+
 # Compile Kernel
-$CC -m32 -ffreestanding -c src/kernel/kernel.c -o build/kernel.o
-$CC -m32 -ffreestanding -c src/drivers/video.c -o build/video.o
-$CC -m32 -ffreestanding -c src/kernel/idt.c -o build/idt.o
-$CC -m32 -ffreestanding -c src/kernel/handlers.c -o build/handlers.o
-$CC -m32 -ffreestanding -c src/kernel/window.c -o build/window.o
-$CC -m32 -ffreestanding -c src/kernel/apps.c -o build/apps.o
-$CC -m32 -ffreestanding -c src/drivers/rtc.c -o build/rtc.o
-$CC -m32 -ffreestanding -c src/kernel/gemlang.c -o build/gemlang.o
+$CC $CFLAGS -c src/kernel/kernel.c -o build/kernel.o
+$CC $CFLAGS -c src/drivers/video.c -o build/video.o
+$CC $CFLAGS -c src/kernel/idt.c -o build/idt.o
+$CC $CFLAGS -c src/kernel/handlers.c -o build/handlers.o
+$CC $CFLAGS -c src/kernel/window.c -o build/window.o
+$CC $CFLAGS -c src/kernel/apps.c -o build/apps.o
+$CC $CFLAGS -c src/drivers/rtc.c -o build/rtc.o
+$CC $CFLAGS -c src/kernel/gemlang.c -o build/gemlang.o
+$CC $CFLAGS -c src/kernel/multiboot.c -o build/multiboot.o
+$CC $CFLAGS -c src/kernel/memory.c -o build/memory.o
+$CC $CFLAGS -c src/drivers/pci.c -o build/pci.o
+$CC $CFLAGS -c src/drivers/serial.c -o build/serial.o
+$CC $CFLAGS -c src/kernel/timeline.c -o build/timeline.o
+$CC $CFLAGS -c src/kernel/timer.c -o build/timer.o
+$CC $CFLAGS -c src/kernel/acpi.c -o build/acpi.o
+$CC $CFLAGS -c src/kernel/apic.c -o build/apic.o
+$CC $CFLAGS -c src/kernel/smp.c -o build/smp.o
+$CC $CFLAGS -c src/kernel/tiles.c -o build/tiles.o
+$CC $CFLAGS -c src/kernel/sched.c -o build/sched.o
+$CC $CFLAGS -c src/kernel/lock.c -o build/lock.o
+$CC $CFLAGS -c src/kernel/rcu.c -o build/rcu.o
+$CC $CFLAGS -c src/kernel/trace.c -o build/trace.o
+$CC $CFLAGS -c src/kernel/frameprof.c -o build/frameprof.o
+$CC $CFLAGS -c src/kernel/sampler.c -o build/sampler.o
+$CC $CFLAGS -c src/kernel/replay.c -o build/replay.o
+$CC $CFLAGS -c src/kernel/snapshot.c -o build/snapshot.o
+$CC $CFLAGS -c src/kernel/block.c -o build/block.o
+$CC $CFLAGS -c src/kernel/bcache.c -o build/bcache.o
+$CC $CFLAGS -c src/kernel/fat32.c -o build/fat32.o
+$CC $CFLAGS -c src/kernel/gar.c -o build/gar.o
+$CC $CFLAGS -c src/drivers/ata.c -o build/ata.o
+$CC $CFLAGS -c src/drivers/virtio_blk.c -o build/virtio_blk.o
 
 # Link Kernel
-# We link to 0x1000 because bootloader loads us there.
-# --oformat binary outputs raw machine code.
-$LD -m elf_i386 -o build/kernel.bin -Ttext 0x10000 --oformat binary build/kernel_entry.o build/interrupts.o build/kernel.o build/idt.o build/handlers.o build/video.o build/window.o build/apps.o build/gemlang.o build/rtc.o
+# We link to 0x10000 because bootloader loads us there.
+# --oformat binary outputs raw machine code. The Multiboot headers in
+# kernel_entry.asm let GRUB and QEMU -kernel load this same file directly.
+# The map file lets tools/profile.py resolve sampler addresses.
+$LD -m elf_i386 -o build/kernel.bin -Ttext 0x10000 --oformat binary \
+    -Map build/kernel.map build/kernel_entry.o build/interrupts.o build/kernel.o build/idt.o build/handlers.o build/video.o build/window.o build/apps.o build/gemlang.o build/rtc.o build/multiboot.o build/memory.o build/pci.o build/serial.o build/timeline.o build/timer.o build/acpi.o build/apic.o build/smp.o build/tiles.o build/sched.o build/lock.o build/rcu.o build/ap_trampoline.o build/trace.o build/frameprof.o build/sampler.o build/replay.o build/snapshot.o build/block.o build/bcache.o build/fat32.o build/gar.o build/ata.o build/virtio_blk.o
+
+# Pack the GemLang apps into the app archive (host tool)
+HOSTCC=${HOSTCC:-cc}
+$HOSTCC -O2 -o build/mkgar tools/mkgar.c
+shopt -s nullglob
+build/mkgar build/apps.gar apps/*.gem apps/*.gemc
+
+# The archive goes right after the kernel, on a 4KB boundary
+KERNEL_SECTORS=$(( ($(wc -c < build/kernel.bin) + 511) / 512 ))
+ARCHIVE_LBA=$(( (1 + KERNEL_SECTORS + 7) / 8 * 8 ))
+ARCHIVE_SECTORS=$(( $(wc -c < build/apps.gar) / 512 ))
+
+# Compile Bootloader (reads exactly as many sectors as the kernel occupies
+# and tells the kernel where the archive is)
+nasm src/boot/boot.asm -f bin -DKERNEL_SECTORS=$KERNEL_SECTORS \
+  -DARCHIVE_LBA=$ARCHIVE_LBA -DARCHIVE_SECTORS=$ARCHIVE_SECTORS \
+  -o build/boot.bin
 
 # Create OS Image
 cat build/boot.bin build/kernel.bin > build/os.img
+truncate -s $(( ARCHIVE_LBA * 512 )) build/os.img
+cat build/apps.gar >> build/os.img
+
+# Padding: at least 1MB, and a whole number of sectors for the BIOS reads.
+if [ $(wc -c < build/os.img) -lt 1048576 ]; then
+  truncate -s 1M build/os.img
+fi
 
-# Padding (optional, to ensure we have enough sectors if we strictly read 50)
-# boot.bin is 512 bytes.
-# We need to make sure the file is large enough for the 'read 50 sectors' command to not fail/read garbage?
-# Actually BIOS usually just reads available. But best to pad.
-truncate -s 1M build/os.img
+# Optional FAT32 data disk with the GemLang apps (needs mtools). Attach it
+# as a second drive; its /apps/*.gem files show up in the Apps menu.
+if command -v mformat >/dev/null && command -v mcopy >/dev/null; then
+  rm -f build/apps.img
+  truncate -s 64M build/apps.img
+  mformat -i build/apps.img -F ::
+  mmd -i build/apps.img ::/apps
+  mcopy -i build/apps.img apps/*.gem ::/apps/
+  echo "Apps disk: build/apps.img"
+fi
 
 echo "Build Complete: build/os.img"
@@ -2,6 +2,17 @@
 [ORG 0x7C00]
 
 KERNEL_OFFSET equ 0x10000
+; Sector count of kernel.bin, passed in by build.sh (-DKERNEL_SECTORS=n)
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 100
+%endif
+; App archive appended to the image (build.sh), 0 = none
+%ifndef ARCHIVE_LBA
+%define ARCHIVE_LBA 0
+%endif
+%ifndef ARCHIVE_SECTORS
+%define ARCHIVE_SECTORS 0
+%endif
 VESA_INFO_ADDR equ 0x9000
 MODE_INFO_ADDR equ 0x9200
 
@@ -33,11 +44,27 @@ start:
     mov al, 'l'
     int 0x10
 
+    ; Read in chunks of up to 64 sectors (32KB) so no transfer crosses
+    ; a 64KB segment and we only read what the kernel actually occupies.
+read_chunk:
+    mov ax, [sectors_left]
+    cmp ax, 64
+    jbe .count_ok
+    mov ax, 64
+.count_ok:
+    mov [lba_packet + 2], ax
+    sub [sectors_left], ax
+
     mov si, lba_packet
     mov ah, 0x42
     mov dl, [boot_drive]
     int 0x13
     jc disk_error
+
+    add word [lba_packet + 6], 0x800   ; Segment += 32KB
+    add dword [lba_packet + 8], 64     ; LBA += 64
+    cmp word [sectors_left], 0
+    jne read_chunk
     jmp kernel_loaded
 
 use_chs_fallback:
@@ -174,6 +201,10 @@ set_mode:
     mov ax, [MODE_INFO_ADDR + 16]  ; Pitch
     mov [0x9009], ax
 
+    ; Where the kernel finds the app archive (it reads it itself)
+    mov dword [0x900C], ARCHIVE_LBA
+    mov dword [0x9010], ARCHIVE_SECTORS
+
     ; --- Enable A20 Line ---
     in al, 0x92
     or al, 2
@@ -212,11 +243,13 @@ init_pm:
     mov ebp, 0x90000        ; Stack at top of free memory
     mov esp, ebp
 
+    xor eax, eax            ; No Multiboot magic: kernel uses the 0x9000 stash
     call KERNEL_OFFSET
     jmp $
 
 ; Variables
 boot_drive db 0
+sectors_left dw KERNEL_SECTORS
 mode_offset dw 0
 mode_segment dw 0
 
@@ -224,7 +257,7 @@ align 4
 lba_packet:
     db 0x10         ; Size
     db 0            ; Res
-    dw 100          ; Count (100 sectors = 50KB)
+    dw 0            ; Count (set per chunk)
     dw 0x0000       ; Offset (0)
     dw 0x1000       ; Segment (0x1000) -> 0x10000 Physical
     dq 1            ; LBA Start
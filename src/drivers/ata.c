@@ -0,0 +1,395 @@
+#include "ata.h"
+#include "../kernel/block.h"
+#include "../kernel/idt.h"
+#include "../kernel/memory.h"
+#include "../kernel/timeline.h"
+#include "io.h"
+#include "pci.h"
+#include "serial.h"
+
+// Task file registers (offset from the channel's I/O base)
+#define ATA_REG_DATA 0
+#define ATA_REG_ERROR 1
+#define ATA_REG_FEATURES 1
+#define ATA_REG_SECCOUNT 2
+#define ATA_REG_LBA0 3
+#define ATA_REG_LBA1 4
+#define ATA_REG_LBA2 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+// Control block register (device control / alternate status)
+#define ATA_CTRL_NIEN 0x02 // Disable the drive's interrupt
+
+#define ATA_SR_ERR 0x01
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_DF 0x20
+#define ATA_SR_BSY 0x80
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_READ_PIO_EXT 0x24
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+// Bus master registers (offset from the channel's BM base)
+#define BM_COMMAND 0
+#define BM_STATUS 2
+#define BM_PRDT 4
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08 // Device -> memory
+#define BM_SR_ACTIVE 0x01
+#define BM_SR_ERR 0x02
+#define BM_SR_IRQ 0x04
+
+// Physical Region Descriptor. A region may not cross a 64KB boundary.
+typedef struct {
+  uint32_t addr;
+  uint16_t bytes; // 0 means 64KB
+  uint16_t flags; // Bit 15: last entry
+} __attribute__((packed)) AtaPrd;
+
+#define ATA_PRD_MAX 32
+#define ATA_PRD_EOT 0x8000
+
+// Largest command we issue (128KB) and most requests merged into it
+#define ATA_MAX_SECTORS 256
+#define ATA_MAX_SEGMENTS 16
+
+typedef struct AtaDisk AtaDisk;
+
+typedef struct {
+  uint16_t io;   // Task file base
+  uint16_t ctrl; // Device control / alt status
+  uint16_t bm;   // Bus master base, 0 = no DMA
+  int irq;
+  AtaPrd *prdt;
+
+  // In-flight DMA command
+  AtaDisk *active;
+  BlockRequest *batch;
+  uint64_t batch_tsc;
+
+  AtaDisk *disks[2];
+} AtaChannel;
+
+struct AtaDisk {
+  BlockDevice blk;
+  AtaChannel *chan;
+  int slave;
+  int lba48;
+  int dma;
+};
+
+static AtaChannel channels[2];
+static AtaDisk disks[4];
+static int disk_count = 0;
+
+// ~400ns: four reads of the alternate status register
+static void ata_delay(AtaChannel *c) {
+  for (int i = 0; i < 4; i++)
+    inb(c->ctrl);
+}
+
+static int ata_wait_not_busy(AtaChannel *c) {
+  int timeout = 1000000;
+  uint8_t s;
+  while (((s = inb(c->io + ATA_REG_STATUS)) & ATA_SR_BSY) && timeout-- > 0)
+    ;
+  return (timeout > 0) ? s : -1;
+}
+
+// Wait for DRQ (data ready). Returns 0 or -1 on error/timeout.
+static int ata_wait_drq(AtaChannel *c) {
+  int timeout = 1000000;
+  while (timeout-- > 0) {
+    uint8_t s = inb(c->io + ATA_REG_STATUS);
+    if (s & (ATA_SR_ERR | ATA_SR_DF))
+      return -1;
+    if (!(s & ATA_SR_BSY) && (s & ATA_SR_DRQ))
+      return 0;
+  }
+  return -1;
+}
+
+// Program drive select, LBA and count for a transfer
+static void ata_setup_lba(AtaDisk *d, uint32_t lba, uint32_t count) {
+  AtaChannel *c = d->chan;
+  if (d->lba48) {
+    outb(c->io + ATA_REG_DRIVE, 0x40 | (d->slave << 4));
+    ata_delay(c);
+    // High bytes first, then low bytes (two-deep FIFO registers)
+    outb(c->io + ATA_REG_SECCOUNT, (count >> 8) & 0xFF);
+    outb(c->io + ATA_REG_LBA0, (lba >> 24) & 0xFF);
+    outb(c->io + ATA_REG_LBA1, 0);
+    outb(c->io + ATA_REG_LBA2, 0);
+  } else {
+    outb(c->io + ATA_REG_DRIVE, 0xE0 | (d->slave << 4) | ((lba >> 24) & 0x0F));
+    ata_delay(c);
+  }
+  outb(c->io + ATA_REG_SECCOUNT, count & 0xFF); // 256 encodes as 0
+  outb(c->io + ATA_REG_LBA0, lba & 0xFF);
+  outb(c->io + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+  outb(c->io + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+}
+
+// --- PIO (fallback) ---
+
+static int ata_pio_transfer(AtaDisk *d, uint32_t lba, uint32_t count,
+                            BlockRequest *batch, int write) {
+  AtaChannel *c = d->chan;
+  if (ata_wait_not_busy(c) < 0)
+    return -1;
+  outb(c->ctrl, ATA_CTRL_NIEN); // Polled
+  ata_setup_lba(d, lba, count);
+  uint8_t cmd;
+  if (write)
+    cmd = d->lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
+  else
+    cmd = d->lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+  outb(c->io + ATA_REG_COMMAND, cmd);
+
+  // Walk the merged requests' buffers sector by sector
+  for (BlockRequest *r = batch; r; r = r->next) {
+    uint16_t *buf = (uint16_t *)r->buffer;
+    for (uint32_t s = 0; s < r->count; s++) {
+      ata_delay(c);
+      if (ata_wait_drq(c) < 0)
+        return -1;
+      if (write) {
+        for (int i = 0; i < 256; i++)
+          outw(c->io + ATA_REG_DATA, *buf++);
+      } else {
+        for (int i = 0; i < 256; i++)
+          *buf++ = inw(c->io + ATA_REG_DATA);
+      }
+    }
+  }
+
+  if (write) {
+    outb(c->io + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
+    if (ata_wait_not_busy(c) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// --- DMA ---
+
+// Fill the PRD table from a batch. Returns entry count, or -1 if it does
+// not fit.
+static int ata_build_prdt(AtaChannel *c, BlockRequest *batch) {
+  int n = 0;
+  for (BlockRequest *r = batch; r; r = r->next) {
+    uint32_t addr = (uint32_t)r->buffer;
+    uint32_t left = r->count * BLOCK_SECTOR_SIZE;
+    while (left > 0) {
+      if (n >= ATA_PRD_MAX)
+        return -1;
+      uint32_t room = 0x10000 - (addr & 0xFFFF); // Up to the 64KB boundary
+      uint32_t len = left < room ? left : room;
+      c->prdt[n].addr = addr;
+      c->prdt[n].bytes = (uint16_t)len; // 64KB wraps to 0 as required
+      c->prdt[n].flags = 0;
+      n++;
+      addr += len;
+      left -= len;
+    }
+  }
+  c->prdt[n - 1].flags = ATA_PRD_EOT;
+  return n;
+}
+
+static void ata_dma_start(AtaDisk *d, uint32_t lba, uint32_t count,
+                          int write) {
+  AtaChannel *c = d->chan;
+  outb(c->bm + BM_COMMAND, 0);
+  outl(c->bm + BM_PRDT, (uint32_t)c->prdt);
+  outb(c->bm + BM_STATUS, BM_SR_IRQ | BM_SR_ERR); // Write 1 to clear
+  outb(c->bm + BM_COMMAND, write ? 0 : BM_CMD_READ);
+
+  ata_wait_not_busy(c);
+  outb(c->ctrl, 0); // Interrupts on
+  ata_setup_lba(d, lba, count);
+  uint8_t cmd;
+  if (write)
+    cmd = d->lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+  else
+    cmd = d->lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+  outb(c->io + ATA_REG_COMMAND, cmd);
+  outb(c->bm + BM_COMMAND, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  d->blk.stats.notifies++;
+}
+
+// BlockDevice.start: dispatch queued work if the channel is idle
+static void ata_start(BlockDevice *dev) {
+  AtaDisk *d = (AtaDisk *)dev->driver_data;
+  AtaChannel *c = d->chan;
+  if (c->active)
+    return; // Channel busy, the completion IRQ will call us again
+
+  uint32_t lba, count;
+  int write;
+  BlockRequest *batch;
+  while ((batch = block_next_batch(dev, &lba, &count, &write))) {
+    uint64_t t = rdtsc();
+    if (d->dma && ata_build_prdt(c, batch) > 0) {
+      c->active = d;
+      c->batch = batch;
+      c->batch_tsc = t;
+      ata_dma_start(d, lba, count, write);
+      return;
+    }
+    // No DMA: the whole batch completes synchronously
+    dev->stats.notifies++;
+    int status = ata_pio_transfer(d, lba, count, batch, write);
+    block_complete(dev, batch, status, t);
+  }
+}
+
+static void ata_irq(int irq) {
+  for (int i = 0; i < 2; i++) {
+    AtaChannel *c = &channels[i];
+    if (c->irq != irq || !c->bm)
+      continue;
+
+    uint8_t bm_status = inb(c->bm + BM_STATUS);
+    if (!(bm_status & BM_SR_IRQ))
+      continue; // Not ours
+    outb(c->bm + BM_COMMAND, 0);
+    uint8_t status = inb(c->io + ATA_REG_STATUS); // Acks INTRQ
+    outb(c->bm + BM_STATUS, BM_SR_IRQ | BM_SR_ERR);
+
+    AtaDisk *d = c->active;
+    if (!d)
+      continue;
+    int err = (bm_status & BM_SR_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF));
+    BlockRequest *batch = c->batch;
+    d->blk.stats.interrupts++;
+    c->active = 0;
+    c->batch = 0;
+    block_complete(&d->blk, batch, err ? -1 : 0, c->batch_tsc);
+
+    // Keep the channel busy: this disk first, then its sibling
+    ata_start(&d->blk);
+    for (int k = 0; k < 2; k++) {
+      if (c->disks[k] && c->disks[k] != d)
+        ata_start(&c->disks[k]->blk);
+    }
+  }
+}
+
+// --- Probe ---
+
+static void ata_identify(AtaChannel *c, int slave) {
+  uint16_t id[256];
+
+  outb(c->ctrl, ATA_CTRL_NIEN);
+  outb(c->io + ATA_REG_DRIVE, 0xA0 | (slave << 4));
+  ata_delay(c);
+  outb(c->io + ATA_REG_SECCOUNT, 0);
+  outb(c->io + ATA_REG_LBA0, 0);
+  outb(c->io + ATA_REG_LBA1, 0);
+  outb(c->io + ATA_REG_LBA2, 0);
+  outb(c->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+  ata_delay(c);
+
+  uint8_t status = inb(c->io + ATA_REG_STATUS);
+  if (status == 0 || status == 0xFF)
+    return; // Nothing there / floating bus
+  if (ata_wait_not_busy(c) < 0)
+    return;
+  // ATAPI and SATA bridges abort IDENTIFY and leave a signature here
+  if (inb(c->io + ATA_REG_LBA1) || inb(c->io + ATA_REG_LBA2))
+    return;
+  if (ata_wait_drq(c) < 0)
+    return;
+  for (int i = 0; i < 256; i++)
+    id[i] = inw(c->io + ATA_REG_DATA);
+
+  if (disk_count >= 4)
+    return;
+  AtaDisk *d = &disks[disk_count];
+  d->chan = c;
+  d->slave = slave;
+  d->lba48 = (id[83] & (1 << 10)) != 0;
+  d->dma = c->bm && (id[49] & (1 << 8));
+
+  BlockDevice *b = &d->blk;
+  b->name[0] = 'a';
+  b->name[1] = 't';
+  b->name[2] = 'a';
+  b->name[3] = '0' + disk_count;
+  b->name[4] = 0;
+  if (d->lba48 && (id[100] | id[101]))
+    b->sector_count = id[100] | ((uint32_t)id[101] << 16);
+  else
+    b->sector_count = id[60] | ((uint32_t)id[61] << 16);
+  b->max_sectors = ATA_MAX_SECTORS;
+  b->max_segments = ATA_MAX_SEGMENTS;
+  b->start = ata_start;
+  b->driver_data = d;
+  b->queue = 0;
+  b->head_lba = 0;
+
+  c->disks[slave] = d;
+  disk_count++;
+  block_register(b);
+
+  serial_write("[ata] ");
+  serial_write(b->name);
+  serial_write(": ");
+  serial_write_dec(b->sector_count / 2048);
+  serial_write(" MB, ");
+  serial_write(d->dma ? "bus-master DMA" : "PIO");
+  serial_write(d->lba48 ? ", LBA48\n" : ", LBA28\n");
+}
+
+void init_ata() {
+  PciDevice pci;
+  if (!pci_find_class(0x01, 0x01, &pci)) // Mass storage / IDE
+    return;
+
+  // Prog IF bit 0/2: channel in native PCI mode (BARs), else legacy ports.
+  // Bit 7: bus master capable (BAR4).
+  uint32_t bm = (pci.prog_if & 0x80) ? pci_bar(&pci, 4) : 0;
+  if (bm)
+    pci_enable(&pci, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+  int pci_irq = pci_read32(pci.bus, pci.dev, pci.func, PCI_INTERRUPT_LINE) &
+                0xFF;
+
+  for (int i = 0; i < 2; i++) {
+    AtaChannel *c = &channels[i];
+    int native = pci.prog_if & (i == 0 ? 0x01 : 0x04);
+    if (native) {
+      c->io = pci_bar(&pci, i * 2);
+      c->ctrl = pci_bar(&pci, i * 2 + 1) + 2;
+      c->irq = pci_irq;
+    } else {
+      c->io = i == 0 ? 0x1F0 : 0x170;
+      c->ctrl = i == 0 ? 0x3F6 : 0x376;
+      c->irq = i == 0 ? 14 : 15;
+    }
+    c->bm = bm ? bm + i * 8 : 0;
+    if (c->bm) {
+      // Table must not cross 64KB: 256 bytes aligned to 256 can't
+      c->prdt = kmalloc_aligned(ATA_PRD_MAX * sizeof(AtaPrd), 256);
+      if (!c->prdt)
+        c->bm = 0;
+    }
+
+    ata_identify(c, 0);
+    ata_identify(c, 1);
+
+    if (c->disks[0] || c->disks[1]) {
+      outb(c->ctrl, 0);
+      irq_register(c->irq, ata_irq);
+    }
+  }
+}
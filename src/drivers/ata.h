@@ -0,0 +1,12 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "../kernel/types.h"
+
+// IDE/ATA disks on the PCI IDE controller (QEMU: PIIX3/PIIX4).
+// Uses bus-master DMA with PRD tables and IRQ 14/15 completion when the
+// controller and drive support it, polled PIO otherwise. Each disk found is
+// registered with the block layer as "ata0".."ata3".
+void init_ata();
+
+#endif
@@ -15,10 +15,44 @@ static inline void outb(uint16_t port, uint8_t data) {
   __asm__ volatile("outb %0, %1" : : "a"(data), "Nd"(port));
 }
 
+// Read/Write a word (16-bit) from/to I/O port
+static inline uint16_t inw(uint16_t port) {
+  uint16_t result;
+  __asm__ volatile("inw %1, %0" : "=a"(result) : "Nd"(port));
+  return result;
+}
+
+static inline void outw(uint16_t port, uint16_t data) {
+  __asm__ volatile("outw %0, %1" : : "a"(data), "Nd"(port));
+}
+
+// Read/Write a dword (32-bit) from/to I/O port
+static inline uint32_t inl(uint16_t port) {
+  uint32_t result;
+  __asm__ volatile("inl %1, %0" : "=a"(result) : "Nd"(port));
+  return result;
+}
+
+static inline void outl(uint16_t port, uint32_t data) {
+  __asm__ volatile("outl %0, %1" : : "a"(data), "Nd"(port));
+}
+
 // Enable Interrupts
 static inline void sti() { __asm__ volatile("sti"); }
 
 // Disable Interrupts
 static inline void cli() { __asm__ volatile("cli"); }
 
+// Disable interrupts, returning the previous EFLAGS for irq_restore
+static inline uint32_t irq_save() {
+  uint32_t flags;
+  __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+  if (flags & 0x200) // IF was set
+    sti();
+}
+
 #endif
@@ -0,0 +1,99 @@
+#include "pci.h"
+#include "io.h"
+
+uint32_t pci_read32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+  uint32_t addr = 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)dev << 11) |
+                  ((uint32_t)func << 8) | (offset & 0xFC);
+  outl(PCI_CONFIG_ADDRESS, addr);
+  return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset,
+                 uint32_t value) {
+  uint32_t addr = 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)dev << 11) |
+                  ((uint32_t)func << 8) | (offset & 0xFC);
+  outl(PCI_CONFIG_ADDRESS, addr);
+  outl(PCI_CONFIG_DATA, value);
+}
+
+uint16_t pci_read16(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+  uint32_t v = pci_read32(bus, dev, func, offset);
+  return (uint16_t)(v >> ((offset & 2) * 8));
+}
+
+uint8_t pci_read8(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+  uint32_t v = pci_read32(bus, dev, func, offset);
+  return (uint8_t)(v >> ((offset & 3) * 8));
+}
+
+// Walk every function, stopping at the first one `match` accepts
+static int pci_scan(int (*match)(PciDevice *d, uint32_t a, uint32_t b),
+                    uint32_t a, uint32_t b, PciDevice *out) {
+  // Brute force scan. Bus 0 is enough under QEMU but scanning all is cheap.
+  for (int bus = 0; bus < 256; bus++) {
+    for (int dev = 0; dev < 32; dev++) {
+      for (int func = 0; func < 8; func++) {
+        uint32_t id = pci_read32(bus, dev, func, PCI_VENDOR_ID);
+        if ((id & 0xFFFF) == 0xFFFF) {
+          if (func == 0)
+            break; // No device in this slot
+          continue;
+        }
+        uint32_t class_rev = pci_read32(bus, dev, func, PCI_CLASS_REV);
+        out->bus = bus;
+        out->dev = dev;
+        out->func = func;
+        out->vendor = id & 0xFFFF;
+        out->device = id >> 16;
+        out->class_code = class_rev >> 24;
+        out->subclass = (class_rev >> 16) & 0xFF;
+        out->prog_if = (class_rev >> 8) & 0xFF;
+        if (match(out, a, b))
+          return 1;
+        // Header type bit 7: only multi-function devices have func 1-7
+        if (func == 0 && !(pci_read32(bus, dev, 0, 0x0C) & 0x00800000))
+          break;
+      }
+    }
+  }
+  return 0;
+}
+
+static int match_id(PciDevice *d, uint32_t vendor, uint32_t device) {
+  return d->vendor == vendor && d->device == device;
+}
+
+static int match_class(PciDevice *d, uint32_t class_code, uint32_t subclass) {
+  return d->class_code == class_code && d->subclass == subclass;
+}
+
+// Never matches, so the scan visits everything
+static int match_each(PciDevice *d, uint32_t fn, uint32_t unused) {
+  ((void (*)(PciDevice *))fn)(d);
+  return 0;
+}
+
+void pci_for_each(void (*fn)(PciDevice *d)) {
+  PciDevice d;
+  pci_scan(match_each, (uint32_t)fn, 0, &d);
+}
+
+int pci_find_device(uint16_t vendor, uint16_t device, PciDevice *out) {
+  return pci_scan(match_id, vendor, device, out);
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice *out) {
+  return pci_scan(match_class, class_code, subclass, out);
+}
+
+uint32_t pci_bar(PciDevice *d, int n) {
+  uint32_t bar = pci_read32(d->bus, d->dev, d->func, PCI_BAR0 + n * 4);
+  if (bar & 1)
+    return bar & 0xFFFFFFFC; // I/O space
+  return bar & 0xFFFFFFF0;   // Memory space
+}
+
+void pci_enable(PciDevice *d, uint16_t command_bits) {
+  uint32_t cmd = pci_read32(d->bus, d->dev, d->func, PCI_COMMAND);
+  pci_write32(d->bus, d->dev, d->func, PCI_COMMAND, cmd | command_bits);
+}
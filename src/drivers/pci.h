@@ -0,0 +1,50 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "../kernel/types.h"
+
+// PCI Configuration Space (Mechanism #1, ports 0xCF8/0xCFC)
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+// Common register offsets
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_STATUS 0x06
+#define PCI_CLASS_REV 0x08
+#define PCI_BAR0 0x10
+#define PCI_CAP_PTR 0x34
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO 0x01
+#define PCI_COMMAND_MEMORY 0x02
+#define PCI_COMMAND_MASTER 0x04
+#define PCI_STATUS_CAP_LIST 0x10
+
+typedef struct {
+  uint8_t bus, dev, func;
+  uint16_t vendor, device;
+  uint8_t class_code, subclass, prog_if;
+} PciDevice;
+
+uint32_t pci_read32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset);
+void pci_write32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset,
+                 uint32_t value);
+uint16_t pci_read16(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset);
+uint8_t pci_read8(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset);
+
+// Find first function matching vendor/device. Returns 1 if found.
+int pci_find_device(uint16_t vendor, uint16_t device, PciDevice *out);
+
+// Find first function with the given class/subclass. Returns 1 if found.
+int pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice *out);
+
+// Call fn for every function present, in bus/device/function order
+void pci_for_each(void (*fn)(PciDevice *d));
+
+// BAR n (address bits only) and PCI_COMMAND bit helpers
+uint32_t pci_bar(PciDevice *d, int n);
+void pci_enable(PciDevice *d, uint16_t command_bits);
+
+#endif
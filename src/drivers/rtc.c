@@ -63,3 +63,12 @@ void rtc_get_time(int *hour, int *min, int *sec) {
   *min = (int)m;
   *sec = (int)s;
 }
+
+// Extended memory size from CMOS (BIOS boot path has no E820 map).
+// 0x30/0x31: KB above 1MB (max 63MB), 0x34/0x35: 64KB blocks above 16MB.
+uint32_t cmos_extended_memory_kb() {
+  uint32_t above16 = get_rtc_register(0x34) | (get_rtc_register(0x35) << 8);
+  if (above16)
+    return 15 * 1024 + above16 * 64;
+  return get_rtc_register(0x30) | (get_rtc_register(0x31) << 8);
+}
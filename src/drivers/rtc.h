@@ -1,6 +1,9 @@
 #ifndef RTC_H
 #define RTC_H
 
+#include "../kernel/types.h"
+
 void rtc_get_time(int *hour, int *min, int *sec);
+uint32_t cmos_extended_memory_kb();
 
 #endif
@@ -0,0 +1,181 @@
+#include "serial.h"
+#include "../kernel/idt.h"
+#include "../kernel/lock.h"
+#include "io.h"
+
+// Register offsets from the base port
+#define UART_DATA 0       // THR/RBR (DLL when DLAB=1)
+#define UART_IER 1        // Interrupt Enable (DLM when DLAB=1)
+#define UART_IIR 2        // Interrupt Identification (read)
+#define UART_FCR 2        // FIFO Control (write)
+#define UART_LCR 3        // Line Control
+#define UART_MCR 4        // Modem Control
+#define UART_LSR 5        // Line Status
+#define UART_SCRATCH 7
+
+#define IER_THRI 0x02 // Interrupt when the transmitter is empty
+#define MCR_OUT2 0x08 // Routes the UART interrupt to the PIC on PCs
+#define LSR_THR_EMPTY 0x20
+#define LSR_TX_DONE 0x40 // FIFO and shift register empty
+#define UART_FIFO 16
+
+static int serial_present = 0;
+static volatile int irq_mode = 0;
+
+// Text TX ring. Threads and CPUs append under tx_lock, the IRQ4 handler
+// drains it.
+#define TX_RING 4096
+static char tx_ring[TX_RING];
+static Spinlock tx_lock = SPINLOCK_INIT("serial tx");
+static volatile uint32_t tx_head = 0; // Written by the producer
+static volatile uint32_t tx_tail = 0; // Written by the IRQ handler
+static volatile int tx_idle = 1;      // THRI off, a kick is needed
+
+// Second byte source, drained whenever the text ring is at a line boundary
+static SerialSource source = 0;
+static char src_buf[SERIAL_SOURCE_MAX];
+static int src_len = 0, src_pos = 0;
+static int mid_line = 0; // Last text byte sent was not '\n'
+
+void init_serial() {
+  // No UART? Writes to the scratch register won't stick.
+  outb(COM1_PORT + UART_SCRATCH, 0xA5);
+  if (inb(COM1_PORT + UART_SCRATCH) != 0xA5)
+    return;
+
+  outb(COM1_PORT + UART_IER, 0x00); // Polled until serial_start_irq
+  outb(COM1_PORT + UART_LCR, 0x80); // DLAB on
+  outb(COM1_PORT + UART_DATA, 0x01); // Divisor 1 = 115200 baud
+  outb(COM1_PORT + UART_IER, 0x00);
+  outb(COM1_PORT + UART_LCR, 0x03); // 8N1, DLAB off
+  outb(COM1_PORT + UART_FCR, 0xC7); // Enable + clear FIFOs, 14 byte trigger
+  outb(COM1_PORT + UART_MCR, 0x03); // DTR + RTS
+  serial_present = 1;
+}
+
+// Next byte to transmit, or -1 when there is nothing queued
+static int tx_next() {
+  // Text first, but a trace line never lands in the middle of a text line
+  if (tx_tail != tx_head && (mid_line || src_pos == src_len)) {
+    char c = tx_ring[tx_tail % TX_RING];
+    tx_tail++;
+    mid_line = c != '\n';
+    return (uint8_t)c;
+  }
+  if (src_pos == src_len && source) {
+    src_len = source(src_buf, SERIAL_SOURCE_MAX);
+    src_pos = 0;
+  }
+  if (src_pos < src_len)
+    return (uint8_t)src_buf[src_pos++];
+  return -1;
+}
+
+static void serial_irq(int irq) {
+  inb(COM1_PORT + UART_IIR); // Acknowledge
+  if (!(inb(COM1_PORT + UART_LSR) & LSR_THR_EMPTY))
+    return;
+  // THR empty means the whole FIFO is free
+  for (int i = 0; i < UART_FIFO; i++) {
+    int c = tx_next();
+    if (c < 0) {
+      // Drained: stop THR interrupts until someone queues more
+      outb(COM1_PORT + UART_IER, 0x00);
+      tx_idle = 1;
+      return;
+    }
+    outb(COM1_PORT + UART_DATA, c);
+  }
+}
+
+void serial_start_irq() {
+  if (!serial_present)
+    return;
+  outb(COM1_PORT + UART_MCR, 0x03 | MCR_OUT2);
+  irq_register(4, serial_irq);
+  irq_mode = 1;
+  serial_kick();
+}
+
+void serial_set_source(SerialSource fn) { source = fn; }
+
+void serial_kick() {
+  // Enabling THRI with the transmitter empty raises the interrupt at once.
+  // Only the caller that flips tx_idle pays for the port writes.
+  if (irq_mode && __sync_lock_test_and_set(&tx_idle, 0))
+    outb(COM1_PORT + UART_IER, IER_THRI);
+}
+
+void serial_flush() {
+  if (!serial_present)
+    return;
+  // tx_idle is only set once both the text ring and the source ran dry
+  int timeout = 10000000;
+  while (irq_mode && (tx_tail != tx_head || !tx_idle) && timeout-- > 0)
+    __asm__ volatile("pause");
+  while (!(inb(COM1_PORT + UART_LSR) & LSR_TX_DONE) && timeout-- > 0)
+    ;
+}
+
+static void serial_putc_polled(char c) {
+  int timeout = 100000;
+  while (!(inb(COM1_PORT + UART_LSR) & LSR_THR_EMPTY) && timeout-- > 0)
+    ;
+  outb(COM1_PORT + UART_DATA, c);
+}
+
+static void serial_queue(char c) {
+  if (!irq_mode) {
+    serial_putc_polled(c);
+    return;
+  }
+  // Ring full: wait for the IRQ to drain it. With interrupts off that
+  // never happens, so give up and drop the byte.
+  int timeout = 1000000;
+  while (1) {
+    uint32_t flags = spin_lock_irqsave(&tx_lock);
+    if (tx_head - tx_tail < TX_RING) {
+      tx_ring[tx_head % TX_RING] = c;
+      __asm__ volatile("" ::: "memory"); // Byte visible before the index
+      tx_head++;
+      spin_unlock_irqrestore(&tx_lock, flags);
+      return;
+    }
+    spin_unlock_irqrestore(&tx_lock, flags);
+    if (timeout-- <= 0)
+      return;
+    serial_kick();
+    __asm__ volatile("pause");
+  }
+}
+
+void serial_putc(char c) {
+  if (!serial_present)
+    return;
+  if (c == '\n')
+    serial_queue('\r');
+  serial_queue(c);
+  serial_kick();
+}
+
+void serial_write(const char *s) {
+  while (*s)
+    serial_putc(*s++);
+}
+
+void serial_write_dec(uint32_t v) {
+  char buf[12];
+  int i = 0;
+  do {
+    buf[i++] = '0' + (v % 10);
+    v /= 10;
+  } while (v);
+  while (i > 0)
+    serial_putc(buf[--i]);
+}
+
+void serial_write_hex(uint32_t v) {
+  serial_write("0x");
+  for (int shift = 28; shift >= 0; shift -= 4)
+    serial_putc("0123456789ABCDEF"[(v >> shift) & 0xF]);
+}
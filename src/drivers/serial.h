@@ -0,0 +1,34 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "../kernel/types.h"
+
+// COM1 (16550 UART). Capture with QEMU -serial stdio or -serial file:log
+#define COM1_PORT 0x3F8
+
+// Polled until serial_start_irq (needs the IDT), then writes only queue
+// into a ring that the IRQ4 handler feeds to the 16 byte TX FIFO.
+void init_serial();
+void serial_start_irq();
+
+// Text output, thread context only; lines from different threads may
+// interleave. IRQ handlers use trace() instead.
+void serial_putc(char c);
+void serial_write(const char *s);
+void serial_write_dec(uint32_t v);
+void serial_write_hex(uint32_t v);
+
+// A second producer of bytes, pulled from IRQ context whenever the text
+// ring is empty or between lines. Returns the number of bytes written.
+#define SERIAL_SOURCE_MAX 96
+typedef int (*SerialSource)(char *buf, int max);
+void serial_set_source(SerialSource fn);
+
+// Make sure the transmitter is running after queueing data elsewhere.
+// Cheap when it already is.
+void serial_kick();
+
+// Wait until everything queued is on the wire (needs interrupts on)
+void serial_flush();
+
+#endif
@@ -1,7 +1,13 @@
 #include "video.h"
+#include "../kernel/memory.h"
+#include "../kernel/multiboot.h"
+#include "../kernel/smp.h"
 #include "font.h"
+#include "io.h"
+#include "pci.h"
+#include "serial.h"
 
-// VESA Info from Bootloader
+// Active video mode (filled from the boot handoff)
 typedef struct {
   uint32_t framebuffer_addr;
   uint16_t width;
@@ -10,27 +16,114 @@ typedef struct {
   uint16_t pitch;
 } __attribute__((packed)) VesaInfo;
 
-#define VESA_INFO_LOC 0x9000
-// Backbuffer location: 8MB mark. Ensure QEMU has -m 32 or more.
+// Fallback backbuffer location if the heap is unavailable: 8MB mark.
 #define BACKBUFFER_ADDR 0x800000
 
-VesaInfo *vesa_info = (VesaInfo *)VESA_INFO_LOC;
+static VesaInfo vesa_mode;
+VesaInfo *vesa_info = &vesa_mode;
 uint8_t *framebuffer;
 uint8_t *backbuffer;
 
 int screen_width = 1024; // Default safe
 int screen_height = 768;
 
+// --- Bochs/QEMU Graphics Adapter ---
+// QEMU's Multiboot loader does not set a video mode, so when booted with
+// -kernel we program the emulated VBE "dispi" interface directly.
+#define BGA_INDEX 0x01CE
+#define BGA_DATA 0x01CF
+#define BGA_REG_ID 0
+#define BGA_REG_XRES 1
+#define BGA_REG_YRES 2
+#define BGA_REG_BPP 3
+#define BGA_REG_ENABLE 4
+#define BGA_ENABLED 0x01
+#define BGA_LFB_ENABLED 0x40
+
+static void bga_write(uint16_t reg, uint16_t value) {
+  outw(BGA_INDEX, reg);
+  outw(BGA_DATA, value);
+}
+
+static int bga_set_mode(BootFramebuffer *fb, int w, int h, int bpp) {
+  outw(BGA_INDEX, BGA_REG_ID);
+  uint16_t id = inw(BGA_DATA);
+  if (id < 0xB0C0 || id > 0xB0CF)
+    return 0;
+
+  PciDevice dev;
+  if (!pci_find_device(0x1234, 0x1111, &dev))
+    return 0;
+
+  bga_write(BGA_REG_ENABLE, 0);
+  bga_write(BGA_REG_XRES, w);
+  bga_write(BGA_REG_YRES, h);
+  bga_write(BGA_REG_BPP, bpp);
+  bga_write(BGA_REG_ENABLE, BGA_ENABLED | BGA_LFB_ENABLED);
+
+  fb->addr = pci_read32(dev.bus, dev.dev, dev.func, PCI_BAR0) & 0xFFFFFFF0;
+  fb->width = w;
+  fb->height = h;
+  fb->bpp = bpp;
+  fb->pitch = w * (bpp / 8);
+  return 1;
+}
+
 void init_video() {
+  BootFramebuffer *fb = &boot_info.fb;
+  if (!fb->addr && !bga_set_mode(fb, 1024, 768, 32)) {
+    // No display at all. Draw into RAM rather than to physical address 0,
+    // so the desktop still runs (e.g. headless, driven over COM1).
+    serial_write("[video] no framebuffer or BGA, drawing off screen\n");
+    fb->width = 1024;
+    fb->height = 768;
+    fb->bpp = 32;
+    fb->pitch = fb->width * 4;
+    fb->addr = (uint32_t)kmalloc_aligned(fb->height * fb->pitch, 4096);
+    if (!fb->addr) {
+      serial_write("[video] no memory for it either, halting\n");
+      serial_flush();
+      while (1)
+        __asm__ volatile("cli; hlt");
+    }
+  }
+
+  vesa_mode.framebuffer_addr = fb->addr;
+  vesa_mode.width = fb->width;
+  vesa_mode.height = fb->height;
+  vesa_mode.bpp = fb->bpp;
+  vesa_mode.pitch = fb->pitch;
+
   framebuffer = (uint8_t *)vesa_info->framebuffer_addr;
-  backbuffer = (uint8_t *)BACKBUFFER_ADDR;
+  backbuffer = kmalloc_aligned(vesa_info->height * vesa_info->pitch, 4096);
+  if (!backbuffer)
+    backbuffer = (uint8_t *)BACKBUFFER_ADDR;
   screen_width = vesa_info->width;
   screen_height = vesa_info->height;
+  video_reset_clip();
+}
+
+void video_set_clip(int x, int y, int w, int h) {
+  ClipRect *c = &this_cpu()->clip;
+  c->x0 = x < 0 ? 0 : x;
+  c->y0 = y < 0 ? 0 : y;
+  c->x1 = x + w > vesa_info->width ? vesa_info->width : x + w;
+  c->y1 = y + h > vesa_info->height ? vesa_info->height : y + h;
+}
+
+void video_reset_clip() {
+  video_set_clip(0, 0, vesa_info->width, vesa_info->height);
+}
+
+int video_clip_overlaps(int x, int y, int w, int h) {
+  ClipRect *c = &this_cpu()->clip;
+  return x < c->x1 && x + w > c->x0 && y < c->y1 && y + h > c->y0;
 }
 
 // Draw to BACKBUFFER
 void put_pixel(int x, int y, uint32_t color) {
-  if (x < 0 || x >= vesa_info->width || y < 0 || y >= vesa_info->height)
+  ClipRect *c = &this_cpu()->clip;
+  if (x < c->x0 || x >= c->x1 || y < c->y0 || y >= c->y1)
     return;
 
   // Calculate offset
@@ -74,14 +167,13 @@ uint32_t get_pixel(int x, int y) {
 // Dithering helper
 // Checkerboard pattern: (x+y)%2 == 0 ? color1 : color2
 void video_clear_dithered(uint32_t c1, uint32_t c2) {
+  ClipRect *c = &this_cpu()->clip;
   int bpp = vesa_info->bpp / 8;
   int pitch = vesa_info->pitch;
-  int w = vesa_info->width;
-  int h = vesa_info->height;
 
-  for (int y = 0; y < h; y++) {
-    uint8_t *row = (uint8_t *)backbuffer + y * pitch;
-    for (int x = 0; x < w; x++) {
+  for (int y = c->y0; y < c->y1; y++) {
+    uint8_t *row = (uint8_t *)backbuffer + y * pitch + c->x0 * bpp;
+    for (int x = c->x0; x < c->x1; x++) {
       uint32_t color = ((x + y) & 1) ? c1 : c2;
 
       if (bpp == 4) {
@@ -113,45 +205,134 @@ void video_swap() {
   }
 }
 
-// Clear backbuffer
-void video_clear(uint32_t color) {
-  uint32_t total_bytes = vesa_info->height * vesa_info->pitch;
+// Partial swap: copy one rectangle of the backbuffer to the framebuffer
+void video_swap_rect(int x, int y, int w, int h) {
+  if (x < 0) {
+    w += x;
+    x = 0;
+  }
+  if (y < 0) {
+    h += y;
+    y = 0;
+  }
+  if (x + w > vesa_info->width)
+    w = vesa_info->width - x;
+  if (y + h > vesa_info->height)
+    h = vesa_info->height - y;
+  if (w <= 0 || h <= 0)
+    return;
 
-  // IF 32bpp, fast fill?
-  // But 'color' is 32-bit.
-  // Loop pixel by pixel or just memset if color is uniform bytes (0 or
-  // FFFFFFFF). If color is specific (e.g. 0x008080), bytes are different.
+  int bpp = vesa_info->bpp / 8;
+  uint32_t offset = y * vesa_info->pitch + x * bpp;
+  for (int row = 0; row < h; row++) {
+    memcpy(framebuffer + offset, backbuffer + offset, w * bpp);
+    offset += vesa_info->pitch;
+  }
+}
 
-  // Fallback to rect or pixel loop for correctness
-  // draw_rect(0, 0, vesa_info->width, vesa_info->height, color);
-  // Actually we can just run per-byte loop if careful? No.
-  // Let's iterate pixels.
+void video_blit(int x, int y, int w, int h, const uint32_t *src, int stride) {
+  ClipRect *c = &this_cpu()->clip;
+  if (x < c->x0) {
+    src += c->x0 - x;
+    w -= c->x0 - x;
+    x = c->x0;
+  }
+  if (y < c->y0) {
+    src += (c->y0 - y) * stride;
+    h -= c->y0 - y;
+    y = c->y0;
+  }
+  if (x + w > c->x1)
+    w = c->x1 - x;
+  if (y + h > c->y1)
+    h = c->y1 - y;
+  if (w <= 0 || h <= 0)
+    return;
 
-  // Optimized pixel loop
   int bpp = vesa_info->bpp / 8;
-  int w = vesa_info->width;
-  int h = vesa_info->height;
-  int pitch = vesa_info->pitch;
-
-  for (int y = 0; y < h; y++) {
-    uint8_t *row = backbuffer + y * pitch;
-    for (int x = 0; x < w; x++) {
-      if (bpp == 4) {
-        *(uint32_t *)row = color;
-        row += 4;
-      } else {
-        *row++ = color & 0xFF;
-        *row++ = (color >> 8) & 0xFF;
-        *row++ = (color >> 16) & 0xFF;
+  uint8_t *row = backbuffer + y * vesa_info->pitch + x * bpp;
+  for (int i = 0; i < h; i++) {
+    if (bpp == 4) {
+      memcpy(row, src, w * 4);
+    } else {
+      uint8_t *p = row;
+      for (int j = 0; j < w; j++) {
+        *p++ = src[j] & 0xFF;
+        *p++ = (src[j] >> 8) & 0xFF;
+        *p++ = (src[j] >> 16) & 0xFF;
       }
     }
+    row += vesa_info->pitch;
+    src += stride;
   }
 }
 
+void video_move_rect(int x, int y, int w, int h, int dx, int dy) {
+  // Keep both the source and the destination on screen
+  int x0 = x, y0 = y, x1 = x + w, y1 = y + h;
+  if (x0 < 0)
+    x0 = 0;
+  if (x0 + dx < 0)
+    x0 = -dx;
+  if (y0 < 0)
+    y0 = 0;
+  if (y0 + dy < 0)
+    y0 = -dy;
+  if (x1 > vesa_info->width)
+    x1 = vesa_info->width;
+  if (x1 + dx > vesa_info->width)
+    x1 = vesa_info->width - dx;
+  if (y1 > vesa_info->height)
+    y1 = vesa_info->height;
+  if (y1 + dy > vesa_info->height)
+    y1 = vesa_info->height - dy;
+  if (x0 >= x1 || y0 >= y1)
+    return;
+
+  // Moving down, start at the bottom so no row is overwritten before it
+  // is read. Within a row (dy = 0) memmove handles the overlap.
+  int bpp = vesa_info->bpp / 8;
+  int pitch = vesa_info->pitch;
+  int delta = dy * pitch + dx * bpp;
+  uint32_t n = (x1 - x0) * bpp;
+  for (int i = 0; i < y1 - y0; i++) {
+    int row = dy > 0 ? y1 - 1 - i : y0 + i;
+    uint8_t *src = backbuffer + row * pitch + x0 * bpp;
+    memmove(src + delta, src, n);
+  }
+}
+
+// Clear backbuffer (the part inside the clip rect)
+void video_clear(uint32_t color) {
+  ClipRect *c = &this_cpu()->clip;
+  draw_rect(c->x0, c->y0, c->x1 - c->x0, c->y1 - c->y0, color);
+}
+
+// Clipped once up front, then filled a row at a time
 void draw_rect(int x, int y, int w, int h, uint32_t color) {
-  for (int i = 0; i < h; i++) {
-    for (int j = 0; j < w; j++) {
-      put_pixel(x + j, y + i, color);
+  ClipRect *c = &this_cpu()->clip;
+  int x0 = x < c->x0 ? c->x0 : x;
+  int y0 = y < c->y0 ? c->y0 : y;
+  int x1 = x + w > c->x1 ? c->x1 : x + w;
+  int y1 = y + h > c->y1 ? c->y1 : y + h;
+  if (x0 >= x1 || y0 >= y1)
+    return;
+
+  int bpp = vesa_info->bpp / 8;
+  int n = x1 - x0;
+  uint8_t *row = backbuffer + y0 * vesa_info->pitch + x0 * bpp;
+  for (int i = y0; i < y1; i++, row += vesa_info->pitch) {
+    if (bpp == 4) {
+      uint32_t *p = (uint32_t *)row, *end = p + n;
+      while (p < end)
+        *p++ = color;
+    } else {
+      uint8_t *p = row;
+      for (int j = 0; j < n; j++) {
+        *p++ = color & 0xFF;
+        *p++ = (color >> 8) & 0xFF;
+        *p++ = (color >> 16) & 0xFF;
+      }
     }
   }
 }
@@ -159,6 +340,10 @@ void draw_rect(int x, int y, int w, int h, uint32_t color) {
 void draw_char(int x, int y, char c, uint32_t color) {
   if (c < 32 || c > 126)
     return;
+  ClipRect *clip = &this_cpu()->clip;
+  if (x + 8 <= clip->x0 || x >= clip->x1 || y + 8 <= clip->y0 ||
+      y >= clip->y1)
+    return;
   int index = c - 32;
 
   for (int row = 0; row < 8; row++) {
@@ -171,7 +356,24 @@ void draw_char(int x, int y, char c, uint32_t color) {
   }
 }
 
+void draw_char_to(uint32_t *dst, int stride, int x, int y, char c,
+                  uint32_t color) {
+  if (c < 32 || c > 126)
+    return;
+  dst += y * stride + x;
+  for (int row = 0; row < 8; row++, dst += stride) {
+    uint8_t line = font_basic[c - 32][row];
+    for (int col = 0; col < 8; col++) {
+      if (line & (0x80 >> col))
+        dst[col] = color;
+    }
+  }
+}
+
 void draw_string(int x, int y, const char *str, uint32_t color) {
+  ClipRect *c = &this_cpu()->clip;
+  if (y + 8 <= c->y0 || y >= c->y1)
+    return;
   int cur_x = x;
   while (*str) {
     draw_char(cur_x, y, *str, color);
@@ -3,15 +3,34 @@
 
 #include "../kernel/types.h"
 
+// Drawing is clipped to a per-CPU rectangle (the whole screen unless
+// changed), so several CPUs can paint different parts of the backbuffer.
+typedef struct {
+  int x0, y0, x1, y1; // x1/y1 exclusive
+} ClipRect;
+
 void init_video();
+// For the calling CPU; intersected with the screen
+void video_set_clip(int x, int y, int w, int h);
+void video_reset_clip();
+int video_clip_overlaps(int x, int y, int w, int h); // Anything to draw?
 void put_pixel(int x, int y, uint32_t color);
 uint32_t get_pixel(int x, int y);
 void draw_rect(int x, int y, int w, int h, uint32_t color);
 void video_swap();
-void video_clear(uint32_t color);
+void video_swap_rect(int x, int y, int w, int h); // Copy only this area
+void video_clear(uint32_t color); // The clip rect only
+// Copy a 32bpp surface (stride in pixels) to the backbuffer, clipped
+void video_blit(int x, int y, int w, int h, const uint32_t *src, int stride);
+// Move a backbuffer rectangle by (dx, dy); source and destination may
+// overlap. Clipped to the screen, not to the clip rect.
+void video_move_rect(int x, int y, int w, int h, int dx, int dy);
 void video_clear_dithered(uint32_t c1, uint32_t c2); // Checkerboard pattern
 void draw_char(int x, int y, char c, uint32_t color);
 void draw_string(int x, int y, const char *str, uint32_t color);
+// Into a 32bpp surface (stride in pixels) instead; no clipping
+void draw_char_to(uint32_t *dst, int stride, int x, int y, char c,
+                  uint32_t color);
 
 extern int screen_width;
 extern int screen_height;
@@ -0,0 +1,566 @@
+#include "virtio_blk.h"
+#include "../kernel/block.h"
+#include "../kernel/idt.h"
+#include "../kernel/memory.h"
+#include "../kernel/timeline.h"
+#include "io.h"
+#include "pci.h"
+#include "serial.h"
+
+#define VIRTIO_VENDOR 0x1AF4
+#define VIRTIO_BLK_TRANSITIONAL 0x1001 // Legacy interface, maybe modern too
+#define VIRTIO_BLK_MODERN 0x1042
+
+// Device status bits
+#define VIRTIO_STATUS_ACK 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+
+// Feature bits (VERSION_1 lives in the second feature word)
+#define VIRTIO_RING_F_INDIRECT_DESC (1u << 28)
+#define VIRTIO_RING_F_EVENT_IDX (1u << 29)
+#define VIRTIO_F_VERSION_1_HI (1u << 0)
+
+// Legacy transport: I/O BAR0 registers
+#define VIRTIO_LEG_DEVICE_FEATURES 0x00
+#define VIRTIO_LEG_GUEST_FEATURES 0x04
+#define VIRTIO_LEG_QUEUE_PFN 0x08
+#define VIRTIO_LEG_QUEUE_SIZE 0x0C
+#define VIRTIO_LEG_QUEUE_SELECT 0x0E
+#define VIRTIO_LEG_QUEUE_NOTIFY 0x10
+#define VIRTIO_LEG_STATUS 0x12
+#define VIRTIO_LEG_ISR 0x13
+#define VIRTIO_LEG_CONFIG 0x14 // Without MSI-X
+
+// Modern transport: vendor capabilities pointing into memory BARs
+#define PCI_CAP_ID_VENDOR 0x09
+#define VIRTIO_PCI_CAP_COMMON 1
+#define VIRTIO_PCI_CAP_NOTIFY 2
+#define VIRTIO_PCI_CAP_ISR 3
+#define VIRTIO_PCI_CAP_DEVICE 4
+
+typedef volatile struct {
+  uint32_t device_feature_select;
+  uint32_t device_feature;
+  uint32_t driver_feature_select;
+  uint32_t driver_feature;
+  uint16_t msix_config;
+  uint16_t num_queues;
+  uint8_t device_status;
+  uint8_t config_generation;
+  uint16_t queue_select;
+  uint16_t queue_size;
+  uint16_t queue_msix_vector;
+  uint16_t queue_enable;
+  uint16_t queue_notify_off;
+  uint32_t queue_desc_lo, queue_desc_hi;
+  uint32_t queue_driver_lo, queue_driver_hi;
+  uint32_t queue_device_lo, queue_device_hi;
+} __attribute__((packed)) VirtioCommonCfg;
+
+// --- Split Virtqueue ---
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2 // Device writes (a read from disk)
+#define VIRTQ_DESC_F_INDIRECT 4
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+typedef struct {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} __attribute__((packed)) VirtqDesc;
+
+typedef volatile struct {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[]; // qsize entries, then used_event
+} __attribute__((packed)) VirtqAvail;
+
+typedef struct {
+  uint32_t id; // Head descriptor of the finished chain
+  uint32_t len;
+} __attribute__((packed)) VirtqUsedElem;
+
+typedef volatile struct {
+  uint16_t flags;
+  uint16_t idx;
+  VirtqUsedElem ring[]; // qsize entries, then avail_event
+} __attribute__((packed)) VirtqUsed;
+
+// Legacy devices want the rings in one block with the used ring on the next
+// 4KB boundary. Modern ones accept any layout, so both use this.
+#define VIRTQ_ALIGN 4096
+#define VIRTQ_ALIGN_UP(x) (((x) + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1))
+
+// --- virtio-blk ---
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+
+typedef struct {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} __attribute__((packed)) VirtioBlkHeader;
+
+#define VBLK_MAX_QUEUE 128    // Ring entries we ask a modern device for
+#define VBLK_SLOTS 32         // Requests in flight
+#define VBLK_MAX_SEGMENTS 16  // Block requests merged into one command
+#define VBLK_MAX_SECTORS 1024 // 512KB per command
+#define VBLK_CHAIN (VBLK_MAX_SEGMENTS + 2) // Header + data + status
+
+typedef struct {
+  VirtioBlkHeader header;
+  VirtqDesc table[VBLK_CHAIN]; // Indirect table
+  BlockRequest *batch;         // 0 = free
+  uint64_t start_tsc;
+  volatile uint8_t status;
+} VblkSlot;
+
+typedef struct {
+  BlockDevice blk;
+  int modern;
+  int irq;
+
+  // Legacy: I/O ports. Modern: mapped capability regions.
+  uint16_t io;
+  VirtioCommonCfg *common;
+  volatile uint8_t *isr;
+  volatile uint16_t *notify;
+  volatile uint8_t *config;
+
+  int indirect;
+  int event_idx;
+
+  uint16_t qsize;
+  VirtqDesc *desc;
+  VirtqAvail *avail;
+  VirtqUsed *used;
+  uint16_t free_head; // Free descriptors, linked through next
+  uint16_t free_count;
+  uint16_t last_used;
+  uint8_t *desc_slot; // Head descriptor -> slot
+  VblkSlot *slots;
+} VirtioBlk;
+
+#define MAX_VIRTIO_BLK 4
+static VirtioBlk vdisks[MAX_VIRTIO_BLK];
+static int vdisk_count = 0;
+
+// Order ring stores against the device: the compiler must not reorder, and
+// loads of the event index must not pass the preceding index store.
+static inline void vblk_wmb() { __asm__ volatile("" : : : "memory"); }
+static inline void vblk_mb() {
+  __asm__ volatile("lock; addl $0, (%%esp)" : : : "memory");
+}
+
+// --- Transport ---
+
+static uint8_t vblk_get_status(VirtioBlk *v) {
+  return v->modern ? v->common->device_status
+                   : inb(v->io + VIRTIO_LEG_STATUS);
+}
+
+static void vblk_set_status(VirtioBlk *v, uint8_t status) {
+  if (v->modern)
+    v->common->device_status = status;
+  else
+    outb(v->io + VIRTIO_LEG_STATUS, status);
+}
+
+static void vblk_kick(VirtioBlk *v) {
+  if (v->modern)
+    *v->notify = 0;
+  else
+    outw(v->io + VIRTIO_LEG_QUEUE_NOTIFY, 0);
+  v->blk.stats.notifies++;
+}
+
+// Reading ISR acknowledges the interrupt. Bit 0: queue, bit 1: config.
+static uint8_t vblk_read_isr(VirtioBlk *v) {
+  return v->modern ? *v->isr : inb(v->io + VIRTIO_LEG_ISR);
+}
+
+// Map the region a modern vendor capability points at, 0 if unusable
+static volatile uint8_t *vblk_cap_region(PciDevice *pci, uint8_t cap) {
+  uint8_t bar = pci_read8(pci->bus, pci->dev, pci->func, cap + 4);
+  uint32_t offset = pci_read32(pci->bus, pci->dev, pci->func, cap + 8);
+  if (bar > 5)
+    return 0;
+  uint32_t raw = pci_read32(pci->bus, pci->dev, pci->func, PCI_BAR0 + bar * 4);
+  if (raw & 1)
+    return 0; // I/O BAR, we want memory
+  // 64-bit BAR placed above 4GB: not reachable without paging tricks
+  if ((raw & 6) == 4 && bar < 5 &&
+      pci_read32(pci->bus, pci->dev, pci->func, PCI_BAR0 + bar * 4 + 4))
+    return 0;
+  return (volatile uint8_t *)(pci_bar(pci, bar) + offset);
+}
+
+// Locate the modern capabilities. Returns 1 if the modern interface is usable.
+static int vblk_find_caps(VirtioBlk *v, PciDevice *pci) {
+  if (!(pci_read16(pci->bus, pci->dev, pci->func, PCI_STATUS) &
+        PCI_STATUS_CAP_LIST))
+    return 0;
+
+  volatile uint8_t *notify_base = 0;
+  uint32_t notify_mult = 0;
+  uint8_t cap = pci_read8(pci->bus, pci->dev, pci->func, PCI_CAP_PTR) & 0xFC;
+  for (int guard = 0; cap && guard < 48; guard++) {
+    uint8_t id = pci_read8(pci->bus, pci->dev, pci->func, cap);
+    if (id == PCI_CAP_ID_VENDOR) {
+      uint8_t type = pci_read8(pci->bus, pci->dev, pci->func, cap + 3);
+      volatile uint8_t *region = vblk_cap_region(pci, cap);
+      if (type == VIRTIO_PCI_CAP_COMMON)
+        v->common = (VirtioCommonCfg *)region;
+      else if (type == VIRTIO_PCI_CAP_ISR)
+        v->isr = region;
+      else if (type == VIRTIO_PCI_CAP_DEVICE)
+        v->config = region;
+      else if (type == VIRTIO_PCI_CAP_NOTIFY) {
+        notify_base = region;
+        notify_mult = pci_read32(pci->bus, pci->dev, pci->func, cap + 16);
+      }
+    }
+    cap = pci_read8(pci->bus, pci->dev, pci->func, cap + 1) & 0xFC;
+  }
+  if (!v->common || !v->isr || !v->config || !notify_base)
+    return 0;
+
+  // Queue 0's doorbell
+  v->common->queue_select = 0;
+  v->notify = (volatile uint16_t *)(notify_base + v->common->queue_notify_off *
+                                                      notify_mult);
+  return 1;
+}
+
+// --- Queue ---
+
+// The event index words sit right after each ring
+static volatile uint16_t *vblk_used_event(VirtioBlk *v) {
+  return (volatile uint16_t *)((uint8_t *)v->avail + 4 + 2 * v->qsize);
+}
+
+static uint16_t vblk_avail_event(VirtioBlk *v) {
+  return *(volatile uint16_t *)((uint8_t *)v->used + 4 + 8 * v->qsize);
+}
+
+static int vblk_alloc_ring(VirtioBlk *v) {
+  uint32_t avail_off = v->qsize * sizeof(VirtqDesc);
+  uint32_t used_off = VIRTQ_ALIGN_UP(avail_off + 6 + 2 * v->qsize);
+  uint32_t size = used_off + VIRTQ_ALIGN_UP(6 + 8 * v->qsize);
+  uint8_t *mem = kmalloc_aligned(size, VIRTQ_ALIGN);
+  v->desc_slot = kmalloc(v->qsize);
+  v->slots = kmalloc_aligned(VBLK_SLOTS * sizeof(VblkSlot), 16);
+  if (!mem || !v->desc_slot || !v->slots)
+    return 0;
+  memset(mem, 0, size);
+  memset(v->slots, 0, VBLK_SLOTS * sizeof(VblkSlot));
+
+  v->desc = (VirtqDesc *)mem;
+  v->avail = (VirtqAvail *)(mem + avail_off);
+  v->used = (VirtqUsed *)(mem + used_off);
+  for (int i = 0; i < v->qsize; i++)
+    v->desc[i].next = i + 1;
+  v->free_head = 0;
+  v->free_count = v->qsize;
+  v->last_used = 0;
+  return 1;
+}
+
+static uint16_t vblk_alloc_desc(VirtioBlk *v) {
+  uint16_t d = v->free_head;
+  v->free_head = v->desc[d].next;
+  v->free_count--;
+  return d;
+}
+
+static void vblk_free_chain(VirtioBlk *v, uint16_t head) {
+  uint16_t d = head;
+  while (1) {
+    uint16_t flags = v->desc[d].flags;
+    uint16_t next = v->desc[d].next;
+    v->desc[d].next = v->free_head;
+    v->free_head = d;
+    v->free_count++;
+    if (!(flags & VIRTQ_DESC_F_NEXT))
+      break;
+    d = next;
+  }
+}
+
+static void vblk_fill(VirtqDesc *d, void *addr, uint32_t len, uint16_t flags) {
+  d->addr = (uint32_t)addr;
+  d->len = len;
+  d->flags = flags;
+}
+
+// Describe one batch as header / data segments / status. Returns the head
+// descriptor index placed in the ring.
+static uint16_t vblk_build(VirtioBlk *v, VblkSlot *s, int write) {
+  uint16_t data_flags = write ? 0 : VIRTQ_DESC_F_WRITE;
+
+  if (v->indirect) {
+    int n = 0;
+    vblk_fill(&s->table[n++], &s->header, sizeof(VirtioBlkHeader), 0);
+    for (BlockRequest *r = s->batch; r; r = r->next)
+      vblk_fill(&s->table[n++], r->buffer, r->count * BLOCK_SECTOR_SIZE,
+                data_flags);
+    vblk_fill(&s->table[n++], (void *)&s->status, 1, VIRTQ_DESC_F_WRITE);
+    for (int i = 0; i < n - 1; i++) {
+      s->table[i].flags |= VIRTQ_DESC_F_NEXT;
+      s->table[i].next = i + 1;
+    }
+    uint16_t head = vblk_alloc_desc(v);
+    vblk_fill(&v->desc[head], s->table, n * sizeof(VirtqDesc),
+              VIRTQ_DESC_F_INDIRECT);
+    return head;
+  }
+
+  // Direct chain in the ring itself
+  uint16_t head = vblk_alloc_desc(v);
+  uint16_t prev = head;
+  vblk_fill(&v->desc[head], &s->header, sizeof(VirtioBlkHeader), 0);
+  for (BlockRequest *r = s->batch; r; r = r->next) {
+    uint16_t d = vblk_alloc_desc(v);
+    vblk_fill(&v->desc[d], r->buffer, r->count * BLOCK_SECTOR_SIZE,
+              data_flags);
+    v->desc[prev].flags |= VIRTQ_DESC_F_NEXT;
+    v->desc[prev].next = d;
+    prev = d;
+  }
+  uint16_t d = vblk_alloc_desc(v);
+  vblk_fill(&v->desc[d], (void *)&s->status, 1, VIRTQ_DESC_F_WRITE);
+  v->desc[prev].flags |= VIRTQ_DESC_F_NEXT;
+  v->desc[prev].next = d;
+  return head;
+}
+
+static VblkSlot *vblk_free_slot(VirtioBlk *v) {
+  for (int i = 0; i < VBLK_SLOTS; i++) {
+    if (!v->slots[i].batch)
+      return &v->slots[i];
+  }
+  return 0;
+}
+
+// BlockDevice.start: move every queued batch we have room for into the ring,
+// then ring the doorbell once (if the device asked to be told at all).
+static void vblk_start(BlockDevice *dev) {
+  VirtioBlk *v = (VirtioBlk *)dev->driver_data;
+  uint16_t old_idx = v->avail->idx;
+  uint16_t idx = old_idx;
+  uint16_t need = v->indirect ? 1 : VBLK_CHAIN;
+
+  while (dev->queue && v->free_count >= need) {
+    VblkSlot *s = vblk_free_slot(v);
+    if (!s)
+      break;
+    uint32_t lba, count;
+    int write;
+    s->batch = block_next_batch(dev, &lba, &count, &write);
+    s->header.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    s->header.reserved = 0;
+    s->header.sector = lba;
+    s->status = 0xFF;
+    s->start_tsc = rdtsc();
+
+    uint16_t head = vblk_build(v, s, write);
+    v->desc_slot[head] = s - v->slots;
+    v->avail->ring[idx & (v->qsize - 1)] = head;
+    idx++;
+  }
+  if (idx == old_idx)
+    return;
+
+  vblk_wmb(); // Ring entries before the index
+  v->avail->idx = idx;
+  vblk_mb(); // Index visible before we read the device's event index
+
+  int kick;
+  if (v->event_idx)
+    kick = (uint16_t)(idx - vblk_avail_event(v) - 1) <
+           (uint16_t)(idx - old_idx);
+  else
+    kick = !(v->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+  if (kick)
+    vblk_kick(v);
+}
+
+// Complete everything in the used ring. Interrupts stay quiet until we are
+// done: with EVENT_IDX the device only signals when used->idx passes
+// used_event, which we move just once, at the end.
+static void vblk_reap(VirtioBlk *v) {
+  if (!v->event_idx)
+    v->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+  while (1) {
+    while (v->last_used != v->used->idx) {
+      vblk_wmb(); // Read the entry only after seeing the index
+      VirtqUsedElem *e = (VirtqUsedElem *)&v->used->ring[v->last_used &
+                                                         (v->qsize - 1)];
+      uint16_t head = e->id;
+      VblkSlot *s = &v->slots[v->desc_slot[head]];
+      vblk_free_chain(v, head);
+      BlockRequest *batch = s->batch;
+      s->batch = 0;
+      block_complete(&v->blk, batch, s->status ? -1 : 0, s->start_tsc);
+      v->last_used++;
+    }
+
+    // Re-arm, then look again: a completion that landed in between would
+    // otherwise sit there without an interrupt.
+    if (v->event_idx)
+      *vblk_used_event(v) = v->last_used;
+    else
+      v->avail->flags = 0;
+    vblk_mb();
+    if (v->last_used == v->used->idx)
+      break;
+  }
+}
+
+static void vblk_irq(int irq) {
+  for (int i = 0; i < vdisk_count; i++) {
+    VirtioBlk *v = &vdisks[i];
+    if (v->irq != irq)
+      continue;
+    if (!(vblk_read_isr(v) & 1))
+      continue; // Shared line, not this one
+    v->blk.stats.interrupts++;
+    vblk_reap(v);
+    vblk_start(&v->blk);
+  }
+}
+
+// --- Probe ---
+
+static int vblk_init_modern(VirtioBlk *v, uint32_t *features) {
+  VirtioCommonCfg *c = v->common;
+  c->device_feature_select = 0;
+  uint32_t lo = c->device_feature;
+  c->device_feature_select = 1;
+  uint32_t hi = c->device_feature;
+  if (!(hi & VIRTIO_F_VERSION_1_HI))
+    return 0;
+
+  *features = lo & (VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_RING_F_EVENT_IDX);
+  c->driver_feature_select = 0;
+  c->driver_feature = *features;
+  c->driver_feature_select = 1;
+  c->driver_feature = VIRTIO_F_VERSION_1_HI;
+  c->device_status |= VIRTIO_STATUS_FEATURES_OK;
+  if (!(c->device_status & VIRTIO_STATUS_FEATURES_OK))
+    return 0;
+
+  c->queue_select = 0;
+  uint16_t max = c->queue_size;
+  if (max == 0)
+    return 0;
+  v->qsize = max < VBLK_MAX_QUEUE ? max : VBLK_MAX_QUEUE;
+  c->queue_size = v->qsize;
+  return 1;
+}
+
+static int vblk_init_legacy(VirtioBlk *v, uint32_t *features) {
+  uint32_t offered = inl(v->io + VIRTIO_LEG_DEVICE_FEATURES);
+  *features = offered & (VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_RING_F_EVENT_IDX);
+  outl(v->io + VIRTIO_LEG_GUEST_FEATURES, *features);
+
+  // Legacy queue size is fixed by the device
+  outw(v->io + VIRTIO_LEG_QUEUE_SELECT, 0);
+  v->qsize = inw(v->io + VIRTIO_LEG_QUEUE_SIZE);
+  return v->qsize != 0;
+}
+
+static void vblk_probe(PciDevice *pci) {
+  if (pci->vendor != VIRTIO_VENDOR ||
+      (pci->device != VIRTIO_BLK_TRANSITIONAL &&
+       pci->device != VIRTIO_BLK_MODERN))
+    return;
+  if (vdisk_count >= MAX_VIRTIO_BLK)
+    return;
+
+  VirtioBlk *v = &vdisks[vdisk_count];
+  memset(v, 0, sizeof(VirtioBlk));
+  pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+  v->irq = pci_read8(pci->bus, pci->dev, pci->func, PCI_INTERRUPT_LINE);
+
+  // Prefer the modern interface; transitional devices offer both
+  v->modern = vblk_find_caps(v, pci);
+  if (!v->modern) {
+    if (pci->device != VIRTIO_BLK_TRANSITIONAL)
+      return;
+    v->io = pci_bar(pci, 0);
+  }
+
+  vblk_set_status(v, 0); // Reset
+  while (vblk_get_status(v) != 0)
+    ;
+  vblk_set_status(v, VIRTIO_STATUS_ACK);
+  vblk_set_status(v, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+  uint32_t features;
+  int ok = v->modern ? vblk_init_modern(v, &features)
+                     : vblk_init_legacy(v, &features);
+  // The ring index math masks with qsize - 1
+  if (!ok || (v->qsize & (v->qsize - 1)) || !vblk_alloc_ring(v)) {
+    vblk_set_status(v, 0);
+    return;
+  }
+  v->indirect = (features & VIRTIO_RING_F_INDIRECT_DESC) != 0;
+  v->event_idx = (features & VIRTIO_RING_F_EVENT_IDX) != 0;
+
+  uint32_t capacity_lo, capacity_hi;
+  if (v->modern) {
+    VirtioCommonCfg *c = v->common;
+    c->queue_desc_lo = (uint32_t)v->desc;
+    c->queue_desc_hi = 0;
+    c->queue_driver_lo = (uint32_t)v->avail;
+    c->queue_driver_hi = 0;
+    c->queue_device_lo = (uint32_t)v->used;
+    c->queue_device_hi = 0;
+    c->queue_enable = 1;
+    capacity_lo = *(volatile uint32_t *)(v->config + 0);
+    capacity_hi = *(volatile uint32_t *)(v->config + 4);
+  } else {
+    outl(v->io + VIRTIO_LEG_QUEUE_PFN, (uint32_t)v->desc / VIRTQ_ALIGN);
+    capacity_lo = inl(v->io + VIRTIO_LEG_CONFIG);
+    capacity_hi = inl(v->io + VIRTIO_LEG_CONFIG + 4);
+  }
+
+  BlockDevice *b = &v->blk;
+  b->name[0] = 'v';
+  b->name[1] = 'd';
+  b->name[2] = 'a' + vdisk_count;
+  b->name[3] = 0;
+  b->sector_count = capacity_hi ? 0xFFFFFFFF : capacity_lo;
+  b->max_sectors = VBLK_MAX_SECTORS;
+  b->max_segments = VBLK_MAX_SEGMENTS;
+  b->start = vblk_start;
+  b->driver_data = v;
+  vdisk_count++;
+
+  irq_register(v->irq, vblk_irq);
+  vblk_set_status(v, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER |
+                         (v->modern ? VIRTIO_STATUS_FEATURES_OK : 0) |
+                         VIRTIO_STATUS_DRIVER_OK);
+  block_register(b);
+
+  serial_write("[virtio] ");
+  serial_write(b->name);
+  serial_write(": ");
+  serial_write_dec(b->sector_count / 2048);
+  serial_write(" MB, ");
+  serial_write(v->modern ? "modern" : "legacy");
+  serial_write(", queue ");
+  serial_write_dec(v->qsize);
+  serial_write(v->indirect ? ", indirect" : "");
+  serial_write(v->event_idx ? ", event-idx\n" : "\n");
+}
+
+void init_virtio_blk() { pci_for_each(vblk_probe); }
@@ -0,0 +1,12 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include "../kernel/types.h"
+
+// virtio-blk disks (QEMU -drive if=virtio), legacy or modern PCI transport.
+// One split virtqueue per disk with indirect descriptors when offered, many
+// requests in flight, and event-index interrupt/notify suppression. Disks
+// are registered with the block layer as "vda", "vdb", ...
+void init_virtio_blk();
+
+#endif
@@ -0,0 +1,127 @@
+#include "acpi.h"
+
+typedef struct {
+  char signature[8]; // "RSD PTR "
+  uint8_t checksum;
+  char oem[6];
+  uint8_t revision;
+  uint32_t rsdt;
+} __attribute__((packed)) Rsdp;
+
+typedef struct {
+  char signature[4];
+  uint32_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  char oem[6];
+  char oem_table[8];
+  uint32_t oem_revision;
+  uint32_t creator;
+  uint32_t creator_revision;
+} __attribute__((packed)) SdtHeader;
+
+typedef struct {
+  SdtHeader h;
+  uint32_t lapic_addr;
+  uint32_t flags;
+} __attribute__((packed)) MadtHeader;
+
+// MADT entry types
+#define MADT_LAPIC 0
+#define MADT_IOAPIC 1
+#define MADT_ISO 2
+#define MADT_LAPIC_ENABLED 1
+
+static int checksum_ok(const void *p, uint32_t len) {
+  const uint8_t *b = p;
+  uint8_t sum = 0;
+  for (uint32_t i = 0; i < len; i++)
+    sum += b[i];
+  return sum == 0;
+}
+
+static int sig_eq(const char *a, const char *b, int n) {
+  for (int i = 0; i < n; i++)
+    if (a[i] != b[i])
+      return 0;
+  return 1;
+}
+
+static Rsdp *scan_rsdp(uint32_t start, uint32_t len) {
+  for (uint32_t p = start; p < start + len; p += 16) {
+    Rsdp *r = (Rsdp *)p;
+    if (sig_eq(r->signature, "RSD PTR ", 8) && checksum_ok(r, 20))
+      return r;
+  }
+  return 0;
+}
+
+static Rsdp *find_rsdp() {
+  // First KB of the EBDA, then the BIOS ROM area
+  uint32_t ebda = (uint32_t)(*(volatile uint16_t *)0x40E) << 4;
+  Rsdp *r = 0;
+  if (ebda >= 0x80000 && ebda < 0xA0000)
+    r = scan_rsdp(ebda, 1024);
+  if (!r)
+    r = scan_rsdp(0xE0000, 0x20000);
+  return r;
+}
+
+static SdtHeader *find_table(Rsdp *rsdp, const char *sig) {
+  SdtHeader *rsdt = (SdtHeader *)rsdp->rsdt;
+  if (!rsdt || !sig_eq(rsdt->signature, "RSDT", 4) ||
+      !checksum_ok(rsdt, rsdt->length))
+    return 0;
+  uint32_t count = (rsdt->length - sizeof(SdtHeader)) / 4;
+  uint32_t *entries = (uint32_t *)(rsdt + 1);
+  for (uint32_t i = 0; i < count; i++) {
+    SdtHeader *t = (SdtHeader *)entries[i];
+    if (sig_eq(t->signature, sig, 4) && checksum_ok(t, t->length))
+      return t;
+  }
+  return 0;
+}
+
+int acpi_parse_madt(AcpiMadt *madt) {
+  Rsdp *rsdp = find_rsdp();
+  if (!rsdp)
+    return -1;
+  MadtHeader *m = (MadtHeader *)find_table(rsdp, "APIC");
+  if (!m)
+    return -1;
+
+  madt->lapic_addr = m->lapic_addr;
+  madt->cpu_count = 0;
+  madt->ioapic_addr = 0;
+  madt->ioapic_gsi_base = 0;
+  for (int i = 0; i < 16; i++) {
+    madt->irq_gsi[i] = i; // Identity unless overridden
+    madt->irq_flags[i] = 0;
+  }
+
+  uint8_t *p = (uint8_t *)(m + 1);
+  uint8_t *end = (uint8_t *)m + m->h.length;
+  while (p + 2 <= end && p[1] >= 2) {
+    switch (p[0]) {
+    case MADT_LAPIC: // ACPI processor ID, APIC ID, flags
+      if ((*(uint32_t *)(p + 4) & MADT_LAPIC_ENABLED) &&
+          madt->cpu_count < ACPI_MAX_CPUS)
+        madt->apic_ids[madt->cpu_count++] = p[3];
+      break;
+    case MADT_IOAPIC: // ID, reserved, address, GSI base
+      if (!madt->ioapic_addr) { // The first one serves the ISA IRQs
+        madt->ioapic_addr = *(uint32_t *)(p + 4);
+        madt->ioapic_gsi_base = *(uint32_t *)(p + 8);
+      }
+      break;
+    case MADT_ISO: // Bus, source IRQ, GSI, flags
+      if (p[3] < 16) {
+        madt->irq_gsi[p[3]] = *(uint32_t *)(p + 4);
+        madt->irq_flags[p[3]] = *(uint16_t *)(p + 8);
+      }
+      break;
+    }
+    p += p[1];
+  }
+  return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "types.h"
+
+// Just enough ACPI to find the CPUs and interrupt controllers: RSDP in the
+// BIOS areas, RSDT, then the MADT ("APIC" table). Tables are read in place
+// (flat physical addressing); what we need is copied out.
+
+#define ACPI_MAX_CPUS 16
+
+// Interrupt source override flags (MPS INTI), as stored in the MADT
+#define ACPI_POLARITY_MASK 0x3
+#define ACPI_POLARITY_LOW 0x3
+#define ACPI_TRIGGER_MASK 0xC
+#define ACPI_TRIGGER_LEVEL 0xC
+
+typedef struct {
+  uint32_t lapic_addr;
+  int cpu_count; // Enabled processors
+  uint8_t apic_ids[ACPI_MAX_CPUS];
+
+  uint32_t ioapic_addr; // 0 = none
+  uint32_t ioapic_gsi_base;
+
+  // ISA IRQ -> global system interrupt, with polarity/trigger flags
+  uint32_t irq_gsi[16];
+  uint16_t irq_flags[16];
+} AcpiMadt;
+
+// Returns 0 and fills madt when an MADT was found
+int acpi_parse_madt(AcpiMadt *madt);
+
+#endif
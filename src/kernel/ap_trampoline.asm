@@ -0,0 +1,71 @@
+; Application processor startup code. The BSP copies the bytes between
+; ap_trampoline_start and ap_trampoline_end to AP_TRAMPOLINE (a page below
+; 1MB) and sends a STARTUP IPI with vector AP_TRAMPOLINE >> 12. The AP
+; wakes up in real mode at that address, switches to protected mode with
+; a temporary flat GDT, takes its stack from the mailbox at the end and
+; calls ap_entry(arg). smp.c fills the mailbox before each start.
+;
+; Everything here is addressed through AP(x), the address the label will
+; have after the copy, so the code doesn't care where it was linked.
+
+AP_TRAMPOLINE equ 0x8000
+%define AP(x) (AP_TRAMPOLINE + (x) - ap_trampoline_start)
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_mailbox_stack
+global ap_mailbox_entry
+global ap_mailbox_arg
+
+[bits 16]
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [AP(ap_gdt_descriptor)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:AP(ap_protected)
+
+[bits 32]
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, [AP(ap_mailbox_stack)]
+    push dword [AP(ap_mailbox_arg)]
+    call [AP(ap_mailbox_entry)]
+.hang:                  ; ap_entry doesn't return
+    cli
+    hlt
+    jmp .hang
+
+align 8
+ap_gdt:                 ; Same layout as the kernel's: code 0x08, data 0x10
+    dq 0x0
+    dw 0xFFFF
+    dw 0x0
+    db 0x0
+    db 10011010b
+    db 11001111b
+    db 0x0
+    dw 0xFFFF
+    dw 0x0
+    db 0x0
+    db 10010010b
+    db 11001111b
+    db 0x0
+ap_gdt_descriptor:
+    dw ap_gdt_descriptor - ap_gdt - 1
+    dd AP(ap_gdt)
+
+align 4
+ap_mailbox_stack: dd 0
+ap_mailbox_entry: dd 0
+ap_mailbox_arg:   dd 0
+ap_trampoline_end:
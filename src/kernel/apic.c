@@ -0,0 +1,113 @@
+#include "apic.h"
+#include "../drivers/io.h"
+#include "../drivers/serial.h"
+#include "idt.h"
+#include "multiboot.h"
+
+// Local APIC registers (byte offsets)
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ESR 0x280
+#define LAPIC_ICR_LO 0x300
+#define LAPIC_ICR_HI 0x310
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_ICR_PENDING 0x1000
+
+// IOAPIC: index register, then data window
+#define IOAPIC_DATA 0x10
+#define IOAPIC_REDIR(n) (0x10 + 2 * (n))
+
+#define REDIR_POLARITY_LOW 0x2000
+#define REDIR_TRIGGER_LEVEL 0x8000
+#define REDIR_MASKED 0x10000
+
+static AcpiMadt madt;
+static volatile uint32_t *lapic;
+static volatile uint32_t *ioapic;
+static uint8_t bsp_apic_id;
+static int active = 0;
+
+static inline uint32_t lapic_read(uint32_t reg) { return lapic[reg / 4]; }
+
+static inline void lapic_write(uint32_t reg, uint32_t v) {
+  lapic[reg / 4] = v;
+}
+
+static void ioapic_write(uint32_t reg, uint32_t v) {
+  ioapic[0] = reg;
+  ioapic[IOAPIC_DATA / 4] = v;
+}
+
+int apic_active() { return active; }
+const AcpiMadt *apic_madt() { return &madt; }
+
+void lapic_enable() {
+  lapic_write(LAPIC_TPR, 0); // Accept every priority
+  lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+void lapic_eoi() { lapic_write(LAPIC_EOI, 0); }
+
+uint8_t lapic_id() { return lapic_read(LAPIC_ID) >> 24; }
+
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr) {
+  lapic_write(LAPIC_ESR, 0);
+  lapic_write(LAPIC_ICR_HI, (uint32_t)apic_id << 24);
+  lapic_write(LAPIC_ICR_LO, icr); // This write sends it
+  while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING)
+    asm volatile("pause");
+}
+
+void ioapic_route(int irq, int masked) {
+  if (!ioapic || irq < 0 || irq >= 16)
+    return;
+  uint32_t pin = madt.irq_gsi[irq] - madt.ioapic_gsi_base;
+  uint16_t flags = madt.irq_flags[irq];
+
+  // ISA defaults are edge/active high; overrides may say otherwise
+  uint32_t lo = 32 + irq;
+  if ((flags & ACPI_POLARITY_MASK) == ACPI_POLARITY_LOW)
+    lo |= REDIR_POLARITY_LOW;
+  if ((flags & ACPI_TRIGGER_MASK) == ACPI_TRIGGER_LEVEL)
+    lo |= REDIR_TRIGGER_LEVEL;
+  if (masked)
+    lo |= REDIR_MASKED;
+
+  ioapic_write(IOAPIC_REDIR(pin) + 1, (uint32_t)bsp_apic_id << 24);
+  ioapic_write(IOAPIC_REDIR(pin), lo);
+}
+
+int init_apic() {
+  if (boot_has_option("noapic") || acpi_parse_madt(&madt) != 0 ||
+      !madt.ioapic_addr) {
+    serial_write("[apic] not used, staying on the 8259 PIC\n");
+    return 0;
+  }
+
+  lapic = (volatile uint32_t *)madt.lapic_addr;
+  ioapic = (volatile uint32_t *)madt.ioapic_addr;
+  lapic_enable();
+  bsp_apic_id = lapic_id();
+
+  set_idt_gate(APIC_SPURIOUS_VECTOR, (uint32_t)apic_spurious);
+  set_idt_gate(APIC_WAKEUP_VECTOR, (uint32_t)ipi_wakeup);
+
+  // idt.c knows which lines drivers have unmasked so far. Nothing is in
+  // service on the PIC here, so no EOI can go to the wrong controller.
+  uint32_t flags = irq_save();
+  active = 1;
+  irq_switch_to_apic();
+  irq_restore(flags);
+
+  serial_write("[apic] LAPIC ");
+  serial_write_hex(madt.lapic_addr);
+  serial_write(", IOAPIC ");
+  serial_write_hex(madt.ioapic_addr);
+  serial_write(", ");
+  serial_write_dec(madt.cpu_count);
+  serial_write(" CPUs in the MADT\n");
+  return 1;
+}
@@ -0,0 +1,36 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "acpi.h"
+#include "types.h"
+
+// Local APIC and IOAPIC. When the MADT describes them, init_apic masks the
+// 8259s and routes the ISA IRQs through the IOAPIC to the same vectors
+// (32 + IRQ) on the boot CPU, so drivers and irq_register don't change.
+// Without an MADT, or with the "noapic" boot option, the PIC stays in
+// charge.
+
+#define APIC_SPURIOUS_VECTOR 0xFF
+#define APIC_WAKEUP_VECTOR 0xF0 // smp_call_others
+
+// ICR delivery modes
+#define APIC_ICR_INIT 0x00000500
+#define APIC_ICR_STARTUP 0x00000600
+#define APIC_ICR_LEVEL_ASSERT 0x00004000
+#define APIC_ICR_ALL_BUT_SELF 0x000C0000
+
+// Returns 1 if the APICs took over from the PIC
+int init_apic();
+int apic_active();
+const AcpiMadt *apic_madt(); // Valid once init_apic succeeded
+
+// Local APIC of the calling CPU
+void lapic_enable();
+void lapic_eoi();
+uint8_t lapic_id();
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr);
+
+// Route ISA IRQ irq to vector 32 + irq on the boot CPU
+void ioapic_route(int irq, int masked);
+
+#endif
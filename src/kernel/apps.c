@@ -1,139 +1,319 @@
 #include "apps.h"
 #include "../drivers/video.h"
+#include "bcache.h"
+#include "fat32.h"
+#include "gar.h"
+#include "gemlang.h"
+#include "memory.h"
+#include "timer.h"
 #include "window.h"
 
 // --- SNAKE GAME ---
+// Steps on the window's thread at a fixed rate, whatever the frame rate. The
+// body is a ring of cell indices (capacity = board size, so it can never
+// overflow) plus an occupancy grid for O(1) self collision. The board is a
+// 32bpp surface where each step repaints only the cells that changed: the
+// new head, the old head, the vacated tail cell and the apple.
+
+#define SNAKE_CELL 10
+#define SNAKE_STEP_MS 90
+#define SNAKE_MAX_CATCHUP 4 // Steps per tick after a long stall
+#define SNAKE_BOARD_Y 24
+#define SNAKE_STATUS_H 16
+
+#define SNAKE_BG 0x000000
+#define SNAKE_BODY 0x008000
+#define SNAKE_HEAD 0x00FF00
+#define SNAKE_APPLE 0xFF0000
 
 typedef struct {
-  int head_x, head_y;
+  int cols, rows;
+  int *body; // Ring of cell indices, body[head] is the head
+  int head, length;
+  uint8_t *occupied;
+  uint32_t *surface;
+
   int dir_x, dir_y;
-  int length;
-  int body_x[100];
-  int body_y[100];
-  int apple_x, apple_y;
+  int next_dir_x, next_dir_y; // Applied on the next step
+  int apple;
+  int score;
   int game_over;
+  uint32_t last_step; // timer_ms
+  uint32_t seed;
 } SnakeState;
 
-static SnakeState snake_state;
-
-void snake_reset() {
-  snake_state.head_x = 10;
-  snake_state.head_y = 10;
-  snake_state.dir_x = 1;
-  snake_state.dir_y = 0;
-  snake_state.length = 3;
-  snake_state.apple_x = 15;
-  snake_state.apple_y = 10;
-  snake_state.game_over = 0;
+static int snake_rand(SnakeState *s) {
+  s->seed = s->seed * 1103515245 + 12345;
+  return (s->seed >> 16) & 0x7FFF;
 }
 
-// --- SNAKE GAME ---
-// Speed increase: frame % 3 instead of 5
-// Wall collision: Explicitly set game_over
-
-void snake_paint(Window *win) {
-  draw_rect(win->x, win->y + 20, win->width, win->height - 20, 0x000000);
+static void snake_cell(SnakeState *s, int cell, uint32_t color) {
+  int w = s->cols * SNAKE_CELL;
+  uint32_t *p = s->surface + (cell / s->cols) * SNAKE_CELL * w +
+                (cell % s->cols) * SNAKE_CELL;
+  for (int y = 0; y < SNAKE_CELL; y++, p += w)
+    for (int x = 0; x < SNAKE_CELL; x++)
+      p[x] = color;
+}
 
-  if (snake_state.game_over) {
-    draw_string(win->x + 80, win->y + 100, "GAME OVER", 0xFF0000);
-    draw_string(win->x + 60, win->y + 120, "Press 'R' to Restart", 0xFFFFFF);
-    return;
+// Returns 0 if the board is full
+static int snake_place_apple(SnakeState *s) {
+  int cells = s->cols * s->rows;
+  int c = snake_rand(s) % cells;
+  for (int i = 0; i < cells; i++, c = (c + 1) % cells) {
+    if (!s->occupied[c]) {
+      s->apple = c;
+      snake_cell(s, c, SNAKE_APPLE);
+      return 1;
+    }
   }
+  return 0;
+}
 
-  int cell = 10;
-  // Apple
-  draw_rect(win->x + snake_state.apple_x * cell,
-            win->y + 25 + snake_state.apple_y * cell, cell, cell, 0xFF0000);
-
-  // Snake
-  for (int i = 0; i < snake_state.length; i++) {
-    uint32_t col = (i == 0) ? 0x00FF00 : 0x008000;
-    draw_rect(win->x + snake_state.body_x[i] * cell,
-              win->y + 25 + snake_state.body_y[i] * cell, cell, cell, col);
+static void snake_reset(SnakeState *s) {
+  int cells = s->cols * s->rows;
+  memset(s->occupied, 0, cells);
+  for (int i = 0; i < cells * SNAKE_CELL * SNAKE_CELL; i++)
+    s->surface[i] = SNAKE_BG;
+
+  // Three cells heading right from the middle of the left half
+  int y = s->rows / 2, x = s->cols / 4;
+  s->length = 0;
+  s->head = -1;
+  for (int i = 0; i < 3; i++) {
+    int c = y * s->cols + x + i;
+    s->head++;
+    s->body[s->head] = c;
+    s->occupied[c] = 1;
+    s->length++;
+    snake_cell(s, c, i == 2 ? SNAKE_HEAD : SNAKE_BODY);
   }
+  s->dir_x = s->next_dir_x = 1;
+  s->dir_y = s->next_dir_y = 0;
+  s->score = 0;
+  s->game_over = 0;
+  s->last_step = timer_ms();
+  snake_place_apple(s);
+}
 
-  static int frame = 0;
-  frame++;
-  // Speed: Every 3rd frame (Faster)
-  if (frame % 3 == 0 && !snake_state.game_over) {
-    for (int i = snake_state.length; i > 0; i--) {
-      snake_state.body_x[i] = snake_state.body_x[i - 1];
-      snake_state.body_y[i] = snake_state.body_y[i - 1];
-    }
-    snake_state.body_x[0] = snake_state.head_x;
-    snake_state.body_y[0] = snake_state.head_y;
+static void snake_step(SnakeState *s) {
+  int cells = s->cols * s->rows;
+  s->dir_x = s->next_dir_x;
+  s->dir_y = s->next_dir_y;
 
-    snake_state.head_x += snake_state.dir_x;
-    snake_state.head_y += snake_state.dir_y;
+  int head = s->body[s->head];
+  int x = head % s->cols + s->dir_x;
+  int y = head / s->cols + s->dir_y;
+  if (x < 0 || x >= s->cols || y < 0 || y >= s->rows) {
+    s->game_over = 1;
+    return;
+  }
+  int next = y * s->cols + x;
+  int grow = next == s->apple;
+
+  // The tail moves away first, so following it closely is allowed
+  if (!grow) {
+    int tail = (s->head - s->length + 1 + cells) % cells;
+    s->occupied[s->body[tail]] = 0;
+    snake_cell(s, s->body[tail], SNAKE_BG);
+    s->length--;
+  }
+  if (s->occupied[next]) {
+    s->game_over = 1;
+    return;
+  }
 
-    // Wall Collision = Death
-    if (snake_state.head_x < 0 || snake_state.head_x > 29 ||
-        snake_state.head_y < 0 || snake_state.head_y > 19) {
-      snake_state.game_over = 1;
-    }
+  snake_cell(s, head, SNAKE_BODY);
+  s->head = (s->head + 1) % cells;
+  s->body[s->head] = next;
+  s->occupied[next] = 1;
+  s->length++;
+  snake_cell(s, next, SNAKE_HEAD);
+
+  if (grow) {
+    s->score++;
+    if (!snake_place_apple(s))
+      s->game_over = 1; // Board full
+  }
+}
 
-    // Self Collision
-    for (int i = 1; i < snake_state.length; i++) {
-      if (snake_state.head_x == snake_state.body_x[i] &&
-          snake_state.head_y == snake_state.body_y[i]) {
-        snake_state.game_over = 1;
-      }
+void snake_tick(Window *win) {
+  SnakeState *s = (SnakeState *)win->app_data;
+
+  // Fixed timestep: catch up on the steps that are due, but give up on a
+  // long stall instead of fast-forwarding through it
+  uint32_t now = timer_ms();
+  int steps = 0;
+  while (!s->game_over && now - s->last_step >= SNAKE_STEP_MS) {
+    if (++steps > SNAKE_MAX_CATCHUP) {
+      s->last_step = now;
+      break;
     }
+    snake_step(s);
+    s->last_step += SNAKE_STEP_MS;
+  }
+}
 
-    if (!snake_state.game_over) {
-      if (snake_state.head_x == snake_state.apple_x &&
-          snake_state.head_y == snake_state.apple_y) {
-        snake_state.length++;
-        snake_state.apple_x = (snake_state.apple_x + 7) % 30;
-        snake_state.apple_y = (snake_state.apple_y + 3) % 20;
-      }
-    }
+void snake_paint(Window *win) {
+  SnakeState *s = (SnakeState *)win->app_data;
+  int bx = win->x, by = win->y + SNAKE_BOARD_Y;
+  int bw = s->cols * SNAKE_CELL, bh = s->rows * SNAKE_CELL;
+  video_blit(bx, by, bw, bh, s->surface, bw);
+
+  char num[12];
+  int_to_str(s->score, num);
+  draw_string(bx + 6, by + bh + 4, "Score:", 0x000000);
+  draw_string(bx + 62, by + bh + 4, num, 0x000000);
+
+  if (s->game_over) {
+    draw_string(bx + bw / 2 - 36, by + bh / 2 - 16, "GAME OVER", 0xFF0000);
+    draw_string(bx + bw / 2 - 80, by + bh / 2, "R: Restart 1-3: Size",
+                0xFFFFFF);
   }
 }
 
-// Input handled by snake_key below
+// Allocates the board; keeps the old one if that fails
+static int snake_resize(SnakeState *s, int cols, int rows) {
+  int cells = cols * rows;
+  int *body = kmalloc(cells * sizeof(int));
+  uint8_t *occupied = kmalloc(cells);
+  uint32_t *surface = kmalloc(cells * SNAKE_CELL * SNAKE_CELL * 4);
+  if (!body || !occupied || !surface) {
+    kfree(body);
+    kfree(occupied);
+    kfree(surface);
+    return -1;
+  }
+  kfree(s->body);
+  kfree(s->occupied);
+  kfree(s->surface);
+  s->body = body;
+  s->occupied = occupied;
+  s->surface = surface;
+  s->cols = cols;
+  s->rows = rows;
+  return 0;
+}
 
 void snake_key(Window *win, char c) {
-  if (snake_state.game_over) {
-    if (c == 'r' || c == 'R')
-      snake_reset();
+  SnakeState *s = (SnakeState *)win->app_data;
+  if (s->game_over) {
+    static const int sizes[3][2] = {{20, 15}, {30, 20}, {45, 30}};
+    if (c >= '1' && c <= '3' &&
+        snake_resize(s, sizes[c - '1'][0], sizes[c - '1'][1]) == 0) {
+      wm_resize(win, s->cols * SNAKE_CELL,
+                SNAKE_BOARD_Y + s->rows * SNAKE_CELL + SNAKE_STATUS_H);
+      snake_reset(s);
+    } else if (c == 'r' || c == 'R') {
+      snake_reset(s);
+    }
     return;
   }
 
-  if (c == 'w' && snake_state.dir_y == 0) {
-    snake_state.dir_x = 0;
-    snake_state.dir_y = -1;
-  }
-  if (c == 's' && snake_state.dir_y == 0) {
-    snake_state.dir_x = 0;
-    snake_state.dir_y = 1;
+  // Turns are checked against the direction actually moved last, so two
+  // quick presses within one step cannot reverse into the body
+  if ((c == 'w' || c == KEY_UP) && s->dir_y == 0) {
+    s->next_dir_x = 0;
+    s->next_dir_y = -1;
+  } else if ((c == 's' || c == KEY_DOWN) && s->dir_y == 0) {
+    s->next_dir_x = 0;
+    s->next_dir_y = 1;
+  } else if ((c == 'a' || c == KEY_LEFT) && s->dir_x == 0) {
+    s->next_dir_x = -1;
+    s->next_dir_y = 0;
+  } else if ((c == 'd' || c == KEY_RIGHT) && s->dir_x == 0) {
+    s->next_dir_x = 1;
+    s->next_dir_y = 0;
   }
-  if (c == 'a' && snake_state.dir_x == 0) {
-    snake_state.dir_x = -1;
-    snake_state.dir_y = 0;
+}
+
+static void snake_free(SnakeState *s) {
+  kfree(s->body);
+  kfree(s->occupied);
+  kfree(s->surface);
+  kfree(s);
+}
+
+static void snake_close(Window *win) { snake_free(win->app_data); }
+
+void start_snake_board(int cols, int rows) {
+  SnakeState *s = kzalloc(sizeof(SnakeState));
+  if (!s)
+    return;
+  s->seed = timer_ticks();
+  if (snake_resize(s, cols, rows)) {
+    kfree(s);
+    return;
   }
-  if (c == 'd' && snake_state.dir_x == 0) {
-    snake_state.dir_x = 1;
-    snake_state.dir_y = 0;
+  int height = SNAKE_BOARD_Y + rows * SNAKE_CELL + SNAKE_STATUS_H;
+  Window *w = create_window(200, 150, cols * SNAKE_CELL, height, "Snake");
+  if (!w) {
+    snake_free(s);
+    return;
   }
+  snake_reset(s);
+  w->app_data = s;
+  w->on_close = snake_close;
+  w->on_paint = snake_paint;
+  w->on_key = snake_key;
+  w->tile_safe = 1;
+  wm_set_tick(w, snake_tick, SNAKE_STEP_MS);
+  wm_open(w);
 }
 
+void start_snake() { start_snake_board(SNAKE_COLS, SNAKE_ROWS); }
+
 // --- NOTEPAD APP ---
 
 // Old Code Removed. See bottom of file for new implementations.
 
 // --- MINESWEEPER ---
-#define MS_GRID_W 10
-#define MS_GRID_H 10
-#define MS_CELL_SIZE 20
+// One byte per cell: neighbour count (computed once, when the mines are
+// laid on the first reveal) plus mine/open/flag bits. Reveals flood with a
+// queue, never recursion. Cells that change are queued for repaint and
+// drawn into a viewport surface, so a frame costs one blit however big the
+// board is. Arrow keys scroll boards larger than the window, +/- zoom.
+
+#define MS_COUNT_MASK 0x0F
+#define MS_MINE 0x10
+#define MS_OPEN 0x20
+#define MS_FLAG 0x40
+#define MS_DIRTY 0x80 // Queued for repaint
+
+#define MS_MARGIN 10
+#define MS_BOARD_Y 50 // Board position inside the window
+#define MS_VIEW_MAX_W 600
+#define MS_VIEW_MAX_H 420
+#define MS_SCROLL 4 // Cells per arrow key
+
+static const int ms_zoom_px[] = {10, 14, 20};
+#define MS_ZOOMS 3
 
 typedef struct {
-  int grid[MS_GRID_W][MS_GRID_H];    // 0-8: neighbors, 9: mine
-  int visible[MS_GRID_W][MS_GRID_H]; // 0: hidden, 1: revealed, 2: flag
-  int game_over;
-} MineState;
+  int w, h, mines, zoom;
+} MineLevel;
 
-static MineState ms_state;
+static const MineLevel ms_levels[] = {
+    {10, 10, 10, 2}, {30, 16, 99, 2}, {200, 200, 6000, 0}};
+
+typedef struct {
+  int w, h, mines;
+  uint8_t *cells;
+  int *queue; // Reveal flood
+  int *dirty; // Cells to repaint
+  int dirty_count;
+  int full_redraw;
+
+  int placed; // Mines are laid on the first reveal
+  int opened, flags;
+  int game_over; // 1 = lost, 2 = won
+
+  int zoom;
+  int view_x, view_y; // First visible cell
+  uint32_t *surface;  // Viewport pixels
+  int sw, sh;
+  int prev_buttons;
+} MineState;
 
 static unsigned int ms_seed = 123;
 int ms_rand() {
@@ -141,342 +321,667 @@ int ms_rand() {
   return (unsigned int)(ms_seed / 65536) % 32768;
 }
 
-void mine_reset() {
-  // Clear
-  for (int x = 0; x < MS_GRID_W; x++)
-    for (int y = 0; y < MS_GRID_H; y++) {
-      ms_state.grid[x][y] = 0;
-      ms_state.visible[x][y] = 0;
+static void mine_touch(MineState *m, int c) {
+  if (!(m->cells[c] & MS_DIRTY)) {
+    m->cells[c] |= MS_DIRTY;
+    m->dirty[m->dirty_count++] = c;
+  }
+}
+
+// Lay mines anywhere but around the first click, then count neighbours
+static void mine_place(MineState *m, int safe) {
+  int sx = safe % m->w, sy = safe / m->w;
+  int cells = m->w * m->h;
+  int left = m->mines;
+  while (left > 0) {
+    int c = ((ms_rand() << 15) | ms_rand()) % cells;
+    int x = c % m->w, y = c / m->w;
+    int near = x >= sx - 1 && x <= sx + 1 && y >= sy - 1 && y <= sy + 1;
+    if (near || (m->cells[c] & MS_MINE))
+      continue;
+    m->cells[c] |= MS_MINE;
+    left--;
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dx = -1; dx <= 1; dx++) {
+        int nx = x + dx, ny = y + dy;
+        if ((dx || dy) && nx >= 0 && nx < m->w && ny >= 0 && ny < m->h)
+          m->cells[ny * m->w + nx]++;
+      }
     }
-  ms_state.game_over = 0;
+  }
+  m->placed = 1;
+}
 
-  // Place Mines (10 mines)
-  int mines = 10;
-  while (mines > 0) {
-    int rx = ms_rand() % MS_GRID_W;
-    int ry = ms_rand() % MS_GRID_H;
-    if (ms_state.grid[rx][ry] != 9) {
-      ms_state.grid[rx][ry] = 9;
-      mines--;
+static void mine_reveal(MineState *m, int start) {
+  if (m->cells[start] & (MS_OPEN | MS_FLAG))
+    return;
+  if (!m->placed)
+    mine_place(m, start);
+
+  if (m->cells[start] & MS_MINE) {
+    // Lost: show every mine
+    m->game_over = 1;
+    for (int c = 0; c < m->w * m->h; c++) {
+      if (m->cells[c] & MS_MINE) {
+        m->cells[c] |= MS_OPEN;
+        mine_touch(m, c);
+      }
     }
+    return;
   }
 
-  // Calculate Numbers
-  for (int x = 0; x < MS_GRID_W; x++) {
-    for (int y = 0; y < MS_GRID_H; y++) {
-      if (ms_state.grid[x][y] == 9)
-        continue;
-      int count = 0;
+  int head = 0, tail = 0;
+  m->cells[start] |= MS_OPEN;
+  m->queue[tail++] = start;
+  while (head < tail) {
+    int c = m->queue[head++];
+    m->opened++;
+    mine_touch(m, c);
+    if (m->cells[c] & MS_COUNT_MASK)
+      continue;
+    int x = c % m->w, y = c / m->w;
+    for (int dy = -1; dy <= 1; dy++) {
       for (int dx = -1; dx <= 1; dx++) {
-        for (int dy = -1; dy <= 1; dy++) {
-          int nx = x + dx;
-          int ny = y + dy;
-          if (nx >= 0 && nx < MS_GRID_W && ny >= 0 && ny < MS_GRID_H) {
-            if (ms_state.grid[nx][ny] == 9)
-              count++;
-          }
+        int nx = x + dx, ny = y + dy;
+        if (nx < 0 || nx >= m->w || ny < 0 || ny >= m->h)
+          continue;
+        int n = ny * m->w + nx;
+        if (!(m->cells[n] & (MS_OPEN | MS_FLAG | MS_MINE))) {
+          m->cells[n] |= MS_OPEN; // Marked when queued, so queued once
+          m->queue[tail++] = n;
         }
       }
-      ms_state.grid[x][y] = count;
     }
   }
+
+  if (m->opened == m->w * m->h - m->mines)
+    m->game_over = 2;
 }
 
-void mine_reveal(int x, int y) {
-  if (x < 0 || x >= MS_GRID_W || y < 0 || y >= MS_GRID_H)
-    return;
-  if (ms_state.visible[x][y])
+static void mine_flag(MineState *m, int c) {
+  if (m->cells[c] & MS_OPEN)
     return;
+  m->cells[c] ^= MS_FLAG;
+  m->flags += (m->cells[c] & MS_FLAG) ? 1 : -1;
+  mine_touch(m, c);
+}
+
+static void mine_draw_cell(MineState *m, int c) {
+  static const uint32_t digit_colors[9] = {0,        0x0000FF, 0x008000,
+                                           0xFF0000, 0x000080, 0x800000,
+                                           0x008080, 0x000000, 0x808080};
+  int px = ms_zoom_px[m->zoom];
+  int x = (c % m->w - m->view_x) * px, y = (c / m->w - m->view_y) * px;
+  uint8_t v = m->cells[c];
+  uint32_t *p = m->surface + y * m->sw + x;
+
+  for (int r = 0; r < px; r++) {
+    uint32_t *row = p + r * m->sw;
+    for (int i = 0; i < px; i++) {
+      uint32_t col;
+      if (v & MS_OPEN)
+        col = (r == px - 1 || i == px - 1) ? 0xC0C0C0 : 0xFFFFFF;
+      else
+        col = (r == 0 || i == 0) ? 0xFFFFFF : 0x888888;
+      if (r >= px / 4 && r < px - px / 4 && i >= px / 4 && i < px - px / 4) {
+        if ((v & MS_OPEN) && (v & MS_MINE))
+          col = 0x000000;
+        else if (!(v & MS_OPEN) && (v & MS_FLAG))
+          col = 0xFF0000;
+      }
+      row[i] = col;
+    }
+  }
+  int count = v & MS_COUNT_MASK;
+  if ((v & MS_OPEN) && !(v & MS_MINE) && count)
+    draw_char_to(m->surface, m->sw, x + (px - 8) / 2, y + (px - 8) / 2,
+                 '0' + count, digit_colors[count]);
+}
+
+static int mine_view_w(MineState *m) {
+  int n = m->sw / ms_zoom_px[m->zoom];
+  return n < m->w ? n : m->w;
+}
 
-  ms_state.visible[x][y] = 1;
-  if (ms_state.grid[x][y] == 0) {
-    // Flood fill
-    for (int dx = -1; dx <= 1; dx++)
-      for (int dy = -1; dy <= 1; dy++)
-        mine_reveal(x + dx, y + dy);
+static int mine_view_h(MineState *m) {
+  int n = m->sh / ms_zoom_px[m->zoom];
+  return n < m->h ? n : m->h;
+}
+
+static void mine_scroll(MineState *m, int dx, int dy) {
+  int x = m->view_x + dx, y = m->view_y + dy;
+  int max_x = m->w - mine_view_w(m), max_y = m->h - mine_view_h(m);
+  x = x < 0 ? 0 : (x > max_x ? max_x : x);
+  y = y < 0 ? 0 : (y > max_y ? max_y : y);
+  if (x != m->view_x || y != m->view_y) {
+    m->view_x = x;
+    m->view_y = y;
+    m->full_redraw = 1;
   }
 }
 
-// Reset Button Logic
-#define MS_RESET_X(w) (w->x + (w->width / 2) - 10)
-#define MS_RESET_Y(w) (w->y + 24)
+// Fit the viewport surface (and the window, if given) to the board at the
+// current zoom
+static int mine_layout(MineState *m, Window *win) {
+  int px = ms_zoom_px[m->zoom];
+  int sw = m->w * px < MS_VIEW_MAX_W ? m->w * px : MS_VIEW_MAX_W;
+  int sh = m->h * px < MS_VIEW_MAX_H ? m->h * px : MS_VIEW_MAX_H;
+  if (!m->surface || sw != m->sw || sh != m->sh) {
+    uint32_t *surface = kmalloc(sw * sh * 4);
+    if (!surface)
+      return -1;
+    kfree(m->surface);
+    m->surface = surface;
+    m->sw = sw;
+    m->sh = sh;
+  }
+  // Anything not covered by whole cells stays background
+  for (int i = 0; i < sw * sh; i++)
+    m->surface[i] = 0xC0C0C0;
+  if (win)
+    wm_resize(win, sw + 2 * MS_MARGIN, MS_BOARD_Y + sh + MS_MARGIN);
+  m->full_redraw = 1;
+  mine_scroll(m, 0, 0);
+  return 0;
+}
+
+static int mine_new_game(MineState *m, const MineLevel *l) {
+  int cells = l->w * l->h;
+  if (cells != m->w * m->h) {
+    uint8_t *c = kmalloc(cells);
+    int *q = kmalloc(cells * sizeof(int));
+    int *d = kmalloc(cells * sizeof(int));
+    if (!c || !q || !d) {
+      kfree(c);
+      kfree(q);
+      kfree(d);
+      return -1;
+    }
+    kfree(m->cells);
+    kfree(m->queue);
+    kfree(m->dirty);
+    m->cells = c;
+    m->queue = q;
+    m->dirty = d;
+  }
+  memset(m->cells, 0, cells);
+  m->w = l->w;
+  m->h = l->h;
+  m->mines = l->mines;
+  m->dirty_count = 0;
+  m->placed = m->opened = m->flags = m->game_over = 0;
+  m->view_x = m->view_y = 0;
+  m->full_redraw = 1;
+  return 0;
+}
 
 void mine_paint(Window *win) {
-  // Background
-  draw_rect(win->x, win->y + 20, win->width, win->height - 20, 0xC0C0C0);
+  MineState *m = (MineState *)win->app_data;
+  int vw = mine_view_w(m), vh = mine_view_h(m);
+
+  if (m->full_redraw) {
+    for (int i = 0; i < m->dirty_count; i++)
+      m->cells[m->dirty[i]] &= ~MS_DIRTY;
+    m->dirty_count = 0;
+    for (int y = m->view_y; y < m->view_y + vh; y++)
+      for (int x = m->view_x; x < m->view_x + vw; x++)
+        mine_draw_cell(m, y * m->w + x);
+    m->full_redraw = 0;
+  } else {
+    for (int i = 0; i < m->dirty_count; i++) {
+      int c = m->dirty[i];
+      int x = c % m->w, y = c / m->w;
+      m->cells[c] &= ~MS_DIRTY;
+      if (x >= m->view_x && x < m->view_x + vw && y >= m->view_y &&
+          y < m->view_y + vh)
+        mine_draw_cell(m, c);
+    }
+    m->dirty_count = 0;
+  }
+  video_blit(win->x + MS_MARGIN, win->y + MS_BOARD_Y, m->sw, m->sh,
+             m->surface, m->sw);
 
-  // Reset Button (Smiley or 'R')
-  int rx = MS_RESET_X(win);
-  int ry = MS_RESET_Y(win);
+  // Header: mines left, reset button, scroll position
+  draw_rect(win->x, win->y + 24, win->width, MS_BOARD_Y - 26, 0xC0C0C0);
+  char num[12];
+  int_to_str(m->mines - m->flags, num);
+  draw_string(win->x + MS_MARGIN, win->y + 32, num, 0xFF0000);
+
+  int rx = win->x + win->width / 2 - 10, ry = win->y + 26;
   draw_rect(rx, ry, 20, 20, 0xE0E0E0);
   draw_rect(rx, ry, 20, 1, 0xFFFFFF);
-  draw_string(rx + 6, ry + 6, ms_state.game_over ? "X" : ":)", 0x000000);
-
-  for (int x = 0; x < MS_GRID_W; x++) {
-    for (int y = 0; y < MS_GRID_H; y++) {
-      int px = win->x + 10 + x * MS_CELL_SIZE;
-      int py = win->y + 50 + y * MS_CELL_SIZE;
-
-      // Draw Cell
-      if (ms_state.visible[x][y] == 1) {
-        draw_rect(px, py, MS_CELL_SIZE - 1, MS_CELL_SIZE - 1,
-                  0xFFFFFF); // Revealed
-        if (ms_state.grid[x][y] == 9) {
-          draw_rect(px + 4, py + 4, 12, 12, 0x000000); // Mine
-        } else if (ms_state.grid[x][y] > 0) {
-          char buf[2] = {'0' + ms_state.grid[x][y], 0};
-          draw_string(px + 6, py + 6, buf, 0x000000);
-        }
-      } else {
-        // Hidden (Button style)
-        draw_rect(px, py, MS_CELL_SIZE - 1, MS_CELL_SIZE - 1, 0x888888);
-        draw_rect(px, py, MS_CELL_SIZE - 1, 1, 0xFFFFFF); // Light Top
-        draw_rect(px, py, 1, MS_CELL_SIZE - 1, 0xFFFFFF); // Light Left
-
-        if (ms_state.visible[x][y] == 2) {
-          // Flag
-          draw_rect(px + 5, py + 5, 10, 10, 0xFF0000);
-        }
-      }
-    }
+  draw_string(rx + 2, ry + 6,
+              m->game_over == 1 ? " X" : (m->game_over == 2 ? "B)" : ":)"),
+              0x000000);
+
+  if (vw < m->w || vh < m->h) {
+    char pos[24];
+    int k = 0;
+    int_to_str(m->view_x, num);
+    for (char *p = num; *p;)
+      pos[k++] = *p++;
+    pos[k++] = ',';
+    int_to_str(m->view_y, num);
+    for (char *p = num; *p;)
+      pos[k++] = *p++;
+    pos[k] = 0;
+    draw_string(win->x + win->width - MS_MARGIN - k * 8, win->y + 32, pos,
+                0x404040);
   }
+}
 
-  if (ms_state.game_over) {
-    draw_string(win->x + 10, win->y + 260, "GAME OVER!", 0xFF0000);
-  }
+// Board cell under a window-relative point, -1 if none
+static int mine_hit(MineState *m, int x, int y) {
+  int px = ms_zoom_px[m->zoom];
+  x -= MS_MARGIN;
+  y -= MS_BOARD_Y;
+  if (x < 0 || y < 0 || x >= mine_view_w(m) * px || y >= mine_view_h(m) * px)
+    return -1;
+  return (m->view_y + y / px) * m->w + m->view_x + x / px;
 }
 
 void mine_click(Window *win, int x, int y) {
-  // Reset Button Click
-  int rx = (win->width / 2) - 10;
-  int ry = 24; // Relative to window content start of 0,0 but click event is 0,0
-               // relative
-  // Wait, on_click is relative X, Y.
-  // Correct logic:
-  if (x >= rx && x <= rx + 20 && y >= 24 && y <= 44) {
-    mine_reset();
+  MineState *m = (MineState *)win->app_data;
+  int rx = win->width / 2 - 10;
+  if (x >= rx && x <= rx + 20 && y >= 26 && y <= 46) {
+    MineLevel l = {m->w, m->h, m->mines, m->zoom};
+    mine_new_game(m, &l);
     return;
   }
+  int c = mine_hit(m, x, y);
+  if (c >= 0 && !m->game_over)
+    mine_reveal(m, c);
+}
 
-  if (ms_state.game_over)
-    return;
-
-  // Correct offset
-  int gx = (x - 10) / MS_CELL_SIZE;
-  int gy = (y - 50) / MS_CELL_SIZE; // moved down for Reset btn
+// Right button flags (on_click only reports the left one)
+void mine_mouse_move(Window *win, int x, int y, int b) {
+  MineState *m = (MineState *)win->app_data;
+  int pressed = (b & 2) && !(m->prev_buttons & 2);
+  m->prev_buttons = b;
+  int c = mine_hit(m, x, y);
+  if (pressed && c >= 0 && !m->game_over)
+    mine_flag(m, c);
+}
 
-  if (gx >= 0 && gx < MS_GRID_W && gy >= 0 && gy < MS_GRID_H) {
-    // Left click reveal
-    if (ms_state.grid[gx][gy] == 9) {
-      ms_state.game_over = 1;
-      // Reveal All
-      for (int i = 0; i < MS_GRID_W; i++)
-        for (int j = 0; j < MS_GRID_H; j++)
-          ms_state.visible[i][j] = 1;
-    } else {
-      mine_reveal(gx, gy);
+void mine_key(Window *win, char c) {
+  MineState *m = (MineState *)win->app_data;
+  int page = mine_view_h(m) - 1;
+  if (c == 'r' || c == 'R') {
+    MineLevel l = {m->w, m->h, m->mines, m->zoom};
+    mine_new_game(m, &l);
+  } else if (c >= '1' && c <= '3') {
+    const MineLevel *l = &ms_levels[c - '1'];
+    if (mine_new_game(m, l) == 0) {
+      m->zoom = l->zoom;
+      mine_layout(m, win);
     }
+  } else if ((c == '+' || c == '=') && m->zoom < MS_ZOOMS - 1) {
+    m->zoom++;
+    mine_layout(m, win);
+  } else if (c == '-' && m->zoom > 0) {
+    m->zoom--;
+    mine_layout(m, win);
+  } else if (c == KEY_LEFT) {
+    mine_scroll(m, -MS_SCROLL, 0);
+  } else if (c == KEY_RIGHT) {
+    mine_scroll(m, MS_SCROLL, 0);
+  } else if (c == KEY_UP) {
+    mine_scroll(m, 0, -MS_SCROLL);
+  } else if (c == KEY_DOWN) {
+    mine_scroll(m, 0, MS_SCROLL);
+  } else if (c == KEY_PGUP) {
+    mine_scroll(m, 0, -page);
+  } else if (c == KEY_PGDN) {
+    mine_scroll(m, 0, page);
   }
 }
 
-void mine_key(Window *win, char c) {
-  if (c == 'r')
-    mine_reset();
+static void mine_free(MineState *m) {
+  kfree(m->cells);
+  kfree(m->queue);
+  kfree(m->dirty);
+  kfree(m->surface);
+  kfree(m);
 }
 
-void start_minesweeper() {
-  mine_reset();
-  Window *w = create_window(100, 100, 220, 260, "Minesweeper");
-  if (w) {
-    w->on_paint = mine_paint;
-    w->on_click = mine_click;
-    w->on_key = mine_key;
+static void mine_close(Window *win) { mine_free(win->app_data); }
+
+// level: 0 = 10x10, 1 = 30x16, 2 = 200x200
+void start_minesweeper_level(int level) {
+  MineState *m = kzalloc(sizeof(MineState));
+  if (!m)
+    return;
+  ms_seed += timer_ticks();
+  const MineLevel *l = &ms_levels[level];
+  m->zoom = l->zoom;
+  Window *w = 0;
+  if (mine_new_game(m, l) == 0 && mine_layout(m, 0) == 0)
+    w = create_window(100, 100, m->sw + 2 * MS_MARGIN,
+                      MS_BOARD_Y + m->sh + MS_MARGIN, "Minesweeper");
+  if (!w) {
+    mine_free(m);
+    return;
   }
+  w->app_data = m;
+  w->on_close = mine_close;
+  w->on_paint = mine_paint;
+  w->on_click = mine_click;
+  w->on_mouse_move = mine_mouse_move;
+  w->on_key = mine_key;
+  wm_open(w);
 }
 
+void start_minesweeper() { start_minesweeper_level(0); }
+
 // --- SOLITAIRE ---
-// Simplified: 7 columns, 1 stock, 1 foundation (simplified).
-// Cards: 0-51. Value = c % 13, Suit = c / 13.
-// Suits: 0=H, 1=D, 2=C, 3=S
+// Klondike, draw one. Cards: 0-51, rank = c % 13 (0 = ace), suit = c / 13
+// (0=H, 1=D, 2=C, 3=S). Faces and the back are rendered once into a
+// sprite sheet; covered tableau cards only blit their visible strip.
 #define CARD_W 40
 #define CARD_H 60
+#define CARD_STRIP 15 // Visible part of a covered card
+#define CARD_BACK 52  // Sprite index
+#define SOL_COLS 7
+#define SOL_TOP_Y 40
+#define SOL_TABLEAU_Y 120
+#define SOL_WASTE 10 // Selection sources besides tableau columns 0-6
+#define SOL_FOUNDATION 20
 
 typedef struct {
-  int stock[52];
-  int stock_top;
-  int waste[52];
-  int waste_top;
-  int tableau[7][20]; // up to 20 cards per col
-  int tableau_cnt[7];
-  int selected_col; // -1 none, 0-6 tableau, 10 waste
-  int selected_idx;
+  int stock[52], stock_count; // Top = last
+  int waste[52], waste_count;
+  int foundation[4][13], foundation_count[4];
+  int tableau[SOL_COLS][20]; // At most 6 face down + K..A
+  int tableau_count[SOL_COLS];
+  int tableau_down[SOL_COLS]; // Bottom cards still face down
+  int selected;               // -1, column, SOL_WASTE or SOL_FOUNDATION + i
+  int selected_idx;           // First selected card in a column
 } SolState;
-static SolState sol;
 
-void sol_init() {
-  // Fill stock
-  for (int i = 0; i < 52; i++)
-    sol.stock[i] = i;
-  // Shuffle
-  for (int i = 0; i < 52; i++) {
-    int r = ms_rand() % 52;
-    int t = sol.stock[i];
-    sol.stock[i] = sol.stock[r];
-    sol.stock[r] = t;
-  }
+static uint32_t *sol_sprites; // 53 sprites of CARD_W x CARD_H
+
+// sol_legal[0][dest][card]: card may go on tableau card dest (52 = empty
+// column). sol_legal[1][dest][card]: on foundation top dest (52 = empty).
+static uint8_t sol_legal[2][53][52];
 
-  sol.stock_top = 0; // Index of next card
-  sol.waste_top = 0;
+static uint32_t *sol_sprite(int i) { return sol_sprites + i * CARD_W * CARD_H; }
 
-  // Deal
-  for (int i = 0; i < 7; i++) {
-    sol.tableau_cnt[i] = 0;
-    for (int j = 0; j <= i; j++) { // i+1 cards
-      sol.tableau[i][sol.tableau_cnt[i]++] = sol.stock[sol.stock_top++];
+static void sol_build_tables() {
+  for (int c = 0; c < 52; c++) {
+    int rank = c % 13, suit = c / 13, red = suit < 2;
+    for (int d = 0; d < 52; d++) {
+      int drank = d % 13, dsuit = d / 13, dred = dsuit < 2;
+      sol_legal[0][d][c] = rank == drank - 1 && red != dred;
+      sol_legal[1][d][c] = rank == drank + 1 && suit == dsuit;
     }
+    sol_legal[0][52][c] = rank == 12; // Kings to empty columns
+    sol_legal[1][52][c] = rank == 0;  // Aces start foundations
   }
-  sol.selected_col = -1;
 }
 
-void draw_card(Window *win, int x, int y, int card, int selected) {
-  if (card == -1) {                                              // Back
-    draw_rect(win->x + x, win->y + y, CARD_W, CARD_H, 0x000080); // Blue back
-    draw_rect(win->x + x + 2, win->y + y + 2, CARD_W - 4, CARD_H - 4, 0x8080FF);
-  } else {
-    draw_rect(win->x + x, win->y + y, CARD_W, CARD_H,
-              selected ? 0xFFFF00 : 0xFFFFFF);
-    draw_rect(win->x + x, win->y + y, CARD_W, 1, 0x000000);
-    draw_rect(win->x + x, win->y + y, 1, CARD_H, 0x000000);
-    draw_rect(win->x + x + CARD_W, win->y + y, 1, CARD_H, 0x000000);
-    draw_rect(win->x + x, win->y + y + CARD_H, CARD_W, 1, 0x000000);
-
-    int val = card % 13;
-    int suit = card / 13;
-    uint32_t col = (suit < 2) ? 0xFF0000 : 0x000000;
-
-    char v_char = '0';
-    if (val == 0)
-      v_char = 'A';
-    else if (val == 9)
-      v_char = 'X'; // 10
-    else if (val == 10)
-      v_char = 'J';
-    else if (val == 11)
-      v_char = 'Q';
-    else if (val == 12)
-      v_char = 'K';
-    else
-      v_char = '1' + val;
+static int sol_build_sprites() {
+  sol_sprites = kmalloc(53 * CARD_W * CARD_H * 4);
+  if (!sol_sprites)
+    return -1;
+  for (int i = 0; i <= CARD_BACK; i++) {
+    uint32_t *s = sol_sprite(i);
+    for (int y = 0; y < CARD_H; y++) {
+      for (int x = 0; x < CARD_W; x++) {
+        int edge = x == 0 || y == 0 || x == CARD_W - 1 || y == CARD_H - 1;
+        uint32_t col;
+        if (i == CARD_BACK)
+          col = (edge || x == 1 || y == 1 || x == CARD_W - 2 ||
+                 y == CARD_H - 2)
+                    ? 0x000080
+                    : 0x8080FF;
+        else
+          col = edge ? 0x000000 : 0xFFFFFF;
+        s[y * CARD_W + x] = col;
+      }
+    }
+    if (i == CARD_BACK)
+      continue;
+    int rank = i % 13, suit = i / 13;
+    uint32_t col = suit < 2 ? 0xFF0000 : 0x000000;
+    char r = "A23456789XJQK"[rank], u = "HDCS"[suit];
+    draw_char_to(s, CARD_W, 5, 5, r, col);
+    draw_char_to(s, CARD_W, 13, 5, u, col);
+    draw_char_to(s, CARD_W, CARD_W - 21, CARD_H - 13, r, col);
+    draw_char_to(s, CARD_W, CARD_W - 13, CARD_H - 13, u, col);
+  }
+  return 0;
+}
 
-    char s_str[3] = {v_char, "HDCS"[suit], 0};
-    draw_string(win->x + x + 5, win->y + y + 5, s_str, col);
+static void sol_deal(SolState *s) {
+  for (int i = 0; i < 52; i++)
+    s->stock[i] = i;
+  for (int i = 51; i > 0; i--) {
+    int r = ms_rand() % (i + 1);
+    int t = s->stock[i];
+    s->stock[i] = s->stock[r];
+    s->stock[r] = t;
+  }
+  s->stock_count = 52;
+  s->waste_count = 0;
+  for (int f = 0; f < 4; f++)
+    s->foundation_count[f] = 0;
+  for (int i = 0; i < SOL_COLS; i++) {
+    s->tableau_count[i] = 0;
+    for (int j = 0; j <= i; j++)
+      s->tableau[i][s->tableau_count[i]++] = s->stock[--s->stock_count];
+    s->tableau_down[i] = i;
   }
+  s->selected = -1;
+}
+
+static void sol_blit(Window *win, int x, int y, int h, int sprite) {
+  video_blit(win->x + x, win->y + y, CARD_W, h, sol_sprite(sprite), CARD_W);
+}
+
+static void sol_frame(Window *win, int x, int y, int h) {
+  x += win->x;
+  y += win->y;
+  draw_rect(x, y, CARD_W, 2, 0xFFFF00);
+  draw_rect(x, y + h - 2, CARD_W, 2, 0xFFFF00);
+  draw_rect(x, y, 2, h, 0xFFFF00);
+  draw_rect(x + CARD_W - 2, y, 2, h, 0xFFFF00);
 }
 
+static int sol_foundation_x(int f) { return 10 + (3 + f) * (CARD_W + 10); }
+static int sol_column_x(int i) { return 10 + i * (CARD_W + 10); }
+
 void sol_paint(Window *win) {
-  // Green Felt
-  draw_rect(win->x, win->y + 20, win->width, win->height - 20, 0x008000);
-
-  // Stock (Top Left)
-  if (sol.stock_top < 52)
-    draw_card(win, 10, 40, -1, 0);
-  else {
-    draw_rect(win->x + 10, win->y + 40, CARD_W, CARD_H, 0x004000);
-  }
-
-  // Waste
-  if (sol.waste_top > 0)
-    draw_card(win, 60, 40, sol.waste[sol.waste_top - 1],
-              (sol.selected_col == 10));
-
-  // Tableau
-  for (int i = 0; i < 7; i++) {
-    int x = 10 + i * (CARD_W + 10);
-    int y = 120;
-    if (sol.tableau_cnt[i] == 0) {
-      draw_rect(win->x + x, win->y + y, CARD_W, CARD_H, 0x006000);
-    } else {
-      for (int j = 0; j < sol.tableau_cnt[i]; j++) {
-        int selected = (sol.selected_col == i && j >= sol.selected_idx);
-        // Draw back if not last? Simplified: All revealed for MVP except maybe
-        // bottom? Real Solitaire: Only top is revealed. Let's reveal all for
-        // simplicity or only top. Reveal ONLY TOP for "gameplay" challenge? Too
-        // hard without logic. Reveal ALL.
-        draw_card(win, x, y + j * 15, sol.tableau[i][j], selected);
-      }
+  SolState *s = (SolState *)win->app_data;
+  draw_rect(win->x, win->y + 24, win->width, win->height - 24, 0x008000);
+
+  if (s->stock_count)
+    sol_blit(win, 10, SOL_TOP_Y, CARD_H, CARD_BACK);
+  else
+    draw_rect(win->x + 10, win->y + SOL_TOP_Y, CARD_W, CARD_H, 0x004000);
+  if (s->waste_count) {
+    sol_blit(win, 60, SOL_TOP_Y, CARD_H, s->waste[s->waste_count - 1]);
+    if (s->selected == SOL_WASTE)
+      sol_frame(win, 60, SOL_TOP_Y, CARD_H);
+  }
+
+  int won = 1;
+  for (int f = 0; f < 4; f++) {
+    int x = sol_foundation_x(f), n = s->foundation_count[f];
+    if (n)
+      sol_blit(win, x, SOL_TOP_Y, CARD_H, s->foundation[f][n - 1]);
+    else
+      draw_rect(win->x + x, win->y + SOL_TOP_Y, CARD_W, CARD_H, 0x006000);
+    if (s->selected == SOL_FOUNDATION + f)
+      sol_frame(win, x, SOL_TOP_Y, CARD_H);
+    won &= n == 13;
+  }
+
+  for (int i = 0; i < SOL_COLS; i++) {
+    int x = sol_column_x(i), n = s->tableau_count[i];
+    if (!n) {
+      draw_rect(win->x + x, win->y + SOL_TABLEAU_Y, CARD_W, CARD_H, 0x006000);
+      continue;
+    }
+    for (int j = 0; j < n; j++) {
+      int sprite = j < s->tableau_down[i] ? CARD_BACK : s->tableau[i][j];
+      sol_blit(win, x, SOL_TABLEAU_Y + j * CARD_STRIP,
+               j == n - 1 ? CARD_H : CARD_STRIP, sprite);
+    }
+    if (s->selected == i) {
+      int y = SOL_TABLEAU_Y + s->selected_idx * CARD_STRIP;
+      sol_frame(win, x, y, (n - 1 - s->selected_idx) * CARD_STRIP + CARD_H);
     }
   }
+
+  if (won)
+    draw_string(win->x + 150, win->y + 300, "You win!", 0xFFFF00);
+}
+
+// First selected card, or -1
+static int sol_selected_card(SolState *s) {
+  if (s->selected == SOL_WASTE)
+    return s->waste[s->waste_count - 1];
+  if (s->selected >= SOL_FOUNDATION) {
+    int f = s->selected - SOL_FOUNDATION;
+    return s->foundation[f][s->foundation_count[f] - 1];
+  }
+  if (s->selected >= 0)
+    return s->tableau[s->selected][s->selected_idx];
+  return -1;
+}
+
+// Take the selection off its pile (after the move was validated)
+static void sol_take(SolState *s, int *out, int *count) {
+  *count = 0;
+  if (s->selected == SOL_WASTE) {
+    out[(*count)++] = s->waste[--s->waste_count];
+  } else if (s->selected >= SOL_FOUNDATION) {
+    int f = s->selected - SOL_FOUNDATION;
+    out[(*count)++] = s->foundation[f][--s->foundation_count[f]];
+  } else {
+    int i = s->selected;
+    for (int j = s->selected_idx; j < s->tableau_count[i]; j++)
+      out[(*count)++] = s->tableau[i][j];
+    s->tableau_count[i] = s->selected_idx;
+    // Turn over the card that is now on top
+    if (s->tableau_down[i] && s->tableau_down[i] == s->tableau_count[i])
+      s->tableau_down[i]--;
+  }
+}
+
+static void sol_to_column(SolState *s, int i) {
+  int n = s->tableau_count[i];
+  int dest = n ? s->tableau[i][n - 1] : 52;
+  if (s->selected == i || !sol_legal[0][dest][sol_selected_card(s)])
+    return;
+  int cards[20], count;
+  sol_take(s, cards, &count);
+  for (int k = 0; k < count; k++)
+    s->tableau[i][s->tableau_count[i]++] = cards[k];
+}
+
+static void sol_to_foundation(SolState *s, int f) {
+  // Single cards only: the waste top, a column's top card
+  if (s->selected >= SOL_FOUNDATION ||
+      (s->selected >= 0 && s->selected < SOL_COLS &&
+       s->selected_idx != s->tableau_count[s->selected] - 1))
+    return;
+  int n = s->foundation_count[f];
+  int dest = n ? s->foundation[f][n - 1] : 52;
+  if (!sol_legal[1][dest][sol_selected_card(s)])
+    return;
+  int cards[20], count;
+  sol_take(s, cards, &count);
+  s->foundation[f][s->foundation_count[f]++] = cards[0];
 }
 
 void sol_click(Window *win, int x, int y) {
-  // 0. Stock click
-  if (y >= 40 && y <= 40 + CARD_H && x >= 10 && x <= 10 + CARD_W) {
-    if (sol.stock_top < 52) {
-      sol.waste[sol.waste_top++] = sol.stock[sol.stock_top++];
-      sol.selected_col = -1;
+  SolState *s = (SolState *)win->app_data;
+  int top_row = y >= SOL_TOP_Y && y < SOL_TOP_Y + CARD_H;
+
+  // Stock: deal one, or turn the waste back over when empty
+  if (top_row && x >= 10 && x < 10 + CARD_W) {
+    if (s->stock_count) {
+      s->waste[s->waste_count++] = s->stock[--s->stock_count];
     } else {
-      // Reset stock
-      sol.stock_top = 0;
-      sol.waste_top = 0; // Simplified reset (cheat: lost cards if not cycled
-                         // logic correct) Real logic: move waste back to stock.
-      // Impl: TODO. Just refill.
-      sol_init(); // Reset game
-    }
-    return;
-  }
-
-  // 1. Waste click
-  if (y >= 40 && y <= 40 + CARD_H && x >= 60 && x <= 60 + CARD_W) {
-    if (sol.waste_top > 0) {
-      sol.selected_col = 10;
-    }
-    return;
-  }
-
-  // 2. Tableau click
-  for (int i = 0; i < 7; i++) {
-    int tx = 10 + i * (CARD_W + 10);
-    // Hit test simplified: entire column
-    if (x >= tx && x <= tx + CARD_W && y >= 120) {
-      // Clicked column i
-      if (sol.selected_col != -1) {
-        // Try Move
-        if (sol.selected_col == 10) { // From Waste
-          // Move to Col i
-          sol.tableau[i][sol.tableau_cnt[i]++] = sol.waste[--sol.waste_top];
-          sol.selected_col = -1;
-        } else if (sol.selected_col != i) { // From Tableau
-          // Move stack
-          int src = sol.selected_col;
-          int idx = sol.selected_idx;
-          // Move idx..end to dest
-          for (int k = idx; k < sol.tableau_cnt[src]; k++) {
-            sol.tableau[i][sol.tableau_cnt[i]++] = sol.tableau[src][k];
-          }
-          sol.tableau_cnt[src] = idx;
-          sol.selected_col = -1;
-        } else {
-          sol.selected_col = -1; // Deselect
-        }
-      } else {
-        // Select
-        if (sol.tableau_cnt[i] > 0) {
-          sol.selected_col = i;
-          // Select Top Card (simplest)
-          sol.selected_idx = sol.tableau_cnt[i] - 1;
-        }
+      while (s->waste_count)
+        s->stock[s->stock_count++] = s->waste[--s->waste_count];
+    }
+    s->selected = -1;
+    return;
+  }
+
+  if (top_row && x >= 60 && x < 60 + CARD_W) {
+    s->selected = (s->selected == -1 && s->waste_count) ? SOL_WASTE : -1;
+    return;
+  }
+
+  for (int f = 0; f < 4; f++) {
+    int fx = sol_foundation_x(f);
+    if (top_row && x >= fx && x < fx + CARD_W) {
+      if (s->selected != -1) {
+        sol_to_foundation(s, f);
+        s->selected = -1;
+      } else if (s->foundation_count[f]) {
+        s->selected = SOL_FOUNDATION + f;
       }
+      return;
     }
   }
+
+  for (int i = 0; i < SOL_COLS; i++) {
+    int tx = sol_column_x(i);
+    if (x < tx || x >= tx + CARD_W || y < SOL_TABLEAU_Y)
+      continue;
+    if (s->selected != -1) {
+      sol_to_column(s, i);
+      s->selected = -1;
+      return;
+    }
+    int n = s->tableau_count[i];
+    int j = (y - SOL_TABLEAU_Y) / CARD_STRIP;
+    if (j >= n)
+      j = n - 1;
+    if (n && y < SOL_TABLEAU_Y + (n - 1) * CARD_STRIP + CARD_H &&
+        j >= s->tableau_down[i]) {
+      s->selected = i;
+      s->selected_idx = j;
+    }
+    return;
+  }
+  s->selected = -1;
 }
 
+void sol_key(Window *win, char c) {
+  if (c == 'n' || c == 'N')
+    sol_deal((SolState *)win->app_data);
+}
+
+static void sol_close(Window *win) { kfree(win->app_data); }
+
 void start_solitaire() {
-  sol_init();
-  Window *w = create_window(150, 150, 400, 400, "Solitaire");
-  if (w) {
-    w->on_paint = sol_paint;
-    w->on_click = sol_click;
+  if (!sol_sprites) {
+    if (sol_build_sprites())
+      return;
+    sol_build_tables();
+  }
+  SolState *s = kzalloc(sizeof(SolState));
+  if (!s)
+    return;
+  ms_seed += timer_ticks();
+  sol_deal(s);
+  Window *w = create_window(150, 100, 370, 470, "Solitaire");
+  if (!w) {
+    kfree(s);
+    return;
   }
+  w->app_data = s;
+  w->on_close = sol_close;
+  w->on_paint = sol_paint;
+  w->tile_safe = 1;
+  w->on_click = sol_click;
+  w->on_key = sol_key;
+  wm_open(w);
 }
 
 // --- CALCULATOR APP ---
@@ -642,180 +1147,694 @@ void start_calculator() {
   Window *w = create_window(150, 150, 200, 200, "Calc");
   if (w) {
     w->on_paint = calc_paint;
+    w->tile_safe = 1;
     w->on_click = calc_click;
+    wm_open(w);
   }
 }
-// --- NOTEPAD (Enhanced with Scroll) ---
+// --- NOTEPAD ---
+// Text lives in a gap buffer: edits at the cursor are O(1) and moving the
+// cursor moves the gap. Line starts are kept in a second gap array split
+// at the cursor line: starts before it are absolute offsets, starts after
+// it are distances from the end of the text, so typing never has to touch
+// them. Wrapping is by character count, so each line's row count comes
+// straight from its length and only visible lines are ever looked at.
+
+#define NOTE_GAP 4096 // Growth step for the text gap
+#define NOTE_LINE_GAP 256
+#define NOTE_TEXT_X 8
+#define NOTE_TEXT_Y 28
+#define NOTE_LINE_H 12
+#define NOTE_STATUS_H 16
+#define NOTE_MAX_COLS 127
+#define NOTE_DEFAULT_PATH "/notes.txt"
+
 typedef struct {
-  char buffer[512];
-  int cursor;
-  int scroll_y; // Pixel offset
+  char *buf; // Text = buf[0, gap_start) + buf[gap_end, cap)
+  uint32_t cap, gap_start, gap_end;
+
+  uint32_t *lines; // Front: absolute starts, back: distance from the end
+  uint32_t line_cap, line_gap, line_gap_end;
+
+  uint32_t top_line, top_row; // First visible row
+  char path[64];
+  int modified;
+  const char *status;
 } NotepadState;
 
-static NotepadState note_state;
+static uint32_t note_len(NotepadState *n) {
+  return n->cap - (n->gap_end - n->gap_start);
+}
 
-void note_paint(Window *win) {
-  // White background
-  draw_rect(win->x + 2, win->y + 22, win->width - 4, win->height - 24,
-            0xFFFFFF);
+static char note_char(NotepadState *n, uint32_t pos) {
+  return pos < n->gap_start ? n->buf[pos]
+                            : n->buf[pos + n->gap_end - n->gap_start];
+}
 
-  int x = win->x + 8;
-  int start_y = win->y + 28 - note_state.scroll_y;
-  int y = start_y;
-  int line_height = 12;
-  int max_width = win->width - 16;
-  int current_w = 0;
+static uint32_t note_line_count(NotepadState *n) {
+  return n->line_gap + (n->line_cap - n->line_gap_end);
+}
 
-  int cursor_x = x;
-  int cursor_y = y;
+static uint32_t note_line_start(NotepadState *n, uint32_t i) {
+  if (i < n->line_gap)
+    return n->lines[i];
+  return note_len(n) - n->lines[n->line_gap_end + (i - n->line_gap)];
+}
+
+// Without the newline
+static uint32_t note_line_len(NotepadState *n, uint32_t i) {
+  if (i + 1 < note_line_count(n))
+    return note_line_start(n, i + 1) - note_line_start(n, i) - 1;
+  return note_len(n) - note_line_start(n, i);
+}
 
-  char *p = note_state.buffer;
-  int idx = 0;
+static uint32_t note_rows(NotepadState *n, uint32_t i, int cols) {
+  return note_line_len(n, i) / cols + 1;
+}
 
-  int min_y = win->y + 22;
-  int max_y = win->y + win->height - 5;
+// The cursor is the gap; its line is the last entry of the front part
+static uint32_t note_cursor(NotepadState *n) { return n->gap_start; }
+static uint32_t note_cursor_line(NotepadState *n) { return n->line_gap - 1; }
 
-  while (*p) {
-    char c = *p;
+static int note_reserve(NotepadState *n, uint32_t more) {
+  if (n->gap_end - n->gap_start >= more)
+    return 0;
+  uint32_t cap = n->cap + more + NOTE_GAP + n->cap / 2;
+  char *buf = kmalloc(cap);
+  if (!buf)
+    return -1;
+  uint32_t tail = n->cap - n->gap_end;
+  memcpy(buf, n->buf, n->gap_start);
+  memcpy(buf + cap - tail, n->buf + n->gap_end, tail);
+  kfree(n->buf);
+  n->buf = buf;
+  n->gap_end = cap - tail;
+  n->cap = cap;
+  return 0;
+}
 
-    if (idx == note_state.cursor) {
-      cursor_x = x + current_w;
-      cursor_y = y;
-    }
+static int note_reserve_lines(NotepadState *n) {
+  if (n->line_gap < n->line_gap_end)
+    return 0;
+  uint32_t cap = n->line_cap * 2 + NOTE_LINE_GAP;
+  uint32_t *lines = kmalloc(cap * sizeof(uint32_t));
+  if (!lines)
+    return -1;
+  uint32_t tail = n->line_cap - n->line_gap_end;
+  memcpy(lines, n->lines, n->line_gap * sizeof(uint32_t));
+  memcpy(lines + cap - tail, n->lines + n->line_gap_end,
+         tail * sizeof(uint32_t));
+  kfree(n->lines);
+  n->lines = lines;
+  n->line_gap_end = cap - tail;
+  n->line_cap = cap;
+  return 0;
+}
+
+static void note_move_to(NotepadState *n, uint32_t pos) {
+  uint32_t len = note_len(n);
+  if (pos > len)
+    pos = len;
+
+  // Text gap
+  if (pos < n->gap_start) {
+    uint32_t k = n->gap_start - pos;
+    memmove(n->buf + n->gap_end - k, n->buf + pos, k);
+    n->gap_start -= k;
+    n->gap_end -= k;
+  } else if (pos > n->gap_start) {
+    uint32_t k = pos - n->gap_start;
+    memmove(n->buf + n->gap_start, n->buf + n->gap_end, k);
+    n->gap_start += k;
+    n->gap_end += k;
+  }
+
+  // Line gap: the front must end with the line holding pos
+  while (n->line_gap > 1 && n->lines[n->line_gap - 1] > pos)
+    n->lines[--n->line_gap_end] = len - n->lines[--n->line_gap];
+  while (n->line_gap_end < n->line_cap &&
+         len - n->lines[n->line_gap_end] <= pos)
+    n->lines[n->line_gap++] = len - n->lines[n->line_gap_end++];
+}
+
+static void note_insert(NotepadState *n, char c) {
+  if (note_reserve(n, 1) || (c == '\n' && note_reserve_lines(n)))
+    return;
+  n->buf[n->gap_start++] = c;
+  if (c == '\n')
+    n->lines[n->line_gap++] = n->gap_start;
+  n->modified = 1;
+}
+
+static void note_backspace(NotepadState *n) {
+  if (!n->gap_start)
+    return;
+  if (n->buf[--n->gap_start] == '\n')
+    n->line_gap--;
+  n->modified = 1;
+}
+
+static void note_delete(NotepadState *n) {
+  if (n->gap_end == n->cap)
+    return;
+  if (n->buf[n->gap_end++] == '\n')
+    n->line_gap_end++;
+  n->modified = 1;
+}
+
+// Replace the whole text. data may be 0.
+static int note_set_text(NotepadState *n, const char *data, uint32_t size) {
+  uint32_t newlines = 0;
+  for (uint32_t i = 0; i < size; i++)
+    newlines += data[i] == '\n';
+
+  uint32_t cap = size + NOTE_GAP;
+  uint32_t line_cap = newlines + 1 + NOTE_LINE_GAP;
+  char *buf = kmalloc(cap);
+  uint32_t *lines = kmalloc(line_cap * sizeof(uint32_t));
+  if (!buf || !lines) {
+    kfree(buf);
+    kfree(lines);
+    return -1;
+  }
+  kfree(n->buf);
+  kfree(n->lines);
+
+  // Cursor at the start: all text after the gap, all lines but the first
+  // in the back part
+  n->buf = buf;
+  n->cap = cap;
+  n->gap_start = 0;
+  n->gap_end = cap - size;
+  if (size)
+    memcpy(buf + n->gap_end, data, size);
+  n->lines = lines;
+  n->line_cap = line_cap;
+  n->lines[0] = 0;
+  n->line_gap = 1;
+  n->line_gap_end = line_cap - newlines;
+  uint32_t k = n->line_gap_end;
+  for (uint32_t i = 0; i < size; i++) {
+    if (data[i] == '\n')
+      lines[k++] = size - (i + 1);
+  }
+  n->top_line = n->top_row = 0;
+  n->modified = 0;
+  return 0;
+}
+
+static int note_cols(Window *win) {
+  int cols = (win->width - 2 * NOTE_TEXT_X) / 8;
+  if (cols < 1)
+    cols = 1;
+  return cols > NOTE_MAX_COLS ? NOTE_MAX_COLS : cols;
+}
+
+static int note_visible_rows(Window *win) {
+  int rows = (win->height - NOTE_TEXT_Y - NOTE_STATUS_H) / NOTE_LINE_H;
+  return rows < 1 ? 1 : rows;
+}
 
-    // Draw Logic with "Clipping"
-    int draw = (y >= min_y && y <= max_y);
+// Scroll just enough to show the cursor row
+static void note_scroll_to_cursor(NotepadState *n, Window *win) {
+  int cols = note_cols(win), visible = note_visible_rows(win);
+  uint32_t cl = note_cursor_line(n);
+  uint32_t crow = (note_cursor(n) - note_line_start(n, cl)) / cols;
 
-    if (c == '\n') {
-      y += line_height;
-      current_w = 0;
+  if (cl < n->top_line || (cl == n->top_line && crow < n->top_row)) {
+    n->top_line = cl;
+    n->top_row = crow;
+    return;
+  }
+  int rows = -(int)n->top_row;
+  for (uint32_t i = n->top_line; i < cl && rows < visible; i++)
+    rows += note_rows(n, i, cols);
+  if (rows + (int)crow < visible)
+    return;
+
+  // Below the view: put the cursor on the last row
+  n->top_line = cl;
+  n->top_row = crow;
+  for (int need = visible - 1; need > 0; need--) {
+    if (n->top_row > 0) {
+      n->top_row--;
+    } else if (n->top_line > 0) {
+      n->top_line--;
+      n->top_row = note_rows(n, n->top_line, cols) - 1;
     } else {
-      if (draw) {
-        char buf[2] = {c, 0};
-        draw_string(x + current_w, y, buf, 0x000000);
-      }
-      current_w += 8;
-      if (current_w >= max_width) {
-        y += line_height;
-        current_w = 0;
-      }
+      break;
     }
-    p++;
-    idx++;
   }
+}
 
-  if (idx == note_state.cursor) {
-    cursor_x = x + current_w;
-    cursor_y = y;
+// Up/down by one wrapped row, keeping the column on screen
+static void note_move_vertical(NotepadState *n, Window *win, int dir) {
+  int cols = note_cols(win);
+  uint32_t cl = note_cursor_line(n);
+  uint32_t start = note_line_start(n, cl);
+  uint32_t col = note_cursor(n) - start;
+  uint32_t len = note_line_len(n, cl);
+  uint32_t x = col % cols;
+
+  if (dir < 0) {
+    if (col >= (uint32_t)cols) {
+      note_move_to(n, start + col - cols);
+    } else if (cl > 0) {
+      uint32_t plen = note_line_len(n, cl - 1);
+      uint32_t pcol = (plen / cols) * cols + x;
+      uint32_t pstart = note_line_start(n, cl - 1);
+      note_move_to(n, pstart + (pcol < plen ? pcol : plen));
+    }
+  } else {
+    if (col / cols < len / cols) {
+      col += cols;
+      note_move_to(n, start + (col < len ? col : len));
+    } else if (cl + 1 < note_line_count(n)) {
+      uint32_t nlen = note_line_len(n, cl + 1);
+      note_move_to(n, note_line_start(n, cl + 1) + (x < nlen ? x : nlen));
+    }
   }
+}
 
-  // Auto-scroll logic
-  if (cursor_y > max_y)
-    note_state.scroll_y += line_height;
-  if (cursor_y < min_y)
-    note_state.scroll_y -= line_height;
-  if (note_state.scroll_y < 0)
-    note_state.scroll_y = 0;
+static void note_load(NotepadState *n) {
+  uint32_t size;
+  char *data = fat32_mounted() ? fat32_load(n->path, &size) : 0;
+  if (!data) {
+    n->status = "Not found";
+    return;
+  }
+  n->status = note_set_text(n, data, size) ? "Out of memory" : "Loaded";
+  kfree(data);
+}
 
-  // Draw Cursor (if visible)
-  if (cursor_y >= min_y && cursor_y <= max_y)
-    draw_rect(cursor_x, cursor_y, 2, 10, 0x000000);
+static void note_save(NotepadState *n) {
+  FatFile f;
+  if (!fat32_mounted() || fat32_create(n->path, &f)) {
+    n->status = "Cannot save";
+    return;
+  }
+  uint32_t tail = n->cap - n->gap_end;
+  int ok = fat32_write(&f, n->buf, n->gap_start) == (int)n->gap_start &&
+           fat32_write(&f, n->buf + n->gap_end, tail) == (int)tail &&
+           fat32_truncate(&f) == 0;
+  fat32_close(&f);
+  if (ok && fat32_sync() == 0) {
+    n->modified = 0;
+    n->status = "Saved";
+  } else {
+    n->status = "Write error";
+  }
 }
 
-void note_key(Window *win, char c) {
-  if (c == '\b') {
-    if (note_state.cursor > 0) {
-      // Shift left
-      for (int i = note_state.cursor; i < 512; i++) {
-        note_state.buffer[i - 1] = note_state.buffer[i];
-      }
-      note_state.cursor--;
+void note_paint(Window *win) {
+  NotepadState *n = (NotepadState *)win->app_data;
+  int cols = note_cols(win), visible = note_visible_rows(win);
+
+  draw_rect(win->x + 2, win->y + 22, win->width - 4, win->height - 24,
+            0xFFFFFF);
+
+  uint32_t cursor = note_cursor(n);
+  uint32_t line = n->top_line, row = n->top_row;
+  int x0 = win->x + NOTE_TEXT_X;
+  char text[NOTE_MAX_COLS + 1];
+  for (int r = 0; r < visible && line < note_line_count(n); r++) {
+    int y = win->y + NOTE_TEXT_Y + r * NOTE_LINE_H;
+    uint32_t start = note_line_start(n, line);
+    uint32_t len = note_line_len(n, line);
+    uint32_t from = row * cols;
+    uint32_t count = len - from < (uint32_t)cols ? len - from : cols;
+    for (uint32_t i = 0; i < count; i++) {
+      char c = note_char(n, start + from + i);
+      text[i] = (c >= 32 && c <= 126) ? c : ' ';
     }
-  } else if (c == '\n') { // Enter
-    if (note_state.cursor < 511) {
-      // Shift right
-      for (int i = 511; i > note_state.cursor; i--) {
-        note_state.buffer[i] = note_state.buffer[i - 1];
-      }
-      note_state.buffer[note_state.cursor++] = '\n';
+    text[count] = 0;
+    draw_string(x0, y, text, 0x000000);
+
+    // Cursor: on this row, or at the very end of its last row
+    if (cursor >= start + from && cursor <= start + len &&
+        (cursor < start + from + cols || from + cols > len))
+      draw_rect(x0 + (cursor - start - from) * 8, y, 2, 10, 0x000000);
+
+    if (++row >= note_rows(n, line, cols)) {
+      line++;
+      row = 0;
     }
-  } else if (c >= 32 && c <= 126) {
-    if (note_state.cursor < 511) {
-      // Insert mode: Shift right
-      for (int i = 511; i > note_state.cursor; i--) {
-        note_state.buffer[i] = note_state.buffer[i - 1];
-      }
-      note_state.buffer[note_state.cursor++] = c;
+  }
+
+  // Status bar: file, position, state
+  int sy = win->y + win->height - NOTE_STATUS_H;
+  draw_rect(win->x + 2, sy, win->width - 4, NOTE_STATUS_H - 2, 0xE0E0E0);
+  char pos[40];
+  char num[12];
+  int k = 0;
+  for (const char *p = "Ln "; *p;)
+    pos[k++] = *p++;
+  int_to_str(note_cursor_line(n) + 1, num);
+  for (char *p = num; *p;)
+    pos[k++] = *p++;
+  for (const char *p = ", Col "; *p;)
+    pos[k++] = *p++;
+  int_to_str(cursor - note_line_start(n, note_cursor_line(n)) + 1, num);
+  for (char *p = num; *p;)
+    pos[k++] = *p++;
+  pos[k] = 0;
+  draw_string(win->x + 6, sy + 3, n->path, 0x000000);
+  draw_string(win->x + 6 + 8 * 14, sy + 3, pos, 0x000000);
+  draw_string(win->x + win->width - 8 * 13, sy + 3,
+              n->modified ? "Modified" : n->status, 0x404040);
+}
+
+void note_click(Window *win, int x, int y) {
+  NotepadState *n = (NotepadState *)win->app_data;
+  int cols = note_cols(win);
+  int r = (y - NOTE_TEXT_Y) / NOTE_LINE_H;
+  if (y < NOTE_TEXT_Y || r >= note_visible_rows(win))
+    return;
+  int c = (x - NOTE_TEXT_X + 4) / 8;
+  if (c < 0)
+    c = 0;
+  if (c > cols)
+    c = cols;
+
+  uint32_t line = n->top_line, row = n->top_row;
+  while (r > 0 && line < note_line_count(n)) {
+    if (++row >= note_rows(n, line, cols)) {
+      line++;
+      row = 0;
     }
+    r--;
+  }
+  if (line >= note_line_count(n)) {
+    note_move_to(n, note_len(n));
+    return;
   }
+  uint32_t col = row * cols + c;
+  uint32_t len = note_line_len(n, line);
+  note_move_to(n, note_line_start(n, line) + (col < len ? col : len));
+}
+
+void note_key(Window *win, char c) {
+  NotepadState *n = (NotepadState *)win->app_data;
+  int page = note_visible_rows(win) - 1;
+  uint32_t cl = note_cursor_line(n);
+
+  if (c == '\b') {
+    note_backspace(n);
+  } else if (c == KEY_DELETE) {
+    note_delete(n);
+  } else if (c == KEY_LEFT) {
+    if (note_cursor(n))
+      note_move_to(n, note_cursor(n) - 1);
+  } else if (c == KEY_RIGHT) {
+    note_move_to(n, note_cursor(n) + 1);
+  } else if (c == KEY_UP || c == KEY_DOWN) {
+    note_move_vertical(n, win, c == KEY_UP ? -1 : 1);
+  } else if (c == KEY_PGUP || c == KEY_PGDN) {
+    for (int i = 0; i < page; i++)
+      note_move_vertical(n, win, c == KEY_PGUP ? -1 : 1);
+  } else if (c == KEY_HOME) {
+    note_move_to(n, note_line_start(n, cl));
+  } else if (c == KEY_END) {
+    note_move_to(n, note_line_start(n, cl) + note_line_len(n, cl));
+  } else if (c == KEY_CTRL('s')) {
+    note_save(n);
+  } else if (c == KEY_CTRL('o')) {
+    note_load(n);
+  } else if (c == '\n' || c == '\t' || (c >= 32 && c <= 126)) {
+    note_insert(n, c == '\t' ? ' ' : c);
+  }
+  note_scroll_to_cursor(n, win);
 }
 
 // --- PAINT APP ---
-#define PAINT_W 200
-#define PAINT_H 150
-static uint8_t paint_canvas[PAINT_W * PAINT_H];
+// The canvas is a 32bpp surface sized from the window and blitted in one
+// go. Strokes are interpolated between mouse samples (Bresenham), so fast
+// drags leave no gaps.
+
+#define PAINT_X 10 // Canvas position inside the window
+#define PAINT_Y 30
+#define PAINT_BAR 34 // Tool bar height below the canvas
+#define PAINT_SWATCH 16
+#define PAINT_SELECT 0x00C0FF // Frame around the active tool
 
-void paint_reset() {
-  for (int i = 0; i < PAINT_W * PAINT_H; i++)
-    paint_canvas[i] = 0;
+static const uint32_t paint_palette[] = {
+    0x000000, 0x808080, 0xFFFFFF, 0xE02020, 0xF08020,
+    0xF0E020, 0x20B040, 0x2080F0, 0x6030C0, 0x804020};
+#define PAINT_COLORS (int)(sizeof(paint_palette) / sizeof(paint_palette[0]))
+
+static const int paint_brushes[] = {1, 3, 7}; // Diameters
+
+typedef struct {
+  uint32_t *pixels;
+  int w, h;
+  uint32_t color;
+  int brush; // Index into paint_brushes
+  int fill;  // Fill tool instead of brush
+  int drawing, last_x, last_y;
+} PaintState;
+
+static void paint_clear(PaintState *p) {
+  for (int i = 0; i < p->w * p->h; i++)
+    p->pixels[i] = 0xFFFFFF;
 }
 
-void paint_paint(Window *win) {
-  // Canvas Bg
-  draw_rect(win->x + 10, win->y + 30, PAINT_W, PAINT_H, 0xFFFFFF);
-  draw_rect(win->x + 10, win->y + 30, PAINT_W, 1, 0x000000);
-  draw_rect(win->x + 10, win->y + 30, 1, PAINT_H, 0x000000);
-  draw_rect(win->x + 10 + PAINT_W, win->y + 30, 1, PAINT_H, 0x000000);
-  draw_rect(win->x + 10, win->y + 30 + PAINT_H, PAINT_W, 1, 0x000000);
-
-  // Draw Pixels
-  for (int y = 0; y < PAINT_H; y++) {
-    for (int x = 0; x < PAINT_W; x++) {
-      if (paint_canvas[y * PAINT_W + x]) {
-        int screen_x = win->x + 10 + x;
-        int screen_y = win->y + 30 + y;
-        if (screen_x < 1024 && screen_y < 768)
-          draw_rect(screen_x, screen_y, 2, 2, 0x000000);
+// Size the canvas to the window, keeping what is already drawn
+static void paint_fit(PaintState *p, Window *win) {
+  int w = win->width - 2 * PAINT_X;
+  int h = win->height - PAINT_Y - PAINT_BAR;
+  if (w < 1 || h < 1 || (p->pixels && w == p->w && h == p->h))
+    return;
+  uint32_t *pixels = kmalloc(w * h * 4);
+  if (!pixels)
+    return;
+  for (int i = 0; i < w * h; i++)
+    pixels[i] = 0xFFFFFF;
+  if (p->pixels) {
+    for (int y = 0; y < h && y < p->h; y++)
+      memcpy(pixels + y * w, p->pixels + y * p->w,
+             (w < p->w ? w : p->w) * 4);
+    kfree(p->pixels);
+  }
+  p->pixels = pixels;
+  p->w = w;
+  p->h = h;
+}
+
+static void paint_dab(PaintState *p, int cx, int cy) {
+  int d = paint_brushes[p->brush];
+  int r = d / 2;
+  for (int dy = -r; dy <= r; dy++) {
+    int y = cy + dy;
+    if (y < 0 || y >= p->h)
+      continue;
+    for (int dx = -r; dx <= r; dx++) {
+      int x = cx + dx;
+      if (x >= 0 && x < p->w && dx * dx + dy * dy <= r * r + r)
+        p->pixels[y * p->w + x] = p->color;
+    }
+  }
+}
+
+static void paint_line(PaintState *p, int x0, int y0, int x1, int y1) {
+  int dx = x1 > x0 ? x1 - x0 : x0 - x1;
+  int dy = y1 > y0 ? y0 - y1 : y1 - y0; // Negative
+  int sx = x0 < x1 ? 1 : -1;
+  int sy = y0 < y1 ? 1 : -1;
+  int err = dx + dy;
+  while (1) {
+    paint_dab(p, x0, y0);
+    if (x0 == x1 && y0 == y1)
+      break;
+    int e2 = 2 * err;
+    if (e2 >= dy) {
+      err += dy;
+      x0 += sx;
+    }
+    if (e2 <= dx) {
+      err += dx;
+      y0 += sy;
+    }
+  }
+}
+
+// Scanline flood fill: fill a whole run, then queue one seed per run of
+// matching pixels on the rows above and below
+static void paint_flood(PaintState *p, int x, int y) {
+  uint32_t target = p->pixels[y * p->w + x];
+  if (target == p->color)
+    return;
+  // Each filled run queues at most len + 2 seeds and no pixel is filled
+  // twice, so w * h seeds is plenty for any real picture
+  int cap = p->w * p->h;
+  uint16_t *stack = kmalloc(cap * 2 * sizeof(uint16_t));
+  if (!stack)
+    return;
+  int top = 0;
+  stack[top++] = x;
+  stack[top++] = y;
+
+  while (top) {
+    y = stack[--top];
+    x = stack[--top];
+    uint32_t *row = p->pixels + y * p->w;
+    if (row[x] != target)
+      continue;
+    int l = x, r = x;
+    while (l > 0 && row[l - 1] == target)
+      l--;
+    while (r < p->w - 1 && row[r + 1] == target)
+      r++;
+    for (int i = l; i <= r; i++)
+      row[i] = p->color;
+
+    for (int ny = y - 1; ny <= y + 1; ny += 2) {
+      if (ny < 0 || ny >= p->h)
+        continue;
+      uint32_t *nrow = p->pixels + ny * p->w;
+      int in_run = 0;
+      for (int i = l; i <= r; i++) {
+        if (nrow[i] != target) {
+          in_run = 0;
+        } else if (!in_run && top + 2 <= cap * 2) {
+          stack[top++] = i;
+          stack[top++] = ny;
+          in_run = 1;
+        }
       }
     }
   }
-  draw_string(win->x + 10, win->y + 190, "Drag to Draw. C: Clear", 0x000000);
+  kfree(stack);
 }
 
-// Unified handler for click and move
-void paint_draw_action(int lx, int ly) {
-  int cx = lx - 10;
-  int cy = ly - 30;
+static void paint_frame(int x, int y, int w, int h, uint32_t color) {
+  draw_rect(x, y, w, 1, color);
+  draw_rect(x, y + h - 1, w, 1, color);
+  draw_rect(x, y, 1, h, color);
+  draw_rect(x + w - 1, y, 1, h, color);
+}
+
+void paint_paint(Window *win) {
+  PaintState *p = (PaintState *)win->app_data;
+  paint_fit(p, win);
+  if (!p->pixels)
+    return;
 
-  if (cx >= 0 && cx < PAINT_W && cy >= 0 && cy < PAINT_H) {
-    paint_canvas[cy * PAINT_W + cx] = 1;
-    if (cx + 1 < PAINT_W)
-      paint_canvas[cy * PAINT_W + cx + 1] = 1;
-    if (cy + 1 < PAINT_H)
-      paint_canvas[(cy + 1) * PAINT_W + cx] = 1;
+  int cx = win->x + PAINT_X, cy = win->y + PAINT_Y;
+  video_blit(cx, cy, p->w, p->h, p->pixels, p->w);
+  paint_frame(cx - 1, cy - 1, p->w + 2, p->h + 2, 0x000000);
+
+  // Tool bar: palette, brush sizes, fill, clear
+  int by = cy + p->h + 8;
+  for (int i = 0; i < PAINT_COLORS; i++) {
+    int x = cx + i * (PAINT_SWATCH + 4);
+    draw_rect(x, by, PAINT_SWATCH, PAINT_SWATCH, paint_palette[i]);
+    paint_frame(x - 1, by - 1, PAINT_SWATCH + 2, PAINT_SWATCH + 2,
+                paint_palette[i] == p->color ? PAINT_SELECT : 0x000000);
+  }
+  int tx = cx + PAINT_COLORS * (PAINT_SWATCH + 4) + 6;
+  for (int i = 0; i < 3; i++) {
+    int x = tx + i * (PAINT_SWATCH + 4);
+    int d = paint_brushes[i];
+    draw_rect(x, by, PAINT_SWATCH, PAINT_SWATCH, 0xFFFFFF);
+    draw_rect(x + (PAINT_SWATCH - d) / 2, by + (PAINT_SWATCH - d) / 2, d, d,
+              0x000000);
+    paint_frame(x - 1, by - 1, PAINT_SWATCH + 2, PAINT_SWATCH + 2,
+                i == p->brush && !p->fill ? PAINT_SELECT : 0x000000);
   }
+  tx += 3 * (PAINT_SWATCH + 4) + 6;
+  draw_string(tx + 2, by + 4, "Fill", p->fill ? PAINT_SELECT : 0x000000);
+  draw_string(tx + 42, by + 4, "Clear", 0x000000);
 }
 
-void paint_click(Window *win, int x, int y) { paint_draw_action(x, y); }
+// Tool bar hit test, in window coordinates. Returns 1 if it was a button.
+static int paint_toolbar(PaintState *p, int x, int y) {
+  int by = PAINT_Y + p->h + 8;
+  if (y < by || y >= by + PAINT_SWATCH)
+    return 0;
+  int i = (x - PAINT_X) / (PAINT_SWATCH + 4);
+  if (x >= PAINT_X && i < PAINT_COLORS) {
+    p->color = paint_palette[i];
+    return 1;
+  }
+  int tx = PAINT_X + PAINT_COLORS * (PAINT_SWATCH + 4) + 6;
+  if (x >= tx && x < tx + 3 * (PAINT_SWATCH + 4)) {
+    p->brush = (x - tx) / (PAINT_SWATCH + 4);
+    p->fill = 0;
+    return 1;
+  }
+  tx += 3 * (PAINT_SWATCH + 4) + 6;
+  if (x >= tx && x < tx + 36)
+    p->fill = !p->fill;
+  else if (x >= tx + 40 && x < tx + 84)
+    paint_clear(p);
+  return 1;
+}
+
+void paint_click(Window *win, int x, int y) {
+  PaintState *p = (PaintState *)win->app_data;
+  if (!p->pixels || paint_toolbar(p, x, y))
+    return;
+  int cx = x - PAINT_X, cy = y - PAINT_Y;
+  if (p->fill && cx >= 0 && cx < p->w && cy >= 0 && cy < p->h)
+    paint_flood(p, cx, cy);
+}
 
 void paint_mouse_move(Window *win, int x, int y, int b) {
-  if (b & 1)
-    paint_draw_action(x, y);
+  PaintState *p = (PaintState *)win->app_data;
+  int cx = x - PAINT_X, cy = y - PAINT_Y;
+  int inside = cx >= 0 && cx < p->w && cy >= 0 && cy < p->h;
+  if (!(b & 1) || p->fill || !p->pixels) {
+    p->drawing = 0;
+    return;
+  }
+  if (p->drawing) {
+    // Segments may leave the canvas; paint_dab clips
+    paint_line(p, p->last_x, p->last_y, cx, cy);
+  } else if (inside) {
+    paint_dab(p, cx, cy);
+    p->drawing = 1;
+  } else {
+    return;
+  }
+  p->last_x = cx;
+  p->last_y = cy;
 }
 
 void paint_key(Window *win, char c) {
+  PaintState *p = (PaintState *)win->app_data;
+  if (!p->pixels)
+    return;
   if (c == 'c' || c == 'C')
-    paint_reset();
+    paint_clear(p);
+  else if (c == 'f' || c == 'F')
+    p->fill = !p->fill;
+  else if (c >= '1' && c <= '3')
+    p->brush = c - '1';
+}
+
+static void paint_close(Window *win) {
+  PaintState *p = (PaintState *)win->app_data;
+  kfree(p->pixels);
+  kfree(p);
 }
 
 void start_paint() {
-  Window *w = create_window(250, 250, 240, 220, "Paint");
-  if (w) {
-    w->on_paint = paint_paint;
-    w->on_click = paint_click;
-    w->on_mouse_move = paint_mouse_move;
-    w->on_key = paint_key;
+  PaintState *p = kzalloc(sizeof(PaintState));
+  if (!p)
+    return;
+  Window *w = create_window(250, 150, 400, 340, "Paint");
+  if (!w) {
+    kfree(p);
+    return;
   }
+  w->app_data = p;
+  w->on_close = paint_close;
+  paint_fit(p, w);
+  w->on_paint = paint_paint;
+  w->on_click = paint_click;
+  w->on_mouse_move = paint_mouse_move;
+  w->on_key = paint_key;
+  wm_open(w);
 }
 
 // --- ABOUT APP ---
@@ -835,27 +1854,54 @@ void start_about() {
   Window *w = create_window(250, 200, 400, 200, "About GemOS");
   if (w) {
     w->on_paint = about_paint;
+    w->tile_safe = 1;
+    wm_open(w);
   }
 }
 
-void start_snake() {
-  snake_reset();
-  Window *w = create_window(200, 150, 320, 240, "Snake");
-  if (w) {
-    w->on_paint = snake_paint;
-    w->on_key = snake_key;
-  }
+static void note_free(NotepadState *n) {
+  kfree(n->buf);
+  kfree(n->lines);
+  kfree(n);
+}
+
+static void note_close(Window *win) { note_free(win->app_data); }
+
+// One-shot tick: reads the file on the window's own thread, not in
+// whatever context launched the app
+static void note_first_load(Window *win) {
+  wm_set_tick(win, 0, 0);
+  note_load((NotepadState *)win->app_data);
 }
 
 void start_notepad() {
-  note_state.cursor = 0;
-  note_state.buffer[0] = 0;
-  note_state.scroll_y = 0;
-  Window *w = create_window(50, 400, 300, 200, "Notes");
-  if (w) {
-    w->on_paint = note_paint;
-    w->on_key = note_key;
+  NotepadState *n = kzalloc(sizeof(NotepadState));
+  if (!n)
+    return;
+  if (note_set_text(n, 0, 0)) {
+    kfree(n);
+    return;
+  }
+  Window *w = create_window(50, 300, 420, 300, "Notes");
+  if (!w) {
+    note_free(n);
+    return;
   }
+  int i = 0;
+  for (const char *p = NOTE_DEFAULT_PATH; *p; p++)
+    n->path[i++] = *p;
+  n->status = "Ctrl+S save";
+  w->app_data = n;
+  w->on_close = note_close;
+  w->on_paint = note_paint;
+  w->tile_safe = 1;
+  w->on_click = note_click;
+  w->on_key = note_key;
+  if (fat32_mounted()) {
+    n->status = "Loading";
+    wm_set_tick(w, note_first_load, 1);
+  }
+  wm_open(w);
 }
 
 // --- SETTINGS APP ---
@@ -900,15 +1946,221 @@ void start_settings() {
   Window *w = create_window(300, 300, 250, 250, "Settings");
   if (w) {
     w->on_paint = settings_paint;
+    w->tile_safe = 1;
     w->on_click = settings_click;
+    wm_open(w);
   }
 }
 
-#include "gemlang.h"
+// --- DISK CACHE (diagnostics) ---
+
+
+static void cache_line(Window *win, int row, char *label, uint32_t value,
+                       char *unit) {
+  char num[16];
+  int_to_str((int)value, num);
+  int y = win->y + 35 + row * 18;
+  draw_string(win->x + 15, y, label, 0x000000);
+  draw_string(win->x + 140, y, num, 0x000000);
+  int len = 0;
+  while (num[len])
+    len++;
+  draw_string(win->x + 148 + len * 8, y, unit, 0x404040);
+}
+
+// a * 100 / b without overflowing 32 bits
+static uint32_t cache_percent(uint32_t a, uint32_t b) {
+  while (a > 40000000) {
+    a >>= 1;
+    b >>= 1;
+  }
+  return b ? a * 100 / b : 0;
+}
+
+void cache_stats_paint(Window *win) {
+  BcacheStats s;
+  bcache_get_stats(&s);
+  uint32_t hit_pct = cache_percent(s.hits, s.hits + s.misses);
+  uint32_t ra_pct = cache_percent(s.readahead_hits, s.readahead);
+
+  cache_line(win, 0, "Size", s.buffers * (BCACHE_BLOCK_SIZE / 1024), "KB");
+  cache_line(win, 1, "In use", s.used, "blocks");
+  cache_line(win, 2, "Dirty", s.dirty, "blocks");
+  cache_line(win, 3, "Hits", s.hits, "");
+  cache_line(win, 4, "Misses", s.misses, "");
+  cache_line(win, 5, "Hit rate", hit_pct, "%");
+  cache_line(win, 6, "Read-ahead", s.readahead, "blocks");
+  cache_line(win, 7, "RA used", ra_pct, "%");
+  cache_line(win, 8, "Evictions", s.evictions, "");
+  cache_line(win, 9, "Writebacks", s.writebacks, "");
+
+  // Hit rate bar
+  int bar_y = win->y + win->height - 25;
+  draw_rect(win->x + 15, bar_y, 220, 12, 0x808080);
+  draw_rect(win->x + 16, bar_y + 1, (218 * hit_pct) / 100, 10, 0x00A000);
+}
+
+// The numbers change without any input: keep drag frames repainting it
+static void cache_stats_tick(Window *win) { wm_invalidate(win); }
+
+void start_cache_stats() {
+  Window *w = create_window(420, 120, 250, 240, "Disk Cache");
+  if (w) {
+    w->on_paint = cache_stats_paint;
+    w->tile_safe = 1;
+    wm_set_tick(w, cache_stats_tick, 500);
+    wm_open(w);
+  }
+}
+
+// --- APP REGISTRY ---
+
+
+static AppEntry app_table[MAX_APPS];
+static int app_total = 0;
+
+static int app_name_eq(const char *a, const char *b) {
+  while (*a && (*a | 32) == (*b | 32)) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+static AppEntry *app_new(const char *name) {
+  for (int i = 0; i < app_total; i++) {
+    if (app_name_eq(app_table[i].name, name))
+      return 0; // First one wins (boot module over disk copy)
+  }
+  if (app_total >= MAX_APPS)
+    return 0;
+  AppEntry *a = &app_table[app_total++];
+  memset(a, 0, sizeof(AppEntry));
+  int i = 0;
+  while (name[i] && i < APP_NAME_LEN - 1) {
+    a->name[i] = name[i];
+    i++;
+  }
+  a->name[i] = 0;
+  return a;
+}
+
+void app_register(const char *name, void (*start)()) {
+  AppEntry *a = app_new(name);
+  if (a)
+    a->start = start;
+}
+
+AppEntry *app_register_gem(const char *file, char *source, uint32_t len) {
+  // Base name without directory, arguments or the .gem/.gemc extension
+  const char *base = file;
+  int end = 0;
+  for (int i = 0; file[i] && file[i] != ' '; i++) {
+    if (file[i] == '/')
+      base = file + i + 1;
+    end = i + 1;
+  }
+  int n = (file + end) - base;
+  for (int i = n - 1; i > 0; i--) {
+    if (base[i] == '.') {
+      n = i;
+      break;
+    }
+  }
+  char name[APP_NAME_LEN];
+  if (n > APP_NAME_LEN - 1)
+    n = APP_NAME_LEN - 1;
+  for (int i = 0; i < n; i++)
+    name[i] = base[i];
+  name[n] = 0;
+
+  AppEntry *a = app_new(name);
+  if (!a)
+    return 0;
+  a->source = source;
+  a->source_len = len;
+  if (!source) {
+    for (int i = 0; i < end && i < (int)sizeof(a->path) - 1; i++)
+      a->path[i] = file[i];
+  }
+  return a;
+}
+
+int app_count() { return app_total; }
+
+AppEntry *app_get(int index) {
+  if (index < 0 || index >= app_total)
+    return 0;
+  return &app_table[index];
+}
+
+void app_launch(int index) {
+  AppEntry *a = app_get(index);
+  if (!a)
+    return;
+  if (a->start) {
+    a->start();
+  } else if (a->source) {
+    run_gem_source(a->source, a->source_len);
+  } else if (a->path[0]) {
+    // Read on every launch, so edits on disk show up without a reboot
+    uint32_t size;
+    char *src = fat32_load(a->path, &size);
+    if (src) {
+      run_gem_source(src, size);
+      kfree(src);
+    }
+  }
+}
+
+// *.gem source, or *.gemc
+static int is_gem_file(const char *name) {
+  int n = 0;
+  while (name[n])
+    n++;
+  if (n > 5 && (name[n - 1] | 32) == 'c')
+    n--;
+  return n > 4 && name[n - 4] == '.' && (name[n - 3] | 32) == 'g' &&
+         (name[n - 2] | 32) == 'e' && (name[n - 1] | 32) == 'm';
+}
+
+static void scan_app_entry(FatDirEntry *e, void *dir) {
+  if ((e->attr & FAT_ATTR_DIRECTORY) || !is_gem_file(e->name))
+    return;
+  char path[64];
+  int n = 0;
+  for (const char *p = (const char *)dir; *p && n < 40; p++)
+    path[n++] = *p;
+  if (n == 0 || path[n - 1] != '/')
+    path[n++] = '/';
+  for (int i = 0; e->name[i] && n < 63; i++)
+    path[n++] = e->name[i];
+  path[n] = 0;
+  app_register_gem(path, 0, 0);
+}
+
+void scan_app_directory(const char *dir) {
+  fat32_list(dir, scan_app_entry, (void *)dir);
+}
+
+void register_archive_apps() {
+  // Sources stay in the archive; nothing is copied
+  for (int i = 0; i < gar_count(); i++) {
+    GarEntry *e = gar_entry(i);
+    if (is_gem_file(e->name))
+      app_register_gem(e->name, gar_data(e), e->size);
+  }
+}
 
+// GemLang extensions are loaded later by the kernel's deferred init
 void init_apps() {
+  app_register("Notepad", start_notepad);
+  app_register("Snake", start_snake);
+  app_register("Paint", start_paint_wrapper);
+  app_register("Calculator", start_calculator);
+  app_register("Solitaire", start_solitaire);
+  app_register("Minesweeper", start_minesweeper);
   start_about();
-  load_extension_apps();
 }
 
 void start_paint_wrapper() { start_paint(); }
@@ -1,11 +1,49 @@
 #ifndef APPS_H
 #define APPS_H
 
+#include "types.h"
+
+// --- App Registry ---
+// Everything the Apps menu lists: built-in C apps plus GemLang bundles
+// found at boot (app archive, boot modules, /apps on disk).
+
+#define MAX_APPS 32
+#define APP_NAME_LEN 32
+
+typedef struct {
+  char name[APP_NAME_LEN];
+  void (*start)(); // Built-in app
+
+  // GemLang app: source already in memory, or a file loaded on launch
+  char *source;
+  uint32_t source_len;
+  char path[64];
+} AppEntry;
+
+void app_register(const char *name, void (*start)());
+// The menu name comes from the file name ("/apps/calc.gem" -> "calc")
+AppEntry *app_register_gem(const char *file, char *source, uint32_t len);
+int app_count();
+AppEntry *app_get(int index);
+void app_launch(int index);
+
+// Register every *.gem in a directory of the mounted filesystem
+void scan_app_directory(const char *dir);
+// Register every *.gem / *.gemc in the app archive
+void register_archive_apps();
+
 void init_apps();
+
+// Snake board size in cells
+#define SNAKE_COLS 30
+#define SNAKE_ROWS 20
+
 void start_snake();
+void start_snake_board(int cols, int rows);
 void start_notepad();
 void start_about();
 void start_minesweeper();
+void start_minesweeper_level(int level); // 0-2, small to 200x200
 void start_solitaire();
 void start_calculator();
 void start_paint();
@@ -15,5 +53,6 @@ void start_solitaire();
 void start_calculator();
 void start_paint_wrapper();
 void start_settings_wrapper();
+void start_cache_stats();
 
 #endif
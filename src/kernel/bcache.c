@@ -0,0 +1,459 @@
+#include "bcache.h"
+#include "../drivers/io.h"
+#include "../drivers/serial.h"
+#include "lock.h"
+#include "memory.h"
+#include "timeline.h"
+
+// Cache size: an eighth of the heap, within these bounds (in blocks)
+#define BCACHE_MIN_BUFFERS 64    // 256KB
+#define BCACHE_MAX_BUFFERS 4096  // 16MB
+#define BCACHE_HEAP_SHARE 8
+
+// Read-ahead window (in blocks). Doubles each time the reader catches up,
+// never more than a quarter of the cache.
+#define RA_MIN 4
+#define RA_MAX 64
+
+static Buffer *buffers;
+static uint32_t buffer_count = 0;
+static Buffer **hash_table;
+static uint32_t hash_mask;
+static Buffer *lru_head, *lru_tail;
+static BcacheStats stats;
+
+// Everything below, for any thread. Held across disk waits, so it sleeps.
+static Mutex bcache_lock = MUTEX_INIT("bcache");
+
+// One sequential stream detector per device
+typedef struct {
+  BlockDevice *dev;
+  uint32_t last;   // Last block accessed
+  uint32_t ra_end; // First block not yet prefetched
+  uint32_t window;
+} RaStream;
+
+static RaStream streams[MAX_BLOCK_DEVICES];
+
+void init_bcache() {
+  uint32_t n = heap_size() / BCACHE_HEAP_SHARE / BCACHE_BLOCK_SIZE;
+  if (n < BCACHE_MIN_BUFFERS)
+    n = BCACHE_MIN_BUFFERS;
+  if (n > BCACHE_MAX_BUFFERS)
+    n = BCACHE_MAX_BUFFERS;
+
+  // Small heaps: back off until it fits
+  uint8_t *data = 0;
+  while (n >= BCACHE_MIN_BUFFERS / 4) {
+    data = kmalloc_aligned(n * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+    if (data)
+      break;
+    n /= 2;
+  }
+  buffers = kzalloc(n * sizeof(Buffer));
+  uint32_t buckets = 1;
+  while (buckets < n)
+    buckets <<= 1;
+  hash_table = kzalloc(buckets * sizeof(Buffer *));
+  if (!data || !buffers || !hash_table)
+    return;
+  hash_mask = buckets - 1;
+
+  // Every buffer sits on the LRU list, empty ones at the tail
+  for (uint32_t i = 0; i < n; i++) {
+    Buffer *b = &buffers[i];
+    b->data = data + i * BCACHE_BLOCK_SIZE;
+    b->lru_prev = i > 0 ? &buffers[i - 1] : 0;
+    b->lru_next = i + 1 < n ? &buffers[i + 1] : 0;
+  }
+  lru_head = &buffers[0];
+  lru_tail = &buffers[n - 1];
+  buffer_count = n;
+  stats.buffers = n;
+
+  serial_write("[bcache] ");
+  serial_write_dec(n * (BCACHE_BLOCK_SIZE / 1024));
+  serial_write(" KB\n");
+}
+
+// --- Hash / LRU ---
+
+static uint32_t bcache_hash(BlockDevice *dev, uint32_t block) {
+  return (((uint32_t)dev >> 4) ^ (block * 2654435761u)) & hash_mask;
+}
+
+static Buffer *bcache_lookup(BlockDevice *dev, uint32_t block) {
+  Buffer *b = hash_table[bcache_hash(dev, block)];
+  while (b && !(b->dev == dev && b->block == block))
+    b = b->hash_next;
+  return b;
+}
+
+static void bcache_unhash(Buffer *buf) {
+  Buffer **pp = &hash_table[bcache_hash(buf->dev, buf->block)];
+  while (*pp && *pp != buf)
+    pp = &(*pp)->hash_next;
+  if (*pp)
+    *pp = buf->hash_next;
+  buf->hash_next = 0;
+}
+
+static void lru_unlink(Buffer *b) {
+  if (b->lru_prev)
+    b->lru_prev->lru_next = b->lru_next;
+  else
+    lru_head = b->lru_next;
+  if (b->lru_next)
+    b->lru_next->lru_prev = b->lru_prev;
+  else
+    lru_tail = b->lru_prev;
+}
+
+static void lru_touch(Buffer *b) {
+  if (b == lru_head)
+    return;
+  lru_unlink(b);
+  b->lru_prev = 0;
+  b->lru_next = lru_head;
+  lru_head->lru_prev = b;
+  lru_head = b;
+}
+
+// --- I/O ---
+
+static uint32_t bcache_block_sectors(Buffer *b) {
+  uint32_t first = b->block * BCACHE_SECTORS;
+  uint32_t left = b->dev->sector_count - first;
+  return left < BCACHE_SECTORS ? left : BCACHE_SECTORS;
+}
+
+static void bcache_submit(Buffer *b, int write) {
+  b->req.lba = b->block * BCACHE_SECTORS;
+  b->req.count = bcache_block_sectors(b);
+  b->req.buffer = b->data;
+  b->req.write = write;
+  b->req.on_done = 0;
+  b->req.private_data = b;
+  b->io = 1;
+  block_submit(b->dev, &b->req);
+}
+
+// Settle a finished asynchronous read. With wait set, block until it is.
+static void bcache_finish_io(Buffer *b, int wait) {
+  if (!b->io)
+    return;
+  if (!b->req.done) {
+    if (!wait)
+      return;
+    block_wait(&b->req);
+  }
+  b->io = 0;
+  if (!b->req.write)
+    b->valid = b->req.status == 0;
+}
+
+// Reclaim the least recently used idle buffer. Dirty victims are written
+// back first, which waits on the device, so callers holding a plug pass
+// allow_dirty = 0.
+static Buffer *bcache_evict(int allow_dirty) {
+  for (Buffer *b = lru_tail; b; b = b->lru_prev) {
+    bcache_finish_io(b, 0);
+    if (b->refs > 0 || b->io || (b->dirty && !allow_dirty))
+      continue;
+    if (b->dev) {
+      if (b->dirty) {
+        bcache_submit(b, 1);
+        bcache_finish_io(b, 1);
+        b->dirty = 0;
+        stats.dirty--;
+        stats.writebacks++;
+      }
+      bcache_unhash(b);
+      stats.evictions++;
+      stats.used--;
+    }
+    b->dev = 0;
+    b->valid = 0;
+    b->prefetch = 0;
+    return b;
+  }
+  return 0;
+}
+
+static Buffer *bcache_claim(BlockDevice *dev, uint32_t block,
+                           int allow_dirty) {
+  Buffer *b = bcache_evict(allow_dirty);
+  if (!b)
+    return 0;
+  b->dev = dev;
+  b->block = block;
+  uint32_t h = bcache_hash(dev, block);
+  b->hash_next = hash_table[h];
+  hash_table[h] = b;
+  stats.used++;
+  return b;
+}
+
+// --- Read-ahead ---
+
+static RaStream *bcache_stream(BlockDevice *dev) {
+  RaStream *free_slot = 0;
+  for (int i = 0; i < MAX_BLOCK_DEVICES; i++) {
+    if (streams[i].dev == dev)
+      return &streams[i];
+    if (!streams[i].dev && !free_slot)
+      free_slot = &streams[i];
+  }
+  if (free_slot) {
+    free_slot->dev = dev;
+    free_slot->last = 0xFFFFFFFF;
+  }
+  return free_slot;
+}
+
+// Called on every access. Keeps at least half a window of blocks in flight
+// ahead of a sequential reader; any jump resets the window.
+static void bcache_readahead(BlockDevice *dev, uint32_t block) {
+  RaStream *s = bcache_stream(dev);
+  if (!s)
+    return;
+  if (block == s->last)
+    return; // Same block again (sector-sized reads)
+  if (block != s->last + 1) {
+    s->last = block;
+    s->window = 0;
+    s->ra_end = block + 1;
+    return;
+  }
+  s->last = block;
+  if (s->ra_end > block + s->window / 2)
+    return; // Still far enough ahead
+
+  uint32_t limit = buffer_count / 4;
+  uint32_t window = s->window ? s->window * 2 : RA_MIN;
+  if (window > RA_MAX)
+    window = RA_MAX;
+  if (window > limit)
+    window = limit;
+  s->window = window;
+
+  uint32_t blocks = (dev->sector_count + BCACHE_SECTORS - 1) / BCACHE_SECTORS;
+  uint32_t start = s->ra_end > block + 1 ? s->ra_end : block + 1;
+  uint32_t end = block + 1 + window;
+  if (end > blocks)
+    end = blocks;
+
+  for (uint32_t i = start; i < end; i++) {
+    if (bcache_lookup(dev, i))
+      continue;
+    Buffer *b = bcache_claim(dev, i, 0);
+    if (!b)
+      break;
+    b->prefetch = 1;
+    lru_touch(b);
+    bcache_submit(b, 0);
+    stats.readahead++;
+  }
+  s->ra_end = end;
+}
+
+// --- API ---
+
+static Buffer *bcache_get_block(BlockDevice *dev, uint32_t block, int read) {
+  if (!buffer_count ||
+      block >= (dev->sector_count + BCACHE_SECTORS - 1) / BCACHE_SECTORS)
+    return 0;
+
+  Buffer *b = bcache_lookup(dev, block);
+  int miss = !b;
+  if (b) {
+    stats.hits++;
+    if (b->prefetch) {
+      stats.readahead_hits++;
+      b->prefetch = 0;
+    }
+  } else {
+    stats.misses++;
+    b = bcache_claim(dev, block, 1);
+  }
+  if (b) {
+    b->refs++;
+    lru_touch(b);
+  }
+
+  // Demand read and read-ahead go to the driver together, so they can
+  // merge into one command.
+  block_plug(dev);
+  if (b && miss && read)
+    bcache_submit(b, 0);
+  if (read)
+    bcache_readahead(dev, block);
+  block_unplug(dev);
+  if (!b)
+    return 0;
+
+  bcache_finish_io(b, 1);
+  if (read && !b->valid) {
+    // Failed earlier (maybe a read-ahead): one synchronous retry
+    bcache_submit(b, 0);
+    bcache_finish_io(b, 1);
+    if (!b->valid) {
+      bcache_release(b);
+      return 0;
+    }
+  }
+  return b;
+}
+
+Buffer *bcache_get(BlockDevice *dev, uint32_t block) {
+  mutex_lock(&bcache_lock);
+  Buffer *b = bcache_get_block(dev, block, 1);
+  mutex_unlock(&bcache_lock);
+  return b;
+}
+
+void bcache_release(Buffer *buf) {
+  mutex_lock(&bcache_lock);
+  if (buf && buf->refs > 0)
+    buf->refs--;
+  mutex_unlock(&bcache_lock);
+}
+
+void bcache_mark_dirty(Buffer *buf) {
+  mutex_lock(&bcache_lock);
+  if (!buf->dirty) {
+    buf->dirty = 1;
+    stats.dirty++;
+  }
+  buf->valid = 1;
+  mutex_unlock(&bcache_lock);
+}
+
+int bcache_read(BlockDevice *dev, uint32_t lba, uint32_t count, void *out) {
+  uint8_t *dst = (uint8_t *)out;
+  int status = 0;
+  mutex_lock(&bcache_lock);
+  while (count > 0) {
+    uint32_t block = lba / BCACHE_SECTORS;
+    uint32_t first = lba % BCACHE_SECTORS;
+    uint32_t n = BCACHE_SECTORS - first;
+    if (n > count)
+      n = count;
+    Buffer *b = bcache_get(dev, block);
+    if (!b) {
+      status = -1;
+      break;
+    }
+    memcpy(dst, b->data + first * BLOCK_SECTOR_SIZE, n * BLOCK_SECTOR_SIZE);
+    bcache_release(b);
+    dst += n * BLOCK_SECTOR_SIZE;
+    lba += n;
+    count -= n;
+  }
+  mutex_unlock(&bcache_lock);
+  return status;
+}
+
+int bcache_write(BlockDevice *dev, uint32_t lba, uint32_t count,
+                 const void *in) {
+  const uint8_t *src = (const uint8_t *)in;
+  int status = 0;
+  mutex_lock(&bcache_lock);
+  while (count > 0) {
+    uint32_t block = lba / BCACHE_SECTORS;
+    uint32_t first = lba % BCACHE_SECTORS;
+    uint32_t n = BCACHE_SECTORS - first;
+    if (n > count)
+      n = count;
+    // A whole-block overwrite does not need the old contents
+    Buffer *b = bcache_get_block(dev, block, n != BCACHE_SECTORS);
+    if (!b) {
+      status = -1;
+      break;
+    }
+    memcpy(b->data + first * BLOCK_SECTOR_SIZE, src, n * BLOCK_SECTOR_SIZE);
+    bcache_mark_dirty(b);
+    bcache_release(b);
+    src += n * BLOCK_SECTOR_SIZE;
+    lba += n;
+    count -= n;
+  }
+  mutex_unlock(&bcache_lock);
+  return status;
+}
+
+int bcache_sync(BlockDevice *dev) {
+  // Queue every dirty block at once; the block layer sorts and merges
+  int status = 0;
+  mutex_lock(&bcache_lock);
+  for (uint32_t i = 0; i < buffer_count; i++)
+    bcache_finish_io(&buffers[i], 1);
+  for (uint32_t i = 0; i < buffer_count; i++) {
+    Buffer *b = &buffers[i];
+    if (b->dirty && (!dev || b->dev == dev)) {
+      block_plug(b->dev);
+      bcache_submit(b, 1);
+    }
+  }
+  for (uint32_t i = 0; i < buffer_count; i++) {
+    if (buffers[i].io)
+      block_unplug(buffers[i].dev);
+  }
+  for (uint32_t i = 0; i < buffer_count; i++) {
+    Buffer *b = &buffers[i];
+    if (!b->io)
+      continue;
+    bcache_finish_io(b, 1);
+    if (b->req.status) {
+      status = -1;
+      continue;
+    }
+    b->dirty = 0;
+    stats.dirty--;
+    stats.writebacks++;
+  }
+  mutex_unlock(&bcache_lock);
+  return status;
+}
+
+void bcache_get_stats(BcacheStats *out) { *out = stats; }
+
+static void bcache_bench_pass(BlockDevice *dev, uint32_t sectors,
+                              uint8_t *buf, const char *label) {
+  uint32_t hits = stats.hits;
+  uint32_t ra = stats.readahead;
+  uint64_t start = rdtsc();
+  for (uint32_t lba = 0; lba + BCACHE_SECTORS <= sectors;
+       lba += BCACHE_SECTORS) {
+    if (bcache_read(dev, lba, BCACHE_SECTORS, buf))
+      break;
+  }
+  uint32_t us = tsc_to_us(rdtsc() - start);
+
+  serial_write("[bcache] ");
+  serial_write(dev->name);
+  serial_write(label);
+  serial_write_dec(us);
+  serial_write(" us, ");
+  serial_write_dec(stats.hits - hits);
+  serial_write(" hits, ");
+  serial_write_dec(stats.readahead - ra);
+  serial_write(" blocks read ahead\n");
+}
+
+void bcache_benchmark(BlockDevice *dev, uint32_t sectors) {
+  if (!buffer_count)
+    return;
+  if (sectors > dev->sector_count)
+    sectors = dev->sector_count;
+  // Keep the warm pass inside the cache
+  if (sectors > buffer_count / 2 * BCACHE_SECTORS)
+    sectors = buffer_count / 2 * BCACHE_SECTORS;
+  uint8_t *buf = kmalloc(BCACHE_BLOCK_SIZE);
+  if (!buf)
+    return;
+  timeline_calibrate();
+  bcache_bench_pass(dev, sectors, buf, ": cold ");
+  bcache_bench_pass(dev, sectors, buf, ": warm ");
+  kfree(buf);
+}
@@ -0,0 +1,66 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "block.h"
+#include "types.h"
+
+// Buffer cache between filesystems and block drivers. Caches whole 4KB
+// blocks (8 sectors), looked up by (device, block) in a hash table and
+// recycled in LRU order. Writes are held back until eviction or
+// bcache_sync. Sequential misses trigger asynchronous read-ahead with a
+// window that grows while the pattern holds. Thread context only: calls
+// take a sleeping lock and may wait for the disk.
+
+#define BCACHE_BLOCK_SIZE 4096
+#define BCACHE_SECTORS (BCACHE_BLOCK_SIZE / BLOCK_SECTOR_SIZE)
+
+typedef struct Buffer {
+  BlockDevice *dev;
+  uint32_t block; // In BCACHE_BLOCK_SIZE units
+  uint8_t *data;
+  int valid;
+  int dirty;
+  int refs;     // Pinned while > 0
+  int io;       // Read in flight
+  int prefetch; // Brought in by read-ahead, not used yet
+
+  struct Buffer *hash_next;
+  struct Buffer *lru_prev, *lru_next; // Head = most recently used
+  BlockRequest req;
+} Buffer;
+
+typedef struct {
+  uint32_t buffers;
+  uint32_t used; // Buffers holding a block
+  uint32_t dirty;
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t readahead;      // Blocks prefetched
+  uint32_t readahead_hits; // Prefetched blocks later used
+  uint32_t evictions;
+  uint32_t writebacks;
+} BcacheStats;
+
+// Sized from available RAM. Safe to call before any disk exists.
+void init_bcache();
+
+// Pin a block, reading it if needed. Returns 0 on I/O error.
+Buffer *bcache_get(BlockDevice *dev, uint32_t block);
+void bcache_release(Buffer *buf);
+void bcache_mark_dirty(Buffer *buf);
+
+// Sector-granular helpers for filesystems. Return 0 on success.
+int bcache_read(BlockDevice *dev, uint32_t lba, uint32_t count, void *out);
+int bcache_write(BlockDevice *dev, uint32_t lba, uint32_t count,
+                 const void *in);
+
+// Write back every dirty block of dev (all devices if dev is 0)
+int bcache_sync(BlockDevice *dev);
+
+void bcache_get_stats(BcacheStats *out);
+
+// Read `sectors` from LBA 0 through the cache in 4KB steps, twice (cold,
+// then warm), and print timings and cache stats on COM1
+void bcache_benchmark(BlockDevice *dev, uint32_t sectors);
+
+#endif
@@ -0,0 +1,277 @@
+#include "block.h"
+#include "../drivers/io.h"
+#include "../drivers/serial.h"
+#include "memory.h"
+#include "sched.h"
+#include "timeline.h"
+#include "trace.h"
+
+static BlockDevice *devices[MAX_BLOCK_DEVICES];
+static int device_count = 0;
+
+void block_register(BlockDevice *dev) {
+  if (device_count < MAX_BLOCK_DEVICES)
+    devices[device_count++] = dev;
+}
+
+int block_device_count() { return device_count; }
+
+BlockDevice *block_device(int index) {
+  if (index < 0 || index >= device_count)
+    return 0;
+  return devices[index];
+}
+
+// --- Queue ---
+
+void block_submit(BlockDevice *dev, BlockRequest *req) {
+  req->done = 0;
+  req->status = 0;
+
+  uint32_t flags = irq_save();
+  dev->stats.requests++;
+
+  // Sorted insert by LBA (stable: equal LBAs keep submission order)
+  BlockRequest **pp = &dev->queue;
+  while (*pp && (*pp)->lba <= req->lba)
+    pp = &(*pp)->next;
+  req->next = *pp;
+  *pp = req;
+
+  if (!dev->plugged)
+    dev->start(dev);
+  irq_restore(flags);
+}
+
+void block_plug(BlockDevice *dev) {
+  uint32_t flags = irq_save();
+  dev->plugged++;
+  irq_restore(flags);
+}
+
+void block_unplug(BlockDevice *dev) {
+  uint32_t flags = irq_save();
+  if (dev->plugged > 0 && --dev->plugged == 0 && dev->queue)
+    dev->start(dev);
+  irq_restore(flags);
+}
+
+void block_wait(BlockRequest *req) {
+  // Check and sleep atomically. A thread sleeps until block_complete wakes
+  // it; before threads exist, sti takes effect after hlt starts, so a
+  // completion IRQ can't slip in between and leave us halted.
+  uint32_t flags = irq_save();
+  while (!req->done) {
+    if (current_thread()) {
+      sched_sleep(req, 0);
+    } else {
+      __asm__ volatile("sti; hlt");
+      cli();
+    }
+  }
+  irq_restore(flags);
+}
+
+#define BLOCK_RW_BATCH 16
+
+int block_rw(BlockDevice *dev, uint32_t lba, uint32_t count, void *buffer,
+             int write) {
+  BlockRequest reqs[BLOCK_RW_BATCH];
+  uint8_t *buf = (uint8_t *)buffer;
+  int status = 0;
+
+  while (count > 0) {
+    int n = 0;
+    block_plug(dev);
+    while (count > 0 && n < BLOCK_RW_BATCH) {
+      uint32_t chunk = count < dev->max_sectors ? count : dev->max_sectors;
+      BlockRequest *r = &reqs[n++];
+      r->lba = lba;
+      r->count = chunk;
+      r->buffer = buf;
+      r->write = write;
+      r->on_done = 0;
+      block_submit(dev, r);
+      lba += chunk;
+      count -= chunk;
+      buf += chunk * BLOCK_SECTOR_SIZE;
+    }
+    block_unplug(dev);
+    for (int i = 0; i < n; i++) {
+      block_wait(&reqs[i]);
+      if (reqs[i].status)
+        status = -1;
+    }
+  }
+  return status;
+}
+
+// --- Driver Side ---
+
+BlockRequest *block_next_batch(BlockDevice *dev, uint32_t *lba,
+                               uint32_t *count, int *write) {
+  if (!dev->queue)
+    return 0;
+
+  // C-LOOK: first request at or beyond the head, else wrap to the lowest
+  BlockRequest **pp = &dev->queue;
+  while (*pp && (*pp)->lba < dev->head_lba)
+    pp = &(*pp)->next;
+  if (!*pp)
+    pp = &dev->queue;
+
+  BlockRequest *first = *pp;
+  *pp = first->next;
+  first->next = 0;
+
+  // Merge followers that continue exactly where the batch ends. The queue
+  // is sorted, so candidates are right behind the request we took.
+  BlockRequest *tail = first;
+  uint32_t end = first->lba + first->count;
+  uint32_t total = first->count;
+  uint32_t segments = 1;
+  while (*pp && (*pp)->lba == end && (*pp)->write == first->write &&
+         total + (*pp)->count <= dev->max_sectors &&
+         segments < dev->max_segments) {
+    BlockRequest *r = *pp;
+    *pp = r->next;
+    r->next = 0;
+    tail->next = r;
+    tail = r;
+    end += r->count;
+    total += r->count;
+    segments++;
+    dev->stats.merged++;
+  }
+
+  dev->head_lba = end;
+  dev->stats.commands++;
+  *lba = first->lba;
+  *count = total;
+  *write = first->write;
+  return first;
+}
+
+void block_complete(BlockDevice *dev, BlockRequest *batch, int status,
+                    uint64_t start_tsc) {
+  dev->stats.busy_tsc += rdtsc() - start_tsc;
+  if (status)
+    dev->stats.errors++;
+  uint32_t first_lba = batch ? batch->lba : 0, sectors = 0;
+
+  while (batch) {
+    BlockRequest *next = batch->next;
+    sectors += batch->count;
+    uint64_t bytes = (uint64_t)batch->count * BLOCK_SECTOR_SIZE;
+    if (batch->write)
+      dev->stats.bytes_written += bytes;
+    else
+      dev->stats.bytes_read += bytes;
+    batch->status = status;
+    batch->done = 1;
+    if (batch->on_done)
+      batch->on_done(batch);
+    sched_wakeup(batch); // A thread in block_wait
+    batch = next;
+  }
+  trace(TRACE_DISK, TRACE_DISK_DONE, first_lba, sectors, status);
+}
+
+// --- Diagnostics ---
+
+// "12.3 MB/s" from a byte count and a duration
+static void write_rate(uint64_t bytes, uint32_t us) {
+  if (us == 0)
+    us = 1;
+  uint32_t tenths = udiv64(bytes * 10, us); // bytes/us == MB/s
+  serial_write_dec(tenths / 10);
+  serial_putc('.');
+  serial_write_dec(tenths % 10);
+  serial_write(" MB/s");
+}
+
+#define BENCH_REQUEST_SECTORS 8 // Page sized requests, so merging matters
+
+void block_benchmark(BlockDevice *dev, uint32_t sectors) {
+  if (sectors > dev->sector_count)
+    sectors = dev->sector_count;
+  uint32_t n = sectors / BENCH_REQUEST_SECTORS;
+  if (n == 0)
+    return;
+
+  uint8_t *buf = kmalloc(n * BENCH_REQUEST_SECTORS * BLOCK_SECTOR_SIZE);
+  BlockRequest *reqs = kmalloc(n * sizeof(BlockRequest));
+  if (!buf || !reqs) {
+    kfree(buf);
+    kfree(reqs);
+    return;
+  }
+
+  uint32_t merged_before = dev->stats.merged;
+  uint32_t commands_before = dev->stats.commands;
+  uint32_t notifies_before = dev->stats.notifies;
+  uint32_t interrupts_before = dev->stats.interrupts;
+  timeline_calibrate();
+  uint64_t start = rdtsc();
+
+  // Queue everything up front, as read-ahead would
+  block_plug(dev);
+  for (uint32_t i = 0; i < n; i++) {
+    reqs[i].lba = i * BENCH_REQUEST_SECTORS;
+    reqs[i].count = BENCH_REQUEST_SECTORS;
+    reqs[i].buffer = buf + i * BENCH_REQUEST_SECTORS * BLOCK_SECTOR_SIZE;
+    reqs[i].write = 0;
+    reqs[i].on_done = 0;
+    block_submit(dev, &reqs[i]);
+  }
+  block_unplug(dev);
+  for (uint32_t i = 0; i < n; i++)
+    block_wait(&reqs[i]);
+
+  uint32_t us = tsc_to_us(rdtsc() - start);
+  uint64_t bytes = (uint64_t)n * BENCH_REQUEST_SECTORS * BLOCK_SECTOR_SIZE;
+
+  serial_write("[blk] ");
+  serial_write(dev->name);
+  serial_write(": read ");
+  serial_write_dec((uint32_t)(bytes >> 10));
+  serial_write(" KB in ");
+  serial_write_dec(us);
+  serial_write(" us = ");
+  write_rate(bytes, us);
+  serial_write(", ");
+  serial_write_dec(n);
+  serial_write(" requests, ");
+  serial_write_dec(dev->stats.merged - merged_before);
+  serial_write(" merged into ");
+  serial_write_dec(dev->stats.commands - commands_before);
+  serial_write(" commands, ");
+  serial_write_dec(dev->stats.notifies - notifies_before);
+  serial_write(" notifies, ");
+  serial_write_dec(dev->stats.interrupts - interrupts_before);
+  serial_write(" interrupts\n");
+
+  kfree(reqs);
+  kfree(buf);
+}
+
+void block_report(BlockDevice *dev) {
+  BlockStats *s = &dev->stats;
+  serial_write("[blk] ");
+  serial_write(dev->name);
+  serial_write(": ");
+  serial_write_dec(dev->sector_count / 2048);
+  serial_write(" MB, ");
+  serial_write_dec(s->requests);
+  serial_write(" requests, ");
+  serial_write_dec(s->merged);
+  serial_write(" merged, ");
+  serial_write_dec(s->commands);
+  serial_write(" commands, ");
+  serial_write_dec(s->interrupts);
+  serial_write(" interrupts, ");
+  serial_write_dec(s->errors);
+  serial_write(" errors, ");
+  write_rate(s->bytes_read + s->bytes_written, tsc_to_us(s->busy_tsc));
+  serial_write(" while busy\n");
+}
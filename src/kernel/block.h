@@ -0,0 +1,92 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "types.h"
+
+// Generic block device layer. Drivers (ATA, ...) register a BlockDevice and
+// pull work from its request queue; callers never talk to a driver directly.
+
+#define BLOCK_SECTOR_SIZE 512
+#define MAX_BLOCK_DEVICES 8
+
+typedef struct BlockRequest {
+  uint32_t lba;
+  uint32_t count; // Sectors, at most dev->max_sectors
+  void *buffer;
+  int write;
+  volatile int done;
+  int status; // 0 = OK, -1 = I/O error
+
+  // Optional completion callback (runs in IRQ context)
+  void (*on_done)(struct BlockRequest *req);
+  void *private_data;
+
+  struct BlockRequest *next; // Queue link, then batch link once dispatched
+} BlockRequest;
+
+typedef struct {
+  uint32_t requests;  // Submitted by callers
+  uint32_t merged;    // Folded into a neighbour's command
+  uint32_t commands;  // Commands issued to the hardware
+  uint32_t errors;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t busy_tsc;  // Time the device spent on commands
+  uint32_t notifies;  // Doorbell writes / commands kicked off
+  uint32_t interrupts;
+} BlockStats;
+
+typedef struct BlockDevice {
+  char name[8];
+  uint32_t sector_count;
+  uint32_t max_sectors;  // Largest single command
+  uint32_t max_segments; // Most requests one command can scatter into
+
+  // Driver hook: start queued work if the hardware is idle. Called with
+  // interrupts disabled, from submit or from the completion IRQ.
+  void (*start)(struct BlockDevice *dev);
+  void *driver_data;
+
+  BlockRequest *queue; // Pending, sorted by LBA
+  int plugged;         // While > 0, submits queue up without kicking start
+  uint32_t head_lba;   // Elevator position (end of last dispatched batch)
+  BlockStats stats;
+} BlockDevice;
+
+void block_register(BlockDevice *dev);
+int block_device_count();
+BlockDevice *block_device(int index);
+
+// Asynchronous: queue the request and kick the driver
+void block_submit(BlockDevice *dev, BlockRequest *req);
+void block_wait(BlockRequest *req);
+
+// Hold back dispatch while queueing a burst, so the driver sees it all at
+// once: more merging, and one doorbell for many requests. Nests.
+void block_plug(BlockDevice *dev);
+void block_unplug(BlockDevice *dev);
+
+// Synchronous helper. Splits large transfers and queues them all at once so
+// the driver can merge them. Returns 0 on success.
+int block_rw(BlockDevice *dev, uint32_t lba, uint32_t count, void *buffer,
+             int write);
+
+// --- Driver side ---
+
+// Take the next batch in elevator (C-LOOK) order: one request plus any
+// queued requests directly following it on disk in the same direction.
+// Returns a chain linked through `next`, or 0 when the queue is empty.
+BlockRequest *block_next_batch(BlockDevice *dev, uint32_t *lba,
+                               uint32_t *count, int *write);
+
+// Finish a batch returned by block_next_batch (IRQ or polled context)
+void block_complete(BlockDevice *dev, BlockRequest *batch, int status,
+                    uint64_t start_tsc);
+
+// --- Diagnostics ---
+
+// Time a sequential read of `sectors` from LBA 0 and print the stats
+void block_benchmark(BlockDevice *dev, uint32_t sectors);
+void block_report(BlockDevice *dev);
+
+#endif
@@ -0,0 +1,1025 @@
+#include "fat32.h"
+#include "../drivers/serial.h"
+#include "bcache.h"
+#include "lock.h"
+#include "memory.h"
+
+#define FAT_EOC 0x0FFFFFF8 // Entries at or above end a chain
+#define FAT_EOC_MARK 0x0FFFFFFF
+#define FAT_FREE 0
+#define FAT_DIRENT_SIZE 32
+#define FAT_DELETED 0xE5
+#define FAT_NT_LOWER_BASE 0x08
+#define FAT_NT_LOWER_EXT 0x10
+
+// Reads at least this large and sector aligned skip the buffer cache and
+// go to the device as one multi-cluster request
+#define FAT_DIRECT_MIN (16 * 1024)
+
+typedef struct {
+  BlockDevice *dev;
+  uint32_t part_lba;
+  uint32_t sectors_per_cluster;
+  uint32_t cluster_bytes;
+  uint32_t fat_lba;
+  uint32_t fat_count;
+  uint32_t fat_sectors;
+  uint32_t data_lba;
+  uint32_t root_cluster;
+  uint32_t cluster_count; // Data clusters are numbered 2..cluster_count+1
+  uint32_t fsinfo_lba;    // 0 = none
+  uint32_t next_free;
+  uint32_t free_count; // 0xFFFFFFFF = unknown
+  int fsinfo_dirty;
+} FatVolume;
+
+static FatVolume vol;
+static int mounted = 0;
+
+// Volume, FAT, directory indexes and open files' chains. The public
+// entry points (at the end) take it; everything else runs under it.
+static Mutex fs_lock = MUTEX_INIT("fat32");
+
+static uint16_t rd16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t rd32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static void wr16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+static void wr32(uint8_t *p, uint32_t v) {
+  wr16(p, v);
+  wr16(p + 2, v >> 16);
+}
+
+static char to_lower(char c) { return (c >= 'A' && c <= 'Z') ? c + 32 : c; }
+static char to_upper(char c) { return (c >= 'a' && c <= 'z') ? c - 32 : c; }
+
+static int name_eq(const char *a, const char *b) {
+  while (*a && *b && to_lower(*a) == to_lower(*b)) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+static uint32_t cluster_lba(uint32_t c) {
+  return vol.data_lba + (c - 2) * vol.sectors_per_cluster;
+}
+
+// Copy n bytes at byte `offset` from sector `lba`, through the cache
+static int fat_io(uint32_t lba, uint32_t offset, void *buf, uint32_t n,
+                  int write) {
+  uint8_t *p = (uint8_t *)buf;
+  lba += offset / BLOCK_SECTOR_SIZE;
+  uint32_t block = lba / BCACHE_SECTORS;
+  uint32_t pos = (lba % BCACHE_SECTORS) * BLOCK_SECTOR_SIZE +
+                 offset % BLOCK_SECTOR_SIZE;
+  while (n > 0) {
+    uint32_t chunk = BCACHE_BLOCK_SIZE - pos;
+    if (chunk > n)
+      chunk = n;
+    Buffer *b = bcache_get(vol.dev, block);
+    if (!b)
+      return -1;
+    if (write) {
+      memcpy(b->data + pos, p, chunk);
+      bcache_mark_dirty(b);
+    } else {
+      memcpy(p, b->data + pos, chunk);
+    }
+    bcache_release(b);
+    p += chunk;
+    n -= chunk;
+    pos = 0;
+    block++;
+  }
+  return 0;
+}
+
+// --- FAT ---
+
+static uint32_t fat_get(uint32_t c) {
+  uint8_t v[4];
+  if (fat_io(vol.fat_lba, c * 4, v, 4, 0))
+    return FAT_EOC_MARK;
+  return rd32(v) & 0x0FFFFFFF;
+}
+
+static int fat_set(uint32_t c, uint32_t value) {
+  // Every FAT copy; the top 4 bits are reserved and must be preserved
+  for (uint32_t i = 0; i < vol.fat_count; i++) {
+    uint32_t lba = vol.fat_lba + i * vol.fat_sectors;
+    uint8_t v[4];
+    if (fat_io(lba, c * 4, v, 4, 0))
+      return -1;
+    wr32(v, (rd32(v) & 0xF0000000) | (value & 0x0FFFFFFF));
+    if (fat_io(lba, c * 4, v, 4, 1))
+      return -1;
+  }
+  return 0;
+}
+
+// Allocate a cluster and link it after `prev` (0 = start of a new chain).
+// Tries the cluster right after prev first so files stay contiguous.
+static uint32_t fat_alloc(uint32_t prev) {
+  uint32_t end = vol.cluster_count + 2;
+  uint32_t c = prev ? prev + 1 : vol.next_free;
+  if (c < 2 || c >= end)
+    c = 2;
+  for (uint32_t n = 0; n < vol.cluster_count; n++) {
+    if (fat_get(c) == FAT_FREE) {
+      if (fat_set(c, FAT_EOC_MARK) || (prev && fat_set(prev, c)))
+        return 0;
+      vol.next_free = c + 1;
+      if (vol.free_count != 0xFFFFFFFF)
+        vol.free_count--;
+      vol.fsinfo_dirty = 1;
+      return c;
+    }
+    if (++c >= end)
+      c = 2;
+  }
+  return 0;
+}
+
+// --- Cluster Chains ---
+// A chain is walked through the FAT once and kept as a list of extents
+// (runs of consecutive clusters). Seeking is then a binary search, and a
+// contiguous file is a single extent however large it is.
+
+typedef struct {
+  uint32_t index;   // First file cluster covered
+  uint32_t cluster; // Disk cluster it maps to
+  uint32_t length;
+} FatExtent;
+
+struct FatChain {
+  uint32_t first; // 0 = unused slot, or an empty file while refs > 0
+  uint32_t clusters;
+  uint32_t extent_count;
+  uint32_t extent_cap;
+  FatExtent *extents;
+  int refs;
+  uint32_t last_use;
+};
+
+#define FAT_CHAIN_CACHE 16
+static FatChain chains[FAT_CHAIN_CACHE];
+static uint32_t chain_clock = 0;
+
+static int chain_append(FatChain *ch, uint32_t cluster) {
+  if (ch->extent_count) {
+    FatExtent *last = &ch->extents[ch->extent_count - 1];
+    if (last->cluster + last->length == cluster) {
+      last->length++;
+      ch->clusters++;
+      return 0;
+    }
+  }
+  if (ch->extent_count == ch->extent_cap) {
+    uint32_t cap = ch->extent_cap ? ch->extent_cap * 2 : 4;
+    FatExtent *e = kmalloc(cap * sizeof(FatExtent));
+    if (!e)
+      return -1;
+    if (ch->extents) {
+      memcpy(e, ch->extents, ch->extent_count * sizeof(FatExtent));
+      kfree(ch->extents);
+    }
+    ch->extents = e;
+    ch->extent_cap = cap;
+  }
+  FatExtent *x = &ch->extents[ch->extent_count++];
+  x->index = ch->clusters;
+  x->cluster = cluster;
+  x->length = 1;
+  ch->clusters++;
+  return 0;
+}
+
+static FatChain *chain_get(uint32_t first) {
+  FatChain *victim = 0;
+  for (int i = 0; i < FAT_CHAIN_CACHE; i++) {
+    FatChain *ch = &chains[i];
+    if (first && ch->first == first) {
+      ch->refs++;
+      ch->last_use = ++chain_clock;
+      return ch;
+    }
+    if (ch->refs == 0 && (!victim || ch->last_use < victim->last_use))
+      victim = ch;
+  }
+  if (!victim)
+    return 0;
+
+  victim->first = first;
+  victim->clusters = 0;
+  victim->extent_count = 0;
+  victim->refs = 1;
+  victim->last_use = ++chain_clock;
+
+  uint32_t c = first;
+  uint32_t guard = vol.cluster_count;
+  while (c >= 2 && c < vol.cluster_count + 2 && guard-- > 0) {
+    if (chain_append(victim, c)) {
+      victim->first = 0;
+      victim->refs = 0;
+      return 0;
+    }
+    c = fat_get(c);
+  }
+  return victim;
+}
+
+static void chain_put(FatChain *ch) {
+  if (ch && ch->refs > 0)
+    ch->refs--;
+}
+
+// Disk cluster for file cluster idx, 0 if past the end. *run is how many
+// clusters from there on are contiguous.
+static uint32_t chain_map(FatChain *ch, uint32_t idx, uint32_t *run) {
+  uint32_t lo = 0, hi = ch->extent_count;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    FatExtent *e = &ch->extents[mid];
+    if (idx < e->index)
+      hi = mid;
+    else if (idx >= e->index + e->length)
+      lo = mid + 1;
+    else {
+      *run = e->length - (idx - e->index);
+      return e->cluster + (idx - e->index);
+    }
+  }
+  return 0;
+}
+
+// Append one cluster to a chain, updating the FAT
+static uint32_t chain_grow(FatChain *ch) {
+  uint32_t run;
+  uint32_t last = ch->clusters ? chain_map(ch, ch->clusters - 1, &run) : 0;
+  uint32_t c = fat_alloc(last);
+  if (!c)
+    return 0;
+  if (!ch->clusters)
+    ch->first = c;
+  if (chain_append(ch, c))
+    return 0;
+  return c;
+}
+
+// --- Directory Index ---
+// Each cached directory gets its entries in an array plus a hash table on
+// the (case folded) name, so a path lookup costs one hash probe per level
+// instead of a scan of every directory cluster.
+
+#define FAT_DIR_BUCKETS 64
+#define FAT_DIR_CACHE 8
+
+typedef struct {
+  FatDirEntry e;
+  char short_name[13];
+  uint32_t lba, offset; // The 8.3 entry on disk
+  int next;             // Hash chain, -1 ends
+} FatIndexEntry;
+
+typedef struct {
+  uint32_t cluster; // 0 = unused
+  uint32_t count, cap;
+  FatIndexEntry *entries;
+  int buckets[FAT_DIR_BUCKETS];
+  int has_free; // First reusable slot, if any
+  uint32_t free_lba, free_offset;
+  uint32_t last_use;
+} FatDirIndex;
+
+static FatDirIndex dir_cache[FAT_DIR_CACHE];
+static uint32_t dir_clock = 0;
+
+static uint32_t name_hash(const char *s) {
+  uint32_t h = 2166136261u;
+  while (*s)
+    h = (h ^ (uint8_t)to_lower(*s++)) * 16777619u;
+  return h % FAT_DIR_BUCKETS;
+}
+
+static uint8_t short_checksum(const uint8_t *name) {
+  uint8_t sum = 0;
+  for (int i = 0; i < 11; i++)
+    sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+  return sum;
+}
+
+// "NOTES   TXT" -> "NOTES.TXT" (or "notes.txt" with the NT case bits)
+static void format_short_name(const uint8_t *d, char *out) {
+  int n = 0;
+  for (int i = 0; i < 8 && d[i] != ' '; i++)
+    out[n++] = (d[12] & FAT_NT_LOWER_BASE) ? to_lower(d[i]) : d[i];
+  if (d[8] != ' ') {
+    out[n++] = '.';
+    for (int i = 8; i < 11 && d[i] != ' '; i++)
+      out[n++] = (d[12] & FAT_NT_LOWER_EXT) ? to_lower(d[i]) : d[i];
+  }
+  out[n] = 0;
+}
+
+// LFN entries carry 13 UCS-2 characters each, scattered over the entry
+static void lfn_collect(const uint8_t *d, char *lfn) {
+  static const uint8_t offsets[13] = {1,  3,  5,  7,  9,  14, 16,
+                                      18, 20, 22, 24, 28, 30};
+  int base = ((d[0] & 0x1F) - 1) * 13;
+  for (int i = 0; i < 13; i++) {
+    uint16_t ch = rd16(d + offsets[i]);
+    int pos = base + i;
+    if (ch == 0 || ch == 0xFFFF || pos < 0 || pos >= FAT_NAME_MAX - 1)
+      continue;
+    lfn[pos] = ch < 0x80 ? (char)ch : '?';
+  }
+}
+
+static int dir_add(FatDirIndex *idx, FatIndexEntry *src) {
+  if (idx->count == idx->cap) {
+    uint32_t cap = idx->cap ? idx->cap * 2 : 16;
+    FatIndexEntry *e = kmalloc(cap * sizeof(FatIndexEntry));
+    if (!e)
+      return -1;
+    if (idx->entries) {
+      memcpy(e, idx->entries, idx->count * sizeof(FatIndexEntry));
+      kfree(idx->entries);
+    }
+    idx->entries = e;
+    idx->cap = cap;
+  }
+  FatIndexEntry *e = &idx->entries[idx->count];
+  *e = *src;
+  uint32_t h = name_hash(e->e.name);
+  e->next = idx->buckets[h];
+  idx->buckets[h] = idx->count;
+  idx->count++;
+  return 0;
+}
+
+static int dir_build(FatDirIndex *idx, uint32_t cluster) {
+  FatChain *ch = chain_get(cluster);
+  if (!ch)
+    return -1;
+
+  idx->cluster = cluster;
+  idx->count = 0;
+  idx->has_free = 0;
+  for (int i = 0; i < FAT_DIR_BUCKETS; i++)
+    idx->buckets[i] = -1;
+
+  uint8_t sector[BLOCK_SECTOR_SIZE];
+  char lfn[FAT_NAME_MAX];
+  int lfn_ok = 0;
+  uint8_t lfn_sum = 0;
+  int status = 0;
+
+  for (uint32_t ci = 0; ci < ch->clusters; ci++) {
+    uint32_t run;
+    uint32_t first = cluster_lba(chain_map(ch, ci, &run));
+    for (uint32_t s = 0; s < vol.sectors_per_cluster; s++) {
+      if (fat_io(first + s, 0, sector, BLOCK_SECTOR_SIZE, 0)) {
+        status = -1;
+        goto done;
+      }
+      for (uint32_t off = 0; off < BLOCK_SECTOR_SIZE; off += FAT_DIRENT_SIZE) {
+        uint8_t *d = sector + off;
+        if (d[0] == 0x00 || d[0] == FAT_DELETED) {
+          if (!idx->has_free) {
+            idx->has_free = 1;
+            idx->free_lba = first + s;
+            idx->free_offset = off;
+          }
+          if (d[0] == 0x00)
+            goto done; // End of directory
+          lfn_ok = 0;
+          continue;
+        }
+        if (d[11] == FAT_ATTR_LFN) {
+          if (d[0] & 0x40) { // Last LFN piece comes first
+            memset(lfn, 0, FAT_NAME_MAX);
+            lfn_ok = 1;
+            lfn_sum = d[13];
+          } else if (d[13] != lfn_sum) {
+            lfn_ok = 0;
+          }
+          if (lfn_ok)
+            lfn_collect(d, lfn);
+          continue;
+        }
+        if ((d[11] & FAT_ATTR_VOLUME_ID) || d[0] == '.') {
+          lfn_ok = 0;
+          continue;
+        }
+
+        FatIndexEntry e;
+        format_short_name(d, e.short_name);
+        const char *name = e.short_name;
+        if (lfn_ok && lfn[0] && short_checksum(d) == lfn_sum)
+          name = lfn;
+        int n = 0;
+        while (name[n] && n < FAT_NAME_MAX - 1) {
+          e.e.name[n] = name[n];
+          n++;
+        }
+        e.e.name[n] = 0;
+        e.e.attr = d[11];
+        e.e.size = rd32(d + 28);
+        e.e.cluster = (rd16(d + 20) << 16) | rd16(d + 26);
+        e.lba = first + s;
+        e.offset = off;
+        lfn_ok = 0;
+        if (dir_add(idx, &e)) {
+          status = -1;
+          goto done;
+        }
+      }
+    }
+  }
+done:
+  chain_put(ch);
+  if (status)
+    idx->cluster = 0;
+  return status;
+}
+
+static FatDirIndex *dir_index(uint32_t cluster) {
+  FatDirIndex *victim = &dir_cache[0];
+  for (int i = 0; i < FAT_DIR_CACHE; i++) {
+    FatDirIndex *idx = &dir_cache[i];
+    if (idx->cluster == cluster) {
+      idx->last_use = ++dir_clock;
+      return idx;
+    }
+    if (idx->last_use < victim->last_use)
+      victim = idx;
+  }
+  if (dir_build(victim, cluster))
+    return 0;
+  victim->last_use = ++dir_clock;
+  return victim;
+}
+
+static void dir_invalidate(uint32_t cluster) {
+  for (int i = 0; i < FAT_DIR_CACHE; i++) {
+    if (dir_cache[i].cluster == cluster)
+      dir_cache[i].cluster = 0;
+  }
+}
+
+static FatIndexEntry *dir_find(FatDirIndex *idx, const char *name) {
+  for (int i = idx->buckets[name_hash(name)]; i >= 0;
+       i = idx->entries[i].next) {
+    if (name_eq(idx->entries[i].e.name, name))
+      return &idx->entries[i];
+  }
+  // Long names hide the 8.3 alias from the hash, but it still works
+  for (uint32_t i = 0; i < idx->count; i++) {
+    if (name_eq(idx->entries[i].short_name, name))
+      return &idx->entries[i];
+  }
+  return 0;
+}
+
+// Keep cached listings in step with a directory entry we just rewrote
+static void dir_patch(uint32_t lba, uint32_t offset, uint32_t cluster,
+                      uint32_t size) {
+  for (int i = 0; i < FAT_DIR_CACHE; i++) {
+    FatDirIndex *idx = &dir_cache[i];
+    if (!idx->cluster)
+      continue;
+    for (uint32_t k = 0; k < idx->count; k++) {
+      FatIndexEntry *e = &idx->entries[k];
+      if (e->lba == lba && e->offset == offset) {
+        e->e.cluster = cluster;
+        e->e.size = size;
+      }
+    }
+  }
+}
+
+// Walk a path from the root. The root itself has no directory entry, so
+// it comes back with lba 0.
+static int fat_lookup(const char *path, FatIndexEntry *out) {
+  memset(out, 0, sizeof(FatIndexEntry));
+  out->e.attr = FAT_ATTR_DIRECTORY;
+  out->e.cluster = vol.root_cluster;
+
+  const char *p = path;
+  while (1) {
+    while (*p == '/')
+      p++;
+    if (!*p)
+      return 0;
+
+    char name[FAT_NAME_MAX];
+    int n = 0;
+    while (*p && *p != '/') {
+      if (n >= FAT_NAME_MAX - 1)
+        return -1;
+      name[n++] = *p++;
+    }
+    name[n] = 0;
+
+    if (!(out->e.attr & FAT_ATTR_DIRECTORY))
+      return -1;
+    FatDirIndex *idx = dir_index(out->e.cluster);
+    if (!idx)
+      return -1;
+    FatIndexEntry *e = dir_find(idx, name);
+    if (!e)
+      return -1;
+    *out = *e;
+    if ((out->e.attr & FAT_ATTR_DIRECTORY) && out->e.cluster == 0)
+      out->e.cluster = vol.root_cluster; // ".." of a top level directory
+  }
+}
+
+// --- Mount ---
+
+static int fat_try(BlockDevice *dev, uint32_t part_lba) {
+  uint8_t bpb[BLOCK_SECTOR_SIZE];
+  if (bcache_read(dev, part_lba, 1, bpb))
+    return 0;
+
+  uint32_t spc = bpb[13];
+  uint32_t reserved = rd16(bpb + 14);
+  uint32_t fats = bpb[16];
+  uint32_t total = rd16(bpb + 19) ? rd16(bpb + 19) : rd32(bpb + 32);
+  uint32_t fat_sectors = rd32(bpb + 36);
+  // FAT32 layout: 512 byte sectors, no fixed root directory, no 16-bit FAT
+  // size. Anything else is not ours.
+  if (rd16(bpb + 510) != 0xAA55 || rd16(bpb + 11) != BLOCK_SECTOR_SIZE ||
+      spc == 0 || (spc & (spc - 1)) || fats == 0 || fats > 2 ||
+      rd16(bpb + 17) != 0 || rd16(bpb + 22) != 0 || fat_sectors == 0)
+    return 0;
+  uint32_t meta = reserved + fats * fat_sectors;
+  if (total <= meta || part_lba + total > dev->sector_count)
+    return 0;
+
+  vol.dev = dev;
+  vol.part_lba = part_lba;
+  vol.sectors_per_cluster = spc;
+  vol.cluster_bytes = spc * BLOCK_SECTOR_SIZE;
+  vol.fat_lba = part_lba + reserved;
+  vol.fat_count = fats;
+  vol.fat_sectors = fat_sectors;
+  vol.data_lba = part_lba + meta;
+  vol.root_cluster = rd32(bpb + 44);
+  vol.cluster_count = (total - meta) / spc;
+  if (vol.cluster_count > fat_sectors * (BLOCK_SECTOR_SIZE / 4) - 2)
+    vol.cluster_count = fat_sectors * (BLOCK_SECTOR_SIZE / 4) - 2;
+  vol.fsinfo_lba = 0;
+  vol.next_free = 2;
+  vol.free_count = 0xFFFFFFFF;
+  vol.fsinfo_dirty = 0;
+
+  uint32_t fsinfo = rd16(bpb + 48);
+  if (fsinfo && fsinfo < reserved &&
+      !bcache_read(dev, part_lba + fsinfo, 1, bpb) &&
+      rd32(bpb) == 0x41615252 && rd32(bpb + 484) == 0x61417272) {
+    vol.fsinfo_lba = part_lba + fsinfo;
+    vol.free_count = rd32(bpb + 488);
+    vol.next_free = rd32(bpb + 492);
+  }
+  return 1;
+}
+
+static int fat_mount() {
+  for (int i = 0; i < block_device_count() && !mounted; i++) {
+    BlockDevice *dev = block_device(i);
+    uint8_t mbr[BLOCK_SECTOR_SIZE];
+
+    // Whole-disk volume first, then the MBR's FAT32 partitions
+    if (fat_try(dev, 0)) {
+      mounted = 1;
+    } else if (!bcache_read(dev, 0, 1, mbr) && rd16(mbr + 510) == 0xAA55) {
+      for (int p = 0; p < 4 && !mounted; p++) {
+        uint8_t *part = mbr + 446 + p * 16;
+        if ((part[4] == 0x0B || part[4] == 0x0C) &&
+            fat_try(dev, rd32(part + 8)))
+          mounted = 1;
+      }
+    }
+  }
+  if (!mounted)
+    return 0;
+
+  serial_write("[fat32] ");
+  serial_write(vol.dev->name);
+  serial_write(": ");
+  serial_write_dec(vol.cluster_count / 1024 * (vol.cluster_bytes / 1024));
+  serial_write(" MB volume, ");
+  serial_write_dec(vol.cluster_bytes);
+  serial_write(" byte clusters\n");
+  return 1;
+}
+
+int fat32_mounted() { return mounted; }
+
+// --- Files ---
+
+static int fat_open_entry(FatIndexEntry *e, FatFile *f) {
+  // The index may lag behind an open writer, the entry itself does not
+  uint32_t cluster = e->e.cluster;
+  f->size = e->e.size;
+  if (e->lba) {
+    uint8_t d[FAT_DIRENT_SIZE];
+    if (fat_io(e->lba, e->offset, d, FAT_DIRENT_SIZE, 0))
+      return -1;
+    cluster = (rd16(d + 20) << 16) | rd16(d + 26);
+    f->size = rd32(d + 28);
+  }
+  f->pos = 0;
+  f->attr = e->e.attr;
+  f->dirty = 0;
+  f->dirent_lba = e->lba;
+  f->dirent_offset = e->offset;
+  f->chain = chain_get(cluster);
+  return f->chain ? 0 : -1;
+}
+
+static int fat_open(const char *path, FatFile *f) {
+  FatIndexEntry e;
+  if (!mounted || fat_lookup(path, &e))
+    return -1;
+  return fat_open_entry(&e, f);
+}
+
+// "notes.txt" -> "NOTES   TXT". Only names that already fit 8.3.
+static int make_short_name(const char *name, uint8_t *out) {
+  memset(out, ' ', 11);
+  out[12] = 0;
+  int lower[2] = {0, 0}, upper[2] = {0, 0};
+  int part = 0, n = 0;
+  for (const char *p = name; *p; p++) {
+    char c = *p;
+    if (c == '.') {
+      if (part == 1 || n == 0)
+        return -1;
+      part = 1;
+      n = 0;
+      continue;
+    }
+    if (c <= ' ' || c == '"' || c == '*' || c == '/' || c == ':' ||
+        c == '<' || c == '>' || c == '?' || c == '\\' || c == '|' ||
+        c == '+' || c == ',' || c == ';' || c == '=' || c == '[' || c == ']')
+      return -1;
+    if (n >= (part ? 3 : 8))
+      return -1;
+    if (c >= 'a' && c <= 'z')
+      lower[part] = 1;
+    if (c >= 'A' && c <= 'Z')
+      upper[part] = 1;
+    out[(part ? 8 : 0) + n++] = to_upper(c);
+  }
+  if (out[0] == ' ')
+    return -1;
+  // All-lowercase parts round trip through the NT case bits
+  if (lower[0] && !upper[0])
+    out[12] |= FAT_NT_LOWER_BASE;
+  if (lower[1] && !upper[1])
+    out[12] |= FAT_NT_LOWER_EXT;
+  return 0;
+}
+
+// Add a cluster to a directory and zero it. Returns the first sector.
+static uint32_t dir_extend(uint32_t dir_cluster) {
+  FatChain *ch = chain_get(dir_cluster);
+  if (!ch)
+    return 0;
+  uint32_t c = chain_grow(ch);
+  chain_put(ch);
+  if (!c)
+    return 0;
+  uint8_t zero[BLOCK_SECTOR_SIZE];
+  memset(zero, 0, BLOCK_SECTOR_SIZE);
+  for (uint32_t s = 0; s < vol.sectors_per_cluster; s++) {
+    if (fat_io(cluster_lba(c) + s, 0, zero, BLOCK_SECTOR_SIZE, 1))
+      return 0;
+  }
+  return cluster_lba(c);
+}
+
+static int fat_create(const char *path, FatFile *f) {
+  if (!mounted)
+    return -1;
+  if (fat_open(path, f) == 0)
+    return 0;
+
+  // Split into parent directory and new name
+  char parent[128];
+  int slash = -1, n = 0;
+  for (; path[n]; n++) {
+    if (n >= (int)sizeof(parent) - 1)
+      return -1;
+    parent[n] = path[n];
+    if (path[n] == '/')
+      slash = n;
+  }
+  const char *name = path + slash + 1;
+  parent[slash >= 0 ? slash : 0] = 0;
+
+  uint8_t d[FAT_DIRENT_SIZE];
+  memset(d, 0, FAT_DIRENT_SIZE);
+  if (make_short_name(name, d))
+    return -1;
+  d[11] = FAT_ATTR_ARCHIVE;
+
+  FatIndexEntry dir;
+  if (fat_lookup(parent, &dir) || !(dir.e.attr & FAT_ATTR_DIRECTORY))
+    return -1;
+  FatDirIndex *idx = dir_index(dir.e.cluster);
+  if (!idx)
+    return -1;
+
+  FatIndexEntry e;
+  memset(&e, 0, sizeof(FatIndexEntry));
+  if (idx->has_free) {
+    e.lba = idx->free_lba;
+    e.offset = idx->free_offset;
+  } else {
+    e.lba = dir_extend(dir.e.cluster);
+    if (!e.lba)
+      return -1;
+  }
+  if (fat_io(e.lba, e.offset, d, FAT_DIRENT_SIZE, 1))
+    return -1;
+  dir_invalidate(dir.e.cluster);
+
+  e.e.attr = FAT_ATTR_ARCHIVE;
+  return fat_open_entry(&e, f);
+}
+
+static void fat_close(FatFile *f) {
+  if (!f->chain)
+    return;
+  if (f->dirty && f->dirent_lba) {
+    uint8_t d[FAT_DIRENT_SIZE];
+    if (!fat_io(f->dirent_lba, f->dirent_offset, d, FAT_DIRENT_SIZE, 0)) {
+      wr16(d + 20, f->chain->first >> 16);
+      wr16(d + 26, f->chain->first & 0xFFFF);
+      wr32(d + 28, f->size);
+      fat_io(f->dirent_lba, f->dirent_offset, d, FAT_DIRENT_SIZE, 1);
+      dir_patch(f->dirent_lba, f->dirent_offset, f->chain->first, f->size);
+    }
+  }
+  chain_put(f->chain);
+  f->chain = 0;
+}
+
+void fat32_seek(FatFile *f, uint32_t pos) { f->pos = pos; }
+
+// Big reads bypass the cache, so make sure it holds nothing newer
+static int fat_read_direct(uint32_t lba, uint32_t count, void *dst) {
+  BcacheStats s;
+  bcache_get_stats(&s);
+  if (s.dirty && bcache_sync(vol.dev))
+    return -1;
+  return block_rw(vol.dev, lba, count, dst, 0);
+}
+
+static int fat_read(FatFile *f, void *buf, uint32_t len) {
+  if (!f->chain)
+    return -1;
+  if (f->pos >= f->size)
+    return 0;
+  if (len > f->size - f->pos)
+    len = f->size - f->pos;
+
+  uint8_t *dst = (uint8_t *)buf;
+  uint32_t done = 0;
+  while (done < len) {
+    uint32_t idx = f->pos / vol.cluster_bytes;
+    uint32_t off = f->pos % vol.cluster_bytes;
+    uint32_t run;
+    uint32_t c = chain_map(f->chain, idx, &run);
+    if (!c)
+      return -1; // Chain shorter than the size says
+
+    // Whole extent from here on is contiguous on disk
+    uint32_t n = run * vol.cluster_bytes - off;
+    if (n > len - done)
+      n = len - done;
+    uint32_t lba = cluster_lba(c);
+    uint32_t aligned = (n / BLOCK_SECTOR_SIZE) * BLOCK_SECTOR_SIZE;
+    if (off % BLOCK_SECTOR_SIZE == 0 && aligned >= FAT_DIRECT_MIN) {
+      n = aligned;
+      if (fat_read_direct(lba + off / BLOCK_SECTOR_SIZE,
+                          n / BLOCK_SECTOR_SIZE, dst + done))
+        return -1;
+    } else {
+      if (n > vol.cluster_bytes - off)
+        n = vol.cluster_bytes - off;
+      if (fat_io(lba, off, dst + done, n, 0))
+        return -1;
+    }
+    done += n;
+    f->pos += n;
+  }
+  return done;
+}
+
+static int fat_write(FatFile *f, const void *buf, uint32_t len) {
+  if (!f->chain || (f->attr & (FAT_ATTR_DIRECTORY | FAT_ATTR_READ_ONLY)))
+    return -1;
+
+  const uint8_t *src = (const uint8_t *)buf;
+  uint32_t done = 0;
+  while (done < len) {
+    uint32_t idx = f->pos / vol.cluster_bytes;
+    uint32_t off = f->pos % vol.cluster_bytes;
+    while (idx >= f->chain->clusters) {
+      int was_empty = f->chain->clusters == 0;
+      if (!chain_grow(f->chain))
+        goto out; // Disk full
+      if (was_empty)
+        f->dirty = 1;
+    }
+    uint32_t run;
+    uint32_t c = chain_map(f->chain, idx, &run);
+    uint32_t n = vol.cluster_bytes - off;
+    if (n > len - done)
+      n = len - done;
+    if (fat_io(cluster_lba(c), off, (void *)(src + done), n, 1))
+      break;
+    done += n;
+    f->pos += n;
+  }
+out:
+  if (f->pos > f->size) {
+    f->size = f->pos;
+    f->dirty = 1;
+  }
+  return done ? (int)done : (len ? -1 : 0);
+}
+
+static int fat_truncate(FatFile *f) {
+  if (!f->chain || (f->attr & (FAT_ATTR_DIRECTORY | FAT_ATTR_READ_ONLY)))
+    return -1;
+  FatChain *ch = f->chain;
+  uint32_t keep = (f->pos + vol.cluster_bytes - 1) / vol.cluster_bytes;
+  if (keep < ch->clusters) {
+    uint32_t run;
+    for (uint32_t i = keep; i < ch->clusters; i++) {
+      if (fat_set(chain_map(ch, i, &run), FAT_FREE))
+        return -1;
+      if (vol.free_count != 0xFFFFFFFF)
+        vol.free_count++;
+    }
+    if (keep && fat_set(chain_map(ch, keep - 1, &run), FAT_EOC_MARK))
+      return -1;
+    vol.fsinfo_dirty = 1;
+
+    // Drop the freed clusters from the cached extent list as well
+    while (ch->extent_count) {
+      FatExtent *e = &ch->extents[ch->extent_count - 1];
+      if (e->index < keep) {
+        if (e->index + e->length > keep)
+          e->length = keep - e->index;
+        break;
+      }
+      ch->extent_count--;
+    }
+    ch->clusters = keep;
+    if (!keep) {
+      ch->first = 0;
+      f->dirty = 1;
+    }
+  }
+  if (f->size != f->pos) {
+    f->size = f->pos;
+    f->dirty = 1;
+  }
+  return 0;
+}
+
+static int fat_list(const char *path,
+                    void (*fn)(FatDirEntry *e, void *arg), void *arg) {
+  FatIndexEntry dir;
+  if (!mounted || fat_lookup(path, &dir) ||
+      !(dir.e.attr & FAT_ATTR_DIRECTORY))
+    return -1;
+  FatDirIndex *idx = dir_index(dir.e.cluster);
+  if (!idx)
+    return -1;
+  // Copy first: fn may open files and recycle the index
+  uint32_t count = idx->count;
+  FatDirEntry *list = kmalloc(count * sizeof(FatDirEntry) + 1);
+  if (!list)
+    return -1;
+  for (uint32_t i = 0; i < count; i++)
+    list[i] = idx->entries[i].e;
+  for (uint32_t i = 0; i < count; i++)
+    fn(&list[i], arg);
+  kfree(list);
+  return count;
+}
+
+static void *fat_load(const char *path, uint32_t *size) {
+  FatFile f;
+  if (fat_open(path, &f))
+    return 0;
+  // One spare byte so text files can be NUL terminated by the caller
+  uint8_t *data = kmalloc(f.size + 1);
+  if (data && fat_read(&f, data, f.size) != (int)f.size) {
+    kfree(data);
+    data = 0;
+  }
+  if (data) {
+    data[f.size] = 0;
+    *size = f.size;
+  }
+  fat_close(&f);
+  return data;
+}
+
+static int fat_sync() {
+  if (!mounted)
+    return -1;
+  if (vol.fsinfo_dirty && vol.fsinfo_lba) {
+    uint8_t v[8];
+    wr32(v, vol.free_count);
+    wr32(v + 4, vol.next_free);
+    fat_io(vol.fsinfo_lba, 488, v, 8, 1);
+    vol.fsinfo_dirty = 0;
+  }
+  return bcache_sync(vol.dev);
+}
+
+// --- Locked entry points ---
+
+int fat32_mount() {
+  mutex_lock(&fs_lock);
+  int r = fat_mount();
+  mutex_unlock(&fs_lock);
+  return r;
+}
+
+int fat32_open(const char *path, FatFile *f) {
+  mutex_lock(&fs_lock);
+  int r = fat_open(path, f);
+  mutex_unlock(&fs_lock);
+  return r;
+}
+
+int fat32_create(const char *path, FatFile *f) {
+  mutex_lock(&fs_lock);
+  int r = fat_create(path, f);
+  mutex_unlock(&fs_lock);
+  return r;
+}
+
+void fat32_close(FatFile *f) {
+  mutex_lock(&fs_lock);
+  fat_close(f);
+  mutex_unlock(&fs_lock);
+}
+
+int fat32_read(FatFile *f, void *buf, uint32_t len) {
+  mutex_lock(&fs_lock);
+  int r = fat_read(f, buf, len);
+  mutex_unlock(&fs_lock);
+  return r;
+}
+
+int fat32_write(FatFile *f, const void *buf, uint32_t len) {
+  mutex_lock(&fs_lock);
+  int r = fat_write(f, buf, len);
+  mutex_unlock(&fs_lock);
+  return r;
+}
+
+int fat32_truncate(FatFile *f) {
+  mutex_lock(&fs_lock);
+  int r = fat_truncate(f);
+  mutex_unlock(&fs_lock);
+  return r;
+}
+
+// fn runs with the lock held, and may call back in
+int fat32_list(const char *path, void (*fn)(FatDirEntry *e, void *arg),
+               void *arg) {
+  mutex_lock(&fs_lock);
+  int r = fat_list(path, fn, arg);
+  mutex_unlock(&fs_lock);
+  return r;
+}
+
+void *fat32_load(const char *path, uint32_t *size) {
+  mutex_lock(&fs_lock);
+  void *r = fat_load(path, size);
+  mutex_unlock(&fs_lock);
+  return r;
+}
+
+int fat32_sync() {
+  mutex_lock(&fs_lock);
+  int r = fat_sync();
+  mutex_unlock(&fs_lock);
+  return r;
+}
@@ -0,0 +1,74 @@
+#ifndef FAT32_H
+#define FAT32_H
+
+#include "block.h"
+#include "types.h"
+
+// FAT32 on any block device (whole disk or first MBR partition), through
+// the buffer cache. One volume is mounted at a time; paths are absolute
+// ("/apps/calc.gem") and matched case-insensitively against long or 8.3
+// names. New files get 8.3 names only. Calls wait for the disk, so they
+// are for thread context (not IRQ handlers); one thread at a time is let
+// into the filesystem.
+
+#define FAT_NAME_MAX 64
+
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN 0x02
+#define FAT_ATTR_SYSTEM 0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE 0x20
+#define FAT_ATTR_LFN 0x0F
+
+typedef struct {
+  char name[FAT_NAME_MAX];
+  uint32_t size;
+  uint32_t cluster;
+  uint8_t attr;
+} FatDirEntry;
+
+typedef struct FatChain FatChain;
+
+typedef struct {
+  uint32_t size;
+  uint32_t pos;
+  uint8_t attr;
+  int dirty; // Size or first cluster changed, directory entry needs update
+
+  // Where the 32-byte directory entry lives
+  uint32_t dirent_lba;
+  uint32_t dirent_offset;
+
+  FatChain *chain; // Cached cluster chain (extent list)
+} FatFile;
+
+// Mount the first FAT32 volume found on the registered block devices.
+// Returns 1 if one was found.
+int fat32_mount();
+int fat32_mounted();
+
+// Returns 0 on success
+int fat32_open(const char *path, FatFile *f);
+int fat32_create(const char *path, FatFile *f); // Opens it if it exists
+void fat32_close(FatFile *f); // Writes back the directory entry
+
+// Byte counts, or -1 on error
+int fat32_read(FatFile *f, void *buf, uint32_t len);
+int fat32_write(FatFile *f, const void *buf, uint32_t len);
+void fat32_seek(FatFile *f, uint32_t pos);
+// Cut the file at the current position, freeing clusters past it
+int fat32_truncate(FatFile *f);
+
+// Calls fn for each entry of a directory (not "." / ".."). Returns the
+// number of entries visited, -1 if the path is not a directory.
+int fat32_list(const char *path, void (*fn)(FatDirEntry *e, void *arg),
+               void *arg);
+
+// Read a whole file into a kmalloc'd buffer (caller frees). 0 on error.
+void *fat32_load(const char *path, uint32_t *size);
+
+// Flush cached metadata and data to disk
+int fat32_sync();
+
+#endif
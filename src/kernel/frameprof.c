@@ -0,0 +1,274 @@
+#include "frameprof.h"
+#include "../drivers/serial.h"
+#include "../drivers/video.h"
+#include "timeline.h"
+#include "timer.h"
+#include "window.h"
+
+#define PROF_SAMPLES 128 // Rolling window per series
+#define PROF_WINDOWS 20  // Tracked at once
+#define PROF_SLOWEST 4   // Windows listed in the overlay
+#define PROF_REFRESH_MS 250
+
+typedef struct {
+  uint32_t cycles[PROF_SAMPLES];
+  uint32_t count; // Samples ever added
+  // Refreshed every PROF_REFRESH_MS, in TSC cycles
+  uint32_t p50, p99, max;
+} ProfSeries;
+
+typedef struct {
+  struct Window *win;
+  uint32_t last_seen_ms;
+  ProfSeries series;
+} WindowProf;
+
+static const char *stage_names[PROF_STAGE_COUNT] = {
+    "backgrnd", "windows", "menubar", "taskbar", "menus",
+    "overlay",  "cursor",  "tiles",   "swap",    "frame"};
+
+static ProfSeries stages[PROF_STAGE_COUNT];
+static WindowProf windows[PROF_WINDOWS];
+
+static uint64_t frame_start, mark;
+static volatile int overlay_on = 0;
+static volatile int dump_pending = 0;
+
+static uint32_t fps = 0, fps_frames = 0, fps_start_ms = 0;
+static uint32_t refresh_ms = 0;
+
+static void series_add(ProfSeries *s, uint32_t cycles) {
+  s->cycles[s->count % PROF_SAMPLES] = cycles;
+  s->count++;
+}
+
+static void series_update(ProfSeries *s) {
+  uint32_t sorted[PROF_SAMPLES];
+  uint32_t n = s->count < PROF_SAMPLES ? s->count : PROF_SAMPLES;
+  if (n == 0)
+    return;
+  // Insertion sort: 128 mostly similar values, a few times a second
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t v = s->cycles[i];
+    uint32_t j = i;
+    while (j > 0 && sorted[j - 1] > v) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = v;
+  }
+  s->p50 = sorted[n / 2];
+  s->p99 = sorted[(n * 99) / 100];
+  s->max = sorted[n - 1];
+}
+
+void frameprof_begin_frame() {
+  frame_start = rdtsc();
+  mark = frame_start;
+}
+
+void frameprof_stage(ProfStage stage) {
+  uint64_t now = rdtsc();
+  series_add(&stages[stage], (uint32_t)(now - mark));
+  mark = now;
+}
+
+void frameprof_window(struct Window *win, uint32_t cycles) {
+  WindowProf *free_slot = 0;
+  for (int i = 0; i < PROF_WINDOWS; i++) {
+    if (windows[i].win == win) {
+      windows[i].last_seen_ms = timer_ms();
+      series_add(&windows[i].series, cycles);
+      return;
+    }
+    if (!windows[i].win && !free_slot)
+      free_slot = &windows[i];
+  }
+  if (free_slot) {
+    free_slot->win = win;
+    free_slot->last_seen_ms = timer_ms();
+    free_slot->series.count = 0;
+    series_add(&free_slot->series, cycles);
+  }
+}
+
+void frameprof_forget(struct Window *win) {
+  for (int i = 0; i < PROF_WINDOWS; i++)
+    if (windows[i].win == win)
+      windows[i].win = 0;
+}
+
+void frameprof_toggle_overlay() { overlay_on = !overlay_on; }
+void frameprof_request_dump() { dump_pending = 1; }
+
+// Windows painted within the last second
+static int window_active(WindowProf *w, uint32_t now) {
+  return w->win && now - w->last_seen_ms < 1000;
+}
+
+// "123.4" microseconds from cycles, or "-" before TSC calibration
+static void format_us(char *buf, uint32_t cycles) {
+  uint32_t mhz = tsc_khz() / 1000;
+  if (!mhz) {
+    buf[0] = '-';
+    buf[1] = 0;
+    return;
+  }
+  uint32_t tenths = udiv64((uint64_t)cycles * 10, mhz);
+  char tmp[12];
+  int n = 0;
+  tmp[n++] = '0' + tenths % 10;
+  tmp[n++] = '.';
+  tenths /= 10;
+  do {
+    tmp[n++] = '0' + tenths % 10;
+    tenths /= 10;
+  } while (tenths);
+  for (int i = 0; i < n; i++)
+    buf[i] = tmp[n - 1 - i];
+  buf[n] = 0;
+}
+
+// name, then p50/p99/max in 8 character columns
+static void format_row(char *line, const char *name, ProfSeries *s) {
+  int n = 0;
+  while (name[n] && n < 8) {
+    line[n] = name[n];
+    n++;
+  }
+  uint32_t v[3] = {s->p50, s->p99, s->max};
+  for (int c = 0; c < 3; c++) {
+    int col = 9 + c * 8;
+    while (n < col)
+      line[n++] = ' ';
+    char num[16];
+    format_us(num, v[c]);
+    for (int i = 0; num[i] && n < col + 8; i++)
+      line[n++] = num[i];
+  }
+  line[n] = 0;
+}
+
+// Active windows, most expensive p99 first
+static int slowest_windows(WindowProf **out, int max) {
+  WindowProf *all[PROF_WINDOWS];
+  uint32_t now = timer_ms();
+  int n = 0;
+  for (int i = 0; i < PROF_WINDOWS; i++) {
+    if (!window_active(&windows[i], now))
+      continue;
+    int j = n++;
+    while (j > 0 && all[j - 1]->series.p99 < windows[i].series.p99) {
+      all[j] = all[j - 1];
+      j--;
+    }
+    all[j] = &windows[i];
+  }
+  if (n > max)
+    n = max;
+  for (int i = 0; i < n; i++)
+    out[i] = all[i];
+  return n;
+}
+
+#define OVERLAY_W 280
+#define OVERLAY_LINE 11
+#define OVERLAY_LINES_MAX (2 + PROF_STAGE_COUNT + 1 + PROF_SLOWEST)
+
+int frameprof_overlay_rect(int *x, int *y, int *w, int *h) {
+  *x = screen_width - OVERLAY_W - 8;
+  *y = 32;
+  *w = OVERLAY_W;
+  *h = OVERLAY_LINES_MAX * OVERLAY_LINE + 8;
+  return overlay_on;
+}
+
+void frameprof_draw_overlay() {
+  if (!overlay_on)
+    return;
+
+  WindowProf *slow[PROF_SLOWEST];
+  int nslow = slowest_windows(slow, PROF_SLOWEST);
+  int lines = 2 + PROF_STAGE_COUNT + (nslow ? 1 + nslow : 0);
+  int x = screen_width - OVERLAY_W - 8, y = 32;
+  draw_rect(x, y, OVERLAY_W, lines * OVERLAY_LINE + 8, 0x000000);
+
+  char line[48] = "FPS ";
+  int ly = y + 4;
+  int n = 4;
+  uint32_t v = fps, div = 1;
+  while (v / div >= 10)
+    div *= 10;
+  for (; div; div /= 10)
+    line[n++] = '0' + (v / div) % 10;
+  line[n] = 0;
+  draw_string(x + 4, ly, line, 0x00FF00);
+  ly += OVERLAY_LINE;
+  draw_string(x + 4, ly, "us       p50     p99     max", 0x808080);
+  ly += OVERLAY_LINE;
+
+  for (int i = 0; i < PROF_STAGE_COUNT; i++) {
+    format_row(line, stage_names[i], &stages[i]);
+    draw_string(x + 4, ly, line, i == PROF_FRAME ? 0xFFFF00 : 0xFFFFFF);
+    ly += OVERLAY_LINE;
+  }
+  if (nslow) {
+    draw_string(x + 4, ly, "slowest windows", 0x808080);
+    ly += OVERLAY_LINE;
+    for (int i = 0; i < nslow; i++) {
+      format_row(line, slow[i]->win->title ? slow[i]->win->title : "?",
+                 &slow[i]->series);
+      draw_string(x + 4, ly, line, 0x80C0FF);
+      ly += OVERLAY_LINE;
+    }
+  }
+}
+
+static void dump() {
+  char line[48];
+  serial_write("[prof] fps ");
+  serial_write_dec(fps);
+  serial_write(", us p50/p99/max\n");
+  for (int i = 0; i < PROF_STAGE_COUNT; i++) {
+    format_row(line, stage_names[i], &stages[i]);
+    serial_write("[prof] ");
+    serial_write(line);
+    serial_putc('\n');
+  }
+  uint32_t now = timer_ms();
+  for (int i = 0; i < PROF_WINDOWS; i++) {
+    if (!window_active(&windows[i], now))
+      continue;
+    format_row(line, windows[i].win->title ? windows[i].win->title : "?",
+               &windows[i].series);
+    serial_write("[prof] win ");
+    serial_write(line);
+    serial_putc('\n');
+  }
+}
+
+void frameprof_end_frame() {
+  series_add(&stages[PROF_FRAME], (uint32_t)(rdtsc() - frame_start));
+
+  uint32_t now = timer_ms();
+  fps_frames++;
+  if (now - fps_start_ms >= 1000) {
+    fps = fps_frames;
+    fps_frames = 0;
+    fps_start_ms = now;
+  }
+
+  // Percentiles only matter when someone looks at them
+  if (dump_pending || (overlay_on && now - refresh_ms >= PROF_REFRESH_MS)) {
+    refresh_ms = now;
+    for (int i = 0; i < PROF_STAGE_COUNT; i++)
+      series_update(&stages[i]);
+    for (int i = 0; i < PROF_WINDOWS; i++)
+      if (windows[i].win)
+        series_update(&windows[i].series);
+  }
+  if (dump_pending) {
+    dump_pending = 0;
+    dump();
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef FRAMEPROF_H
+#define FRAMEPROF_H
+
+#include "types.h"
+
+// Frame profiler: rdtsc timers around the stages of desktop_paint and
+// around each window's paint, kept as rolling windows of recent samples
+// (p50 / p99 / max). F12 toggles an on-screen overlay, F11 dumps the
+// numbers to COM1. With tiled rendering the per-layer stages and windows
+// aren't measured (they happen once per tile, on several CPUs); the frame
+// splits into "tiles" and "swap" instead.
+
+typedef enum {
+  PROF_BACKGROUND,
+  PROF_WINDOWS,
+  PROF_MENUBAR,
+  PROF_TASKBAR,
+  PROF_MENUS,
+  PROF_OVERLAY,
+  PROF_CURSOR,
+  PROF_TILES, // Tiled painting, all layers
+  PROF_SWAP,
+  PROF_FRAME, // Whole frame, filled in by frameprof_end_frame
+  PROF_STAGE_COUNT
+} ProfStage;
+
+struct Window;
+
+void frameprof_begin_frame();
+void frameprof_stage(ProfStage stage); // Stage ended now (since last mark)
+void frameprof_end_frame();
+
+// Paint cost of one window this frame, in TSC cycles
+void frameprof_window(struct Window *win, uint32_t cycles);
+void frameprof_forget(struct Window *win); // Before it is freed
+
+void frameprof_draw_overlay(); // No-op while hidden
+// The largest area the overlay can cover. Returns 0 while hidden.
+int frameprof_overlay_rect(int *x, int *y, int *w, int *h);
+
+// Safe from IRQ context (keyboard hotkeys)
+void frameprof_toggle_overlay();
+void frameprof_request_dump();
+
+#endif
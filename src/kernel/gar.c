@@ -0,0 +1,93 @@
+#include "gar.h"
+#include "../drivers/serial.h"
+#include "block.h"
+#include "memory.h"
+#include "multiboot.h"
+
+static GarHeader *archive = 0;
+
+static int gar_name_cmp(const char *a, const char *b) {
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return (uint8_t)*a - (uint8_t)*b;
+}
+
+int gar_attach(void *base, uint32_t size) {
+  GarHeader *h = (GarHeader *)base;
+  if (size < sizeof(GarHeader) || h->magic != GAR_MAGIC || h->size > size)
+    return -1;
+  if (h->count > (h->size - sizeof(GarHeader)) / sizeof(GarEntry))
+    return -1;
+
+  // Entries must stay inside the archive; names are trusted to be sorted
+  GarEntry *e = (GarEntry *)(h + 1);
+  for (uint32_t i = 0; i < h->count; i++) {
+    if (e[i].name[GAR_NAME_LEN - 1] || e[i].offset > h->size ||
+        e[i].size > h->size - e[i].offset)
+      return -1;
+  }
+
+  archive = h;
+  serial_write("gar: ");
+  serial_write_dec(h->count);
+  serial_write(" apps\n");
+  return 0;
+}
+
+int gar_load_boot_disk() {
+  if (archive)
+    return 0; // Already have one from a boot module
+  uint32_t lba = boot_info.archive_lba;
+  uint32_t sectors = boot_info.archive_sectors;
+  if (!lba || !sectors)
+    return -1;
+
+  // The BIOS drive number does not tell us which controller it is on, so
+  // check each disk for the magic before reading the rest of it
+  uint8_t *buf = kmalloc_aligned(sectors * BLOCK_SECTOR_SIZE, GAR_ALIGN);
+  if (!buf)
+    return -1;
+  for (int i = 0; i < block_device_count(); i++) {
+    BlockDevice *dev = block_device(i);
+    if (dev->sector_count < lba + sectors)
+      continue;
+    if (block_rw(dev, lba, 1, buf, 0) ||
+        ((GarHeader *)buf)->magic != GAR_MAGIC)
+      continue;
+    if (sectors > 1 && block_rw(dev, lba + 1, sectors - 1,
+                                buf + BLOCK_SECTOR_SIZE, 0))
+      continue;
+    if (gar_attach(buf, sectors * BLOCK_SECTOR_SIZE) == 0)
+      return 0;
+  }
+  kfree(buf);
+  return -1;
+}
+
+int gar_count() { return archive ? archive->count : 0; }
+
+GarEntry *gar_entry(int index) {
+  if (index < 0 || index >= gar_count())
+    return 0;
+  return (GarEntry *)(archive + 1) + index;
+}
+
+GarEntry *gar_find(const char *name) {
+  int lo = 0, hi = gar_count() - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    GarEntry *e = gar_entry(mid);
+    int c = gar_name_cmp(name, e->name);
+    if (c == 0)
+      return e;
+    if (c < 0)
+      hi = mid - 1;
+    else
+      lo = mid + 1;
+  }
+  return 0;
+}
+
+char *gar_data(GarEntry *e) { return (char *)archive + e->offset; }
@@ -0,0 +1,43 @@
+#ifndef GAR_H
+#define GAR_H
+
+#include "types.h"
+
+// GemOS app archive, packed by tools/mkgar at build time. A header, a
+// name-sorted entry table, then each file at a 4KB aligned offset. It is
+// kept in memory as one block and files are used in place, never copied.
+//
+// It reaches us either appended to os.img (the boot sector tells us where)
+// or as a Multiboot module (QEMU -initrd build/apps.gar).
+
+#define GAR_MAGIC 0x31524147 // "GAR1"
+#define GAR_ALIGN 4096
+#define GAR_NAME_LEN 48
+
+typedef struct {
+  uint32_t magic;
+  uint32_t count;
+  uint32_t size; // Whole archive, multiple of GAR_ALIGN
+  uint32_t reserved;
+} GarHeader;
+
+typedef struct {
+  char name[GAR_NAME_LEN]; // NUL terminated
+  uint32_t offset;         // From the start of the archive
+  uint32_t size;
+  uint32_t reserved[2];
+} GarEntry;
+
+// Use an archive already in memory. Returns 0 if it is valid.
+int gar_attach(void *base, uint32_t size);
+
+// Read the archive build.sh appended to the boot disk, in one request.
+// Returns 0 on success, -1 if there is none.
+int gar_load_boot_disk();
+
+int gar_count();
+GarEntry *gar_entry(int index);
+GarEntry *gar_find(const char *name); // Binary search, 0 if missing
+char *gar_data(GarEntry *e);
+
+#endif
@@ -1,6 +1,10 @@
 #include "gemlang.h"
 #include "../drivers/video.h"
 #include "apps.h"
+#include "gar.h"
+#include "memory.h"
+#include "multiboot.h"
+#include "sched.h"
 #include "window.h"
 
 // --- Utils ---
@@ -62,28 +66,68 @@ void str_cat_safe(char *dest, char *src) {
   dest[i] = 0;
 }
 
-// --- Tokenizer ---
+// --- Interpreter Context ---
+// Everything one running app owns. Each GemLang window carries its own
+// context in app_data, so several scripts can be open at once.
 #define MAX_TOKENS 800
 #define TOKEN_LEN 64
-char tokens[MAX_TOKENS][TOKEN_LEN];
-int token_count = 0;
+#define MAX_VARS 30
+#define MAX_COMPS 100
+
+typedef struct {
+  char name[32];
+  int int_val;
+  char str_val[32];
+  int type; // 0=Int, 1=String
+} GemVar;
 
-void tokenize(char *script) {
-  token_count = 0;
+typedef struct {
+  int type; // 0=Label, 1=Button, 2=Container(VStack), 3=HStack
+  int x, y, w, h;
+  char text[64];
+  int action_start;
+  int action_end;
+  // Layout props
+  uint32_t bg_color;
+  uint32_t fg_color;
+  int padding;
+} GemComp;
+
+typedef struct {
+  char tokens[MAX_TOKENS][TOKEN_LEN];
+  int token_count;
+  GemVar vars[MAX_VARS];
+  int var_count;
+  GemComp comps[MAX_COMPS];
+  int comp_count;
+} GemContext;
+
+// The app being parsed, painted or clicked. Set by each entry point.
+// Every thread has its own copy (clicks run on the window's thread while
+// the compositor paints).
+static GemContext *ctx;
+static int ctx_per_thread = 0;
+
+// --- Tokenizer ---
+
+// Source is bounded by `end` so bundles can be parsed in place without a
+// terminating NUL (boot modules are raw file images).
+void tokenize(char *script, char *end) {
+  ctx->token_count = 0;
   char *p = script;
-  while (*p && token_count < MAX_TOKENS) {
-    while (*p == ' ' || *p == '\n' || *p == '\t')
+  while (p < end && *p && ctx->token_count < MAX_TOKENS) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r'))
       p++;
-    if (!*p)
+    if (p >= end || !*p)
       break;
 
     // Delimiters
     if (*p == '{' || *p == '}' || *p == '(' || *p == ')' || *p == ':' ||
         *p == '.' || *p == '=' || *p == '+' || *p == '-') {
-      tokens[token_count][0] = *p;
-      tokens[token_count][1] = 0;
+      ctx->tokens[ctx->token_count][0] = *p;
+      ctx->tokens[ctx->token_count][1] = 0;
       p++;
-      token_count++;
+      ctx->token_count++;
       continue;
     }
 
@@ -91,44 +135,34 @@ void tokenize(char *script) {
     if (*p == '"') {
       p++;
       int i = 0;
-      while (*p && *p != '"' && i < TOKEN_LEN - 1) {
-        tokens[token_count][i++] = *p++;
+      while (p < end && *p && *p != '"' && i < TOKEN_LEN - 1) {
+        ctx->tokens[ctx->token_count][i++] = *p++;
       }
-      tokens[token_count][i] = 0;
-      if (*p == '"')
+      ctx->tokens[ctx->token_count][i] = 0;
+      if (p < end && *p == '"')
         p++;
-      token_count++;
+      ctx->token_count++;
       continue;
     }
 
     // Word/Number
     int i = 0;
-    while (*p && *p > 32 && *p != '{' && *p != '}' && *p != '(' && *p != ')' &&
-           *p != ':' && *p != '.' && *p != '=' && *p != '+' && *p != '-' &&
-           *p != '"' && i < TOKEN_LEN - 1) {
-      tokens[token_count][i++] = *p++;
+    while (p < end && *p > 32 && *p != '{' && *p != '}' && *p != '(' &&
+           *p != ')' && *p != ':' && *p != '.' && *p != '=' && *p != '+' &&
+           *p != '-' && *p != '"' && i < TOKEN_LEN - 1) {
+      ctx->tokens[ctx->token_count][i++] = *p++;
     }
-    tokens[token_count][i] = 0;
-    token_count++;
+    ctx->tokens[ctx->token_count][i] = 0;
+    ctx->token_count++;
   }
 }
 
-// --- Interpreter Context ---
-#define MAX_VARS 30
-typedef struct {
-  char name[32];
-  int int_val;
-  char str_val[32];
-  int type; // 0=Int, 1=String
-} GemVar;
-
-GemVar g_vars[MAX_VARS];
-int g_var_count = 0;
+// --- Variables ---
 
 GemVar *find_var(char *name) {
-  for (int i = 0; i < g_var_count; i++) {
-    if (str_eq(g_vars[i].name, name))
-      return &g_vars[i];
+  for (int i = 0; i < ctx->var_count; i++) {
+    if (str_eq(ctx->vars[i].name, name))
+      return &ctx->vars[i];
   }
   return 0;
 }
@@ -136,9 +170,9 @@ GemVar *find_var(char *name) {
 void set_var_int(char *name, int v) {
   GemVar *fv = find_var(name);
   if (!fv) {
-    if (g_var_count >= MAX_VARS)
+    if (ctx->var_count >= MAX_VARS)
       return;
-    fv = &g_vars[g_var_count++];
+    fv = &ctx->vars[ctx->var_count++];
     int i = 0;
     while (name[i]) {
       fv->name[i] = name[i];
@@ -154,9 +188,9 @@ void set_var_int(char *name, int v) {
 void set_var_str(char *name, char *s) {
   GemVar *fv = find_var(name);
   if (!fv) {
-    if (g_var_count >= MAX_VARS)
+    if (ctx->var_count >= MAX_VARS)
       return;
-    fv = &g_vars[g_var_count++];
+    fv = &ctx->vars[ctx->var_count++];
     int i = 0;
     while (name[i]) {
       fv->name[i] = name[i];
@@ -210,21 +244,6 @@ void resolve_string(char *src, char *dest) {
 }
 
 // --- Component Tree ---
-#define MAX_COMPS 100
-typedef struct {
-  int type; // 0=Label, 1=Button, 2=Container(VStack), 3=HStack
-  int x, y, w, h;
-  char text[64];
-  int action_start;
-  int action_end;
-  // Layout props
-  uint32_t bg_color;
-  uint32_t fg_color;
-  int padding;
-} GemComp;
-
-GemComp g_comps[MAX_COMPS];
-int g_comp_count = 0;
 
 // Layout Tracking
 int layout_x = 0;
@@ -239,12 +258,12 @@ void parse_block_logic(int start, int end) {
   while (t < end) {
     // Simple: VAR = VAL
     // Simple: VAR = VAR + VAL
-    if (t + 1 < end && str_eq(tokens[t + 1], "=")) {
-      char *vn = tokens[t];
+    if (t + 1 < end && str_eq(ctx->tokens[t + 1], "=")) {
+      char *vn = ctx->tokens[t];
       GemVar *gv = find_var(vn);
       // Right Hand Side
-      char *op1 = tokens[t + 2];
-      char *op = (t + 3 < end) ? tokens[t + 3] : 0;
+      char *op1 = ctx->tokens[t + 2];
+      char *op = (t + 3 < end) ? ctx->tokens[t + 3] : 0;
 
       // Int Math?
       int v1 = 0;
@@ -262,7 +281,7 @@ void parse_block_logic(int start, int end) {
 
       if (is_int) {
         if (op && (str_eq(op, "+") || str_eq(op, "-"))) {
-          char *op2 = tokens[t + 4];
+          char *op2 = ctx->tokens[t + 4];
           int v2 = 0;
           if (op2[0] >= '0' && op2[0] <= '9')
             v2 = str_to_int(op2);
@@ -292,7 +311,7 @@ void parse_block_logic(int start, int end) {
           str_cat_safe(buf, op1);
 
         if (op && str_eq(op, "+")) {
-          char *op2 = tokens[t + 4];
+          char *op2 = ctx->tokens[t + 4];
           // Strip quotes? Tokenizer already did
           str_cat_safe(buf, op2);
           t += 5;
@@ -301,14 +320,14 @@ void parse_block_logic(int start, int end) {
         }
         set_var_str(vn, buf);
       }
-    } else if (str_eq(tokens[t], "if")) {
+    } else if (str_eq(ctx->tokens[t], "if")) {
       // Very basic if: if ( x == y ) { ... }
       // Skip for now in prototype 2.0 to ensure stability first
       int brace = 0;
       while (t < end) {
-        if (str_eq(tokens[t], "{"))
+        if (str_eq(ctx->tokens[t], "{"))
           brace++;
-        if (str_eq(tokens[t], "}")) {
+        if (str_eq(ctx->tokens[t], "}")) {
           brace--;
           if (brace == 0)
             break;
@@ -328,13 +347,13 @@ int parse_ui(int t, int stop_token, int px, int py, int p_width) {
   int cy = py;
   int row_h = 0; // For HStack
 
-  while (t < stop_token && !str_eq(tokens[t], "}")) {
-    int is_vstack = str_eq(tokens[t], "VStack");
-    int is_hstack = str_eq(tokens[t], "HStack");
+  while (t < stop_token && !str_eq(ctx->tokens[t], "}")) {
+    int is_vstack = str_eq(ctx->tokens[t], "VStack");
+    int is_hstack = str_eq(ctx->tokens[t], "HStack");
 
     if (is_vstack || is_hstack) {
       t++;
-      if (str_eq(tokens[t], "{"))
+      if (str_eq(ctx->tokens[t], "{"))
         t++;
       // Layout context switch?
       // Simple recursive call
@@ -355,10 +374,10 @@ int parse_ui(int t, int stop_token, int px, int py, int p_width) {
       // Re-use logic: just parse children.
       int t_end = t;
       int b = 1;
-      while (b > 0 && t_end < token_count) {
-        if (str_eq(tokens[t_end], "{"))
+      while (b > 0 && t_end < ctx->token_count) {
+        if (str_eq(ctx->tokens[t_end], "{"))
           b++;
-        if (str_eq(tokens[t_end], "}"))
+        if (str_eq(ctx->tokens[t_end], "}"))
           b--;
         t_end++;
       }
@@ -369,16 +388,16 @@ int parse_ui(int t, int stop_token, int px, int py, int p_width) {
       // for the demo.
     }
 
-    if (str_eq(tokens[t], "Label")) {
+    if (str_eq(ctx->tokens[t], "Label")) {
       t++;
-      if (str_eq(tokens[t], "("))
+      if (str_eq(ctx->tokens[t], "("))
         t++;
-      char *txt = tokens[t];
+      char *txt = ctx->tokens[t];
       t++;
-      if (str_eq(tokens[t], ")"))
+      if (str_eq(ctx->tokens[t], ")"))
         t++;
 
-      GemComp *c = &g_comps[g_comp_count++];
+      GemComp *c = &ctx->comps[ctx->comp_count++];
       c->type = 0;
       // c->text...
       int k = 0;
@@ -393,16 +412,16 @@ int parse_ui(int t, int stop_token, int px, int py, int p_width) {
       c->h = 24;
 
       cy += 30; // Auto-VStack
-    } else if (str_eq(tokens[t], "Button")) {
+    } else if (str_eq(ctx->tokens[t], "Button")) {
       t++;
-      if (str_eq(tokens[t], "("))
+      if (str_eq(ctx->tokens[t], "("))
         t++;
-      char *txt = tokens[t];
+      char *txt = ctx->tokens[t];
       t++;
-      if (str_eq(tokens[t], ")"))
+      if (str_eq(ctx->tokens[t], ")"))
         t++;
 
-      GemComp *c = &g_comps[g_comp_count++];
+      GemComp *c = &ctx->comps[ctx->comp_count++];
       c->type = 1;
       int k = 0;
       while (txt[k]) {
@@ -418,14 +437,14 @@ int parse_ui(int t, int stop_token, int px, int py, int p_width) {
       c->fg_color = 0x000000;
 
       // Action block?
-      if (str_eq(tokens[t], "{")) {
+      if (str_eq(ctx->tokens[t], "{")) {
         t++;
         c->action_start = t;
         int b = 1;
-        while (b > 0 && t < token_count) {
-          if (str_eq(tokens[t], "{"))
+        while (b > 0 && t < ctx->token_count) {
+          if (str_eq(ctx->tokens[t], "{"))
             b++;
-          if (str_eq(tokens[t], "}")) {
+          if (str_eq(ctx->tokens[t], "}")) {
             b--;
             if (b == 0)
               break;
@@ -456,16 +475,17 @@ void reload_layout() {
   // In a real VDOM, we just re-evaluate bindings.
   // Here, we re-parse completely?
   // No, we just re-eval string bindings.
-  for (int i = 0; i < g_comp_count; i++) {
+  for (int i = 0; i < ctx->comp_count; i++) {
     // Refresh?
   }
 }
 
 void gem_paint(Window *win) {
+  ctx = (GemContext *)win->app_data;
   // Re-parse layout on every paint? No, too slow.
   // Just draw display list.
-  for (int i = 0; i < g_comp_count; i++) {
-    GemComp *c = &g_comps[i];
+  for (int i = 0; i < ctx->comp_count; i++) {
+    GemComp *c = &ctx->comps[i];
 
     char final_text[64];
     resolve_string(c->text, final_text);
@@ -489,9 +509,10 @@ void gem_paint(Window *win) {
 }
 
 void gem_click(Window *win, int x, int y) {
+  ctx = (GemContext *)win->app_data;
   int redraw = 0;
-  for (int i = 0; i < g_comp_count; i++) {
-    GemComp *c = &g_comps[i];
+  for (int i = 0; i < ctx->comp_count; i++) {
+    GemComp *c = &ctx->comps[i];
     if (c->type == 1) {
       if (x >= c->x && x <= c->x + c->w && y >= c->y && y <= c->y + c->h) {
         if (c->action_end > c->action_start) {
@@ -505,63 +526,83 @@ void gem_click(Window *win, int x, int y) {
   // For now, just repaint bindings.
 }
 
-void run_gem_script(char *script) {
-  tokenize(script);
-  g_comp_count = 0;
-  g_var_count = 0;
+static void gem_close(Window *win) { kfree(win->app_data); }
+
+void run_gem_source(char *src, uint32_t len) {
+  // Tokens are copied out of the source, so it can go away afterwards
+  GemContext *app = kzalloc(sizeof(GemContext));
+  if (!app)
+    return;
+  if (!ctx_per_thread) {
+    sched_per_thread((void **)&ctx);
+    ctx_per_thread = 1;
+  }
+  // Launches run on the compositor thread (wm_poll), which has its own
+  // ctx from gem_paint
+  GemContext *saved = ctx;
+  ctx = app;
+  tokenize(src, src + len);
+  Window *opened = 0;
 
   // Parse
   int t = 0;
   // App "Name" {
-  if (str_eq(tokens[t], "App")) {
+  if (str_eq(ctx->tokens[t], "App")) {
     t += 2;
-    if (str_eq(tokens[t], "{"))
+    if (str_eq(ctx->tokens[t], "{"))
       t++;
 
     // Inside App
-    while (t < token_count && !str_eq(tokens[t], "}")) {
+    while (t < ctx->token_count && !str_eq(ctx->tokens[t], "}")) {
 
-      if (str_eq(tokens[t], "var")) {
+      if (str_eq(ctx->tokens[t], "var")) {
         t++;
-        char *nm = tokens[t];
+        char *nm = ctx->tokens[t];
         t += 2; // skip =
-        char *val = tokens[t];
+        char *val = ctx->tokens[t];
         if (val[0] == '"')
           set_var_str(nm, val);
         else
           set_var_int(nm, str_to_int(val));
         t++;
-      } else if (str_eq(tokens[t], "Window")) {
+      } else if (str_eq(ctx->tokens[t], "Window")) {
         t += 2; // {
         // Scan properties
         char *title = "App";
         int w = 300, h = 200;
 
-        while (!str_eq(tokens[t], "VStack") && !str_eq(tokens[t], "HStack") &&
-               !str_eq(tokens[t], "Body")) {
-          if (str_eq(tokens[t], "title")) {
-            title = tokens[t + 2];
+        while (!str_eq(ctx->tokens[t], "VStack") &&
+               !str_eq(ctx->tokens[t], "HStack") &&
+               !str_eq(ctx->tokens[t], "Body")) {
+          if (str_eq(ctx->tokens[t], "title")) {
+            title = ctx->tokens[t + 2];
             t += 3;
-          } else if (str_eq(tokens[t], "width")) {
-            w = str_to_int(tokens[t + 2]);
+          } else if (str_eq(ctx->tokens[t], "width")) {
+            w = str_to_int(ctx->tokens[t + 2]);
             t += 3;
-          } else if (str_eq(tokens[t], "height")) {
-            h = str_to_int(tokens[t + 2]);
+          } else if (str_eq(ctx->tokens[t], "height")) {
+            h = str_to_int(ctx->tokens[t + 2]);
             t += 3;
           } else
             t++;
-          if (t >= token_count)
+          if (t >= ctx->token_count)
             break;
         }
 
         Window *win = create_window(150, 100, w, h, title);
+        if (!win)
+          break;
         win->on_paint = gem_paint;
         win->on_click = gem_click;
+        win->app_data = app;
+        win->on_close = gem_close;
+        opened = win;
 
         // Now Parse Body / VStack
-        if (str_eq(tokens[t], "Body") || str_eq(tokens[t], "VStack")) {
+        if (str_eq(ctx->tokens[t], "Body") ||
+            str_eq(ctx->tokens[t], "VStack")) {
           t += 2; // skip name and {
-          parse_ui(t, token_count, 10, 10, w);
+          parse_ui(t, ctx->token_count, 10, 10, w);
         }
 
         // Break after window for now (1 window app)
@@ -571,37 +612,45 @@ void run_gem_script(char *script) {
       }
     }
   }
+
+  // On screen only once the UI is parsed, so gem_paint sees all of it
+  if (opened)
+    wm_open(opened);
+  else
+    kfree(app);
+  ctx = saved;
+}
+
+void run_gem_script(char *script) {
+  uint32_t len = 0;
+  while (script[len])
+    len++;
+  run_gem_source(script, len);
+}
+
+// Does the first word of a module command line end in ".gem"?
+static int is_gem_bundle(const char *name) {
+  int len = 0;
+  while (name[len] && name[len] != ' ')
+    len++;
+  return len > 4 && name[len - 4] == '.' && name[len - 3] == 'g' &&
+         name[len - 2] == 'e' && name[len - 1] == 'm';
 }
 
 void load_extension_apps() {
-  // 2.0 SciCalc Demo
-  char *scicalc = "App \"SciCalc\" { "
-                  "  var display = \"0\" "
-                  "  var acc = 0 "
-                  "  Window { "
-                  "    title: \"GemLang Calc\" "
-                  "    width: 250 "
-                  "    height: 600 " // Taller
-                  "    VStack { "
-                  "      Label( \"{display}\" ) "
-                  "      Button( \"7\" ) { display = display + \"7\" } "
-                  "      Button( \"8\" ) { display = display + \"8\" } "
-                  "      Button( \"9\" ) { display = display + \"9\" } "
-                  "      Button( \"+\" ) { display = display + \"+\" } "
-                  "      Button( \"4\" ) { display = display + \"4\" } "
-                  "      Button( \"5\" ) { display = display + \"5\" } "
-                  "      Button( \"6\" ) { display = display + \"6\" } "
-                  "      Button( \"-\" ) { display = display + \"-\" } "
-                  "      Button( \"1\" ) { display = display + \"1\" } "
-                  "      Button( \"2\" ) { display = display + \"2\" } "
-                  "      Button( \"3\" ) { display = display + \"3\" } "
-                  "      Button( \"=\" ) { "
-                  "         display = \"Error\" "
-                  "      } "
-                  "      Button( \"C\" ) { display = \"\" } "
-                  "    } "
-                  "  } "
-                  "}";
-
-  run_gem_script(scicalc);
+  // Boot modules: an app archive (QEMU -initrd build/apps.gar) or single
+  // bundles (-initrd "calc.gem", GRUB module2). Single bundles were asked
+  // for explicitly, so they are also started right away.
+  for (int i = 0; i < boot_info.module_count; i++) {
+    BootModule *m = &boot_info.modules[i];
+    if (gar_attach((void *)m->start, m->end - m->start) == 0)
+      continue;
+    if (is_gem_bundle(m->name)) {
+      char *src = (char *)m->start;
+      uint32_t len = m->end - m->start;
+      app_register_gem(m->name, src, len);
+      run_gem_source(src, len);
+    }
+  }
+  register_archive_apps();
 }
@@ -1,7 +1,13 @@
 #ifndef GEMLANG_H
 #define GEMLANG_H
 
+#include "types.h"
+
 void run_gem_script(char *script);
+void run_gem_source(char *src, uint32_t len); // Not NUL terminated
+
 void load_extension_apps();
 
+void int_to_str(int v, char *buf);
+
 #endif
@@ -1,6 +1,16 @@
 #include "../drivers/io.h"
 #include "../drivers/video.h"
+#include "apic.h"
+#include "frameprof.h"
 #include "idt.h"
+#include "input.h"
+#include "lock.h"
+#include "sampler.h"
+#include "sched.h"
+#include "smp.h"
+#include "snapshot.h"
+#include "tiles.h"
+#include "trace.h"
 #include "window.h"
 
 // Scancode Map (Unshifted)
@@ -12,9 +22,75 @@ char kbd_US[128] = {0,    27,  '1', '2',  '3',  '4',  '5', '6', '7',  '8',
                     '\'', '`', 0,   '\\', 'z',  'x',  'c', 'v', 'b',  'n',
                     'm',  ',', '.', '/',  0,    '*',  0,   ' '};
 
-void keyboard_handler() {
-  uint8_t scancode = inb(0x60);
+// Navigation block (E0 prefixed) and the keypad with NumLock off
+static char nav_key(uint8_t scancode) {
+  switch (scancode) {
+  case 0x48:
+    return KEY_UP;
+  case 0x50:
+    return KEY_DOWN;
+  case 0x4B:
+    return KEY_LEFT;
+  case 0x4D:
+    return KEY_RIGHT;
+  case 0x47:
+    return KEY_HOME;
+  case 0x4F:
+    return KEY_END;
+  case 0x49:
+    return KEY_PGUP;
+  case 0x51:
+    return KEY_PGDN;
+  case 0x53:
+    return KEY_DELETE;
+  }
+  return 0;
+}
+
+void keyboard_handler() { keyboard_scancode(inb(0x60)); }
+
+void keyboard_scancode(uint8_t scancode) {
   static int shift_pressed = 0;
+  static int ctrl_pressed = 0;
+  static int extended = 0;
+
+  if (scancode == 0xE0) {
+    extended = 1;
+    return;
+  }
+  int was_extended = extended;
+  extended = 0;
+
+  // Global hotkeys: F9 dumps a screen snapshot, F10 starts/stops the
+  // sampling profiler, F11 dumps the frame profile, F12 toggles its overlay
+  if (scancode == 0x43) {
+    snapshot_request("f9");
+    return;
+  }
+  if (scancode == 0x44) {
+    sampler_toggle();
+    return;
+  }
+  if (scancode == 0x57) {
+    frameprof_request_dump();
+    tiles_request_dump();
+    lock_request_dump();
+    return;
+  }
+  if (scancode == 0x58) {
+    frameprof_toggle_overlay();
+    return;
+  }
+
+  if (scancode == 0x1D || scancode == 0x9D) { // Left/Right Ctrl
+    ctrl_pressed = !(scancode & 0x80);
+    return;
+  }
+  if (was_extended) {
+    if (!(scancode & 0x80) && nav_key(scancode))
+      wm_handle_keyboard(nav_key(scancode));
+    return;
+  }
 
   if (scancode == 0x2A || scancode == 0x36) {
     shift_pressed = 1;
@@ -28,6 +104,13 @@ void keyboard_handler() {
   // Ignore break codes for other keys (scancode & 0x80)
   if (!(scancode & 0x80)) {
     char c = kbd_US[scancode];
+    if (!c)
+      c = nav_key(scancode);
+
+    if (ctrl_pressed && c >= 'a' && c <= 'z') {
+      wm_handle_keyboard(KEY_CTRL(c));
+      return;
+    }
 
     // Shift Logic (Simple Uppercase)
     if (shift_pressed) {
@@ -160,9 +243,12 @@ void mouse_handler() {
     // Not mouse?
   }
 
-  uint8_t data = inb(0x60);
+  mouse_byte(inb(0x60));
+}
+
+void mouse_byte(uint8_t data) {
   static uint8_t mouse_cycle = 0;
-  static uint8_t mouse_byte[3];
+  static uint8_t packet[3];
 
   // Synchronization: Bit 3 of Byte 0 must be 1.
   if (mouse_cycle == 0) {
@@ -172,14 +258,14 @@ void mouse_handler() {
     }
   }
 
-  mouse_byte[mouse_cycle++] = data;
+  packet[mouse_cycle++] = data;
 
   if (mouse_cycle == 3) {
     mouse_cycle = 0;
 
-    uint8_t flags = mouse_byte[0];
-    uint8_t x_raw = mouse_byte[1];
-    uint8_t y_raw = mouse_byte[2];
+    uint8_t flags = packet[0];
+    uint8_t x_raw = packet[1];
+    uint8_t y_raw = packet[2];
 
     // Check Overflows (Bit 6=X, Bit 7=Y)
     if ((flags & 0x80) || (flags & 0x40)) {
@@ -226,14 +312,32 @@ void mouse_handler() {
 }
 
 void irq_handler(registers_t r) {
+  // A thread giving up the CPU: the stub switches on the way out, no EOI
+  if (r.int_no == SCHED_YIELD_VECTOR)
+    return;
+  if (r.int_no == 32)
+    sampler_tick(r.eip);
+  // Not the 1kHz tick (it would swamp the link), the UART itself or the
+  // per-frame wakeups
+  if (r.int_no != 32 && r.int_no != 36 && r.int_no != APIC_WAKEUP_VECTOR)
+    trace(TRACE_IRQ, TRACE_IRQ_ENTER, r.int_no - 32, 0, 0);
   if (r.int_no == 33) {
     keyboard_handler();
   }
   if (r.int_no == 44) {
     mouse_handler();
   }
+  if (r.int_no >= 32 && r.int_no < 48 && irq_handlers[r.int_no - 32]) {
+    irq_handlers[r.int_no - 32](r.int_no - 32);
+  }
+
+  this_cpu()->irqs++;
 
   // EOI
+  if (apic_active()) {
+    lapic_eoi();
+    return;
+  }
   if (r.int_no >= 40) {
     outb(0xA0, 0x20); // Slave
   }
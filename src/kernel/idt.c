@@ -1,6 +1,7 @@
 #include "idt.h"
 #include "../drivers/io.h"
 #include "../drivers/video.h"
+#include "apic.h"
 
 idt_gate_t idt[ISR_HANDLERS_COUNT];
 idt_register_t idt_reg;
@@ -8,10 +9,17 @@ idt_register_t idt_reg;
 // External assembly function to load IDT
 extern void idt_load(uint32_t);
 
-// Assembly Wrappers
-extern void isr0();
-extern void irq1();  // Keyboard
-extern void irq12(); // Mouse
+// Assembly Wrappers (interrupts.asm), indexed by IRQ line
+static void (*irq_stubs[16])() = {irq0,  irq1,  irq2,  irq3,  irq4,  irq5,
+                                  irq6,  irq7,  irq8,  irq9,  irq10, irq11,
+                                  irq12, irq13, irq14, irq15};
+
+// Driver handlers for lines other than keyboard/mouse
+IrqHandler irq_handlers[16];
+
+// Current PIC masks (1 = masked)
+static uint8_t pic_master_mask = 0xF9;
+static uint8_t pic_slave_mask = 0xEF;
 
 void set_idt_gate(int n, uint32_t handler) {
   idt[n].low_offset = (uint16_t)(handler & 0xFFFF);
@@ -22,9 +30,47 @@ void set_idt_gate(int n, uint32_t handler) {
   idt[n].high_offset = (uint16_t)((handler >> 16) & 0xFFFF);
 }
 
+void pic_unmask(int irq) {
+  if (irq < 8)
+    pic_master_mask &= ~(1 << irq);
+  else
+    pic_slave_mask &= ~(1 << (irq - 8));
+
+  // The masks are kept as the record of enabled lines either way
+  if (apic_active()) {
+    ioapic_route(irq, 0);
+  } else if (irq < 8) {
+    outb(0x21, pic_master_mask);
+  } else {
+    outb(0xA1, pic_slave_mask);
+  }
+}
+
+static int pic_masked(int irq) {
+  if (irq < 8)
+    return (pic_master_mask >> irq) & 1;
+  return (pic_slave_mask >> (irq - 8)) & 1;
+}
+
+void irq_switch_to_apic() {
+  // Same vectors, same enabled lines; the cascade (IRQ2) has no meaning
+  for (int irq = 0; irq < 16; irq++)
+    ioapic_route(irq, irq == 2 || pic_masked(irq));
+  outb(0x21, 0xFF);
+  outb(0xA1, 0xFF);
+}
+
+void irq_register(int irq, IrqHandler handler) {
+  if (irq < 0 || irq >= 16)
+    return;
+  irq_handlers[irq] = handler;
+  pic_unmask(irq);
+}
+
 void init_idt() {
-  set_idt_gate(33, (uint32_t)irq1);  // IRQ 1 -> Keyboard
-  set_idt_gate(44, (uint32_t)irq12); // IRQ 12 -> Mouse (0x20 + 12 = 32+12=44)
+  // IRQ n -> IDT 32 + n (1 = Keyboard -> 33, 12 = Mouse -> 44)
+  for (int i = 0; i < 16; i++)
+    set_idt_gate(32 + i, (uint32_t)irq_stubs[i]);
 
   idt_reg.base = (uint32_t)&idt;
   idt_reg.limit = ISR_HANDLERS_COUNT * sizeof(idt_gate_t) - 1;
@@ -42,10 +88,10 @@ void init_idt() {
   // Masking: Enable only IRQ1 (Keyboard), IRQ2 (Cascade), IRQ12 (Mouse)
   // Master: IRQ1 (bit 1) and IRQ2 (bit 2) = 0000 0110 inverted = 1111 1001 =
   // 0xF9
-  outb(0x21, 0xF9);
+  outb(0x21, pic_master_mask);
   // Slave: IRQ12 is IRQ 4 on slave (bit 4) = 0001 0000 inverted = 1110 1111 =
   // 0xEF
-  outb(0xA1, 0xEF);
+  outb(0xA1, pic_slave_mask);
 
   idt_load((uint32_t)&idt_reg);
 
@@ -28,13 +28,27 @@ typedef struct {
   uint32_t eip, cs, eflags, useresp, ss;
 } registers_t;
 
+// Driver interrupt handler, called with the IRQ line number
+typedef void (*IrqHandler)(int irq);
+
 void init_idt();
 void set_idt_gate(int n, uint32_t handler);
+void pic_unmask(int irq);
+
+// Move every line to the IOAPIC, keeping the current masks, and silence the
+// 8259s. pic_unmask keeps working afterwards.
+void irq_switch_to_apic();
+
+// Install a handler for a PIC line and unmask it
+void irq_register(int irq, IrqHandler handler);
+extern IrqHandler irq_handlers[16];
 
 // External defined in interrupts.asm
 extern void idt_load(uint32_t);
-extern void irq1();  // Keyboard
-extern void irq12(); // Mouse
+extern void irq0(), irq1(), irq2(), irq3(), irq4(), irq5(), irq6(), irq7();
+extern void irq8(), irq9(), irq10(), irq11(), irq12(), irq13(), irq14();
+extern void irq15();
+extern void apic_spurious(), ipi_wakeup(), sched_yield_stub();
 extern void irq_handler(registers_t r);
 
 #endif
@@ -0,0 +1,15 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "types.h"
+
+// PS/2 decoding (handlers.c). The IRQ handlers read the controller and
+// pass the bytes on; the bench replay feeds recorded bytes straight in.
+// Call with interrupts off, like the IRQ path does.
+void keyboard_scancode(uint8_t scancode);
+void mouse_byte(uint8_t data); // One byte of a 3-byte packet
+
+extern int mouse_x, mouse_y;
+extern char kbd_US[128];
+
+#endif
@@ -1,10 +1,8 @@
 [bits 32]
 [extern irq_handler] ; C function
+[extern sched_switch]
 global idt_load
 
-global irq1
-global irq12
-
 idt_load:
     mov eax, [esp+4]
     lidt [eax]
@@ -19,30 +17,65 @@ irq_common_stub:
 
     mov ax, 0x10    ; Load the kernel data segment descriptor
     mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+    mov es, ax      ; gs is left alone: it points at this CPU's data
 
     call irq_handler
 
+    push esp        ; Frame of the interrupted thread
+    call sched_switch
+    mov esp, eax    ; Frame of the thread to resume (usually the same)
+
     pop eax         ; Reload the original data segment descriptor
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
 
     popa            ; Pops edi,esi,ebp...
     add esp, 8      ; Cleans up the pushed error code and ISR number
     iret
 
-; IRQ 1 - Keyboard
-irq1:
-    push byte 0     ; Dummy error code
-    push byte 33    ; IDT Index (32+1)
+; One stub per PIC line. IDT index = 32 + IRQ number.
+; (IRQ 1 = Keyboard -> 33, IRQ 12 = Mouse -> 44, IRQ 14/15 = ATA -> 46/47)
+%macro IRQ 1
+global irq%1
+irq%1:
+    push byte 0         ; Dummy error code
+    push byte 32 + %1   ; IDT Index
+    jmp irq_common_stub
+%endmacro
+
+IRQ 0
+IRQ 1
+IRQ 2
+IRQ 3
+IRQ 4
+IRQ 5
+IRQ 6
+IRQ 7
+IRQ 8
+IRQ 9
+IRQ 10
+IRQ 11
+IRQ 12
+IRQ 13
+IRQ 14
+IRQ 15
+
+; Local APIC spurious interrupt: no EOI, nothing to do
+global apic_spurious
+apic_spurious:
+    iret
+
+; Wakeup IPI between CPUs: goes through irq_handler like a device IRQ
+global ipi_wakeup
+ipi_wakeup:
+    push byte 0
+    push dword 0xF0     ; APIC_WAKEUP_VECTOR
     jmp irq_common_stub
 
-; IRQ 12 - Mouse
-irq12:
+; Thread yield (int 0x81): same frame as an IRQ, so sched_switch can resume
+; it from any interrupt
+global sched_yield_stub
+sched_yield_stub:
     push byte 0
-    push byte 44    ; IDT Index (32+12)
+    push dword 0x81     ; SCHED_YIELD_VECTOR
     jmp irq_common_stub
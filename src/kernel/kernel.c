@@ -1,13 +1,79 @@
+#include "../drivers/ata.h"
+#include "../drivers/serial.h"
 #include "../drivers/video.h"
+#include "../drivers/virtio_blk.h"
+#include "apic.h"
 #include "apps.h"
+#include "bcache.h"
+#include "block.h"
+#include "fat32.h"
+#include "gar.h"
+#include "gemlang.h"
 #include "idt.h"
+#include "lock.h"
+#include "memory.h"
+#include "multiboot.h"
+#include "rcu.h"
+#include "replay.h"
+#include "sampler.h"
+#include "sched.h"
+#include "smp.h"
+#include "snapshot.h"
+#include "timeline.h"
+#include "timer.h"
+#include "trace.h"
 #include "types.h"
 #include "window.h"
 
 extern void init_mouse();
 
+// Fast boot: no logo, no progress bar, straight to an interactive desktop.
+// Enable with the kernel command line option "fastboot" (Multiboot) or by
+// building with -DGEMOS_FAST_BOOT.
+#ifdef GEMOS_FAST_BOOT
+static int fast_boot = 1;
+#else
+static int fast_boot = 0;
+#endif
+
+// --- Deferred Init ---
+// Work that does not gate the first interactive frame. Runs one job per
+// frame from the main loop, interleaved with painting.
+typedef void (*DeferredInit)();
+
+typedef struct {
+  const char *name;
+  DeferredInit fn;
+} DeferredJob;
+
+#define MAX_DEFERRED 8
+static DeferredJob deferred[MAX_DEFERRED];
+static int deferred_count = 0;
+static int deferred_next = 0;
+
+static void defer_init(const char *name, DeferredInit fn) {
+  if (deferred_count < MAX_DEFERRED) {
+    deferred[deferred_count].name = name;
+    deferred[deferred_count].fn = fn;
+    deferred_count++;
+  }
+}
+
+// Returns 1 when a job ran
+static int run_deferred_init() {
+  if (deferred_next >= deferred_count)
+    return 0;
+  DeferredJob *job = &deferred[deferred_next++];
+  job->fn();
+  timeline_mark(job->name);
+  return 1;
+}
+
 // Boot Status Helper
 void draw_boot_progress(char *msg, int percent) {
+  if (fast_boot)
+    return;
+
   int cx = screen_width / 2;
   int cy = screen_height / 2;
 
@@ -24,14 +90,14 @@ void draw_boot_progress(char *msg, int percent) {
   int fill = (percent * 196) / 100;
   draw_rect(cx - 98, cy + 102, fill, 16, 0x000000);
 
-  video_swap();
-
-  // Minimal delay for visual effect
-  for (int w = 0; w < 500000; w++)
-    asm volatile("nop");
+  // Only the bar and status line changed
+  video_swap_rect(cx - 100, cy + 100, 200, 50);
 }
 
 void show_boot_logo() {
+  if (fast_boot)
+    return;
+
   video_clear(0xFFFFFF);
   int cx = screen_width / 2;
   int cy = screen_height / 2;
@@ -50,39 +116,153 @@ void show_boot_logo() {
   video_swap();
 }
 
-void kernel_main() {
+static void deferred_print_timeline() { timeline_dump(); }
+
+// Probe disks. Needs IRQs, so it runs from the main loop rather than inside
+// the boot sequence. The read benchmarks stall frames and fill the cache,
+// so they only run with the "diskbench" boot option.
+#define DISK_BENCH_SECTORS 2048
+
+static void deferred_init_disks() {
+  init_bcache();
+  init_virtio_blk();
+  init_ata();
+  int bench = boot_has_option("diskbench");
+  for (int i = 0; i < block_device_count(); i++) {
+    BlockDevice *dev = block_device(i);
+    if (bench) {
+      block_benchmark(dev, DISK_BENCH_SECTORS);
+      bcache_benchmark(dev, DISK_BENCH_SECTORS);
+    }
+    block_report(dev);
+  }
+
+  // The app archive appended to the boot image is read in one go once the
+  // disks are up (unless a boot module already provided one)
+  if (gar_load_boot_disk() == 0)
+    register_archive_apps();
+
+  // GemLang apps shipped on the FAT32 disk join the Apps menu. They are
+  // read from disk on launch, not now.
+  if (fat32_mount())
+    scan_app_directory("/apps");
+}
+
+// Frame times go to the trace channel: every frame over budget, plus a
+// summary once a second (tracing every frame would swamp the link)
+#define FRAME_BUDGET_US 16667
+
+// The compositor paints at a steady rate and sleeps in between, which is
+// when the app threads run. A late frame starts the next period instead of
+// being made up for. While boot work is pending or a benchmark measures
+// frames, it only sleeps for a tick.
+#define FRAME_MS 16
+
+static void pace_frame(int busy) {
+  static uint32_t next = 0;
+  uint32_t now = timer_ms();
+  next += FRAME_MS;
+  if (busy || replay_running() || (int32_t)(next - now) < 1)
+    next = now + 1;
+  thread_sleep_ms(next - now);
+}
+
+static void paint_traced() {
+  static uint32_t frame = 0, frames = 0, max_us = 0, total_us = 0;
+  static uint32_t window_start = 0;
+
+  uint64_t start = rdtsc();
+  desktop_paint();
+  uint32_t us = tsc_to_us(rdtsc() - start);
+
+  frame++;
+  frames++;
+  total_us += us;
+  if (us > max_us)
+    max_us = us;
+  if (us > FRAME_BUDGET_US)
+    trace(TRACE_PAINT, TRACE_PAINT_SLOW, frame, us, 0);
+
+  uint32_t now = timer_ms();
+  if (now - window_start >= 1000) {
+    trace(TRACE_PAINT, TRACE_PAINT_STATS, frames, max_us, total_us);
+    window_start = now;
+    frames = max_us = total_us = 0;
+  }
+}
+
+void kernel_main(uint32_t magic, uint32_t info_addr) {
+  timeline_init();
+
+  // Copy the loader handoff (BIOS stash or Multiboot info) before anything
+  // can overwrite it, then hand the remaining RAM to the heap.
+  parse_boot_info(magic, info_addr);
+  if (boot_has_option("fastboot"))
+    fast_boot = 1;
+  replay_init();
+  timeline_mark("boot info");
+
+  init_memory();
+  timeline_mark("heap");
+
+  init_serial();
+  init_trace();
+  timeline_mark("serial");
+
   // CRITICAL: Initialize IDT first so interrupts don't Triple Fault
+  init_cpu(); // Per-CPU GDT, so this_cpu() works in interrupt handlers
   init_idt();
-  init_mouse();
+  init_timer();
+  serial_start_irq(); // COM1 output is interrupt driven from here on
+  init_apic();        // Takes the enabled lines over from the PIC
+  init_sched();       // This becomes the compositor thread
+  timeline_mark("idt");
 
-  // Now safe to init video
+  // Now safe to init video (backbuffer comes from the heap)
   init_video();
+  timeline_mark("video");
 
   show_boot_logo();
-
-  // Logs
   draw_boot_progress("System Core Loaded...", 20);
+  timeline_mark("boot logo");
 
-  draw_boot_progress("Initializing Extensions...", 40);
-  // Any other init? GemLang?
+  // The PS/2 handshake only needs the IDT, so it overlaps with the logo
+  init_mouse();
+  draw_boot_progress("Input Ready...", 40);
+  timeline_mark("mouse");
 
   draw_boot_progress("Starting Window Manager...", 60);
   init_window_manager();
+  timeline_mark("window manager");
 
   draw_boot_progress("Loading Applications...", 80);
   init_apps();
+  timeline_mark("apps");
 
   draw_boot_progress("Starting Desktop...", 100);
 
-  // Final small wait
-  for (int w = 0; w < 2000000; w++)
-    asm volatile("nop");
-
-  // Start clean with just About
-  start_about();
+  // Off the critical path: GemLang parsing, then the timeline report
+  // (which needs the ~10ms TSC calibration).
+  defer_init("gemlang extensions", load_extension_apps);
+  defer_init("timeline report", deferred_print_timeline);
+  defer_init("disks", deferred_init_disks);
+  defer_init("smp", smp_start_aps);
 
   // Main Loop
+  desktop_paint();
+  timeline_mark("first frame");
   while (1) {
-    desktop_paint();
+    replay_begin_frame();
+    wm_poll();
+    paint_traced();
+    replay_end_frame();
+    snapshot_poll();
+    rcu_frame_end(); // Frees what closed windows left behind
+    int busy = run_deferred_init();
+    if (!busy)
+      replay_idle(); // Benchmark runs start once boot work is done
+    sampler_poll();
+    lock_poll();
+    pace_frame(busy);
   }
 }
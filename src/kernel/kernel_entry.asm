@@ -1,7 +1,149 @@
 [bits 32]
 [extern kernel_main]
+[extern _edata]   ; End of loaded image (linker provided)
+[extern _end]     ; End of .bss (linker provided)
+
+; Multiboot constants
+MB2_MAGIC       equ 0xE85250D6
+MB2_ARCH_I386   equ 0
+MB1_MAGIC       equ 0x1BADB002
+; Bit 1: want memory info, Bit 2: want video mode, Bit 16: address fields valid
+; (we are a flat binary, not ELF, so the loader needs the a.out kludge fields)
+MB1_FLAGS       equ (1 << 1) | (1 << 2) | (1 << 16)
+
+BOOT_STACK_SIZE equ 16384
 
 global _start
+global boot_stack_top
+
+; Entry is reached three ways:
+;  1. boot.asm    -> call 0x10000, EAX = 0 (no handoff, VESA stash at 0x9000)
+;  2. GRUB        -> Multiboot2, EAX = 0x36D76289, EBX = info
+;  3. QEMU -kernel-> Multiboot1, EAX = 0x2BADB002, EBX = info
+; The first instruction must stay at the load address for boot.asm.
 _start:
+    jmp entry
+
+; --- Multiboot2 Header (GRUB) ---
+; Must be 8-byte aligned and within the first 32KB.
+align 8
+mb2_header:
+    dd MB2_MAGIC
+    dd MB2_ARCH_I386
+    dd mb2_header_end - mb2_header
+    dd 0x100000000 - (MB2_MAGIC + MB2_ARCH_I386 + (mb2_header_end - mb2_header))
+
+    ; Address tag (type 2): load us as a flat image
+align 8
+    dw 2, 0
+    dd 24
+    dd mb2_header      ; header_addr
+    dd _start          ; load_addr
+    dd _edata          ; load_end_addr
+    dd _end            ; bss_end_addr
+
+    ; Entry address tag (type 3)
+align 8
+    dw 3, 0
+    dd 12
+    dd entry
+
+    ; Framebuffer tag (type 5): same mode the VESA scan in boot.asm prefers
+align 8
+    dw 5, 0
+    dd 20
+    dd 1024            ; width
+    dd 768             ; height
+    dd 32              ; depth
+
+    ; End tag
+align 8
+    dw 0, 0
+    dd 8
+mb2_header_end:
+
+; --- Multiboot1 Header (QEMU -kernel) ---
+; QEMU only speaks Multiboot1. Must be 4-byte aligned and within the first 8KB.
+align 4
+mb1_header:
+    dd MB1_MAGIC
+    dd MB1_FLAGS
+    dd 0x100000000 - (MB1_MAGIC + MB1_FLAGS)
+    dd mb1_header      ; header_addr
+    dd _start          ; load_addr
+    dd _edata          ; load_end_addr
+    dd _end            ; bss_end_addr
+    dd entry           ; entry_addr
+    dd 0               ; mode_type (linear)
+    dd 1024            ; width
+    dd 768             ; height
+    dd 32              ; depth
+
+entry:
+    cli
+    mov esi, eax            ; Keep magic / info pointer safe from rep stosd
+    ; EBX (info pointer) is left untouched below
+
+    ; Multiboot leaves GDT/segments undefined. Load our own flat GDT so the
+    ; selectors used by idt.c (0x08) and interrupts.asm (0x10) are valid.
+    lgdt [gdt_descriptor]
+    jmp CODE_SEG:.reload_cs
+.reload_cs:
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Zero .bss (Multiboot loaders do this, boot.asm does not)
+    mov edi, _edata
+    mov ecx, _end
+    sub ecx, edi
+    xor eax, eax
+    cld
+    rep stosb
+
+    mov esp, boot_stack_top
+    mov ebp, esp
+
+    push ebx                ; kernel_main(magic, info_addr)
+    push esi
     call kernel_main
-    jmp $
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+; GDT (same layout as boot.asm)
+align 8
+gdt_start:
+    dq 0x0
+gdt_code:
+    dw 0xFFFF
+    dw 0x0
+    db 0x0
+    db 10011010b
+    db 11001111b
+    db 0x0
+gdt_data:
+    dw 0xFFFF
+    dw 0x0
+    db 0x0
+    db 10010010b
+    db 11001111b
+    db 0x0
+gdt_end:
+
+gdt_descriptor:
+    dw gdt_end - gdt_start - 1
+    dd gdt_start
+
+CODE_SEG equ gdt_code - gdt_start
+DATA_SEG equ gdt_data - gdt_start
+
+section .bss
+align 16
+boot_stack_bottom:
+    resb BOOT_STACK_SIZE
+boot_stack_top:
@@ -0,0 +1,141 @@
+#include "lock.h"
+#include "../drivers/io.h"
+#include "../drivers/serial.h"
+#include "sched.h"
+#include "timeline.h"
+
+static volatile int dump_pending = 0;
+
+#ifdef GEMOS_LOCK_STATS
+static Spinlock *volatile all_locks = 0;
+
+static void stats_register(Spinlock *l) {
+  if (!__sync_bool_compare_and_swap(&l->stats.registered, 0, 1))
+    return;
+  Spinlock *head;
+  do {
+    head = all_locks;
+    l->stats.next = head;
+  } while (!__sync_bool_compare_and_swap(&all_locks, head, l));
+}
+
+// Holding the lock, so the counters need no atomics
+static void stats_acquired(Spinlock *l, int contended, uint32_t wait) {
+  LockStats *s = &l->stats;
+  stats_register(l);
+  s->acquires++;
+  if (contended)
+    s->contended++;
+  s->wait += wait;
+  if (wait > s->wait_max)
+    s->wait_max = wait;
+  s->acquired_at = rdtsc();
+}
+
+static void stats_released(Spinlock *l) {
+  LockStats *s = &l->stats;
+  uint32_t held = (uint32_t)(rdtsc() - s->acquired_at);
+  s->hold += held;
+  if (held > s->hold_max)
+    s->hold_max = held;
+}
+#endif
+
+// Returns 1 if another holder had to be waited for
+static int ticket_lock(Spinlock *l) {
+  uint32_t ticket = __sync_fetch_and_add(&l->next, 1);
+  if (l->owner == ticket)
+    return 0;
+  while (l->owner != ticket)
+    __asm__ volatile("pause");
+  return 1;
+}
+
+void spin_lock(Spinlock *l) {
+#ifdef GEMOS_LOCK_STATS
+  uint64_t start = rdtsc();
+  int contended = ticket_lock(l);
+  stats_acquired(l, contended, contended ? rdtsc() - start : 0);
+#else
+  ticket_lock(l);
+#endif
+}
+
+void spin_unlock(Spinlock *l) {
+#ifdef GEMOS_LOCK_STATS
+  stats_released(l);
+#endif
+  __asm__ volatile("" ::: "memory"); // Critical section done first
+  l->owner = l->owner + 1;           // Only the holder writes it
+}
+
+uint32_t spin_lock_irqsave(Spinlock *l) {
+  uint32_t flags = irq_save();
+  spin_lock(l);
+  return flags;
+}
+
+void spin_unlock_irqrestore(Spinlock *l, uint32_t flags) {
+  spin_unlock(l);
+  irq_restore(flags);
+}
+
+void mutex_lock(Mutex *m) {
+  Thread *self = current_thread(); // 0 before threads: boot code only
+  uint32_t flags = spin_lock_irqsave(&m->lock);
+  while (m->depth && m->owner != self) {
+    // Interrupts stay off until we sleep: the wakeup can't slip in
+    spin_unlock(&m->lock);
+    sched_sleep(m, 0);
+    spin_lock(&m->lock);
+  }
+  m->owner = self;
+  m->depth++;
+  spin_unlock_irqrestore(&m->lock, flags);
+}
+
+void mutex_unlock(Mutex *m) {
+  uint32_t flags = spin_lock_irqsave(&m->lock);
+  int free = --m->depth == 0;
+  if (free)
+    m->owner = 0;
+  spin_unlock_irqrestore(&m->lock, flags);
+  if (free)
+    sched_wakeup(m);
+}
+
+void lock_request_dump() { dump_pending = 1; }
+
+void lock_poll() {
+  if (!dump_pending)
+    return;
+  dump_pending = 0;
+#ifdef GEMOS_LOCK_STATS
+  serial_write("[locks] name acquires contended wait_avg/max "
+               "hold_avg/max (cycles)\n");
+  for (Spinlock *l = all_locks; l; l = l->stats.next) {
+    // Racy copy: the lock may be in use while we print
+    LockStats s = l->stats;
+    if (!s.acquires)
+      continue;
+    serial_write("[locks] ");
+    serial_write(l->name);
+    serial_putc(' ');
+    serial_write_dec(s.acquires);
+    serial_putc(' ');
+    serial_write_dec(s.contended);
+    serial_putc(' ');
+    serial_write_dec(udiv64(s.wait, s.acquires));
+    serial_putc('/');
+    serial_write_dec(s.wait_max);
+    serial_putc(' ');
+    serial_write_dec(udiv64(s.hold, s.acquires));
+    serial_putc('/');
+    serial_write_dec(s.hold_max);
+    serial_putc('\n');
+  }
+#else
+  serial_write("[locks] no stats, build with "
+               "EXTRA_CFLAGS=-DGEMOS_LOCK_STATS\n");
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include "types.h"
+
+// Ticket spinlocks: CPUs are served in the order they arrived. A holder
+// that gets interrupted or preempted on its own CPU cannot release the
+// lock until it runs again, so any lock an IRQ handler or another thread
+// may take is taken with interrupts off (spin_lock_irqsave). Plain
+// spin_lock is for code that already runs with them off.
+//
+// Building with -DGEMOS_LOCK_STATS counts acquires, contended acquires,
+// wait cycles and hold cycles per lock; F11 dumps them on COM1.
+
+#ifdef GEMOS_LOCK_STATS
+typedef struct {
+  uint32_t acquires;
+  uint32_t contended; // Had to wait for another holder
+  uint64_t wait;      // Cycles spent spinning
+  uint64_t hold;      // Cycles between lock and unlock
+  uint32_t wait_max, hold_max;
+  uint64_t acquired_at;
+  int registered;
+  struct Spinlock *next; // All locks seen so far
+} LockStats;
+#endif
+
+typedef struct Spinlock {
+  volatile uint32_t next;  // Next ticket to hand out
+  volatile uint32_t owner; // Ticket being served
+  const char *name;
+#ifdef GEMOS_LOCK_STATS
+  LockStats stats;
+#endif
+} Spinlock;
+
+#define SPINLOCK_INIT(name) {0, 0, name}
+
+void spin_lock(Spinlock *l);
+void spin_unlock(Spinlock *l);
+uint32_t spin_lock_irqsave(Spinlock *l); // Returns flags for the unlock
+void spin_unlock_irqrestore(Spinlock *l, uint32_t flags);
+
+// Sleeping lock for thread context only: waiters sleep instead of
+// spinning, so it may be held across disk I/O. The owner may take it
+// again (public calls nest, e.g. fat32_load opens and reads).
+typedef struct {
+  Spinlock lock;
+  struct Thread *owner;
+  int depth;
+} Mutex;
+
+#define MUTEX_INIT(name) {SPINLOCK_INIT(name), 0, 0}
+
+void mutex_lock(Mutex *m);
+void mutex_unlock(Mutex *m);
+
+void lock_request_dump(); // IRQ safe, printed by lock_poll
+void lock_poll();         // Main loop
+
+#endif
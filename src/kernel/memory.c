@@ -0,0 +1,244 @@
+#include "memory.h"
+#include "lock.h"
+#include "multiboot.h"
+
+#define NULL ((void *)0)
+#define HEAP_MIN_SPLIT 64
+
+// Block header. Blocks are kept in address order so free neighbours can be
+// merged. 16 bytes so every payload is 16-byte aligned.
+typedef struct HeapBlock {
+  uint32_t size; // Payload bytes
+  uint32_t free;
+  struct HeapBlock *next;
+  struct HeapBlock *prev;
+} HeapBlock;
+
+static HeapBlock *heap_head = 0;
+static uint32_t heap_bytes = 0;
+static uint32_t heap_in_use = 0;
+static uint32_t ram_total = 0;
+static Spinlock heap_lock = SPINLOCK_INIT("heap");
+
+extern char _end[]; // End of kernel image + bss (linker provided)
+
+static uint32_t align_up(uint32_t v, uint32_t a) {
+  return (v + a - 1) & ~(a - 1);
+}
+
+void init_memory() {
+  // Pick the largest available region above 1MB
+  uint32_t best_base = 0, best_end = 0;
+  ram_total = 0;
+  for (int i = 0; i < boot_info.region_count; i++) {
+    BootMemRegion *r = &boot_info.regions[i];
+    if (r->type != BOOT_MEM_AVAILABLE)
+      continue;
+    ram_total += r->length;
+    uint32_t base = r->base;
+    uint32_t end = r->base + r->length;
+    if (end <= 0x100000)
+      continue;
+    if (base < 0x100000)
+      base = 0x100000;
+    if (end - base > best_end - best_base) {
+      best_base = base;
+      best_end = end;
+    }
+  }
+
+  // Skip over anything the loader placed there (modules, or the kernel
+  // itself if a loader relocated it high)
+  uint32_t start = best_base;
+  for (int i = 0; i < boot_info.module_count; i++) {
+    BootModule *m = &boot_info.modules[i];
+    if (m->end > start && m->start < best_end)
+      start = m->end;
+  }
+  if ((uint32_t)_end > start && (uint32_t)_end < best_end)
+    start = (uint32_t)_end;
+
+  start = align_up(start, 4096);
+  if (start + sizeof(HeapBlock) + HEAP_MIN_SPLIT >= best_end)
+    return; // No usable memory: every kmalloc will fail
+
+  heap_head = (HeapBlock *)start;
+  heap_head->size = best_end - start - sizeof(HeapBlock);
+  heap_head->free = 1;
+  heap_head->next = 0;
+  heap_head->prev = 0;
+  heap_bytes = heap_head->size;
+  heap_in_use = 0;
+}
+
+// Cut `b` so its payload is exactly `size`, leaving the rest as a new block
+static void split_block(HeapBlock *b, uint32_t size) {
+  if (b->size < size + sizeof(HeapBlock) + HEAP_MIN_SPLIT)
+    return;
+  HeapBlock *rest = (HeapBlock *)((uint8_t *)(b + 1) + size);
+  rest->size = b->size - size - sizeof(HeapBlock);
+  rest->free = 1;
+  rest->next = b->next;
+  rest->prev = b;
+  if (b->next)
+    b->next->prev = rest;
+  b->next = rest;
+  b->size = size;
+}
+
+static void *heap_alloc(uint32_t size, uint32_t align) {
+  if (size == 0)
+    return NULL;
+  if (align < 16)
+    align = 16;
+  size = align_up(size, 16);
+
+  for (HeapBlock *b = heap_head; b; b = b->next) {
+    if (!b->free)
+      continue;
+
+    uint32_t payload = (uint32_t)(b + 1);
+    uint32_t aligned = align_up(payload, align);
+    // Need room in front for a separate free block if we shift forward
+    while (aligned != payload &&
+           aligned - payload < sizeof(HeapBlock) + HEAP_MIN_SPLIT)
+      aligned += align;
+
+    uint32_t end = payload + b->size;
+    if (aligned + size > end || aligned + size < aligned)
+      continue;
+
+    if (aligned != payload) {
+      // Split off the front padding as its own free block
+      HeapBlock *nb = (HeapBlock *)(aligned - sizeof(HeapBlock));
+      nb->size = end - aligned;
+      nb->free = 1;
+      nb->next = b->next;
+      nb->prev = b;
+      if (b->next)
+        b->next->prev = nb;
+      b->next = nb;
+      b->size = (uint32_t)nb - payload;
+      b = nb;
+    }
+
+    split_block(b, size);
+    b->free = 0;
+    heap_in_use += b->size;
+    return (void *)(b + 1);
+  }
+  return NULL;
+}
+
+// Threads, IRQ handlers and other CPUs all allocate
+void *kmalloc_aligned(uint32_t size, uint32_t align) {
+  uint32_t flags = spin_lock_irqsave(&heap_lock);
+  void *p = heap_alloc(size, align);
+  spin_unlock_irqrestore(&heap_lock, flags);
+  return p;
+}
+
+void *kmalloc(uint32_t size) { return kmalloc_aligned(size, 16); }
+
+void *kzalloc(uint32_t size) {
+  void *p = kmalloc(size);
+  if (p)
+    memset(p, 0, size);
+  return p;
+}
+
+static void heap_free(void *ptr) {
+  HeapBlock *b = (HeapBlock *)ptr - 1;
+  if (b->free)
+    return; // Double free, ignore
+  b->free = 1;
+  heap_in_use -= b->size;
+
+  // Merge with next
+  if (b->next && b->next->free) {
+    HeapBlock *n = b->next;
+    b->size += sizeof(HeapBlock) + n->size;
+    b->next = n->next;
+    if (n->next)
+      n->next->prev = b;
+  }
+  // Merge with prev
+  if (b->prev && b->prev->free) {
+    HeapBlock *p = b->prev;
+    p->size += sizeof(HeapBlock) + b->size;
+    p->next = b->next;
+    if (b->next)
+      b->next->prev = p;
+  }
+}
+
+void kfree(void *ptr) {
+  if (!ptr)
+    return;
+  uint32_t flags = spin_lock_irqsave(&heap_lock);
+  heap_free(ptr);
+  spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+uint32_t memory_total() { return ram_total; }
+uint32_t heap_size() { return heap_bytes; }
+uint32_t heap_used() { return heap_in_use; }
+
+// --- mem* ---
+
+void *memset(void *dst, int value, uint32_t n) {
+  uint8_t *d = (uint8_t *)dst;
+  uint32_t v = (uint8_t)value;
+  v |= v << 8;
+  v |= v << 16;
+  while (n && ((uint32_t)d & 3)) {
+    *d++ = (uint8_t)value;
+    n--;
+  }
+  uint32_t words = n / 4;
+  __asm__ volatile("rep stosl" : "+D"(d), "+c"(words) : "a"(v) : "memory");
+  n &= 3;
+  while (n--)
+    *d++ = (uint8_t)value;
+  return dst;
+}
+
+void *memcpy(void *dst, const void *src, uint32_t n) {
+  void *ret = dst;
+  uint32_t words = n / 4;
+  uint32_t bytes = n & 3;
+  __asm__ volatile("rep movsl\n\t"
+                   "mov %3, %%ecx\n\t"
+                   "rep movsb"
+                   : "+D"(dst), "+S"(src), "+c"(words)
+                   : "r"(bytes)
+                   : "memory");
+  return ret;
+}
+
+void *memmove(void *dst, const void *src, uint32_t n) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  if (d <= s || d >= s + n)
+    return memcpy(dst, src, n);
+  // Overlapping, dst above src: copy backwards
+  d += n - 1;
+  s += n - 1;
+  __asm__ volatile("std\n\t"
+                   "rep movsb\n\t"
+                   "cld"
+                   : "+D"(d), "+S"(s), "+c"(n)
+                   :
+                   : "memory");
+  return dst;
+}
+
+int memcmp(const void *a, const void *b, uint32_t n) {
+  const uint8_t *x = (const uint8_t *)a;
+  const uint8_t *y = (const uint8_t *)b;
+  for (uint32_t i = 0; i < n; i++) {
+    if (x[i] != y[i])
+      return x[i] - y[i];
+  }
+  return 0;
+}
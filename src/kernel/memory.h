@@ -0,0 +1,27 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "types.h"
+
+// Kernel heap. Lives in the largest free RAM region above 1MB, after any
+// boot modules. Flat physical addressing (no paging), so pointers returned
+// here are also the physical addresses DMA engines need.
+
+void init_memory();
+void *kmalloc(uint32_t size);
+void *kmalloc_aligned(uint32_t size, uint32_t align);
+void *kzalloc(uint32_t size);
+void kfree(void *ptr);
+
+uint32_t memory_total(); // Usable RAM reported by the loader (bytes)
+uint32_t heap_size();    // Bytes managed by the heap
+uint32_t heap_used();    // Bytes currently allocated (payload)
+
+// The compiler may emit calls to these for struct copies, so keep the
+// standard names.
+void *memset(void *dst, int value, uint32_t n);
+void *memcpy(void *dst, const void *src, uint32_t n);
+void *memmove(void *dst, const void *src, uint32_t n);
+int memcmp(const void *a, const void *b, uint32_t n);
+
+#endif
@@ -0,0 +1,221 @@
+#include "multiboot.h"
+#include "../drivers/rtc.h"
+
+BootInfo boot_info;
+
+// --- Helpers ---
+
+static void copy_str(char *dst, const char *src, int max) {
+  int i = 0;
+  if (src) {
+    while (src[i] && i < max - 1) {
+      dst[i] = src[i];
+      i++;
+    }
+  }
+  dst[i] = 0;
+}
+
+// Clip a 64-bit region to 4GB and append it
+static void add_region(uint32_t base_lo, uint32_t base_hi, uint32_t len_lo,
+                       uint32_t len_hi, uint32_t type) {
+  if (base_hi || boot_info.region_count >= BOOT_MAX_REGIONS)
+    return;
+  uint32_t len = len_lo;
+  if (len_hi || base_lo + len_lo < base_lo)
+    len = 0xFFFFFFFF - base_lo; // Runs past 4GB
+  BootMemRegion *r = &boot_info.regions[boot_info.region_count++];
+  r->base = base_lo;
+  r->length = len;
+  r->type = type;
+}
+
+static void add_module(uint32_t start, uint32_t end, const char *name) {
+  if (boot_info.module_count >= BOOT_MAX_MODULES)
+    return;
+  BootModule *m = &boot_info.modules[boot_info.module_count++];
+  m->start = start;
+  m->end = end;
+  copy_str(m->name, name, sizeof(m->name));
+}
+
+// --- BIOS (boot.asm) ---
+
+// Layout of the stash boot.asm writes after setting the VESA mode
+typedef struct {
+  uint32_t framebuffer_addr;
+  uint16_t width;
+  uint16_t height;
+  uint8_t bpp;
+  uint16_t pitch;
+  uint8_t pad;
+  uint32_t archive_lba; // Set from build.sh's -DARCHIVE_LBA
+  uint32_t archive_sectors;
+} __attribute__((packed)) VesaStash;
+
+#define VESA_STASH_LOC 0x9000
+
+static void parse_bios() {
+  VesaStash *v = (VesaStash *)VESA_STASH_LOC;
+  boot_info.fb.addr = v->framebuffer_addr;
+  boot_info.fb.width = v->width;
+  boot_info.fb.height = v->height;
+  boot_info.fb.bpp = v->bpp;
+  boot_info.fb.pitch = v->pitch;
+  boot_info.archive_lba = v->archive_lba;
+  boot_info.archive_sectors = v->archive_sectors;
+
+  // No E820 from the boot sector (no room), ask CMOS instead
+  boot_info.mem_upper_kb = cmos_extended_memory_kb();
+}
+
+// --- Multiboot1 (QEMU -kernel) ---
+
+#define MB1_INFO_MEMORY (1 << 0)
+#define MB1_INFO_CMDLINE (1 << 2)
+#define MB1_INFO_MODS (1 << 3)
+#define MB1_INFO_MMAP (1 << 6)
+#define MB1_INFO_FRAMEBUFFER (1 << 12)
+
+static void parse_multiboot1(uint32_t addr) {
+  uint32_t *mbi = (uint32_t *)addr;
+  uint32_t flags = mbi[0];
+
+  if (flags & MB1_INFO_MEMORY)
+    boot_info.mem_upper_kb = mbi[2];
+
+  if (flags & MB1_INFO_CMDLINE)
+    copy_str(boot_info.cmdline, (char *)mbi[4], sizeof(boot_info.cmdline));
+
+  if (flags & MB1_INFO_MODS) {
+    uint32_t *mod = (uint32_t *)mbi[6];
+    for (uint32_t i = 0; i < mbi[5]; i++, mod += 4)
+      add_module(mod[0], mod[1], (char *)mod[2]);
+  }
+
+  if (flags & MB1_INFO_MMAP) {
+    // Entries are prefixed by their own size (which excludes the size field)
+    uint32_t p = mbi[12];
+    uint32_t end = p + mbi[11];
+    while (p < end) {
+      uint32_t *e = (uint32_t *)p;
+      add_region(e[1], e[2], e[3], e[4], e[5]);
+      p += e[0] + 4;
+    }
+  }
+
+  if (flags & MB1_INFO_FRAMEBUFFER) {
+    uint8_t *fb = (uint8_t *)addr + 88;
+    if (*(uint32_t *)(fb + 4) == 0) { // Below 4GB
+      boot_info.fb.addr = *(uint32_t *)fb;
+      boot_info.fb.pitch = *(uint32_t *)(fb + 8);
+      boot_info.fb.width = *(uint32_t *)(fb + 12);
+      boot_info.fb.height = *(uint32_t *)(fb + 16);
+      boot_info.fb.bpp = fb[20];
+    }
+  }
+}
+
+// --- Multiboot2 (GRUB) ---
+
+#define MB2_TAG_END 0
+#define MB2_TAG_CMDLINE 1
+#define MB2_TAG_MODULE 3
+#define MB2_TAG_BASIC_MEMINFO 4
+#define MB2_TAG_MMAP 6
+#define MB2_TAG_FRAMEBUFFER 8
+
+static void parse_multiboot2(uint32_t addr) {
+  uint32_t total = *(uint32_t *)addr;
+  uint32_t p = addr + 8; // Skip total_size + reserved
+
+  while (p < addr + total) {
+    uint32_t type = *(uint32_t *)p;
+    uint32_t size = *(uint32_t *)(p + 4);
+    if (type == MB2_TAG_END)
+      break;
+
+    if (type == MB2_TAG_CMDLINE) {
+      copy_str(boot_info.cmdline, (char *)(p + 8), sizeof(boot_info.cmdline));
+    } else if (type == MB2_TAG_MODULE) {
+      add_module(*(uint32_t *)(p + 8), *(uint32_t *)(p + 12),
+                 (char *)(p + 16));
+    } else if (type == MB2_TAG_BASIC_MEMINFO) {
+      boot_info.mem_upper_kb = *(uint32_t *)(p + 12);
+    } else if (type == MB2_TAG_MMAP) {
+      uint32_t entry_size = *(uint32_t *)(p + 8);
+      for (uint32_t e = p + 16; e < p + size; e += entry_size) {
+        uint32_t *m = (uint32_t *)e;
+        add_region(m[0], m[1], m[2], m[3], m[4]);
+      }
+    } else if (type == MB2_TAG_FRAMEBUFFER) {
+      if (*(uint32_t *)(p + 12) == 0) { // Below 4GB
+        boot_info.fb.addr = *(uint32_t *)(p + 8);
+        boot_info.fb.pitch = *(uint32_t *)(p + 16);
+        boot_info.fb.width = *(uint32_t *)(p + 20);
+        boot_info.fb.height = *(uint32_t *)(p + 24);
+        boot_info.fb.bpp = *(uint8_t *)(p + 28);
+      }
+    }
+
+    p += (size + 7) & ~7; // Tags are 8-byte aligned
+  }
+}
+
+void parse_boot_info(uint32_t magic, uint32_t info_addr) {
+  if (magic == MULTIBOOT2_BOOTLOADER_MAGIC) {
+    boot_info.source = BOOT_SOURCE_MULTIBOOT2;
+    parse_multiboot2(info_addr);
+  } else if (magic == MULTIBOOT1_BOOTLOADER_MAGIC) {
+    boot_info.source = BOOT_SOURCE_MULTIBOOT1;
+    parse_multiboot1(info_addr);
+  } else {
+    boot_info.source = BOOT_SOURCE_BIOS;
+    parse_bios();
+  }
+
+  // No map from the loader: synthesize one from the size it did give us
+  if (boot_info.region_count == 0) {
+    add_region(0, 0, 0x9F000, 0, BOOT_MEM_AVAILABLE);
+    add_region(0x100000, 0, boot_info.mem_upper_kb * 1024, 0,
+               BOOT_MEM_AVAILABLE);
+  }
+}
+
+int boot_has_option(const char *opt) {
+  const char *p = boot_info.cmdline;
+  while (*p) {
+    while (*p == ' ')
+      p++;
+    int i = 0;
+    while (opt[i] && p[i] == opt[i])
+      i++;
+    if (!opt[i] && (p[i] == ' ' || p[i] == 0))
+      return 1;
+    while (*p && *p != ' ')
+      p++;
+  }
+  return 0;
+}
+
+int boot_option_value(const char *key, char *out, int max) {
+  const char *p = boot_info.cmdline;
+  while (*p) {
+    while (*p == ' ')
+      p++;
+    int i = 0;
+    while (key[i] && p[i] == key[i])
+      i++;
+    if (!key[i] && p[i] == '=') {
+      p += i + 1;
+      int n = 0;
+      while (*p && *p != ' ' && n < max - 1)
+        out[n++] = *p++;
+      out[n] = 0;
+      return 1;
+    }
+    while (*p && *p != ' ')
+      p++;
+  }
+  return 0;
+}
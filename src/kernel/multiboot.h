@@ -0,0 +1,70 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "types.h"
+
+// Magic values left in EAX by the loader
+#define MULTIBOOT1_BOOTLOADER_MAGIC 0x2BADB002
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36D76289
+
+// Where the boot handoff came from
+#define BOOT_SOURCE_BIOS 0       // boot.asm, VESA stash at 0x9000
+#define BOOT_SOURCE_MULTIBOOT1 1 // QEMU -kernel
+#define BOOT_SOURCE_MULTIBOOT2 2 // GRUB
+
+#define BOOT_MAX_REGIONS 16
+#define BOOT_MAX_MODULES 16
+
+// Memory region types (Multiboot numbering)
+#define BOOT_MEM_AVAILABLE 1
+
+typedef struct {
+  uint32_t addr; // Physical, 0 = none handed over
+  uint32_t width;
+  uint32_t height;
+  uint32_t pitch;
+  uint8_t bpp;
+} BootFramebuffer;
+
+// Regions are clipped to the 32-bit physical address space
+typedef struct {
+  uint32_t base;
+  uint32_t length;
+  uint32_t type;
+} BootMemRegion;
+
+// A file the loader put in memory for us (e.g. a GemLang app bundle)
+typedef struct {
+  uint32_t start;
+  uint32_t end; // Exclusive
+  char name[64]; // Module command line, usually the file name
+} BootModule;
+
+typedef struct {
+  int source;
+  BootFramebuffer fb;
+  uint32_t mem_upper_kb; // RAM above 1MB (fallback when no map)
+  int region_count;
+  BootMemRegion regions[BOOT_MAX_REGIONS];
+  int module_count;
+  BootModule modules[BOOT_MAX_MODULES];
+  char cmdline[128];
+
+  // BIOS boot: app archive build.sh appended to the boot disk (0 = none)
+  uint32_t archive_lba;
+  uint32_t archive_sectors;
+} BootInfo;
+
+extern BootInfo boot_info;
+
+// Copy everything we need out of the loader's structures. Must run before
+// anything allocates memory, since the info block may live in free RAM.
+void parse_boot_info(uint32_t magic, uint32_t info_addr);
+
+// Is `opt` one of the space separated words of the kernel command line?
+int boot_has_option(const char *opt);
+
+// Value of a "key=value" word, copied into out. Returns 1 if present.
+int boot_option_value(const char *key, char *out, int max);
+
+#endif
@@ -0,0 +1,33 @@
+#include "rcu.h"
+#include "lock.h"
+
+static Spinlock retire_lock = SPINLOCK_INIT("rcu retire");
+static RcuHead *retired = 0; // Newest first
+static volatile uint32_t epoch = 0;
+
+void rcu_retire(RcuHead *head, void (*free)(RcuHead *head)) {
+  uint32_t flags = spin_lock_irqsave(&retire_lock);
+  head->epoch = epoch;
+  head->free = free;
+  head->next = retired;
+  retired = head;
+  spin_unlock_irqrestore(&retire_lock, flags);
+}
+
+void rcu_frame_end() {
+  uint32_t flags = spin_lock_irqsave(&retire_lock);
+  epoch++;
+  // Newest first, so everything after the first expired entry is too
+  RcuHead **link = &retired;
+  while (*link && epoch - (*link)->epoch < 2)
+    link = &(*link)->next;
+  RcuHead *expired = *link;
+  *link = 0;
+  spin_unlock_irqrestore(&retire_lock, flags);
+
+  while (expired) {
+    RcuHead *next = expired->next;
+    expired->free(expired);
+    expired = next;
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include "types.h"
+
+// Read-copy-update for data read every frame and changed rarely. Readers
+// take no lock: they load the published pointer with rcu_dereference and
+// may use what it points to until the next frame boundary, but not past
+// it. Writers serialize among themselves, publish a new version with
+// rcu_assign_pointer and hand the old one to rcu_retire. The compositor
+// calls rcu_frame_end between frames; retired objects are freed at the
+// second boundary after they were retired, when no reader that could
+// have seen them is left (readers outside the compositor, e.g. hit tests
+// in IRQ handlers, must be shorter than a frame).
+
+typedef struct RcuHead {
+  struct RcuHead *next;
+  uint32_t epoch; // Frame it was retired in
+  void (*free)(struct RcuHead *head);
+} RcuHead;
+
+// x86 keeps stores in order; the barrier keeps the compiler from moving
+// the initialization of *v after the publish
+#define rcu_assign_pointer(p, v)                                               \
+  do {                                                                         \
+    __asm__ volatile("" ::: "memory");                                         \
+    (p) = (v);                                                                 \
+  } while (0)
+#define rcu_dereference(p) (*(__typeof__(p) volatile *)&(p))
+
+// The struct an embedded RcuHead belongs to
+#define rcu_container(head, type, member)                                      \
+  ((type *)((char *)(head) - __builtin_offsetof(type, member)))
+
+void rcu_retire(RcuHead *head, void (*free)(RcuHead *head)); // Any context
+void rcu_frame_end(); // Compositor, between frames, holding no pointers
+
+#endif
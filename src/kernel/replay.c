@@ -0,0 +1,340 @@
+#include "replay.h"
+#include "../drivers/io.h"
+#include "../drivers/serial.h"
+#include "../drivers/video.h"
+#include "apps.h"
+#include "input.h"
+#include "memory.h"
+#include "multiboot.h"
+#include "snapshot.h"
+#include "timeline.h"
+#include "window.h"
+
+#define DEBUG_EXIT_PORT 0xF4
+#define SETTLE_FRAMES 60 // Measured after the last event
+#define TYPING_CHARS 10000
+
+enum { EV_KEY, EV_MOUSE, EV_MOUSE_WIN, EV_MOUSE_BY, EV_SNAPSHOT };
+
+typedef struct {
+  uint32_t frame; // Played at the start of this frame
+  uint8_t type;
+  uint8_t code; // Scancode, or mouse buttons
+  short x, y;   // Target (EV_MOUSE), window offset or delta
+} ReplayEvent;
+
+enum { IDLE, PENDING, RUNNING };
+static int state = IDLE;
+static char scenario[16];
+static int snapshots; // "snapshots" on the command line
+
+static ReplayEvent *events;
+static int event_count, event_cap, next_event;
+static uint32_t build_frame;
+
+static uint32_t frame, frame_limit;
+static uint32_t *frame_cycles, *latency;
+static uint32_t latency_count;
+static uint64_t last_end, inject_tsc, run_start;
+static int injected;
+
+// --- Trace building ---
+
+static int name_eq(const char *a, const char *b) {
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+static void ev(int delay, int type, int code, int x, int y) {
+  if (event_count == event_cap) {
+    int cap = event_cap ? event_cap * 2 : 1024;
+    ReplayEvent *grown = kmalloc(cap * sizeof(ReplayEvent));
+    if (!grown)
+      return;
+    if (events) {
+      memcpy(grown, events, event_count * sizeof(ReplayEvent));
+      kfree(events);
+    }
+    events = grown;
+    event_cap = cap;
+  }
+  build_frame += delay;
+  ReplayEvent *e = &events[event_count++];
+  e->frame = build_frame;
+  e->type = type;
+  e->code = code;
+  e->x = x;
+  e->y = y;
+}
+
+static void click(int x, int y) {
+  ev(1, EV_MOUSE, 0, x, y);
+  ev(1, EV_MOUSE, 1, x, y);
+  ev(1, EV_MOUSE, 0, x, y);
+}
+
+// Through the Apps menu, like a user would
+static void launch_index(int i) {
+  click(95, 12);
+  click(100, 25 + i * 25 + 12);
+}
+
+static int launch(const char *name) {
+  for (int i = 0; i < app_count(); i++) {
+    if (name_eq(app_get(i)->name, name)) {
+      launch_index(i);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static uint8_t scancode_of(char c) {
+  if (c == '\n')
+    return 0x1C;
+  for (int i = 0; i < 128; i++)
+    if (kbd_US[i] == c)
+      return i;
+  return 0;
+}
+
+// Snapshot of the frame this event lands in
+static void checkpoint() { ev(1, EV_SNAPSHOT, 0, 0, 0); }
+
+static int build_apps() {
+  // Every app that fits in the menu
+  for (int i = 0; i < app_count() && 25 + (i + 1) * 25 < screen_height; i++) {
+    launch_index(i);
+    build_frame += 20; // Let it paint a while
+    checkpoint();
+  }
+  return 0;
+}
+
+static int build_drag() {
+  if (launch("Notepad"))
+    return -1;
+  ev(10, EV_MOUSE_WIN, 0, 60, 10); // Onto the title bar
+  ev(1, EV_MOUSE_BY, 1, 0, 0);
+  // A square, 3 pixels a frame
+  static const int dirs[4][2] = {{3, 0}, {0, 3}, {-3, 0}, {0, -3}};
+  for (int lap = 0; lap < 2; lap++)
+    for (int side = 0; side < 4; side++)
+      for (int i = 0; i < 100; i++)
+        ev(1, EV_MOUSE_BY, 1, dirs[side][0], dirs[side][1]);
+  ev(1, EV_MOUSE_BY, 0, 0, 0);
+  checkpoint();
+  return 0;
+}
+
+static int build_typing() {
+  if (launch("Notepad"))
+    return -1;
+  build_frame += 10;
+  const char *text = "the quick brown fox jumps over the lazy dog ";
+  int col = 0;
+  for (int i = 0, t = 0; i < TYPING_CHARS; i++) {
+    char c = text[t];
+    t = text[t + 1] ? t + 1 : 0;
+    if (++col == 64) {
+      c = '\n';
+      col = 0;
+    }
+    uint8_t sc = scancode_of(c);
+    ev(i % 4 == 0, EV_KEY, sc, 0, 0); // 4 keystrokes per frame
+    ev(0, EV_KEY, sc | 0x80, 0, 0);
+  }
+  checkpoint();
+  return 0;
+}
+
+// --- Playback ---
+
+static void send_packet(int buttons, int dx, int dy) {
+  dy = -dy; // PS/2 Y grows upwards
+  uint8_t flags = 0x08 | (buttons & 7);
+  if (dx < 0)
+    flags |= 0x10;
+  if (dy < 0)
+    flags |= 0x20;
+  mouse_byte(flags);
+  mouse_byte(dx & 0xFF);
+  mouse_byte(dy & 0xFF);
+}
+
+static int clamp_delta(int d) { return d < -255 ? -255 : d > 255 ? 255 : d; }
+
+static void mouse_to(int x, int y, int buttons) {
+  // Packets carry at most +-255, so long moves take several
+  for (int i = 0; i < 8; i++) {
+    int dx = clamp_delta(x - mouse_x), dy = clamp_delta(y - mouse_y);
+    send_packet(buttons, dx, dy);
+    if (mouse_x == x && mouse_y == y)
+      break;
+  }
+}
+
+static void play(ReplayEvent *e) {
+  uint32_t flags = irq_save(); // Same context as the IRQ path
+  switch (e->type) {
+  case EV_KEY:
+    keyboard_scancode(e->code);
+    break;
+  case EV_MOUSE:
+    mouse_to(e->x, e->y, e->code);
+    break;
+  case EV_MOUSE_WIN:
+    if (focused_window)
+      mouse_to(focused_window->x + e->x, focused_window->y + e->y, e->code);
+    break;
+  case EV_MOUSE_BY:
+    send_packet(e->code, e->x, e->y);
+    break;
+  case EV_SNAPSHOT:
+    if (snapshots)
+      snapshot_request(scenario);
+    break;
+  }
+  irq_restore(flags);
+}
+
+static void replay_exit(int code) {
+  serial_flush();
+  outb(DEBUG_EXIT_PORT, code);
+  // Still here: no isa-debug-exit device, keep the desktop running
+  serial_write("[bench] no isa-debug-exit device, not exiting\n");
+  state = IDLE;
+}
+
+void replay_init() {
+  if (boot_option_value("bench", scenario, sizeof(scenario)))
+    state = PENDING;
+  snapshots = boot_has_option("snapshots");
+}
+
+void replay_idle() {
+  if (state != PENDING)
+    return;
+
+  int err = -1;
+  build_frame = 0;
+  if (name_eq(scenario, "apps"))
+    err = build_apps();
+  else if (name_eq(scenario, "drag"))
+    err = build_drag();
+  else if (name_eq(scenario, "typing"))
+    err = build_typing();
+  if (err || !event_count) {
+    serial_write("[bench] cannot run scenario ");
+    serial_write(scenario);
+    serial_putc('\n');
+    replay_exit(2);
+    return;
+  }
+
+  frame_limit = build_frame + SETTLE_FRAMES + 1;
+  frame_cycles = kmalloc(frame_limit * sizeof(uint32_t));
+  latency = kmalloc(frame_limit * sizeof(uint32_t));
+  if (!frame_cycles || !latency) {
+    serial_write("[bench] out of memory\n");
+    replay_exit(2);
+    return;
+  }
+
+  timeline_calibrate();
+  serial_write("[bench] start ");
+  serial_write(scenario);
+  serial_write(", ");
+  serial_write_dec(event_count);
+  serial_write(" events\n");
+
+  frame = 0;
+  next_event = 0;
+  latency_count = 0;
+  state = RUNNING;
+  run_start = last_end = rdtsc();
+}
+
+int replay_running() { return state == RUNNING; }
+
+void replay_begin_frame() {
+  if (state != RUNNING)
+    return;
+  injected = 0;
+  while (next_event < event_count && events[next_event].frame <= frame) {
+    if (!injected)
+      inject_tsc = rdtsc();
+    injected = 1;
+    play(&events[next_event++]);
+  }
+}
+
+static void sort(uint32_t *v, uint32_t n) {
+  // Shell sort, a few thousand values once per run
+  for (uint32_t gap = n / 2; gap > 0; gap /= 2)
+    for (uint32_t i = gap; i < n; i++) {
+      uint32_t x = v[i], j = i;
+      for (; j >= gap && v[j - gap] > x; j -= gap)
+        v[j] = v[j - gap];
+      v[j] = x;
+    }
+}
+
+static void write_field(const char *key, uint32_t value) {
+  serial_putc(' ');
+  serial_write(key);
+  serial_putc('=');
+  serial_write_dec(value);
+}
+
+// p50, p99 and max of n cycle counts, in microseconds
+static void write_percentiles(const char *prefix, uint32_t *v, uint32_t n) {
+  char key[32];
+  const char *suffix[3] = {"_p50", "_p99", "_max"};
+  sort(v, n);
+  uint32_t at[3] = {n / 2, (n * 99) / 100, n - 1};
+  for (int i = 0; i < 3; i++) {
+    int k = 0;
+    for (const char *p = prefix; *p; p++)
+      key[k++] = *p;
+    for (const char *p = suffix[i]; *p; p++)
+      key[k++] = *p;
+    key[k] = 0;
+    write_field(key, n ? tsc_to_us(v[at[i]]) : 0);
+  }
+}
+
+static void finish() {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < frame; i++)
+    total += frame_cycles[i];
+
+  serial_write("[bench] result");
+  serial_write(" scenario=");
+  serial_write(scenario);
+  write_field("frames", frame);
+  write_field("events", event_count);
+  write_field("cycles_per_frame", frame ? udiv64(total, frame) : 0);
+  write_percentiles("frame_us", frame_cycles, frame);
+  write_percentiles("latency_us", latency, latency_count);
+  write_field("wall_ms", tsc_to_us(rdtsc() - run_start) / 1000);
+  serial_putc('\n');
+  replay_exit(0);
+}
+
+void replay_end_frame() {
+  if (state != RUNNING)
+    return;
+  // Input-to-photon: from injection to the end of the swap that shows it
+  uint64_t now = rdtsc();
+  if (injected)
+    latency[latency_count++] = (uint32_t)(now - inject_tsc);
+  frame_cycles[frame++] = (uint32_t)(now - last_end);
+  last_end = now;
+
+  if (frame >= frame_limit)
+    finish();
+}
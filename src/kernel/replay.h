@@ -0,0 +1,22 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "types.h"
+
+// Benchmark mode: "bench=<scenario>" on the kernel command line replays a
+// scripted input trace through the PS/2 decoders once boot has settled,
+// measures every frame, prints one "[bench] result ..." record on COM1 and
+// exits QEMU through isa-debug-exit (-device isa-debug-exit,iobase=0xf4).
+//
+// Scenarios: apps (open every app from the Apps menu), drag (drag a
+// Notepad window around), typing (10k characters into Notepad). With
+// "snapshots" on the command line each scenario also dumps the screen at
+// its checkpoints (see snapshot.h); that slows the frames it lands after.
+
+void replay_init(); // Reads the command line
+void replay_idle(); // Main loop with no init work left: starts the run
+void replay_begin_frame();
+void replay_end_frame();
+int replay_running(); // Frames are being measured (and not paced)
+
+#endif
@@ -0,0 +1,83 @@
+#include "sampler.h"
+#include "../drivers/serial.h"
+#include "memory.h"
+#include "timer.h"
+
+#define KERNEL_BASE 0x10000 // -Ttext in build.sh
+extern char _end[];
+
+static uint32_t *buckets = 0;
+static uint32_t bucket_count = 0;
+static volatile int active = 0;
+static volatile int toggle_pending = 0;
+static volatile uint32_t samples = 0, outside = 0;
+static uint32_t start_ms = 0;
+
+void sampler_toggle() { toggle_pending = 1; }
+
+void sampler_tick(uint32_t eip) {
+  if (!active)
+    return;
+  samples++;
+  uint32_t b = (eip - KERNEL_BASE) >> SAMPLER_BUCKET_SHIFT;
+  if (eip >= KERNEL_BASE && b < bucket_count)
+    buckets[b]++;
+  else
+    outside++;
+}
+
+static void sampler_start() {
+  if (!buckets) {
+    bucket_count =
+        ((uint32_t)_end - KERNEL_BASE + (1 << SAMPLER_BUCKET_SHIFT) - 1) >>
+        SAMPLER_BUCKET_SHIFT;
+    buckets = kzalloc(bucket_count * sizeof(uint32_t));
+    if (!buckets) {
+      serial_write("[sample] no memory for the histogram\n");
+      return;
+    }
+  } else {
+    for (uint32_t i = 0; i < bucket_count; i++)
+      buckets[i] = 0;
+  }
+  samples = outside = 0;
+  start_ms = timer_ms();
+  active = 1;
+  serial_write("[sample] started\n");
+}
+
+// One "[sample] <address> <count>" line per non-empty bucket, between a
+// header and an end marker so tools/profile.py can find the run
+static void sampler_dump() {
+  serial_write("[sample] begin ");
+  serial_write_dec(samples);
+  serial_write(" samples, ");
+  serial_write_dec(timer_ms() - start_ms);
+  serial_write(" ms, bucket ");
+  serial_write_dec(1 << SAMPLER_BUCKET_SHIFT);
+  serial_write(", outside ");
+  serial_write_dec(outside);
+  serial_putc('\n');
+  for (uint32_t i = 0; i < bucket_count; i++) {
+    if (!buckets[i])
+      continue;
+    serial_write("[sample] ");
+    serial_write_hex(KERNEL_BASE + (i << SAMPLER_BUCKET_SHIFT));
+    serial_putc(' ');
+    serial_write_dec(buckets[i]);
+    serial_putc('\n');
+  }
+  serial_write("[sample] end\n");
+}
+
+void sampler_poll() {
+  if (!toggle_pending)
+    return;
+  toggle_pending = 0;
+  if (active) {
+    active = 0;
+    sampler_dump();
+  } else {
+    sampler_start();
+  }
+}
@@ -0,0 +1,18 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "types.h"
+
+// Statistical profiler: while running, every timer tick (TIMER_HZ) records
+// the interrupted EIP into a histogram of 16-byte buckets over the kernel
+// image. F10 starts a run; pressing it again stops it and dumps the
+// non-empty buckets on COM1. tools/profile.py turns the dump plus
+// build/kernel.map into a flat profile.
+
+#define SAMPLER_BUCKET_SHIFT 4
+
+void sampler_toggle();           // IRQ safe, the work happens in poll
+void sampler_tick(uint32_t eip); // From the timer interrupt
+void sampler_poll();             // Main loop: starts runs, dumps results
+
+#endif
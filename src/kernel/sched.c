@@ -0,0 +1,227 @@
+#include "sched.h"
+#include "../drivers/io.h"
+#include "idt.h"
+#include "memory.h"
+#include "smp.h"
+#include "timer.h"
+
+static Thread threads[MAX_THREADS];
+static Thread *current = 0;
+static Thread *run_head[PRIO_COUNT], *run_tail[PRIO_COUNT];
+static volatile int need_resched = 0;
+static int next_id = 0;
+
+static void **per_thread_vars[SCHED_MAX_PER_THREAD];
+static int per_thread_count = 0;
+
+static void enqueue(Thread *t) {
+  t->next = 0;
+  if (run_tail[t->prio])
+    run_tail[t->prio]->next = t;
+  else
+    run_head[t->prio] = t;
+  run_tail[t->prio] = t;
+}
+
+static Thread *dequeue() {
+  for (int p = 0; p < PRIO_COUNT; p++) {
+    Thread *t = run_head[p];
+    if (t) {
+      run_head[p] = t->next;
+      if (!run_head[p])
+        run_tail[p] = 0;
+      return t;
+    }
+  }
+  return 0;
+}
+
+// Interrupts off
+static void make_ready(Thread *t) {
+  t->state = THREAD_READY;
+  t->wait_chan = 0;
+  t->timed = 0;
+  enqueue(t);
+  if (current && t->prio < current->prio)
+    need_resched = 1;
+}
+
+Thread *current_thread() { return current; }
+
+// Free the stacks of threads that exited. Never the running one.
+static void reap() {
+  uint32_t flags = irq_save();
+  for (int i = 0; i < MAX_THREADS; i++) {
+    Thread *t = &threads[i];
+    if (t->state == THREAD_DEAD && t != current) {
+      kfree(t->stack);
+      t->stack = 0;
+      t->state = THREAD_UNUSED;
+    }
+  }
+  irq_restore(flags);
+}
+
+static void thread_entry() {
+  current->fn(current->arg);
+  thread_exit();
+}
+
+Thread *thread_create(const char *name, ThreadPrio prio, void (*fn)(void *),
+                      void *arg) {
+  reap();
+  uint8_t *stack = kmalloc(THREAD_STACK_SIZE);
+  if (!stack)
+    return 0;
+
+  uint32_t flags = irq_save();
+  Thread *t = 0;
+  for (int i = 0; i < MAX_THREADS && !t; i++)
+    if (threads[i].state == THREAD_UNUSED)
+      t = &threads[i];
+  if (!t) {
+    irq_restore(flags);
+    kfree(stack);
+    return 0;
+  }
+
+  // The frame irq_common_stub pops: ds, pusha, vector/error code, then
+  // iret to thread_entry with interrupts on. thread_entry never returns,
+  // so its return address is a dummy.
+  uint32_t *sp = (uint32_t *)(stack + THREAD_STACK_SIZE);
+  *--sp = 0;                      // Return address
+  *--sp = 0x202;                  // EFLAGS: IF
+  *--sp = 0x08;                   // CS
+  *--sp = (uint32_t)thread_entry; // EIP
+  *--sp = 0;                      // Error code
+  *--sp = 0;                      // Vector
+  // pusha
+  for (int i = 0; i < 8; i++)
+    *--sp = 0;
+  *--sp = 0x10; // DS
+
+  t->esp = (uint32_t)sp;
+  t->stack = stack;
+  t->id = next_id++;
+  t->name = name;
+  t->prio = prio;
+  t->fn = fn;
+  t->arg = arg;
+  for (int i = 0; i < SCHED_MAX_PER_THREAD; i++)
+    t->per_thread[i] = 0;
+  make_ready(t);
+  irq_restore(flags);
+  return t;
+}
+
+// Give up the CPU through the switch point. Interrupts off on entry.
+static void reschedule() {
+  need_resched = 1;
+  __asm__ volatile("int %0" : : "i"(SCHED_YIELD_VECTOR) : "memory");
+}
+
+void thread_yield() {
+  if (!current)
+    return;
+  uint32_t flags = irq_save();
+  reschedule();
+  irq_restore(flags);
+}
+
+void sched_sleep(void *chan, uint32_t timeout_ms) {
+  if (!current)
+    return;
+  uint32_t flags = irq_save();
+  current->wait_chan = chan;
+  current->timed = timeout_ms != 0;
+  current->wake_ms = timer_ms() + timeout_ms;
+  current->state = THREAD_SLEEPING;
+  reschedule();
+  irq_restore(flags);
+}
+
+void thread_sleep_ms(uint32_t ms) { sched_sleep(0, ms ? ms : 1); }
+
+void sched_wakeup(void *chan) {
+  if (!chan)
+    return;
+  uint32_t flags = irq_save();
+  for (int i = 0; i < MAX_THREADS; i++) {
+    Thread *t = &threads[i];
+    if (t->state == THREAD_SLEEPING && t->wait_chan == chan)
+      make_ready(t);
+  }
+  irq_restore(flags);
+}
+
+void thread_exit() {
+  cli();
+  current->state = THREAD_DEAD;
+  reschedule();
+  while (1) // Not reached
+    ;
+}
+
+void sched_per_thread(void **var) {
+  uint32_t flags = irq_save();
+  if (per_thread_count < SCHED_MAX_PER_THREAD)
+    per_thread_vars[per_thread_count++] = var;
+  irq_restore(flags);
+}
+
+void sched_tick() {
+  if (!current)
+    return;
+  uint32_t now = timer_ms();
+  for (int i = 0; i < MAX_THREADS; i++) {
+    Thread *t = &threads[i];
+    if (t->state == THREAD_SLEEPING && t->timed &&
+        (int32_t)(now - t->wake_ms) >= 0)
+      make_ready(t);
+  }
+  if (--current->slice <= 0)
+    need_resched = 1;
+}
+
+uint32_t sched_switch(uint32_t esp) {
+  // Threads live on the boot CPU; the others come through here for IPIs
+  if (!need_resched || !current || this_cpu()->index != 0)
+    return esp;
+  need_resched = 0;
+
+  Thread *prev = current;
+  prev->esp = esp;
+  if (prev->state == THREAD_RUNNING)
+    make_ready(prev);
+
+  Thread *next = dequeue(); // The idle thread is always there
+  next->state = THREAD_RUNNING;
+  next->slice = SCHED_SLICE_MS;
+  if (next != prev) {
+    for (int i = 0; i < per_thread_count; i++) {
+      prev->per_thread[i] = *per_thread_vars[i];
+      *per_thread_vars[i] = next->per_thread[i];
+    }
+  }
+  current = next;
+  return next->esp;
+}
+
+static void idle_thread(void *arg) {
+  while (1) {
+    reap();
+    __asm__ volatile("sti; hlt");
+  }
+}
+
+void init_sched() {
+  Thread *t = &threads[0];
+  t->id = next_id++;
+  t->name = "compositor";
+  t->prio = PRIO_UI;
+  t->state = THREAD_RUNNING;
+  t->slice = SCHED_SLICE_MS;
+  current = t;
+  set_idt_gate(SCHED_YIELD_VECTOR, (uint32_t)sched_yield_stub);
+  thread_create("idle", PRIO_IDLE, idle_thread, 0);
+}
@@ -0,0 +1,80 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "types.h"
+
+// Preemptive kernel threads on the boot CPU. Each thread has its own stack
+// and is switched from the return path of any interrupt: the timer tick
+// ends time slices and wakes sleepers, and a wakeup from an IRQ handler
+// switches as soon as the handler returns. Threads give the CPU up
+// themselves through a software interrupt (SCHED_YIELD_VECTOR), so both
+// paths save the same frame.
+//
+// Priorities are strict, round robin within a class. The boot thread
+// becomes the compositor in the boosted UI class; apps run below it and
+// the idle thread (hlt) below everything.
+
+#define SCHED_YIELD_VECTOR 0x81
+#define MAX_THREADS 32
+#define THREAD_STACK_SIZE 16384
+#define SCHED_SLICE_MS 10
+#define SCHED_MAX_PER_THREAD 4 // sched_per_thread slots
+
+typedef enum { PRIO_UI, PRIO_APP, PRIO_IDLE, PRIO_COUNT } ThreadPrio;
+
+typedef enum {
+  THREAD_UNUSED,
+  THREAD_READY,
+  THREAD_RUNNING,
+  THREAD_SLEEPING,
+  THREAD_DEAD
+} ThreadState;
+
+typedef struct Thread {
+  uint32_t esp; // Saved interrupt frame, while not running
+  uint8_t *stack;
+  int id;
+  const char *name;
+  ThreadPrio prio;
+  volatile ThreadState state;
+  int slice; // ms left
+
+  void *wait_chan; // Sleeping on this (0 = timeout only)
+  int timed;       // wake_ms is valid
+  uint32_t wake_ms;
+
+  void (*fn)(void *arg);
+  void *arg;
+  void *per_thread[SCHED_MAX_PER_THREAD];
+  struct Thread *next; // Run queue
+} Thread;
+
+// Adopt the running boot code as the compositor thread and start the idle
+// thread. Threads may be created from then on, from any context.
+void init_sched();
+
+// Returns 0 when out of threads or memory
+Thread *thread_create(const char *name, ThreadPrio prio, void (*fn)(void *),
+                      void *arg);
+Thread *current_thread();
+void thread_yield();
+void thread_sleep_ms(uint32_t ms);
+void thread_exit();
+
+// Sleep on a channel (any address) until sched_wakeup(chan) or timeout_ms
+// (0 = none). Check the condition with interrupts off and keep them off
+// into the call, or a wakeup can land in between:
+//   flags = irq_save(); while (!cond) sched_sleep(&x, 0); irq_restore(flags);
+void sched_sleep(void *chan, uint32_t timeout_ms);
+void sched_wakeup(void *chan); // Safe from IRQ context
+
+// *var holds a separate value in each thread, swapped on every switch
+// (for code written around one global "current" pointer)
+void sched_per_thread(void **var);
+
+// Timer IRQ hook, and the switch point called by the interrupt stub:
+// returns the stack to resume on
+void sched_tick();
+uint32_t sched_switch(uint32_t esp);
+
+#endif
@@ -0,0 +1,197 @@
+#include "smp.h"
+#include "../drivers/io.h"
+#include "../drivers/serial.h"
+#include "apic.h"
+#include "idt.h"
+#include "memory.h"
+#include "timeline.h"
+
+extern uint8_t ap_trampoline_start[], ap_trampoline_end[];
+extern uint32_t ap_mailbox_stack, ap_mailbox_entry, ap_mailbox_arg;
+extern idt_register_t idt_reg;
+
+static Cpu cpus[SMP_MAX_CPUS];
+static int cpu_count = 1;
+
+// Work posted by smp_call_others; a new generation wakes the APs
+static void (*volatile call_fn)(void *arg);
+static void *volatile call_arg;
+static volatile uint32_t call_gen = 0;
+
+// Access byte / flags nibble of a GDT descriptor
+#define GDT_CODE 0x9A
+#define GDT_DATA 0x92
+#define GDT_PAGE_GRANULAR 0xC // 4KB limit units, 32-bit
+#define GDT_BYTE_GRANULAR 0x4 // Byte limit units, 32-bit
+
+static uint64_t gdt_entry(uint32_t base, uint32_t limit, uint8_t access,
+                          uint8_t flags) {
+  uint64_t e = limit & 0xFFFF;
+  e |= (uint64_t)(base & 0xFFFFFF) << 16;
+  e |= (uint64_t)access << 40;
+  e |= (uint64_t)((limit >> 16) & 0xF) << 48;
+  e |= (uint64_t)(flags & 0xF) << 52;
+  e |= (uint64_t)(base >> 24) << 56;
+  return e;
+}
+
+static void cpu_setup(Cpu *c, int index, uint8_t apic_id) {
+  c->self = c;
+  c->index = index;
+  c->apic_id = apic_id;
+  c->online = 0;
+  c->irqs = 0;
+  c->gdt[0] = 0;
+  c->gdt[1] = gdt_entry(0, 0xFFFFF, GDT_CODE, GDT_PAGE_GRANULAR);
+  c->gdt[2] = gdt_entry(0, 0xFFFFF, GDT_DATA, GDT_PAGE_GRANULAR);
+  c->gdt[3] =
+      gdt_entry((uint32_t)c, sizeof(Cpu) - 1, GDT_DATA, GDT_BYTE_GRANULAR);
+}
+
+static void cpu_load_gdt(Cpu *c) {
+  struct {
+    uint16_t limit;
+    uint32_t base;
+  } __attribute__((packed)) desc = {sizeof(c->gdt) - 1, (uint32_t)c->gdt};
+
+  __asm__ volatile("lgdt %0\n\t"
+                   "ljmp $0x08, $1f\n"
+                   "1:\n\t"
+                   "mov $0x10, %%ax\n\t"
+                   "mov %%ax, %%ds\n\t"
+                   "mov %%ax, %%es\n\t"
+                   "mov %%ax, %%fs\n\t"
+                   "mov %%ax, %%ss\n\t"
+                   "mov %1, %%ax\n\t"
+                   "mov %%ax, %%gs"
+                   :
+                   : "m"(desc), "i"(CPU_SEG)
+                   : "eax", "memory");
+}
+
+void init_cpu() {
+  cpu_setup(&cpus[0], 0, 0); // APIC ID filled in by smp_start_aps
+  cpus[0].online = 1;
+  cpu_load_gdt(&cpus[0]);
+}
+
+int smp_cpu_count() { return cpu_count; }
+
+Cpu *smp_cpu(int index) {
+  if (index < 0 || index >= cpu_count)
+    return 0;
+  return &cpus[index];
+}
+
+void smp_call_others(void (*fn)(void *arg), void *arg) {
+  if (cpu_count < 2)
+    return;
+  call_fn = fn;
+  call_arg = arg;
+  call_gen++; // Stores stay in order on x86: fn/arg are visible first
+  lapic_send_ipi(0, APIC_ICR_ALL_BUT_SELF | APIC_WAKEUP_VECTOR);
+}
+
+// First C code on an application processor, on its own stack
+static void ap_main(Cpu *c) {
+  cpu_load_gdt(c);
+  idt_load((uint32_t)&idt_reg);
+  lapic_enable();
+  uint32_t seen = call_gen;
+  c->online = 1;
+
+  while (1) {
+    // Check and sleep with interrupts off: sti only takes effect after
+    // hlt, so a wakeup IPI can't slip in between
+    cli();
+    if (call_gen == seen) {
+      __asm__ volatile("sti; hlt");
+      continue;
+    }
+    sti();
+    seen = call_gen;
+    call_fn(call_arg);
+  }
+}
+
+static void delay_us(uint32_t us) {
+  uint64_t end = rdtsc() + udiv64((uint64_t)tsc_khz() * us, 1000);
+  while (rdtsc() < end)
+    __asm__ volatile("pause");
+}
+
+// Returns 1 once c reports in, 0 after timeout_us
+static int wait_online(Cpu *c, uint32_t timeout_us) {
+  uint64_t end = rdtsc() + udiv64((uint64_t)tsc_khz() * timeout_us, 1000);
+  while (!c->online) {
+    if (rdtsc() >= end)
+      return 0;
+    __asm__ volatile("pause");
+  }
+  return 1;
+}
+
+// Where a trampoline symbol ends up after the copy
+static volatile uint32_t *mailbox(uint32_t *sym) {
+  return (volatile uint32_t *)(AP_TRAMPOLINE + ((uint8_t *)sym -
+                                                ap_trampoline_start));
+}
+
+static int start_ap(Cpu *c) {
+  uint8_t *stack = kmalloc(AP_STACK_SIZE);
+  if (!stack)
+    return 0;
+  c->stack_top = (uint32_t)stack + AP_STACK_SIZE;
+
+  // One AP at a time, so a single mailbox is enough
+  *mailbox(&ap_mailbox_stack) = c->stack_top;
+  *mailbox(&ap_mailbox_entry) = (uint32_t)ap_main;
+  *mailbox(&ap_mailbox_arg) = (uint32_t)c;
+
+  lapic_send_ipi(c->apic_id, APIC_ICR_INIT | APIC_ICR_LEVEL_ASSERT);
+  delay_us(10000);
+
+  // The second SIPI is only for CPUs that missed the first one
+  uint32_t vector = AP_TRAMPOLINE >> 12;
+  for (int i = 0; i < 2 && !c->online; i++) {
+    lapic_send_ipi(c->apic_id, APIC_ICR_STARTUP | vector);
+    wait_online(c, i == 0 ? 200 : 100000);
+  }
+  if (!c->online) {
+    kfree(stack);
+    return 0;
+  }
+  return 1;
+}
+
+void smp_start_aps() {
+  if (!apic_active())
+    return;
+  if (!tsc_khz())
+    timeline_calibrate();
+
+  const AcpiMadt *madt = apic_madt();
+  cpus[0].apic_id = lapic_id();
+
+  memcpy((void *)AP_TRAMPOLINE, ap_trampoline_start,
+         ap_trampoline_end - ap_trampoline_start);
+
+  for (int i = 0; i < madt->cpu_count && cpu_count < SMP_MAX_CPUS; i++) {
+    uint8_t id = madt->apic_ids[i];
+    if (id == cpus[0].apic_id)
+      continue;
+    Cpu *c = &cpus[cpu_count];
+    cpu_setup(c, cpu_count, id);
+    if (start_ap(c)) {
+      cpu_count++;
+    } else {
+      serial_write("[smp] CPU with APIC ID ");
+      serial_write_dec(id);
+      serial_write(" did not start\n");
+    }
+  }
+
+  serial_write("[smp] ");
+  serial_write_dec(cpu_count);
+  serial_write(" CPUs online\n");
+}
@@ -0,0 +1,58 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "../drivers/video.h"
+#include "types.h"
+
+// CPUs and per-CPU data. Every CPU runs on its own GDT, a copy of the boot
+// one plus a data segment (selector 0x18) whose base is that CPU's Cpu
+// struct, loaded into %gs. this_cpu() is therefore one load.
+//
+// Application processors are started with INIT-SIPI-SIPI once the APICs
+// are up. They sit in hlt until smp_call_others hands them work; all
+// device interrupts stay on the boot CPU.
+
+#define SMP_MAX_CPUS 16
+#define AP_STACK_SIZE 16384
+#define AP_TRAMPOLINE 0x8000 // Must match ap_trampoline.asm
+
+#define CPU_SEG 0x18
+
+typedef struct Cpu {
+  struct Cpu *self; // Must stay first: this_cpu() reads %gs:0
+  int index;        // 0 = boot CPU
+  uint8_t apic_id;
+  volatile int online;
+  uint32_t stack_top;
+  uint64_t gdt[4];
+
+  uint32_t irqs; // Interrupts taken on this CPU
+  ClipRect clip; // Drawing clip (video.c)
+} Cpu;
+
+#ifdef GEMOS_HOSTED
+// Host builds (tools/bench) run on one CPU, without our GDT
+extern Cpu host_cpu;
+static inline Cpu *this_cpu() { return &host_cpu; }
+#else
+static inline Cpu *this_cpu() {
+  Cpu *c;
+  __asm__ volatile("mov %%gs:0, %0" : "=r"(c));
+  return c;
+}
+#endif
+
+// Per-CPU GDT for the boot CPU. Call before interrupts are enabled.
+void init_cpu();
+
+// Start the other CPUs listed in the MADT (needs init_apic). Logs on COM1.
+void smp_start_aps();
+
+// Run fn(arg) on every other online CPU. Returns at once; the caller waits
+// for the results itself and must not post another call before then.
+void smp_call_others(void (*fn)(void *arg), void *arg);
+
+int smp_cpu_count(); // CPUs online, including the boot CPU
+Cpu *smp_cpu(int index);
+
+#endif
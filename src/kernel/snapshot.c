@@ -0,0 +1,86 @@
+#include "snapshot.h"
+#include "../drivers/serial.h"
+#include "../drivers/video.h"
+#include "memory.h"
+
+static const char *volatile pending_tag = 0;
+static uint32_t seq = 0;
+
+void snapshot_request(const char *tag) { pending_tag = tag; }
+
+static void write_rgb(uint32_t c) {
+  for (int shift = 20; shift >= 0; shift -= 4)
+    serial_putc("0123456789abcdef"[(c >> shift) & 0xF]);
+}
+
+static void take(const char *tag) {
+  uint32_t *row = kmalloc(screen_width * sizeof(uint32_t));
+  uint32_t *prev = kmalloc(screen_width * sizeof(uint32_t));
+  if (!row || !prev) {
+    kfree(row);
+    kfree(prev);
+    serial_write("[snap] out of memory\n");
+    return;
+  }
+
+  serial_write("#S begin ");
+  serial_write(tag);
+  serial_putc('-');
+  serial_write_dec(seq++);
+  serial_putc(' ');
+  serial_write_dec(screen_width);
+  serial_putc(' ');
+  serial_write_dec(screen_height);
+  serial_putc('\n');
+
+  uint32_t hash = 0x811C9DC5;
+  for (int y = 0; y < screen_height; y++) {
+    int same = y > 0;
+    for (int x = 0; x < screen_width; x++) {
+      row[x] = get_pixel(x, y) & 0xFFFFFF;
+      same &= row[x] == prev[x];
+      for (int b = 0; b < 24; b += 8) {
+        hash ^= (row[x] >> b) & 0xFF;
+        hash *= 0x01000193;
+      }
+    }
+
+    serial_write("#S");
+    if (same) {
+      serial_write(" =\n");
+      continue;
+    }
+    for (int x = 0; x < screen_width;) {
+      int run = 1;
+      while (x + run < screen_width && row[x + run] == row[x])
+        run++;
+      serial_putc(' ');
+      if (run > 1) {
+        serial_write_dec(run);
+        serial_putc('*');
+      }
+      write_rgb(row[x]);
+      x += run;
+    }
+    serial_putc('\n');
+
+    uint32_t *t = prev;
+    prev = row;
+    row = t;
+  }
+
+  serial_write("#S end ");
+  for (int shift = 28; shift >= 0; shift -= 4)
+    serial_putc("0123456789abcdef"[(hash >> shift) & 0xF]);
+  serial_putc('\n');
+  kfree(row);
+  kfree(prev);
+}
+
+void snapshot_poll() {
+  const char *tag = pending_tag;
+  if (!tag)
+    return;
+  pending_tag = 0;
+  take(tag);
+}
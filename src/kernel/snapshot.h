@@ -0,0 +1,20 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+// Backbuffer snapshots on COM1 for pixel-exact render regression tests.
+// F9 takes one; benchmark scenarios take them at scripted checkpoints when
+// "snapshots" is on the kernel command line. tools/snapdiff.py extracts
+// them from a serial log and diffs them against golden images.
+//
+// Text format, run-length encoded per row:
+//   #S begin <name> <width> <height>
+//   #S <run> <run> ...   one line per row, run = [<count>*]<rrggbb>
+//   #S =                 row identical to the previous one
+//   #S end <FNV-1a of all pixels, hex>
+
+// Taken after the current frame is painted. tag must stay valid (a
+// literal); the snapshot is named "<tag>-<n>". Safe from IRQ context.
+void snapshot_request(const char *tag);
+void snapshot_poll(); // Main loop, after the frame
+
+#endif
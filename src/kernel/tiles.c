@@ -0,0 +1,298 @@
+#include "tiles.h"
+#include "../drivers/serial.h"
+#include "../drivers/video.h"
+#include "memory.h"
+#include "multiboot.h"
+#include "smp.h"
+#include "timeline.h"
+
+#define PHASE_PAINT 0
+#define PHASE_SWAP 1
+
+// Chase-Lev style deque, filled before the CPUs start, so only pop (owner,
+// bottom end) and steal (anyone, top end) run concurrently
+typedef struct {
+  volatile int top;
+  volatile int bottom;
+  int *items;
+} TileDeque;
+
+typedef struct {
+  uint32_t tiles;
+  uint32_t stolen;
+  uint64_t busy; // Cycles spent in tiles
+} __attribute__((aligned(64))) TileStats;
+
+static int state = 0; // 0 = not set up yet, 1 = on, -1 = off
+static int ncpus;
+static int cols, rows;
+
+static Tile *tiles;
+static int tile_count;
+static uint32_t *tile_cycles; // Paint cost of each tile, last frame
+static int *pinned;           // Boot CPU only, not stealable
+static int pinned_count;
+static TileDeque deques[SMP_MAX_CPUS];
+
+// The phase in flight
+static int phase;
+static TilePainter phase_fn;
+static volatile int tiles_left;   // Not finished yet
+static volatile int workers_busy; // Other CPUs still in the phase
+
+static TileStats stats[2][SMP_MAX_CPUS];
+static uint64_t phase_cycles[2];
+static volatile int dump_pending = 0;
+
+static int deque_pop(TileDeque *d) {
+  int b = d->bottom - 1;
+  d->bottom = b;
+  __sync_synchronize(); // The store to bottom must land before top is read
+  int t = d->top;
+  if (t > b) {
+    d->bottom = b + 1;
+    return -1;
+  }
+  int item = d->items[b];
+  if (t == b) {
+    // Last one: a thief may be after it too
+    if (!__sync_bool_compare_and_swap(&d->top, t, t + 1))
+      item = -1;
+    d->bottom = b + 1;
+  }
+  return item;
+}
+
+static int deque_steal(TileDeque *d) {
+  int t = d->top;
+  __sync_synchronize();
+  int b = d->bottom;
+  if (t >= b)
+    return -1;
+  int item = d->items[t];
+  if (!__sync_bool_compare_and_swap(&d->top, t, t + 1))
+    return -1; // Lost the race, the caller tries again
+  return item;
+}
+
+static void run_tile(int i, TileStats *st) {
+  Tile *t = &tiles[i];
+  uint64_t start = rdtsc();
+  video_set_clip(t->x, t->y, t->w, t->h);
+  phase_fn(t);
+  uint32_t cycles = (uint32_t)(rdtsc() - start);
+  if (phase == PHASE_PAINT)
+    tile_cycles[i] = cycles;
+  st->tiles++;
+  st->busy += cycles;
+  __sync_fetch_and_sub(&tiles_left, 1);
+}
+
+static void work(int self) {
+  TileStats *st = &stats[phase][self];
+  int i;
+  while ((i = deque_pop(&deques[self])) >= 0)
+    run_tile(i, st);
+
+  // Then help the others until every tile is done
+  for (int v = self + 1; tiles_left > 0; v++) {
+    i = deque_steal(&deques[v % ncpus]);
+    if (i >= 0) {
+      st->stolen++;
+      run_tile(i, st);
+    } else {
+      __asm__ volatile("pause");
+    }
+  }
+}
+
+static void worker(void *arg) {
+  work(this_cpu()->index);
+  __sync_fetch_and_sub(&workers_busy, 1);
+}
+
+static void run_phase(int which, TilePainter fn) {
+  // Contiguous runs per CPU keep neighbouring rows together; stealing
+  // evens out whatever the split gets wrong
+  for (int c = 0; c < ncpus; c++)
+    deques[c].top = deques[c].bottom = 0;
+  if (which == PHASE_PAINT)
+    pinned_count = 0;
+  for (int i = 0; i < tile_count; i++) {
+    if (which == PHASE_PAINT && tiles[i].pinned) {
+      pinned[pinned_count++] = i;
+    } else {
+      TileDeque *d = &deques[i * ncpus / tile_count];
+      d->items[d->bottom++] = i;
+    }
+  }
+
+  phase = which;
+  phase_fn = fn;
+  tiles_left = tile_count;
+  workers_busy = ncpus - 1;
+  uint64_t start = rdtsc();
+  smp_call_others(worker, 0);
+
+  if (which == PHASE_PAINT)
+    for (int i = 0; i < pinned_count; i++)
+      run_tile(pinned[i], &stats[which][0]);
+  work(0);
+
+  // Barrier: every tile done and every CPU out of this phase
+  while (tiles_left > 0 || workers_busy > 0)
+    __asm__ volatile("pause");
+  video_reset_clip();
+  phase_cycles[which] = rdtsc() - start;
+}
+
+static int setup() {
+  ncpus = smp_cpu_count();
+  cols = (screen_width + TILE_W - 1) / TILE_W;
+  rows = (screen_height + TILE_H - 1) / TILE_H;
+  tile_count = cols * rows;
+
+  tiles = kmalloc(tile_count * sizeof(Tile));
+  tile_cycles = kzalloc(tile_count * sizeof(uint32_t));
+  pinned = kmalloc(tile_count * sizeof(int));
+  if (!tiles || !tile_cycles || !pinned)
+    return 0;
+  for (int c = 0; c < ncpus; c++) {
+    deques[c].items = kmalloc(tile_count * sizeof(int));
+    if (!deques[c].items)
+      return 0;
+  }
+
+  for (int i = 0; i < tile_count; i++) {
+    Tile *t = &tiles[i];
+    t->x = (i % cols) * TILE_W;
+    t->y = (i / cols) * TILE_H;
+    t->w = t->x + TILE_W > screen_width ? screen_width - t->x : TILE_W;
+    t->h = t->y + TILE_H > screen_height ? screen_height - t->y : TILE_H;
+  }
+
+  serial_write("[tiles] ");
+  serial_write_dec(tile_count);
+  serial_write(" tiles on ");
+  serial_write_dec(ncpus);
+  serial_write(" CPUs\n");
+  return 1;
+}
+
+int tiles_enabled() {
+  if (state == 0 && smp_cpu_count() > 1) {
+    if (boot_has_option("notiles"))
+      state = -1;
+    else
+      state = setup() ? 1 : -1;
+  }
+  return state == 1;
+}
+
+Tile *tiles_begin_frame(int *count) {
+  for (int i = 0; i < tile_count; i++)
+    tiles[i].pinned = 0;
+  for (int p = 0; p < 2; p++)
+    for (int c = 0; c < ncpus; c++)
+      stats[p][c].tiles = stats[p][c].stolen = stats[p][c].busy = 0;
+  *count = tile_count;
+  return tiles;
+}
+
+void tiles_pin_rect(int x, int y, int w, int h) {
+  int tx0 = x < 0 ? 0 : x / TILE_W;
+  int ty0 = y < 0 ? 0 : y / TILE_H;
+  int tx1 = (x + w - 1) / TILE_W;
+  int ty1 = (y + h - 1) / TILE_H;
+  if (tx1 >= cols)
+    tx1 = cols - 1;
+  if (ty1 >= rows)
+    ty1 = rows - 1;
+  for (int ty = ty0; ty <= ty1; ty++)
+    for (int tx = tx0; tx <= tx1; tx++)
+      tiles[ty * cols + tx].pinned = 1;
+}
+
+void tiles_paint(TilePainter paint) { run_phase(PHASE_PAINT, paint); }
+
+static void swap_tile(Tile *t) { video_swap_rect(t->x, t->y, t->w, t->h); }
+
+static void dump_phase(int which, const char *name) {
+  serial_write("[tiles] ");
+  serial_write(name);
+  serial_write(" ");
+  serial_write_dec(tsc_to_us(phase_cycles[which]));
+  serial_write(" us\n");
+
+  uint64_t total = 0, most = 0;
+  for (int c = 0; c < ncpus; c++) {
+    TileStats *st = &stats[which][c];
+    serial_write("[tiles]   cpu ");
+    serial_write_dec(c);
+    serial_write(": ");
+    serial_write_dec(st->tiles);
+    serial_write(" tiles, ");
+    serial_write_dec(st->stolen);
+    serial_write(" stolen, busy ");
+    serial_write_dec(tsc_to_us(st->busy));
+    serial_write(" us\n");
+    total += st->busy;
+    if (st->busy > most)
+      most = st->busy;
+  }
+  // Busiest CPU against the average: 100% is a perfect split
+  uint32_t avg = udiv64(total, ncpus);
+  serial_write("[tiles]   imbalance ");
+  serial_write_dec(avg ? udiv64(most * 100, avg) : 100);
+  serial_write("%\n");
+}
+
+static void dump() {
+  uint32_t lo = 0xFFFFFFFF, hi = 0;
+  uint64_t sum = 0;
+  int slowest = 0;
+  for (int i = 0; i < tile_count; i++) {
+    uint32_t c = tile_cycles[i];
+    sum += c;
+    if (c < lo)
+      lo = c;
+    if (c > hi) {
+      hi = c;
+      slowest = i;
+    }
+  }
+
+  serial_write("[tiles] ");
+  serial_write_dec(tile_count);
+  serial_write(" tiles of ");
+  serial_write_dec(TILE_W);
+  serial_write("x");
+  serial_write_dec(TILE_H);
+  serial_write(", ");
+  serial_write_dec(pinned_count);
+  serial_write(" pinned to cpu 0\n");
+  dump_phase(PHASE_PAINT, "paint");
+  dump_phase(PHASE_SWAP, "swap");
+
+  serial_write("[tiles] tile us min/avg/max ");
+  serial_write_dec(tsc_to_us(lo));
+  serial_write("/");
+  serial_write_dec(tsc_to_us(udiv64(sum, tile_count)));
+  serial_write("/");
+  serial_write_dec(tsc_to_us(hi));
+  serial_write(", slowest at ");
+  serial_write_dec(tiles[slowest].x);
+  serial_write(",");
+  serial_write_dec(tiles[slowest].y);
+  serial_write("\n");
+}
+
+void tiles_swap() {
+  run_phase(PHASE_SWAP, swap_tile);
+  if (dump_pending) {
+    dump_pending = 0;
+    dump();
+  }
+}
+
+void tiles_request_dump() { dump_pending = 1; }
@@ -0,0 +1,37 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include "types.h"
+
+// Parallel tiled rendering. The screen is cut into TILE_W x TILE_H tiles
+// (16KB of 32bpp backbuffer each, so a tile stays in L1 while it is
+// painted). Each frame the caller pins the tiles under painters that must
+// stay on the boot CPU; the tiles are dealt out to per-CPU work-stealing
+// deques and painted with the clip rect set to the tile, so painters share
+// nothing but the backbuffer (and skip whatever lies outside the clip). A
+// barrier separates painting from the swap, which is split the same way.
+
+#define TILE_W 64
+#define TILE_H 64
+
+typedef struct {
+  int x, y, w, h;
+  int pinned; // Has a painter only the boot CPU may run
+} Tile;
+
+typedef void (*TilePainter)(Tile *t);
+
+// More than one CPU online and no "notiles" boot option
+int tiles_enabled();
+
+// The tile grid, with pinned cleared
+Tile *tiles_begin_frame(int *count);
+void tiles_pin_rect(int x, int y, int w, int h); // Tiles overlapping it
+
+void tiles_paint(TilePainter paint); // Returns once every tile is painted
+void tiles_swap();                   // Copies every tile to the screen
+
+// Per-CPU load and tile costs on COM1 after the next frame (F11)
+void tiles_request_dump();
+
+#endif
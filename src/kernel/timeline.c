@@ -0,0 +1,114 @@
+#include "timeline.h"
+#include "../drivers/io.h"
+#include "../drivers/serial.h"
+
+#define TIMELINE_MAX 32
+
+typedef struct {
+  const char *stage;
+  uint64_t tsc;
+} TimelineEntry;
+
+static TimelineEntry entries[TIMELINE_MAX];
+static int entry_count = 0;
+static uint64_t t0 = 0;
+static uint32_t tsc_cycles_per_us = 0;
+
+void timeline_init() {
+  t0 = rdtsc();
+  entry_count = 0;
+}
+
+void timeline_mark(const char *stage) {
+  if (entry_count >= TIMELINE_MAX)
+    return;
+  entries[entry_count].stage = stage;
+  entries[entry_count].tsc = rdtsc();
+  entry_count++;
+}
+
+// PIT channel 2 one-shot: 11932 ticks of 1.193182 MHz = 10ms
+#define PIT_CAL_TICKS 11932
+#define PIT_CAL_US 10000
+
+void timeline_calibrate() {
+  if (tsc_cycles_per_us)
+    return;
+
+  // Gate channel 2 on, speaker off
+  uint8_t gate = (inb(0x61) & ~0x02) | 0x01;
+  outb(0x61, gate);
+  outb(0x43, 0xB0); // Channel 2, lo/hi byte, mode 0 (terminal count)
+  outb(0x42, PIT_CAL_TICKS & 0xFF);
+  outb(0x42, PIT_CAL_TICKS >> 8);
+
+  // In mode 0 with the gate high, counting starts once the MSB is
+  // written. Wait for OUT2 (bit 5) to go high at terminal count.
+  uint64_t start = rdtsc();
+  int timeout = 10000000;
+  while (!(inb(0x61) & 0x20) && timeout > 0)
+    timeout--;
+  uint64_t end = rdtsc();
+
+  if (!timeout) {
+    tsc_cycles_per_us = 1; // No PIT? Report cycles instead of garbage
+    return;
+  }
+  tsc_cycles_per_us = (uint32_t)(end - start) / PIT_CAL_US;
+  if (tsc_cycles_per_us == 0)
+    tsc_cycles_per_us = 1;
+}
+
+uint32_t tsc_khz() { return tsc_cycles_per_us * 1000; }
+
+uint32_t udiv64(uint64_t n, uint32_t d) {
+  uint32_t lo = (uint32_t)n;
+  uint32_t hi = (uint32_t)(n >> 32);
+  if (hi >= d)
+    return 0xFFFFFFFF; // Would overflow (#DE), saturate instead
+  uint32_t q;
+  __asm__("divl %3" : "=a"(q), "+d"(hi) : "a"(lo), "r"(d));
+  return q;
+}
+
+// Fits 32 bits for anything shorter than ~71 minutes
+uint32_t tsc_to_us(uint64_t cycles) {
+  if (!tsc_cycles_per_us)
+    return 0;
+  return udiv64(cycles, tsc_cycles_per_us);
+}
+
+uint32_t timeline_us(uint64_t tsc) { return tsc_to_us(tsc - t0); }
+
+uint32_t timeline_now_us() { return timeline_us(rdtsc()); }
+
+// "  12.345 ms"
+static void write_ms(uint32_t us) {
+  serial_write_dec(us / 1000);
+  serial_putc('.');
+  uint32_t frac = us % 1000;
+  serial_putc('0' + frac / 100);
+  serial_putc('0' + (frac / 10) % 10);
+  serial_putc('0' + frac % 10);
+  serial_write(" ms");
+}
+
+void timeline_dump() {
+  timeline_calibrate();
+
+  serial_write("[boot] timeline, TSC ");
+  serial_write_dec(tsc_cycles_per_us);
+  serial_write(" MHz\n");
+
+  uint64_t prev = t0;
+  for (int i = 0; i < entry_count; i++) {
+    serial_write("[boot] ");
+    write_ms(tsc_to_us(entries[i].tsc - t0));
+    serial_write("  +");
+    write_ms(tsc_to_us(entries[i].tsc - prev));
+    serial_write("  ");
+    serial_write(entries[i].stage);
+    serial_putc('\n');
+    prev = entries[i].tsc;
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "types.h"
+
+static inline uint64_t rdtsc() {
+  uint32_t lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+// Boot timeline: every init stage records an rdtsc timestamp. Raw cycles are
+// stored; conversion to time needs the TSC rate, which is calibrated against
+// the PIT lazily (off the critical path) before the timeline is printed.
+void timeline_init();                   // Record t0. Call first.
+void timeline_mark(const char *stage); // Stage finished now
+void timeline_calibrate();             // ~10ms PIT measurement
+void timeline_dump();                  // Print to the serial console
+
+// 64 by 32 bit divide without libgcc. The quotient must fit in 32 bits.
+uint32_t udiv64(uint64_t n, uint32_t d);
+
+uint32_t tsc_khz();                    // 0 until calibrated
+uint32_t tsc_to_us(uint64_t cycles);   // Needs calibration
+uint32_t timeline_now_us();            // Since timeline_init
+uint32_t timeline_us(uint64_t tsc);    // A timestamp, since timeline_init
+
+#endif
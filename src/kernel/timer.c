@@ -0,0 +1,25 @@
+#include "timer.h"
+#include "../drivers/io.h"
+#include "idt.h"
+#include "sched.h"
+
+#define PIT_FREQ 1193182
+#define PIT_DIVISOR ((PIT_FREQ + TIMER_HZ / 2) / TIMER_HZ)
+
+static volatile uint32_t ticks = 0;
+
+static void timer_irq(int irq) {
+  ticks++;
+  sched_tick(); // Slices and sleep timeouts; switches on the way out
+}
+
+void init_timer() {
+  outb(0x43, 0x34); // Channel 0, lo/hi byte, mode 2 (rate generator)
+  outb(0x40, PIT_DIVISOR & 0xFF);
+  outb(0x40, PIT_DIVISOR >> 8);
+  irq_register(0, timer_irq);
+}
+
+uint32_t timer_ticks() { return ticks; }
+
+uint32_t timer_ms() { return ticks * (1000 / TIMER_HZ); }
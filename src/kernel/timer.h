@@ -0,0 +1,14 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+
+// System tick: PIT channel 0 on IRQ0. Channel 2 stays free for the TSC
+// calibration in timeline.c.
+#define TIMER_HZ 1000
+
+void init_timer();
+uint32_t timer_ticks(); // Since init_timer, TIMER_HZ per second (wraps)
+uint32_t timer_ms();
+
+#endif
@@ -0,0 +1,120 @@
+#include "trace.h"
+#include "../drivers/serial.h"
+#include "timeline.h"
+
+#define TRACE_RING 1024 // Records, power of two
+
+typedef struct {
+  volatile uint32_t seq; // Ticket + 1 once the record is complete
+  uint8_t subsys;
+  uint8_t event;
+  uint64_t tsc;
+  uint32_t arg[3];
+} TraceRecord;
+
+static TraceRecord ring[TRACE_RING];
+static volatile uint32_t head = 0; // Next ticket to claim
+static volatile uint32_t tail = 0; // Next ticket to format (IRQ only)
+static volatile uint32_t dropped = 0;
+static uint32_t dropped_reported = 0;
+
+volatile uint32_t trace_mask = 0xFFFFFFFF;
+
+static const char *subsys_names[TRACE_SUBSYS_COUNT] = {"core", "irq", "paint",
+                                                        "disk", "app"};
+
+void trace_emit(int subsys, int event, uint32_t a0, uint32_t a1,
+                uint32_t a2) {
+  uint64_t tsc = rdtsc();
+
+  // Claim a ticket. A producer interrupted here by another one simply
+  // retries with the next ticket.
+  uint32_t t;
+  do {
+    t = head;
+    if (t - tail >= TRACE_RING) {
+      __sync_fetch_and_add(&dropped, 1);
+      return;
+    }
+  } while (!__sync_bool_compare_and_swap(&head, t, t + 1));
+
+  TraceRecord *r = &ring[t & (TRACE_RING - 1)];
+  r->subsys = subsys;
+  r->event = event;
+  r->tsc = tsc;
+  r->arg[0] = a0;
+  r->arg[1] = a1;
+  r->arg[2] = a2;
+  __sync_synchronize();
+  r->seq = t + 1; // Publish
+
+  serial_kick();
+}
+
+uint32_t trace_dropped() { return dropped; }
+
+static int put_str(char *buf, int n, const char *s) {
+  while (*s)
+    buf[n++] = *s++;
+  return n;
+}
+
+static int put_dec(char *buf, int n, uint32_t v) {
+  char tmp[10];
+  int i = 0;
+  do {
+    tmp[i++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (i > 0)
+    buf[n++] = tmp[--i];
+  return n;
+}
+
+static int put_hex(char *buf, int n, uint32_t v) {
+  int shift = 28;
+  while (shift > 0 && !(v >> shift))
+    shift -= 4;
+  for (; shift >= 0; shift -= 4)
+    buf[n++] = "0123456789abcdef"[(v >> shift) & 0xF];
+  return n;
+}
+
+static int format(char *buf, uint64_t tsc, int subsys, int event,
+                  const uint32_t *arg) {
+  int n = put_str(buf, 0, "#T ");
+  n = put_dec(buf, n, timeline_us(tsc));
+  buf[n++] = ' ';
+  n = put_str(buf, n, subsys < TRACE_SUBSYS_COUNT ? subsys_names[subsys]
+                                                 : "?");
+  buf[n++] = ' ';
+  n = put_dec(buf, n, event);
+  for (int i = 0; i < 3; i++) {
+    buf[n++] = ' ';
+    n = put_hex(buf, n, arg[i]);
+  }
+  buf[n++] = '\r';
+  buf[n++] = '\n';
+  return n; // At most ~70 bytes
+}
+
+// Serial source, runs in the UART interrupt: one line per call
+static int trace_source(char *buf, int max) {
+  TraceRecord *r = &ring[tail & (TRACE_RING - 1)];
+  if (r->seq != tail + 1) {
+    // Nothing complete yet. Report losses once the ring has drained.
+    uint32_t d = dropped;
+    if (d == dropped_reported)
+      return 0;
+    uint32_t arg[3] = {d - dropped_reported, 0, 0};
+    dropped_reported = d;
+    return format(buf, rdtsc(), TRACE_CORE, TRACE_CORE_DROPPED, arg);
+  }
+  uint32_t arg[3] = {r->arg[0], r->arg[1], r->arg[2]};
+  int n = format(buf, r->tsc, r->subsys, r->event, arg);
+  __sync_synchronize();
+  tail++; // Slot free for reuse
+  return n;
+}
+
+void init_trace() { serial_set_source(trace_source); }
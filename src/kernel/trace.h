@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "types.h"
+
+// Structured trace events on COM1. Producers (any context, IRQs included)
+// claim a slot in a lock-free ring with one compare-and-swap and fill in a
+// fixed-size record; the UART interrupt formats records to text while it
+// feeds the TX FIFO. A full ring drops events and counts them.
+//
+// Each event becomes one line, easy to grep out of a -serial file: log:
+//   #T <us since boot> <subsystem> <event> <arg0> <arg1> <arg2>
+// Arguments are hex.
+
+enum {
+  TRACE_CORE,
+  TRACE_IRQ,
+  TRACE_PAINT,
+  TRACE_DISK,
+  TRACE_APP,
+  TRACE_SUBSYS_COUNT
+};
+
+// Event IDs, per subsystem
+#define TRACE_CORE_DROPPED 1 // Events lost to a full ring: count
+
+#define TRACE_IRQ_ENTER 1 // line
+
+#define TRACE_PAINT_SLOW 1  // Frame over budget: frame, us
+#define TRACE_PAINT_STATS 2 // Once a second: frames, max us, total us
+
+#define TRACE_DISK_DONE 1 // First LBA, sectors, status
+
+extern volatile uint32_t trace_mask; // Bit per subsystem, all on by default
+
+void trace_emit(int subsys, int event, uint32_t a0, uint32_t a1,
+                uint32_t a2);
+
+static inline void trace(int subsys, int event, uint32_t a0, uint32_t a1,
+                         uint32_t a2) {
+  if (trace_mask & (1u << subsys))
+    trace_emit(subsys, event, a0, a1, a2);
+}
+
+// Attach the ring to the serial driver
+void init_trace();
+
+uint32_t trace_dropped();
+
+#endif
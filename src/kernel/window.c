@@ -2,6 +2,15 @@
 #include "../drivers/rtc.h"
 #include "../drivers/video.h"
 #include "apps.h"
+#include "../drivers/io.h"
+#include "frameprof.h"
+#include "lock.h"
+#include "memory.h"
+#include "rcu.h"
+#include "sched.h"
+#include "tiles.h"
+#include "timeline.h"
+#include "timer.h"
 
 // Types
 #define NULL ((void *)0)
@@ -24,128 +33,591 @@ uint32_t theme_text = 0x000000;
 #define CL_WHITE 0xFFFFFF
 #define CL_HIGHLIGHT 0xA0A0E0
 
+#define MAX_WINDOWS 256
+#define WM_WINDOW_THREADS 16 // Windows beyond this share one worker thread
+#define GRID_CELL 64 // Hit test grid, in pixels
+
 // --- Global State ---
-Window *windows_head = 0;
+// Z-order: a doubly linked list from z_top down, plus a stamp that grows
+// on every raise, so windows are added, raised and removed in O(1).
+// Writers hold wm_list_lock and bump wm_seq around each change (odd while
+// one is in progress). The compositor reads without a lock: it walks the
+// list and retries if wm_seq moved. Closed windows are freed through RCU,
+// so a walk that raced a close never touches freed memory.
+static Window *z_top = 0;
+static int window_count = 0;
+static uint32_t z_stamp = 0;
+static volatile uint32_t wm_seq = 0;
+// Bumped when a window changes size or is moved other than by dragging
+static volatile uint32_t wm_layout = 0;
 Window *focused_window = 0;
 
+// Hit testing: each GRID_CELL square of the screen lists the windows
+// overlapping it, refiled whenever a window moves or resizes. Guarded by
+// wm_list_lock.
+typedef struct {
+  Window **w;
+  int count, cap;
+} GridCell;
+
+static GridCell *grid = 0;
+static int grid_cols, grid_rows;
+
+// wm_input_lock serializes input handling (mouse IRQ, keyboard IRQ, bench
+// replay) and the drag/menu state it owns. wm_list_lock serializes list
+// writers and focus changes. Take them in that order.
+static Spinlock wm_input_lock = SPINLOCK_INIT("wm input");
+static Spinlock wm_list_lock = SPINLOCK_INIT("window list");
+
+// Menu picks waiting for wm_poll. Launching creates a thread and may read
+// the disk, neither of which belongs in the mouse IRQ.
+static volatile int launch_pending = -1;
+static void (*volatile start_pending)() = 0; // System menu
+
 // Mouse State
 int mx = 512, my = 384;
 Window *drag_window = 0;
 int drag_offset_x = 0;
 int drag_offset_y = 0;
 
+#define WM_EVENT_QUEUE 64
+#define WM_HANDLER_WAIT_MS 4 // Longest a frame waits for a busy handler
+
+// --- Per-window app threads ---
+// The WM runs in IRQ context (or in the bench replay); it only queues
+// events, and the window's thread calls the app's handlers in order. The
+// first WM_WINDOW_THREADS windows get a thread each, so a slow app only
+// stalls itself; the rest share one worker, which takes one event or tick
+// per window in turn. Either way handlers never run in the IRQ.
+
+typedef enum {
+  WEV_CLICK,
+  WEV_MOVE,
+  WEV_KEY,
+  WEV_CLOSE,
+  WEV_TICK // Not queued: on_tick is due
+} WindowEventType;
+
+typedef struct {
+  uint8_t type;
+  char key;
+  uint8_t buttons;
+  int x, y;
+} WindowEvent;
+
+typedef struct WindowQueue {
+  Window *win;
+  WindowEvent ev[WM_EVENT_QUEUE];
+  uint32_t head, tail; // Written / read counts
+  uint32_t next_tick;  // timer_ms() when on_tick is due
+  void *wake;          // What the thread running it sleeps on
+  int own_thread;
+  struct WindowQueue *next; // Shared worker's list
+} WindowQueue;
+
+static WindowQueue *shared_queues; // Interrupts off to touch
+static volatile int window_threads = 0;
+
+static void dispatch(Window *win, WindowEvent *ev) {
+  switch (ev->type) {
+  case WEV_CLICK:
+    if (win->on_click)
+      win->on_click(win, ev->x, ev->y);
+    break;
+  case WEV_MOVE:
+    if (win->on_mouse_move)
+      win->on_mouse_move(win, ev->x, ev->y, ev->buttons);
+    break;
+  case WEV_KEY:
+    if (win->on_key)
+      win->on_key(win, ev->key);
+    break;
+  case WEV_TICK:
+    win->on_tick(win);
+    break;
+  }
+}
+
+static void post_event(Window *win, WindowEvent ev) {
+  uint32_t flags = irq_save();
+  WindowQueue *q = win->events;
+  if (!q) { // Closing: its thread is gone or draining
+    irq_restore(flags);
+    return;
+  }
+  // A move with the same buttons as the last queued one replaces it, so a
+  // handler that falls behind catches up to the latest position
+  WindowEvent *last = &q->ev[(q->head - 1) % WM_EVENT_QUEUE];
+  if (ev.type == WEV_MOVE && q->head != q->tail && last->type == WEV_MOVE &&
+      last->buttons == ev.buttons) {
+    *last = ev;
+  } else if (q->head - q->tail < WM_EVENT_QUEUE) {
+    q->ev[q->head % WM_EVENT_QUEUE] = ev;
+    q->head++;
+  }
+  void *wake = q->wake;
+  irq_restore(flags);
+  sched_wakeup(wake);
+}
+
+static void free_window(RcuHead *head) {
+  Window *win = rcu_container(head, Window, rcu);
+  if (win->on_close)
+    win->on_close(win);
+  frameprof_forget(win);
+  kfree(win);
+}
+
+// Interrupts off. Takes the next event, or a due tick, and marks the window
+// busy. Otherwise returns 0 and lowers *wait to the ms until its next tick
+// (0 = none yet).
+static int window_take(WindowQueue *q, WindowEvent *ev, uint32_t *wait) {
+  Window *win = q->win;
+  if (q->head != q->tail) {
+    *ev = q->ev[q->tail % WM_EVENT_QUEUE];
+    q->tail++;
+  } else if (win->on_tick) {
+    int32_t due = (int32_t)(q->next_tick - timer_ms());
+    if (due > 0) {
+      if (!*wait || (uint32_t)due < *wait)
+        *wait = (uint32_t)due;
+      return 0;
+    }
+    ev->type = WEV_TICK;
+    q->next_tick = timer_ms() + win->tick_ms;
+  } else {
+    return 0;
+  }
+  win->busy = 1;
+  return 1;
+}
+
+// Runs what window_take returned, interrupts on. On WEV_CLOSE the queue is
+// freed and the window retired.
+static void window_run(WindowQueue *q, WindowEvent *ev) {
+  Window *win = q->win;
+  if (ev->type == WEV_CLOSE) {
+    if (q->own_thread)
+      __sync_fetch_and_sub(&window_threads, 1);
+    win->busy = 0;
+    sched_wakeup((void *)&win->busy);
+    kfree(q);
+    rcu_retire(&win->rcu, free_window);
+    return;
+  }
+  dispatch(win, ev);
+  win->dirty = 1;
+  win->busy = 0;
+  sched_wakeup((void *)&win->busy);
+}
+
+static void window_thread(void *arg) {
+  WindowQueue *q = (WindowQueue *)arg;
+  while (1) {
+    WindowEvent ev;
+    uint32_t flags = irq_save();
+    uint32_t wait = 0;
+    while (!window_take(q, &ev, &wait)) {
+      sched_sleep(q, wait);
+      wait = 0;
+    }
+    irq_restore(flags);
+    window_run(q, &ev);
+    if (ev.type == WEV_CLOSE)
+      thread_exit();
+  }
+}
+
+static void shared_window_thread(void *arg) {
+  while (1) {
+    uint32_t flags = irq_save();
+    uint32_t wait = 0;
+    int ran = 0;
+    // New queues are pushed at the head and only this thread unlinks, so
+    // pp stays valid while a handler runs with interrupts on
+    WindowQueue **pp = &shared_queues;
+    while (*pp) {
+      WindowQueue *q = *pp;
+      WindowEvent ev;
+      if (!window_take(q, &ev, &wait)) {
+        pp = &q->next;
+        continue;
+      }
+      if (ev.type == WEV_CLOSE)
+        *pp = q->next;
+      else
+        pp = &q->next;
+      irq_restore(flags);
+      window_run(q, &ev);
+      ran = 1;
+      flags = irq_save();
+    }
+    if (!ran)
+      sched_sleep(&shared_queues, wait);
+    irq_restore(flags);
+  }
+}
+
+void wm_set_tick(Window *win, void (*fn)(Window *win), uint32_t ms) {
+  win->tick_ms = ms ? ms : 1;
+  win->on_tick = fn;
+  uint32_t flags = irq_save();
+  void *wake = win->events ? win->events->wake : 0;
+  irq_restore(flags);
+  if (wake)
+    sched_wakeup(wake); // Re-arm its sleep
+}
+
+void wm_invalidate(Window *win) { win->dirty = 1; }
+
+
 // --- Helper Prototypes ---
-void draw_windows_recursive(Window *win);
 void draw_window_decorations(Window *win);
 
 void init_window_manager() {
-  windows_head = 0;
+  z_top = 0;
+  window_count = 0;
   focused_window = 0;
+  grid_cols = (screen_width + GRID_CELL - 1) / GRID_CELL;
+  grid_rows = (screen_height + GRID_CELL - 1) / GRID_CELL;
+  grid = kzalloc(grid_cols * grid_rows * sizeof(GridCell)); // 0: list scan
+  thread_create("windows", PRIO_APP, shared_window_thread, 0);
 }
 
-Window *create_window(int x, int y, int w, int h, char *title) {
-  static Window win_pool[20];
-  static int win_pool_idx = 0;
+// --- Z-order and grid (wm_list_lock held) ---
+
+static void seq_begin() {
+  wm_seq++;
+  __asm__ volatile("" ::: "memory");
+}
+
+static void seq_end() {
+  __asm__ volatile("" ::: "memory");
+  wm_seq++;
+}
+
+static void z_unlink(Window *win) {
+  if (win->above)
+    win->above->below = win->below;
+  else
+    z_top = win->below;
+  if (win->below)
+    win->below->above = win->above;
+}
+
+// The window's own pointers are set before it becomes reachable
+static void z_push_top(Window *win) {
+  win->above = 0;
+  win->below = z_top;
+  win->z = ++z_stamp;
+  __asm__ volatile("" ::: "memory");
+  if (z_top)
+    z_top->above = win;
+  z_top = win;
+}
+
+// Cells under the window (hit test area, edges included), clamped to the
+// screen. x1 < x0 when it is entirely off screen.
+static void grid_range(Window *win, int *x0, int *y0, int *x1, int *y1) {
+  *x0 = win->x < 0 ? 0 : win->x / GRID_CELL;
+  *y0 = win->y < 0 ? 0 : win->y / GRID_CELL;
+  *x1 = (win->x + win->width) / GRID_CELL;
+  *y1 = (win->y + win->height) / GRID_CELL;
+  if (*x1 >= grid_cols)
+    *x1 = grid_cols - 1;
+  if (*y1 >= grid_rows)
+    *y1 = grid_rows - 1;
+  if (win->x + win->width < 0 || win->y + win->height < 0)
+    *x1 = *x0 - 1;
+}
+
+static void grid_remove(Window *win) {
+  for (int gy = win->grid_y0; gy <= win->grid_y1; gy++) {
+    for (int gx = win->grid_x0; gx <= win->grid_x1; gx++) {
+      GridCell *c = &grid[gy * grid_cols + gx];
+      for (int i = 0; i < c->count; i++) {
+        if (c->w[i] == win) {
+          c->w[i] = c->w[--c->count];
+          break;
+        }
+      }
+    }
+  }
+  win->grid_x1 = win->grid_x0 - 1;
+}
+
+static void grid_add(Window *win) {
+  grid_range(win, &win->grid_x0, &win->grid_y0, &win->grid_x1,
+             &win->grid_y1);
+  for (int gy = win->grid_y0; gy <= win->grid_y1; gy++) {
+    for (int gx = win->grid_x0; gx <= win->grid_x1; gx++) {
+      GridCell *c = &grid[gy * grid_cols + gx];
+      if (c->count == c->cap) {
+        int cap = c->cap ? c->cap * 2 : 4;
+        Window **w = kmalloc(cap * sizeof(Window *));
+        if (!w)
+          continue; // Not clickable in this cell; better than nothing
+        memcpy(w, c->w, c->count * sizeof(Window *));
+        kfree(c->w);
+        c->w = w;
+        c->cap = cap;
+      }
+      c->w[c->count++] = win;
+    }
+  }
+}
+
+// After the window moved or resized
+static void grid_update(Window *win) {
+  if (!grid || !win->z)
+    return;
+  int x0, y0, x1, y1;
+  grid_range(win, &x0, &y0, &x1, &y1);
+  if (x0 == win->grid_x0 && y0 == win->grid_y0 && x1 == win->grid_x1 &&
+      y1 == win->grid_y1)
+    return; // Same cells, e.g. most drag steps
+  grid_remove(win);
+  grid_add(win);
+}
+
+static int window_contains(Window *win, int x, int y) {
+  return x >= win->x && x <= win->x + win->width && y >= win->y &&
+         y <= win->y + win->height;
+}
 
-  if (win_pool_idx >= 20)
+// Topmost visible window under the point
+static Window *hit_test(int x, int y) {
+  Window *hit = 0;
+  if (!grid) {
+    for (Window *w = z_top; w && !hit; w = w->below)
+      if (w->extra_data != (void *)1 && window_contains(w, x, y))
+        hit = w;
+    return hit;
+  }
+  if (x < 0 || y < 0 || x >= grid_cols * GRID_CELL ||
+      y >= grid_rows * GRID_CELL)
     return 0;
+  GridCell *c = &grid[(y / GRID_CELL) * grid_cols + x / GRID_CELL];
+  for (int i = 0; i < c->count; i++) {
+    Window *w = c->w[i];
+    if (w->extra_data != (void *)1 && window_contains(w, x, y) &&
+        (!hit || w->z > hit->z))
+      hit = w;
+  }
+  return hit;
+}
 
-  Window *win = &win_pool[win_pool_idx++];
+Window *create_window(int x, int y, int w, int h, char *title) {
+  if (window_count >= MAX_WINDOWS)
+    return 0;
+  Window *win = kzalloc(sizeof(Window));
+  if (!win)
+    return 0;
   win->x = x;
   win->y = y;
   win->width = w;
   win->height = h;
   win->title = title;
-  win->next = windows_head;
-  win->on_paint = 0;
-  win->on_click = 0;
-  win->on_mouse_move = 0;
-  win->on_key = 0;
-  win->extra_data = 0;
-
-  windows_head = win;
-  focused_window = win;
+
+  WindowQueue *q = kzalloc(sizeof(WindowQueue));
+  if (!q) {
+    kfree(win);
+    return 0;
+  }
+  q->win = win;
+  q->next_tick = timer_ms();
+  q->wake = q;
+  win->events = q;
+
+  // Its own thread while there are few windows, else the shared worker
+  if (__sync_fetch_and_add(&window_threads, 1) < WM_WINDOW_THREADS)
+    q->own_thread = thread_create(title, PRIO_APP, window_thread, q) != 0;
+  if (!q->own_thread) {
+    __sync_fetch_and_sub(&window_threads, 1);
+    q->wake = &shared_queues;
+    uint32_t flags = irq_save();
+    q->next = shared_queues;
+    shared_queues = q;
+    irq_restore(flags);
+  }
   return win;
 }
 
-void bring_to_front(Window *win) {
-  if (!win || win == windows_head) {
+int wm_open(Window *win) {
+  uint32_t flags = spin_lock_irqsave(&wm_list_lock);
+  int added = window_count < MAX_WINDOWS;
+  if (added) {
+    seq_begin();
+    z_push_top(win);
+    seq_end();
+    window_count++;
+    if (grid)
+      grid_add(win);
     focused_window = win;
-    return;
   }
+  spin_unlock_irqrestore(&wm_list_lock, flags);
 
-  Window *prev = 0;
-  Window *cur = windows_head;
-  while (cur && cur != win) {
-    prev = cur;
-    cur = cur->next;
+  if (!added) { // Screen full
+    WindowEvent ev = {WEV_CLOSE};
+    post_event(win, ev); // Its thread retires it
+    return 0;
   }
+  return 1;
+}
 
-  if (cur == win && prev) {
-    prev->next = cur->next;
-    cur->next = windows_head;
-    windows_head = cur;
-    focused_window = cur;
+// wm_list_lock held
+static void raise_locked(Window *win) {
+  if (win && win->z && win != z_top) {
+    seq_begin();
+    z_unlink(win);
+    z_push_top(win);
+    seq_end();
   }
+  focused_window = win;
+}
+
+void bring_to_front(Window *win) {
+  uint32_t flags = spin_lock_irqsave(&wm_list_lock);
+  raise_locked(win);
+  spin_unlock_irqrestore(&wm_list_lock, flags);
+}
+
+void wm_move(Window *win, int x, int y) {
+  uint32_t flags = spin_lock_irqsave(&wm_list_lock);
+  win->x = x;
+  win->y = y;
+  if (win != drag_window)
+    wm_layout++;
+  grid_update(win);
+  spin_unlock_irqrestore(&wm_list_lock, flags);
+}
+
+void wm_resize(Window *win, int w, int h) {
+  uint32_t flags = spin_lock_irqsave(&wm_list_lock);
+  win->width = w;
+  win->height = h;
+  wm_layout++;
+  grid_update(win);
+  spin_unlock_irqrestore(&wm_list_lock, flags);
 }
 
 void close_window(Window *win) {
   if (!win)
     return;
-  if (win == windows_head) {
-    windows_head = win->next;
-  } else {
-    Window *prev = windows_head;
-    while (prev && prev->next != win)
-      prev = prev->next;
-    if (prev)
-      prev->next = win->next;
+  uint32_t flags = spin_lock_irqsave(&wm_list_lock);
+  int open = win->z != 0;
+  if (open) {
+    seq_begin();
+    z_unlink(win);
+    seq_end();
+    win->z = 0; // Its above/below stay valid for readers still on it
+    window_count--;
+    if (grid)
+      grid_remove(win);
+    if (focused_window == win)
+      focused_window = z_top;
+    if (drag_window == win)
+      drag_window = 0;
   }
-  if (focused_window == win)
-    focused_window = windows_head;
+  spin_unlock_irqrestore(&wm_list_lock, flags);
+  if (!open)
+    return;
+
+  // The thread drains what is queued, then exits and retires the window
+  WindowEvent ev = {WEV_CLOSE};
+  post_event(win, ev);
+  win->events = 0;
 }
 
 // --- Drawing ---
 
-void draw_window_decorations(Window *win) {
+// At (x, y) rather than where the window is now (see drag_frame)
+static void draw_decorations_at(Window *win, int x, int y) {
   // Shadow
-  draw_rect(win->x + 4, win->y + 4, win->width, win->height, 0x202020);
+  draw_rect(x + 4, y + 4, win->width, win->height, 0x202020);
 
   // Border
-  draw_rect(win->x - 1, win->y - 1, win->width + 2, win->height + 2, 0x000000);
+  draw_rect(x - 1, y - 1, win->width + 2, win->height + 2, 0x000000);
 
   // Title Bar
   uint32_t tbg = (win == focused_window) ? theme_title_bg : 0x808080;
-  draw_rect(win->x, win->y, win->width, 24, tbg);
+  draw_rect(x, y, win->width, 24, tbg);
 
   // Close Button
-  draw_rect(win->x + win->width - 18, win->y + 4, 14, 14, 0xC0C0C0);
-  draw_rect(win->x + win->width - 17, win->y + 5, 12, 12, 0xFFFFFF); // 3D Light
-  draw_rect(win->x + win->width - 17, win->y + 5, 12, 1,
-            0x000000); // Inner Detail
-  draw_string(win->x + win->width - 14, win->y + 5, "X", 0x000000);
+  draw_rect(x + win->width - 18, y + 4, 14, 14, 0xC0C0C0);
+  draw_rect(x + win->width - 17, y + 5, 12, 12, 0xFFFFFF); // 3D Light
+  draw_rect(x + win->width - 17, y + 5, 12, 1, 0x000000); // Inner Detail
+  draw_string(x + win->width - 14, y + 5, "X", 0x000000);
 
   // Title Text
   if (win->title) {
-    draw_string(win->x + 8, win->y + 6, win->title, CL_WHITE);
+    draw_string(x + 8, y + 6, win->title, CL_WHITE);
   }
 
   // Content BG
-  draw_rect(win->x, win->y + 24, win->width, win->height - 24, theme_window_bg);
+  draw_rect(x, y + 24, win->width, win->height - 24, theme_window_bg);
 }
 
-void draw_windows_recursive(Window *win) {
-  if (!win)
-    return;
-  draw_windows_recursive(win->next);
+void draw_window_decorations(Window *win) {
+  draw_decorations_at(win, win->x, win->y);
+}
 
-  // If minimized, don't draw
-  if (win->extra_data == (void *)1)
-    return;
+// Every window top first (taskbar order), and the visible ones bottom to
+// top, captured once per frame. Valid until the frame ends.
+static Window *frame_order[MAX_WINDOWS];
+static int frame_count = 0;
+static Window *paint_order[MAX_WINDOWS];
+static int paint_count = 0;
+static uint32_t frame_seq; // wm_seq the walk saw
+
+static void collect_windows() {
+  // A writer on another CPU (or one that interrupted us) changed the list
+  // under us: walk it again
+  uint32_t seq;
+  do {
+    while ((seq = wm_seq) & 1)
+      __asm__ volatile("pause");
+    __asm__ volatile("" ::: "memory");
+    frame_count = 0;
+    for (Window *w = rcu_dereference(z_top); w && frame_count < MAX_WINDOWS;
+         w = rcu_dereference(w->below))
+      frame_order[frame_count++] = w;
+    __asm__ volatile("" ::: "memory");
+  } while (wm_seq != seq);
+  frame_seq = seq;
+
+  paint_count = 0;
+  for (int n = frame_count; n--;) {
+    Window *w = frame_order[n];
+    if (w->extra_data != (void *)1) // If minimized, don't draw
+      paint_order[paint_count++] = w;
+  }
+}
 
+// Before a frame: let handlers that were interrupted finish, for a while.
+// Nothing else of theirs runs until the compositor sleeps again.
+static void wait_for_handlers() {
+  uint32_t start = timer_ms();
+  uint32_t flags = irq_save();
+  for (int i = 0; i < paint_count; i++) {
+    Window *w = paint_order[i];
+    if (w->busy && timer_ms() - start < WM_HANDLER_WAIT_MS) {
+      sched_sleep((void *)&w->busy, 1);
+      i = -1; // Others may have started one meanwhile
+    }
+  }
+  irq_restore(flags);
+}
+
+static void paint_window(Window *win, int profile) {
+  uint64_t start = rdtsc();
   draw_window_decorations(win);
-  if (win->on_paint)
+  // A handler still running after wait_for_handlers: its state may be
+  // half updated, so only the frame is drawn
+  if (win->on_paint && !win->busy)
     win->on_paint(win);
+  if (profile)
+    frameprof_window(win, (uint32_t)(rdtsc() - start));
 }
 
 void draw_cursor(int x, int y) {
@@ -169,34 +641,63 @@ void draw_cursor(int x, int y) {
   }
 }
 
+// What the cursor covers, saved as it is drawn so a frame that reuses the
+// backbuffer can take it off again. Drawn once per frame with the full
+// clip, after the layers (also when tiled).
+#define CURSOR_W 12
+#define CURSOR_H 16
+
+static uint32_t cursor_under[CURSOR_H][CURSOR_W];
+static int cursor_x, cursor_y;
+
+static void paint_cursor() {
+  cursor_x = mx;
+  cursor_y = my;
+  for (int r = 0; r < CURSOR_H; r++)
+    for (int c = 0; c < CURSOR_W; c++)
+      cursor_under[r][c] = get_pixel(cursor_x + c, cursor_y + r);
+  draw_cursor(cursor_x, cursor_y);
+}
+
+static void erase_cursor() {
+  for (int r = 0; r < CURSOR_H; r++)
+    for (int c = 0; c < CURSOR_W; c++)
+      put_pixel(cursor_x + c, cursor_y + r, cursor_under[r][c]);
+}
+
 // File-scope globals for menu state
 static bool menu_sys_open_state = false;
 static bool menu_apps_open_state = false;
 
-// Rewriting desktop_paint completely to be correct
-void desktop_paint() {
-  // 1. Background
-  // Improved Dither (Checkerboard)
-  for (int y = 0; y < screen_height; y++) {
-    for (int x = 0; x < screen_width; x++) {
-      if ((x + y) % 2 == 0)
-        put_pixel(x, y, theme_desktop);
-      else {
-        // Slightly darker
-        uint32_t col = theme_desktop & 0xFEFEFE;
-        col = (col >> 1) & 0x7F7F7F;
-        // Simple darken:
-        put_pixel(x, y, theme_desktop); // Just solid for now, dither is slow in
-                                        // C loop?
-      }
-    }
+// Clock text for the menu bar, refreshed once per frame
+static char clock_text[6];
+
+static void update_clock() {
+  // Only update every 100 frames to prevent bus contention/freezes
+  static int ticks = 0;
+  static int h = 0, m = 0, s = 0;
+
+  ticks++;
+  if (ticks > 300 && ticks % 100 == 1) { // Wait for system stability
+    rtc_get_time(&h, &m, &s);
   }
-  // Solid fill is safer for performance in emulator without optimizations
-  draw_rect(0, 0, screen_width, screen_height, theme_desktop);
 
-  // 2. Windows
-  draw_windows_recursive(windows_head);
+  clock_text[0] = (h / 10) + '0';
+  clock_text[1] = (h % 10) + '0';
+  clock_text[2] = ':';
+  clock_text[3] = (m / 10) + '0';
+  clock_text[4] = (m % 10) + '0';
+  clock_text[5] = 0;
+}
 
+static void stage(int profile, ProfStage s) {
+  if (profile)
+    frameprof_stage(s);
+}
+
+// Menu bar, taskbar, menus and overlay: everything over the windows but
+// the cursor. Same rules as paint_layers.
+static void paint_chrome(int profile) {
   // 3. Menu Bar
   draw_rect(0, 0, screen_width, 24, CL_WHITE);
   draw_rect(0, 24, screen_width, 1, 0x000000);
@@ -216,43 +717,30 @@ void desktop_paint() {
   draw_string(75, 6, "Apps", 0x000000);
 
   // Clock (Real RTC)
-  // Only update every 100 frames to prevent bus contention/freezes
-  static int ticks = 0;
-  static int h = 0, m = 0, s = 0;
-
-  ticks++;
-  if (ticks > 300 && ticks % 100 == 1) { // Wait for system stability
-    rtc_get_time(&h, &m, &s);
-  }
+  draw_string(screen_width - 60, 6, clock_text, 0x000000);
 
-  char time[16];
-  time[0] = (h / 10) + '0';
-  time[1] = (h % 10) + '0';
-  time[2] = ':';
-  time[3] = (m / 10) + '0';
-  time[4] = (m % 10) + '0';
-  time[5] = 0;
-
-  draw_string(screen_width - 60, 6, time, 0x000000);
-
-  // Active App Title
-  if (focused_window) {
+  // Active App Title. Input may clear focused_window while tiles paint
+  // on other CPUs, so read it once.
+  Window *focus = focused_window;
+  if (focus) {
     int l = 0;
-    while (focused_window->title[l])
+    while (focus->title[l])
       l++;
-    draw_string((screen_width - l * 8) / 2, 6, focused_window->title, 0x000000);
+    draw_string((screen_width - l * 8) / 2, 6, focus->title, 0x000000);
   } else {
     draw_string((screen_width - 60) / 2, 6, "System", 0x808080);
   }
 
+  stage(profile, PROF_MENUBAR);
+
   // 4. Taskbar
   int tb_y = screen_height - 36;
   draw_rect(0, tb_y, screen_width, 36, 0x303030); // Dark Gray
   draw_rect(0, tb_y, screen_width, 1, 0x606060);  // Highlight Line
 
   int tx = 6;
-  Window *cur = windows_head;
-  while (cur) {
+  for (int i = 0; i < frame_count; i++) {
+    Window *cur = frame_order[i];
     // App Icon emulation: N, S, P, C...
     // Just use first letter of title
     int w = 32;
@@ -272,18 +760,19 @@ void desktop_paint() {
     draw_string(tx + 12, tb_y + 10, ic, 0xFFFFFF);
 
     tx += 36; // compact toolbar
-    cur = cur->next;
   }
 
+  stage(profile, PROF_TASKBAR);
+
   // 5. Menus Overlay
   if (menu_sys_open_state) {
-    draw_rect(5, 24, 120, 80, 0xFFFFFF);
-    draw_rect(5, 24, 120, 80,
+    draw_rect(5, 24, 120, 105, 0xFFFFFF);
+    draw_rect(5, 24, 120, 105,
               1); // border hack? No, rect doesn't support border
     draw_rect(5, 24, 120, 1, 0);
-    draw_rect(5, 104, 120, 1, 0);
-    draw_rect(5, 24, 1, 80, 0);
-    draw_rect(125, 24, 1, 80, 0);
+    draw_rect(5, 129, 120, 1, 0);
+    draw_rect(5, 24, 1, 105, 0);
+    draw_rect(125, 24, 1, 105, 0);
 
     if (my >= 25 && my < 50 && mx < 125)
       draw_rect(6, 25, 118, 25, CL_HIGHLIGHT);
@@ -295,12 +784,16 @@ void desktop_paint() {
 
     if (my >= 75 && my < 100 && mx < 125)
       draw_rect(6, 75, 118, 25, CL_HIGHLIGHT);
-    draw_string(15, 82, "Restart", 0);
+    draw_string(15, 82, "Disk Cache", 0);
+
+    if (my >= 100 && my < 125 && mx < 125)
+      draw_rect(6, 100, 118, 25, CL_HIGHLIGHT);
+    draw_string(15, 107, "Restart", 0);
   }
 
   if (menu_apps_open_state) {
-    // List: Notepad, Snake, Paint, Calc, Sol, Mine
-    int cnt = 6;
+    // Built-ins first, then GemLang apps in discovery order
+    int cnt = app_count();
     int h = cnt * 25 + 5;
     draw_rect(70, 24, 120, h, 0xFFFFFF);
     // Borders
@@ -309,35 +802,295 @@ void desktop_paint() {
     draw_rect(70, 24, 1, h, 0);
     draw_rect(190, 24, 1, h, 0);
 
-    char *names[] = {"Notepad",    "Snake",     "Paint",
-                     "Calculator", "Solitaire", "Minesweeper"};
     for (int i = 0; i < cnt; i++) {
       int y = 25 + i * 25;
       if (my >= y && my < y + 25 && mx >= 70 && mx < 190)
         draw_rect(71, y, 118, 25, CL_HIGHLIGHT);
-      draw_string(80, y + 8, names[i], 0);
+      draw_string(80, y + 8, app_get(i)->name, 0);
     }
   }
 
-  // 6. Cursor
-  draw_cursor(mx, my);
+  stage(profile, PROF_MENUS);
+
+  frameprof_draw_overlay();
+  stage(profile, PROF_OVERLAY);
+}
+
+// Every layer of the desktop but the cursor, clipped to the calling CPU's
+// clip rect. Windows outside the clip are skipped. Runs once per frame, or
+// once per tile (profile = 0) on any CPU, so nothing here may change state.
+static void paint_layers(int profile) {
+  // 1. Background
+  video_clear(theme_desktop);
+  stage(profile, PROF_BACKGROUND);
+
+  // 2. Windows
+  for (int i = 0; i < paint_count; i++) {
+    Window *w = paint_order[i];
+    // Border and shadow included
+    if (video_clip_overlaps(w->x - 1, w->y - 1, w->width + 5, w->height + 5))
+      paint_window(w, profile);
+  }
+  stage(profile, PROF_WINDOWS);
+
+  paint_chrome(profile);
+}
+
+static void paint_tile(Tile *t) { paint_layers(0); }
+
+static void paint_tiled() {
+  int count;
+  tiles_begin_frame(&count);
+  for (int i = 0; i < paint_count; i++) {
+    Window *w = paint_order[i];
+    if (w->on_paint && !w->tile_safe && !w->busy)
+      tiles_pin_rect(w->x - 1, w->y - 1, w->width + 5, w->height + 5);
+  }
+
+  tiles_paint(paint_tile);
+  paint_cursor();
+  frameprof_stage(PROF_TILES);
+  tiles_swap();
+  frameprof_stage(PROF_SWAP);
+}
 
-  // 7. Swap
-  video_swap();
+// --- Move by blit ---
+// A dragged window is on top, and the last frame left its pixels in the
+// backbuffer. Drag frames move those with video_move_rect instead of
+// painting the window again, and repaint only what the move uncovered:
+// the layers below in its old area, and its shadow. Its on_paint waits
+// until the drag ends or the window goes dirty, which both bring back a
+// full frame, so an expensive app drags as smoothly as a cheap one.
+
+typedef struct {
+  int x0, y0, x1, y1; // x1/y1 exclusive
+} Rect;
+
+#define DAMAGE_MAX 32
+
+// What the last frame left in the backbuffer
+static struct {
+  Window *top;    // Topmost window; 0 if the next frame must be full
+  int x, y, w, h; // Where it was painted
+  uint32_t seq, layout;
+  int overlay; // Profiler overlay shown
+} last;
+
+static Rect damage[DAMAGE_MAX]; // Areas to repaint below the dragged window
+static int damage_count;
+
+static Rect rect(int x, int y, int w, int h) {
+  Rect r = {x, y, x + w, y + h};
+  return r;
 }
 
+static Rect rect_and(Rect a, Rect b) {
+  Rect r = {a.x0 > b.x0 ? a.x0 : b.x0, a.y0 > b.y0 ? a.y0 : b.y0,
+            a.x1 < b.x1 ? a.x1 : b.x1, a.y1 < b.y1 ? a.y1 : b.y1};
+  return r;
+}
+
+static int rect_empty(Rect r) { return r.x0 >= r.x1 || r.y0 >= r.y1; }
+
+// a minus b, as up to 4 rects
+static int rect_sub(Rect a, Rect b, Rect *out) {
+  if (rect_empty(a))
+    return 0;
+  Rect c = rect_and(a, b);
+  if (rect_empty(c)) {
+    out[0] = a;
+    return 1;
+  }
+  int n = 0;
+  if (a.y0 < c.y0)
+    out[n++] = (Rect){a.x0, a.y0, a.x1, c.y0};
+  if (c.y1 < a.y1)
+    out[n++] = (Rect){a.x0, c.y1, a.x1, a.y1};
+  if (a.x0 < c.x0)
+    out[n++] = (Rect){a.x0, c.y0, c.x0, c.y1};
+  if (c.x1 < a.x1)
+    out[n++] = (Rect){c.x1, c.y0, a.x1, c.y1};
+  return n;
+}
+
+static void clip_to(Rect r) {
+  video_set_clip(r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+}
+
+static void swap_rect(Rect r) {
+  video_swap_rect(r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+}
+
+// Queue what of r lies outside keep. 0 once the list is full.
+static int add_damage(Rect r, Rect keep) {
+  Rect parts[4];
+  int n = rect_sub(rect_and(r, rect(0, 0, screen_width, screen_height)),
+                   keep, parts);
+  if (damage_count + n > DAMAGE_MAX)
+    return 0;
+  for (int i = 0; i < n; i++)
+    damage[damage_count++] = parts[i];
+  return 1;
+}
+
+static Rect overlay_area() {
+  int x, y, w, h;
+  frameprof_overlay_rect(&x, &y, &w, &h);
+  return rect(x, y, w, h);
+}
+
+static void remember_frame(Window *top, int x, int y, uint32_t layout,
+                           int overlay) {
+  int ox, oy, ow, oh;
+  // Toggled while this frame was drawn: unsure what is on screen
+  if (frameprof_overlay_rect(&ox, &oy, &ow, &oh) != overlay)
+    top = 0;
+  last.top = top;
+  last.x = x;
+  last.y = y;
+  last.w = top ? top->width : 0;
+  last.h = top ? top->height : 0;
+  last.seq = frame_seq;
+  last.layout = layout;
+  last.overlay = overlay;
+}
+
+// Returns 0, having drawn nothing, if this can't be a drag frame
+static int drag_frame(uint32_t layout, int overlay) {
+  Window *win = drag_window;
+  if (!win || win != last.top || paint_order[paint_count - 1] != win ||
+      frame_seq != last.seq || layout != last.layout || win->dirty)
+    return 0;
+
+  // The mouse IRQ keeps moving it: use one position for the whole frame
+  int x = win->x, y = win->y, w = last.w, h = last.h;
+  int dx = x - last.x, dy = y - last.y;
+  Rect screen = rect(0, 0, screen_width, screen_height);
+  Rect new_box = rect(x - 1, y - 1, w + 2, h + 2); // Border included
+
+  // Pixels worth moving: not under the menu bar, taskbar or overlay, and
+  // landing on screen
+  Rect src = rect_and(rect(last.x - 1, last.y - 1, w + 2, h + 2),
+                      rect(0, 25, screen_width, screen_height - 61));
+  if (last.overlay && !rect_empty(rect_and(src, overlay_area())))
+    return 0;
+  Rect dst = rect_and(rect(src.x0 + dx, src.y0 + dy, src.x1 - src.x0,
+                           src.y1 - src.y0),
+                      screen);
+
+  // Below it: its old area and both shadows, the overlay in case it
+  // shrank or went away, and windows whose contents changed
+  damage_count = 0;
+  if (!add_damage(rect(last.x - 1, last.y - 1, w + 5, h + 5), new_box) ||
+      !add_damage(rect(x - 1, y - 1, w + 5, h + 5), new_box) ||
+      (last.overlay && !add_damage(overlay_area(), new_box)))
+    return 0;
+  for (int i = 0; i < paint_count - 1; i++) {
+    Window *o = paint_order[i];
+    if (o->dirty &&
+        !add_damage(rect(o->x - 1, o->y - 1, o->width + 5, o->height + 5),
+                    new_box))
+      return 0;
+  }
+  for (int i = 0; i < paint_count - 1; i++)
+    paint_order[i]->dirty = 0; // Repainted below, where visible
+
+  // 1. The window itself. Whatever the move can't fill (it came from
+  // under the bars or off screen) gets the frame only; the contents
+  // there come back with the next full frame.
+  erase_cursor();
+  if (!rect_empty(dst))
+    video_move_rect(dst.x0 - dx, dst.y0 - dy, dst.x1 - dst.x0,
+                    dst.y1 - dst.y0, dx, dy);
+  Rect parts[4];
+  int n = rect_sub(new_box, dst, parts);
+  for (int i = 0; i < n; i++) {
+    clip_to(parts[i]);
+    draw_decorations_at(win, x, y);
+  }
+  stage(1, PROF_WINDOWS);
+
+  // 2. What it uncovered
+  for (int i = 0; i < damage_count; i++) {
+    clip_to(damage[i]);
+    video_clear(theme_desktop);
+    for (int j = 0; j < paint_count - 1; j++) {
+      Window *o = paint_order[j];
+      if (video_clip_overlaps(o->x - 1, o->y - 1, o->width + 5,
+                              o->height + 5))
+        paint_window(o, 0);
+    }
+    draw_rect(x + 4, y + 4, w, h, 0x202020); // Its shadow
+  }
+  video_reset_clip();
+  stage(1, PROF_BACKGROUND);
+
+  // 3. The rest is cheap and drawn in full
+  Rect old_cursor = rect(cursor_x, cursor_y, CURSOR_W, CURSOR_H);
+  paint_chrome(1);
+  paint_cursor();
+  stage(1, PROF_CURSOR);
+
+  // Only what changed goes to the framebuffer
+  swap_rect(new_box);
+  for (int i = 0; i < damage_count; i++)
+    swap_rect(damage[i]);
+  swap_rect(rect(0, 0, screen_width, 25));
+  swap_rect(rect(0, screen_height - 36, screen_width, 36));
+  if (overlay)
+    swap_rect(overlay_area());
+  swap_rect(old_cursor);
+  swap_rect(rect(cursor_x, cursor_y, CURSOR_W, CURSOR_H));
+  frameprof_stage(PROF_SWAP);
+
+  remember_frame(win, x, y, layout, overlay);
+  return 1;
+}
+
+static void full_frame(uint32_t layout, int overlay) {
+  Window *top = paint_count ? paint_order[paint_count - 1] : 0;
+  int x = top ? top->x : 0, y = top ? top->y : 0;
+  for (int i = 0; i < paint_count; i++)
+    paint_order[i]->dirty = 0; // Painted now
+
+  if (tiles_enabled()) {
+    paint_tiled();
+  } else {
+    paint_layers(1);
+    paint_cursor();
+    stage(1, PROF_CURSOR);
+    video_swap();
+    frameprof_stage(PROF_SWAP);
+  }
+
+  // Moved while it was painted: parts of it may be at either position
+  if (top && (top->x != x || top->y != y))
+    top = 0;
+  remember_frame(top, x, y, layout, overlay);
+}
+
+void desktop_paint() {
+  frameprof_begin_frame();
+  update_clock();
+  collect_windows();
+  wait_for_handlers();
+
+  int ox, oy, ow, oh;
+  int overlay = frameprof_overlay_rect(&ox, &oy, &ow, &oh);
+  uint32_t layout = wm_layout;
+  if (!paint_count || !drag_frame(layout, overlay))
+    full_frame(layout, overlay);
+  frameprof_end_frame();
+}
+
+
 // --- API Wrappers for external ---
-extern void start_notepad();
-extern void start_snake();
-extern void start_paint_wrapper();
-extern void start_calculator();
-extern void start_solitaire();
-extern void start_minesweeper();
 extern void start_settings_wrapper();
 extern void start_about();
+extern void start_cache_stats();
 
-// Consolidated Input Handler with Capture Logic
-void wm_handle_mouse(int x, int y, int b) {
+// Consolidated Input Handler with Capture Logic. wm_input_lock held.
+static void handle_mouse(int x, int y, int b) {
   mx = x;
   my = y;
   static int prev_b = 0;
@@ -355,8 +1108,7 @@ void wm_handle_mouse(int x, int y, int b) {
       drag_window = 0;
     } else {
       // Mouse Move -> Update Window
-      drag_window->x = x - drag_offset_x;
-      drag_window->y = y - drag_offset_y;
+      wm_move(drag_window, x - drag_offset_x, y - drag_offset_y);
 
       // Keep inside screen bounds? Optional but good.
       // if (drag_window->x < 0) drag_window->x = 0;
@@ -368,12 +1120,14 @@ void wm_handle_mouse(int x, int y, int b) {
   // Check Menus (Top Bar)
   if (click) {
     if (menu_sys_open_state) {
-      if (y >= 25 && y < 100) {
+      if (y >= 25 && y < 125) {
         // Dispatch sys menu action
         if (y < 50)
-          start_about();
+          start_pending = start_about;
         else if (y < 75)
-          start_settings_wrapper();
+          start_pending = start_settings_wrapper;
+        else if (y < 100)
+          start_pending = start_cache_stats;
         // else restart (stub)
         menu_sys_open_state = 0;
         return;
@@ -384,18 +1138,8 @@ void wm_handle_mouse(int x, int y, int b) {
     if (menu_apps_open_state) {
       if (mx >= 70 && mx <= 190 && y >= 25) {
         int idx = (y - 25) / 25;
-        if (idx == 0)
-          start_notepad();
-        if (idx == 1)
-          start_snake();
-        if (idx == 2)
-          start_paint_wrapper();
-        if (idx == 3)
-          start_calculator();
-        if (idx == 4)
-          start_solitaire();
-        if (idx == 5)
-          start_minesweeper();
+        if (idx < app_count())
+          launch_pending = idx; // Started by wm_poll
         menu_apps_open_state = 0;
         return;
       }
@@ -419,51 +1163,31 @@ void wm_handle_mouse(int x, int y, int b) {
 
   // 4. Taskbar
   if (click && y > screen_height - 36) {
-    Window *cur = windows_head;
+    uint32_t flags = spin_lock_irqsave(&wm_list_lock);
     int tx = 6;
-    while (cur) {
+    for (Window *cur = z_top; cur; cur = cur->below) {
       if (x >= tx && x < tx + 32) {
         if (cur->extra_data == (void *)1) { // Minimized
           cur->extra_data = 0;
-          bring_to_front(cur);
+          raise_locked(cur);
         } else if (cur == focused_window) {
           cur->extra_data = (void *)1; // Minimize
           focused_window = 0;
         } else {
-          bring_to_front(cur);
+          raise_locked(cur);
         }
-        return;
+        break;
       }
       tx += 36;
-      cur = cur->next;
     }
+    spin_unlock_irqrestore(&wm_list_lock, flags);
     return;
   }
 
-  // 5. Window Hit Testing
-  // We iterate from head (bottom) to find Z-order?
-  // Actually windows_head is usually bottom, next is top?
-  // Wait, commonly linked list head is top or bottom.
-  // In `draw_windows_recursive`, it draws head first?
-  // If `draw_windows_recursive(windows_head)` draws recursively,
-  // normally standard implementation: head is bottom.
-  // BUT for hit testing, we want front-most.
-  // We need to iterate REVERSE or if we only have forward list, we iterate all
-  // and keep "best candidate". OR, `bring_to_front` moves to tail? Let's assume
-  // naive z-order (list order). If head is bottom, we must find the LAST window
-  // in the list that contains the point.
-
-  Window *hit_win = 0;
-  Window *cur = windows_head;
-  while (cur) {
-    if (cur->extra_data != (void *)1) { // if not min
-      if (x >= cur->x && x <= cur->x + cur->width && y >= cur->y &&
-          y <= cur->y + cur->height) {
-        hit_win = cur; // Potential hit, keep looking for one on top
-      }
-    }
-    cur = cur->next;
-  }
+  // 5. Window Hit Testing: the topmost window under the pointer
+  uint32_t flags = spin_lock_irqsave(&wm_list_lock);
+  Window *hit_win = hit_test(x, y);
+  spin_unlock_irqrestore(&wm_list_lock, flags);
 
   if (hit_win) {
     // We hit a window.
@@ -488,17 +1212,41 @@ void wm_handle_mouse(int x, int y, int b) {
       }
     } else {
       // Content
-      if (click && hit_win->on_click)
-        hit_win->on_click(hit_win, lx, ly);
+      if (click && hit_win->on_click) {
+        WindowEvent ev = {WEV_CLICK, 0, 0, lx, ly};
+        post_event(hit_win, ev);
+      }
       // Hover/Drag inside content (Paint)
       // Pass 'held' state so Paint can draw
-      if (hit_win->on_mouse_move)
-        hit_win->on_mouse_move(hit_win, lx, ly, b);
+      if (hit_win->on_mouse_move) {
+        WindowEvent ev = {WEV_MOVE, 0, b, lx, ly};
+        post_event(hit_win, ev);
+      }
     }
   }
 }
 
+void wm_poll() {
+  void (*start)() = __sync_lock_test_and_set(&start_pending, 0);
+  if (start)
+    start();
+  int idx = __sync_lock_test_and_set(&launch_pending, -1);
+  if (idx >= 0)
+    app_launch(idx);
+}
+
+void wm_handle_mouse(int x, int y, int b) {
+  uint32_t flags = spin_lock_irqsave(&wm_input_lock);
+  handle_mouse(x, y, b);
+  spin_unlock_irqrestore(&wm_input_lock, flags);
+}
+
 void wm_handle_keyboard(char c) {
-  if (focused_window && focused_window->on_key)
-    focused_window->on_key(focused_window, c);
+  uint32_t flags = spin_lock_irqsave(&wm_input_lock);
+  Window *win = focused_window;
+  if (win && win->on_key) {
+    WindowEvent ev = {WEV_KEY, c};
+    post_event(win, ev);
+  }
+  spin_unlock_irqrestore(&wm_input_lock, flags);
 }
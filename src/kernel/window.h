@@ -1,6 +1,7 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
+#include "rcu.h"
 #include "types.h"
 
 // Forward declaration
@@ -17,8 +18,13 @@ typedef struct Window {
   uint32_t bg_color;
   uint32_t title_color;
 
-  // Linked list (Z-Order: Head = Top, Tail = Bottom)
-  struct Window *next;
+  // WM private: Z-order (above = towards the top, 0 at the top), raise
+  // stamp (0 once closed), the hit test grid cells it is filed under, and
+  // freeing through RCU once closed
+  struct Window *above, *below;
+  uint32_t z;
+  int grid_x0, grid_y0, grid_x1, grid_y1;
+  RcuHead rcu;
 
   WindowPaintCallback on_paint;
   WindowKeyCallback on_key;
@@ -27,6 +33,29 @@ typedef struct Window {
 
   // App specific data / For internal state (e.g. minimized)
   void *extra_data;
+
+  // Per-instance app state (e.g. a GemLang context)
+  void *app_data;
+  // Frees app_data and the like. Called once the window is closed and
+  // nothing can paint it or run its handlers any more.
+  void (*on_close)(struct Window *win);
+
+  // on_paint only draws, so it may run once per tile, on several CPUs at
+  // once. Windows without it are painted by the boot CPU only.
+  int tile_safe;
+
+  // Input handlers and on_tick run on the window's own thread, fed by an
+  // event queue; the compositor only calls on_paint. busy is set while a
+  // handler runs, and the compositor waits for it before painting.
+  void (*on_tick)(struct Window *win); // Set with wm_set_tick
+  uint32_t tick_ms;
+  volatile int busy;
+  struct WindowQueue *events;
+
+  // Contents changed since the compositor last painted it: set after every
+  // handler, or by wm_invalidate. Frames that only move pixels around (a
+  // window drag) repaint dirty windows and leave the rest alone.
+  volatile int dirty;
 } Window;
 
 // Theme Globals
@@ -36,10 +65,38 @@ extern uint32_t theme_title_bg;
 extern uint32_t theme_text;
 
 void init_window_manager();
+// A new window stays private to its creator until wm_open: set its
+// callbacks and app_data first, so the compositor never sees it half built.
 Window *create_window(int x, int y, int w, int h, char *title);
+// Put it on screen, on top and focused. Returns 0 if the screen is full; the
+// window is then closed (on_close runs) and must not be touched again.
+int wm_open(Window *win);
+// Change the geometry of an open window (keeps hit testing in step)
+void wm_move(Window *win, int x, int y);
+void wm_resize(Window *win, int w, int h);
 void desktop_paint(); // Main paint routine
+// Compositor thread, once per frame: work input handlers can't do in IRQ
+// context (launching apps and the System menu tools)
+void wm_poll();
 void wm_handle_mouse(int x, int y, int buttons);
 void wm_handle_keyboard(char c);
+// Call fn on the window's thread every ms milliseconds (fn = 0 stops it)
+void wm_set_tick(Window *win, void (*fn)(Window *win), uint32_t ms);
+// For contents that change outside the window's handlers (e.g. live stats)
+void wm_invalidate(Window *win);
+
+// Keys without an ASCII code reach on_key as these values. Ctrl+letter
+// arrives as its control code, e.g. Ctrl+S = KEY_CTRL('s') = 0x13.
+#define KEY_UP ((char)0x80)
+#define KEY_DOWN ((char)0x81)
+#define KEY_LEFT ((char)0x82)
+#define KEY_RIGHT ((char)0x83)
+#define KEY_HOME ((char)0x84)
+#define KEY_END ((char)0x85)
+#define KEY_PGUP ((char)0x86)
+#define KEY_PGDN ((char)0x87)
+#define KEY_DELETE ((char)0x88)
+#define KEY_CTRL(c) ((c) & 0x1F)
 
 extern Window *focused_window;
 
@@ -0,0 +1,313 @@
+// hostbench: time the video and GemLang cores on the build machine.
+//
+//   tools/bench/hostbench.sh                   per-op ns
+//   tools/bench/hostbench.sh --save base.txt   ... and record a baseline
+//   tools/bench/hostbench.sh --compare base.txt [--threshold 10]
+//
+// video.c draws into a heap framebuffer described by a faked VesaInfo.
+// Each op runs in batches sized to take ~50ms; the best of 5 batches is
+// reported, which filters out most scheduler noise. --compare exits 1 if
+// any op got slower than the threshold (percent).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/drivers/video.h"
+#include "../../src/kernel/gemlang.h"
+#include "../../src/kernel/window.h"
+
+// Same layout as in video.c
+typedef struct {
+  uint32_t framebuffer_addr;
+  uint16_t width;
+  uint16_t height;
+  uint8_t bpp;
+  uint16_t pitch;
+} __attribute__((packed)) VesaInfo;
+
+extern VesaInfo *vesa_info;
+extern uint8_t *framebuffer;
+extern uint8_t *backbuffer;
+extern Window host_window;
+
+// Not in gemlang.h: the kernel only calls them internally
+void tokenize(char *script, char *end);
+void gem_paint(Window *win);
+void gem_click(Window *win, int x, int y);
+
+#define MAX_RESULTS 64
+#define BATCH_NS 50000000.0
+#define RUNS 5
+
+typedef struct {
+  char name[48]; // No spaces, it is the key in baseline files
+  double ns;
+} Result;
+
+static Result results[MAX_RESULTS];
+static int result_count = 0;
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef void (*BenchFn)(long iter);
+
+static void bench(const char *name, BenchFn fn) {
+  // Grow the batch until it takes long enough to time
+  long n = 1;
+  double t;
+  while (1) {
+    double start = now_ns();
+    fn(n);
+    t = now_ns() - start;
+    if (t >= BATCH_NS / 10 || n >= (1L << 30))
+      break;
+    n *= 4;
+  }
+  n = (long)(n * (BATCH_NS / (t > 1 ? t : 1)));
+  if (n < 1)
+    n = 1;
+
+  double best = 0;
+  for (int r = 0; r < RUNS; r++) {
+    double start = now_ns();
+    fn(n);
+    double per = (now_ns() - start) / n;
+    if (r == 0 || per < best)
+      best = per;
+  }
+  printf("%-32s %12.1f ns/op\n", name, best);
+  if (result_count < MAX_RESULTS) {
+    snprintf(results[result_count].name, sizeof(results[0].name), "%s",
+             name);
+    results[result_count].ns = best;
+    result_count++;
+  }
+}
+
+// --- Video ---
+
+static int rect_size;
+
+static void op_draw_rect(long iter) {
+  for (long i = 0; i < iter; i++)
+    draw_rect((int)(i & 63), 10, rect_size, rect_size, 0x336699);
+}
+
+static void op_draw_rect_full(long iter) {
+  for (long i = 0; i < iter; i++)
+    draw_rect(0, 0, screen_width, screen_height, 0x405060);
+}
+
+static void op_draw_char(long iter) {
+  for (long i = 0; i < iter; i++)
+    draw_char(100, 100, 'A' + (i % 26), 0x000000);
+}
+
+static void op_draw_string(long iter) {
+  for (long i = 0; i < iter; i++)
+    draw_string(10, 200, "The quick brown fox jumps over it", 0xFFFFFF);
+}
+
+static void op_video_swap(long iter) {
+  for (long i = 0; i < iter; i++)
+    video_swap();
+}
+
+static void op_video_clear(long iter) {
+  for (long i = 0; i < iter; i++)
+    video_clear(0x405060);
+}
+
+static uint32_t blit_src[256 * 256];
+
+static void op_video_blit(long iter) {
+  for (long i = 0; i < iter; i++)
+    video_blit(100, 100, 256, 256, blit_src, 256);
+}
+
+// A window dragged back and forth a few pixels per frame
+static void op_video_move_rect(long iter) {
+  for (long i = 0; i < iter; i++) {
+    int d = (i & 1) ? -3 : 3;
+    video_move_rect(200 + (i & 1) * 3, 150, 400, 300, d, d);
+  }
+}
+
+// --- GemLang ---
+
+static char *gem_src;
+static uint32_t gem_len;
+
+static void op_run_gem_script(long iter) {
+  for (long i = 0; i < iter; i++) {
+    run_gem_script(gem_src);
+    free(host_window.app_data);
+    host_window.app_data = 0;
+  }
+}
+
+static void op_tokenize(long iter) {
+  // gem_paint points the interpreter at this window's context
+  gem_paint(&host_window);
+  for (long i = 0; i < iter; i++)
+    tokenize(gem_src, gem_src + gem_len);
+}
+
+static void op_gem_paint(long iter) {
+  for (long i = 0; i < iter; i++)
+    gem_paint(&host_window);
+}
+
+static void op_gem_click(long iter) {
+  // Sweep a grid over the window so buttons (and their actions) get hit
+  for (long i = 0; i < iter; i++) {
+    int gx = (int)(i % 8), gy = (int)((i / 8) % 32);
+    gem_click(&host_window, 10 + gx * host_window.width / 8,
+              30 + gy * (host_window.height - 30) / 32);
+  }
+}
+
+static const char *builtin_script =
+    "App \"Bench\" {\n"
+    "  var display = \"0\"\n"
+    "  Window {\n"
+    "    title: \"Bench\"\n"
+    "    width: 250\n"
+    "    height: 300\n"
+    "    VStack {\n"
+    "      Label( \"{display}\" )\n"
+    "      Button( \"1\" ) { display = display + \"1\" }\n"
+    "      Button( \"2\" ) { display = display + \"2\" }\n"
+    "      Button( \"C\" ) { display = \"\" }\n"
+    "    }\n"
+    "  }\n"
+    "}\n";
+
+static void load_script(const char *path) {
+  FILE *f = path ? fopen(path, "rb") : 0;
+  if (!f) {
+    if (path)
+      fprintf(stderr, "hostbench: %s not found, using built-in app\n", path);
+    gem_src = strdup(builtin_script);
+    gem_len = strlen(gem_src);
+    return;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  gem_src = malloc(size + 1);
+  gem_len = fread(gem_src, 1, size, f);
+  gem_src[gem_len] = 0;
+  fclose(f);
+}
+
+// --- Baselines ---
+
+static void save(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror(path);
+    exit(2);
+  }
+  for (int i = 0; i < result_count; i++)
+    fprintf(f, "%s %.1f\n", results[i].name, results[i].ns);
+  fclose(f);
+}
+
+static int compare(const char *path, double threshold) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return 2;
+  }
+  int regressions = 0;
+  char name[48];
+  double base;
+  printf("\n%-32s %12s %12s %8s\n", "op", "baseline", "now", "delta");
+  while (fscanf(f, "%47s %lf", name, &base) == 2) {
+    for (int i = 0; i < result_count; i++) {
+      if (strcmp(results[i].name, name) != 0)
+        continue;
+      double delta = base > 0 ? (results[i].ns - base) * 100.0 / base : 0;
+      int bad = delta > threshold;
+      printf("%-32s %12.1f %12.1f %+7.1f%%%s\n", name, base, results[i].ns,
+             delta, bad ? "  REGRESSION" : "");
+      regressions += bad;
+    }
+  }
+  fclose(f);
+  return regressions ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+  const char *save_path = 0, *compare_path = 0, *script = "apps/scicalc.gem";
+  double threshold = 10;
+  int width = 1024, height = 768, bpp = 32;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--save") && i + 1 < argc)
+      save_path = argv[++i];
+    else if (!strcmp(argv[i], "--compare") && i + 1 < argc)
+      compare_path = argv[++i];
+    else if (!strcmp(argv[i], "--threshold") && i + 1 < argc)
+      threshold = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--script") && i + 1 < argc)
+      script = argv[++i];
+    else if (!strcmp(argv[i], "--bpp") && i + 1 < argc)
+      bpp = atoi(argv[++i]);
+    else {
+      fprintf(stderr, "usage: hostbench [--save F] [--compare F] "
+                      "[--threshold PCT] [--script app.gem] [--bpp 24|32]\n");
+      return 2;
+    }
+  }
+
+  // Fake mode set: both buffers on the heap
+  vesa_info->width = width;
+  vesa_info->height = height;
+  vesa_info->bpp = bpp;
+  vesa_info->pitch = width * (bpp / 8);
+  framebuffer = calloc(1, height * vesa_info->pitch);
+  backbuffer = calloc(1, height * vesa_info->pitch);
+  screen_width = width;
+  screen_height = height;
+  video_reset_clip();
+  printf("hostbench: %dx%dx%d\n", width, height, bpp);
+
+  int sizes[] = {8, 32, 128, 512};
+  for (int i = 0; i < 4; i++) {
+    char name[48];
+    rect_size = sizes[i];
+    snprintf(name, sizeof(name), "draw_rect/%dx%d", sizes[i], sizes[i]);
+    bench(name, op_draw_rect);
+  }
+  bench("draw_rect/fullscreen", op_draw_rect_full);
+  bench("draw_char", op_draw_char);
+  bench("draw_string/33", op_draw_string);
+  bench("video_blit/256x256", op_video_blit);
+  bench("video_move_rect/400x300", op_video_move_rect);
+  bench("video_clear", op_video_clear);
+  bench("video_swap", op_video_swap);
+
+  load_script(script);
+  bench("run_gem_script", op_run_gem_script);
+  run_gem_script(gem_src); // Leave one app open for the rest
+  if (!host_window.app_data) {
+    fprintf(stderr, "hostbench: the script did not open a window\n");
+    return 2;
+  }
+  bench("tokenize", op_tokenize);
+  bench("gem_paint", op_gem_paint);
+  bench("gem_click", op_gem_click);
+
+  if (save_path)
+    save(save_path);
+  if (compare_path)
+    return compare(compare_path, threshold);
+  return 0;
+}
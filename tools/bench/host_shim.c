@@ -0,0 +1,88 @@
+// Host stand-ins for the kernel services video.c and gemlang.c link
+// against. Built with the same -D renames as the kernel sources (see
+// hostbench.sh), so the kernel's memcpy & co. do not clash with libc.
+
+#include "../../src/drivers/pci.h"
+#include "../../src/drivers/serial.h"
+#include "../../src/kernel/apps.h"
+#include "../../src/kernel/gar.h"
+#include "../../src/kernel/memory.h"
+#include "../../src/kernel/multiboot.h"
+#include "../../src/kernel/sched.h"
+#include "../../src/kernel/smp.h"
+#include "../../src/kernel/window.h"
+
+// libc, declared by hand: its headers would redefine uint64_t
+void *malloc(unsigned long size);
+void *calloc(unsigned long n, unsigned long size);
+void free(void *p);
+int posix_memalign(void **out, unsigned long align, unsigned long size);
+
+BootInfo boot_info;
+Cpu host_cpu = {&host_cpu}; // this_cpu() under GEMOS_HOSTED
+
+void *kmalloc(uint32_t size) { return malloc(size); }
+void *kzalloc(uint32_t size) { return calloc(1, size); }
+void kfree(void *ptr) { free(ptr); }
+
+void *kmalloc_aligned(uint32_t size, uint32_t align) {
+  void *p = 0;
+  if (posix_memalign(&p, align < sizeof(void *) ? sizeof(void *) : align,
+                     size))
+    return 0;
+  return p;
+}
+
+void *memset(void *dst, int value, uint32_t n) {
+  return __builtin_memset(dst, value, n);
+}
+void *memcpy(void *dst, const void *src, uint32_t n) {
+  return __builtin_memcpy(dst, src, n);
+}
+void *memmove(void *dst, const void *src, uint32_t n) {
+  return __builtin_memmove(dst, src, n);
+}
+int memcmp(const void *a, const void *b, uint32_t n) {
+  return __builtin_memcmp(a, b, n);
+}
+
+// Only reached from init_video, which the bench never calls
+int pci_find_device(uint16_t vendor, uint16_t device, PciDevice *out) {
+  return 0;
+}
+uint32_t pci_read32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+  return 0;
+}
+void serial_write(const char *s) {}
+void serial_flush() {}
+
+// GemLang windows: one slot, reused. The bench frees app_data itself.
+Window host_window;
+Window *focused_window = &host_window;
+
+Window *create_window(int x, int y, int w, int h, char *title) {
+  Window *win = &host_window;
+  win->x = x;
+  win->y = y;
+  win->width = w;
+  win->height = h;
+  win->title = title;
+  win->on_paint = 0;
+  win->on_click = 0;
+  win->on_mouse_move = 0;
+  win->on_key = 0;
+  win->extra_data = 0;
+  win->app_data = 0;
+  return win;
+}
+
+int wm_open(Window *win) { return 1; }
+
+// One thread: a global is already per thread
+void sched_per_thread(void **var) {}
+
+AppEntry *app_register_gem(const char *file, char *source, uint32_t len) {
+  return 0;
+}
+void register_archive_apps() {}
+int gar_attach(void *base, uint32_t size) { return -1; }
@@ -0,0 +1,19 @@
+#!/bin/bash
+# Build and run the host benchmarks for video.c and gemlang.c. Arguments
+# go to the benchmark (see bench.c). Run from the repository root.
+set -e
+
+HOSTCC=${HOSTCC:-cc}
+# The kernel sources get the kernel's flags (no -O, as in build.sh) plus
+# renames so their memcpy & co. stay out of libc's way
+KERNEL_CFLAGS="-ffreestanding -fno-pie -w -DGEMOS_HOSTED $EXTRA_CFLAGS \
+  -Dmemset=kmemset -Dmemcpy=kmemcpy -Dmemmove=kmemmove -Dmemcmp=kmemcmp"
+
+mkdir -p build/hostbench
+$HOSTCC $KERNEL_CFLAGS -c src/drivers/video.c -o build/hostbench/video.o
+$HOSTCC $KERNEL_CFLAGS -c src/kernel/gemlang.c -o build/hostbench/gemlang.o
+$HOSTCC $KERNEL_CFLAGS -c tools/bench/host_shim.c -o build/hostbench/shim.o
+$HOSTCC -O2 -c tools/bench/bench.c -o build/hostbench/bench.o
+$HOSTCC -no-pie -o build/hostbench/hostbench build/hostbench/*.o
+
+build/hostbench/hostbench "$@"
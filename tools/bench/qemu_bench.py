@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# Run the in-kernel benchmark scenarios headless under QEMU and compare
+# them against stored baselines.
+#
+#   python3 tools/bench/qemu_bench.py                     run all, print
+#   python3 tools/bench/qemu_bench.py --save base.json    record baselines
+#   python3 tools/bench/qemu_bench.py --compare base.json [--threshold 10]
+#
+# Each scenario boots build/kernel.bin with "fastboot bench=<name>", which
+# replays a scripted input trace, prints a "[bench] result" line on COM1
+# and leaves through isa-debug-exit. Exit status: 0 all good, 1 regression,
+# 2 a scenario failed to run.
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+SCENARIOS = ["apps", "drag", "typing"]
+# Compared against the baseline; lower is better for all of them
+METRICS = ["cycles_per_frame", "frame_us_p99", "latency_us_p50",
+           "latency_us_p99"]
+
+
+def run(args, scenario):
+    with tempfile.NamedTemporaryFile(suffix=".log", delete=False) as f:
+        log = f.name
+    cmd = [args.qemu, "-kernel", args.kernel, "-m", "256",
+           "-append", "fastboot bench=" + scenario,
+           "-display", "none", "-no-reboot",
+           "-serial", "file:" + log,
+           "-device", "isa-debug-exit,iobase=0xf4,iosize=0x04"]
+    if args.kvm:
+        cmd += ["-accel", "kvm"]
+    try:
+        proc = subprocess.run(cmd, timeout=args.timeout)
+        status = proc.returncode
+    except subprocess.TimeoutExpired:
+        status = None
+    with open(log, errors="replace") as f:
+        lines = f.read().splitlines()
+    os.unlink(log)
+
+    # isa-debug-exit: QEMU exits with (code << 1) | 1, code 0 = success
+    if status != 1:
+        why = "timed out" if status is None else "exit status %d" % status
+        print("%s: failed (%s)" % (scenario, why))
+        for line in lines:
+            if line.startswith("[bench]"):
+                print("  " + line)
+        return None
+    for line in lines:
+        if line.startswith("[bench] result"):
+            fields = dict(kv.split("=", 1) for kv in line.split()[2:])
+            return {k: (v if k == "scenario" else int(v))
+                    for k, v in fields.items()}
+    print("%s: no result record" % scenario)
+    return None
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("scenarios", nargs="*", default=SCENARIOS)
+    ap.add_argument("--kernel", default="build/kernel.bin")
+    ap.add_argument("--qemu", default="qemu-system-i386")
+    ap.add_argument("--kvm", action="store_true")
+    ap.add_argument("--timeout", type=int, default=600)
+    ap.add_argument("--save")
+    ap.add_argument("--compare")
+    ap.add_argument("--threshold", type=float, default=10.0)
+    args = ap.parse_args()
+
+    results, failed = {}, False
+    for scenario in args.scenarios:
+        r = run(args, scenario)
+        if r is None:
+            failed = True
+            continue
+        results[scenario] = r
+        print("%-8s frames=%d cycles/frame=%d frame p99=%dus "
+              "latency p50=%dus p99=%dus" %
+              (scenario, r["frames"], r["cycles_per_frame"],
+               r["frame_us_p99"], r["latency_us_p50"], r["latency_us_p99"]))
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+
+    regressions = 0
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+        print()
+        for scenario, r in results.items():
+            base = baseline.get(scenario)
+            if not base:
+                print("%s: no baseline" % scenario)
+                continue
+            for m in METRICS:
+                if not base.get(m):
+                    continue
+                delta = (r[m] - base[m]) * 100.0 / base[m]
+                bad = delta > args.threshold
+                regressions += bad
+                print("%-8s %-18s %10d %10d %+7.1f%%%s" %
+                      (scenario, m, base[m], r[m], delta,
+                       "  REGRESSION" if bad else ""))
+
+    if failed:
+        return 2
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,116 @@
+// mkgar: pack GemLang apps into a GemOS app archive (host tool)
+//
+//   mkgar out.gar a.gem b.gemc ...
+//
+// Layout (little endian, must match src/kernel/gar.h):
+//   header   "GAR1", entry count, archive size, reserved
+//   entries  64 bytes each, sorted by name: name[48], offset, size, 2 x 0
+//   payloads each at a 4KB aligned offset, zero padded
+// The archive size is a multiple of 4KB as well.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GAR_ALIGN 4096
+#define GAR_NAME_LEN 48
+
+typedef struct {
+  char name[GAR_NAME_LEN];
+  uint32_t offset;
+  uint32_t size;
+  uint32_t reserved[2];
+} Entry;
+
+typedef struct {
+  Entry e;
+  const char *path;
+} Input;
+
+static uint32_t align_up(uint32_t v) {
+  return (v + GAR_ALIGN - 1) & ~(uint32_t)(GAR_ALIGN - 1);
+}
+
+static int by_name(const void *a, const void *b) {
+  return strcmp(((const Input *)a)->e.name, ((const Input *)b)->e.name);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s out.gar [files...]\n", argv[0]);
+    return 1;
+  }
+  int count = argc - 2;
+  Input *in = calloc(count ? count : 1, sizeof(Input));
+
+  for (int i = 0; i < count; i++) {
+    const char *path = argv[i + 2];
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    if (strlen(base) >= GAR_NAME_LEN) {
+      fprintf(stderr, "mkgar: name too long: %s\n", base);
+      return 1;
+    }
+    strcpy(in[i].e.name, base);
+    in[i].path = path;
+  }
+  qsort(in, count, sizeof(Input), by_name);
+  for (int i = 1; i < count; i++) {
+    if (strcmp(in[i - 1].e.name, in[i].e.name) == 0) {
+      fprintf(stderr, "mkgar: duplicate name: %s\n", in[i].e.name);
+      return 1;
+    }
+  }
+
+  // Read everything first so sizes (and so offsets) are known
+  uint8_t **data = calloc(count ? count : 1, sizeof(uint8_t *));
+  uint32_t pos = align_up(16 + count * sizeof(Entry));
+  for (int i = 0; i < count; i++) {
+    FILE *f = fopen(in[i].path, "rb");
+    if (!f) {
+      perror(in[i].path);
+      return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data[i] = malloc(len ? len : 1);
+    if (fread(data[i], 1, len, f) != (size_t)len) {
+      perror(in[i].path);
+      return 1;
+    }
+    fclose(f);
+    in[i].e.offset = pos;
+    in[i].e.size = len;
+    pos = align_up(pos + len);
+  }
+
+  uint8_t *out = calloc(1, pos);
+  memcpy(out, "GAR1", 4);
+  put32(out + 4, count);
+  put32(out + 8, pos);
+  for (int i = 0; i < count; i++) {
+    uint8_t *e = out + 16 + i * sizeof(Entry);
+    memcpy(e, in[i].e.name, GAR_NAME_LEN);
+    put32(e + GAR_NAME_LEN, in[i].e.offset);
+    put32(e + GAR_NAME_LEN + 4, in[i].e.size);
+    memcpy(out + in[i].e.offset, data[i], in[i].e.size);
+  }
+
+  FILE *f = fopen(argv[1], "wb");
+  if (!f || fwrite(out, 1, pos, f) != pos) {
+    perror(argv[1]);
+    return 1;
+  }
+  fclose(f);
+  printf("mkgar: %d apps, %u bytes\n", count, pos);
+  return 0;
+}
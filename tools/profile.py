@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# Flat profile from a GemOS sampler run (F10 on, F10 off).
+#
+#   qemu-system-i386 ... -serial file:serial.log
+#   python3 tools/profile.py serial.log [build/kernel.map]
+#
+# Addresses are resolved against the linker map. The map only lists global
+# symbols, so time spent in a static function is charged to the nearest
+# global before it in the same object file; the object name is printed
+# alongside to narrow it down.
+
+import re
+import sys
+
+SECTION = re.compile(r"^ (\.text\S*)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+)")
+SECTION_NAME = re.compile(r"^ (\.text\S*)\s*$")
+SECTION_REST = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+)")
+SYMBOL = re.compile(r"^\s+0x([0-9a-f]+)\s+([A-Za-z_.$][\w.$]*)\s*$")
+
+
+def load_map(path):
+    """(start, end, object, [(addr, name)]) per input .text section."""
+    sections = []
+    pending = False
+    with open(path) as f:
+        for line in f:
+            m = SECTION.match(line)
+            rest = SECTION_REST.match(line) if pending else None
+            pending = False
+            if m or rest:
+                start, size, obj = (m.groups()[1:] if m else rest.groups())
+                start, size = int(start, 16), int(size, 16)
+                if size:
+                    sections.append((start, start + size, obj, []))
+                continue
+            if SECTION_NAME.match(line):
+                pending = True  # Long names wrap onto the next line
+                continue
+            m = SYMBOL.match(line)
+            if m and sections:
+                addr = int(m.group(1), 16)
+                start, end, obj, syms = sections[-1]
+                if start <= addr < end:
+                    syms.append((addr, m.group(2)))
+    sections.sort()
+    return sections
+
+
+def resolve(sections, addr):
+    for start, end, obj, syms in sections:
+        if start <= addr < end:
+            name = None
+            for sym_addr, sym in syms:
+                if sym_addr <= addr:
+                    name = sym
+            obj = obj.split("/")[-1]
+            return "%s (%s)" % (name, obj) if name else "<static> (%s)" % obj
+    return "<unknown>"
+
+
+def load_run(path):
+    """Buckets of the last complete run in the log."""
+    run, header, buckets = None, None, {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith("[sample] "):
+                continue
+            body = line[len("[sample] "):]
+            if body.startswith("begin"):
+                header, buckets = body[len("begin "):], {}
+            elif body == "end" and header is not None:
+                run = (header, buckets)
+            elif body.startswith("0x") and header is not None:
+                addr, count = body.split()
+                buckets[int(addr, 16)] = int(count)
+    return run
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: profile.py serial.log [kernel.map]")
+        return 1
+    run = load_run(sys.argv[1])
+    if not run:
+        print("no complete sampler run in " + sys.argv[1])
+        return 1
+    sections = load_map(sys.argv[2] if len(sys.argv) > 2
+                        else "build/kernel.map")
+
+    header, buckets = run
+    totals = {}
+    for addr, count in buckets.items():
+        name = resolve(sections, addr)
+        totals[name] = totals.get(name, 0) + count
+    total = sum(totals.values()) or 1
+
+    print("run: " + header)
+    print("%7s %7s  %s" % ("samples", "%", "function"))
+    for name, count in sorted(totals.items(), key=lambda kv: -kv[1]):
+        print("%7d %6.2f%%  %s" % (count, 100.0 * count / total, name))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
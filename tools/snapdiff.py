@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+# Framebuffer snapshots from a GemOS serial log (see src/kernel/snapshot.h).
+#
+#   python3 tools/snapdiff.py extract serial.log out/
+#   python3 tools/snapdiff.py compare serial.log golden/ [--diff out/]
+#                             [--mask X,Y,W,H ...] [--update]
+#
+# extract writes every snapshot as <name>.ppm. compare checks each one
+# against golden/<name>.ppm, pixel for pixel, outside the masked
+# rectangles (e.g. the menu bar clock). --diff writes <name>.diff.ppm with
+# mismatches in red; --update replaces the golden images instead. Exit
+# status: 0 identical, 1 differences or missing goldens, 2 bad input.
+
+import argparse
+import os
+import sys
+
+
+def parse_runs(tokens, width):
+    row = []
+    for tok in tokens:
+        count, _, rgb = tok.rpartition("*")
+        row.extend([int(rgb, 16)] * (int(count) if count else 1))
+    if len(row) != width:
+        raise ValueError("row has %d pixels, expected %d" % (len(row), width))
+    return row
+
+
+def fnv(pixels):
+    h = 0x811C9DC5
+    for p in pixels:
+        for b in (p & 0xFF, (p >> 8) & 0xFF, (p >> 16) & 0xFF):
+            h = ((h ^ b) * 0x01000193) & 0xFFFFFFFF
+    return h
+
+
+def load_log(path):
+    """{name: (width, height, [pixel, ...])} in log order."""
+    shots = {}
+    cur = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\r\n")
+            if not line.startswith("#S "):
+                continue
+            words = line.split()[1:]
+            if words[0] == "begin":
+                name, w, h = words[1], int(words[2]), int(words[3])
+                cur = (name, w, h, [], None)
+            elif cur is None:
+                continue
+            elif words[0] == "end":
+                name, w, h, rows, _ = cur
+                pixels = [p for row in rows for p in row]
+                if len(rows) != h:
+                    print("%s: truncated (%d of %d rows)" % (name, len(rows), h))
+                elif fnv(pixels) != int(words[1], 16):
+                    print("%s: checksum mismatch, capture corrupted" % name)
+                else:
+                    shots[name] = (w, h, pixels)
+                cur = None
+            else:
+                name, w, h, rows, prev = cur
+                row = prev if words == ["="] else parse_runs(words, w)
+                rows.append(row)
+                cur = (name, w, h, rows, row)
+    return shots
+
+
+def write_ppm(path, w, h, pixels):
+    with open(path, "wb") as f:
+        f.write(b"P6\n%d %d\n255\n" % (w, h))
+        f.write(bytes(b for p in pixels
+                      for b in ((p >> 16) & 0xFF, (p >> 8) & 0xFF, p & 0xFF)))
+
+
+def read_ppm(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    fields, pos = [], 0
+    while len(fields) < 4:
+        while data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b"#":
+            pos = data.index(b"\n", pos)
+            continue
+        end = pos
+        while not data[end:end + 1].isspace():
+            end += 1
+        fields.append(data[pos:end])
+        pos = end
+    if fields[0] != b"P6" or fields[3] != b"255":
+        raise ValueError(path + ": not an 8-bit P6 image")
+    w, h = int(fields[1]), int(fields[2])
+    raw = data[pos + 1:pos + 1 + w * h * 3]
+    pixels = [(raw[i] << 16) | (raw[i + 1] << 8) | raw[i + 2]
+              for i in range(0, len(raw), 3)]
+    return w, h, pixels
+
+
+def masked(masks, x, y):
+    return any(mx <= x < mx + mw and my <= y < my + mh
+               for mx, my, mw, mh in masks)
+
+
+def compare(name, shot, golden_path, masks, diff_dir):
+    w, h, pixels = shot
+    gw, gh, gold = read_ppm(golden_path)
+    if (w, h) != (gw, gh):
+        print("%s: size %dx%d, golden %dx%d" % (name, w, h, gw, gh))
+        return False
+    bad, box = 0, None
+    diff = list(pixels) if diff_dir else None
+    for i, (a, b) in enumerate(zip(pixels, gold)):
+        if a == b:
+            continue
+        x, y = i % w, i // w
+        if masked(masks, x, y):
+            continue
+        bad += 1
+        box = (min(box[0], x), min(box[1], y), max(box[2], x),
+               max(box[3], y)) if box else (x, y, x, y)
+        if diff is not None:
+            diff[i] = 0xFF0000
+    if not bad:
+        print("%s: ok" % name)
+        return True
+    print("%s: %d pixels differ in (%d,%d)-(%d,%d)" % ((name, bad) + box))
+    if diff is not None:
+        write_ppm(os.path.join(diff_dir, name + ".diff.ppm"), w, h, diff)
+    return False
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("command", choices=["extract", "compare"])
+    ap.add_argument("log")
+    ap.add_argument("dir")
+    ap.add_argument("--mask", action="append", default=[])
+    ap.add_argument("--diff")
+    ap.add_argument("--update", action="store_true")
+    args = ap.parse_args()
+
+    shots = load_log(args.log)
+    if not shots:
+        print("no complete snapshots in " + args.log)
+        return 2
+    os.makedirs(args.dir, exist_ok=True)
+    if args.diff:
+        os.makedirs(args.diff, exist_ok=True)
+
+    if args.command == "extract" or args.update:
+        for name, (w, h, pixels) in shots.items():
+            write_ppm(os.path.join(args.dir, name + ".ppm"), w, h, pixels)
+            print("%s: written" % name)
+        return 0
+
+    masks = [tuple(int(v) for v in m.split(",")) for m in args.mask]
+    ok = True
+    for name, shot in shots.items():
+        golden = os.path.join(args.dir, name + ".ppm")
+        if not os.path.exists(golden):
+            print("%s: no golden image" % name)
+            ok = False
+            continue
+        ok &= compare(name, shot, golden, masks, args.diff)
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())